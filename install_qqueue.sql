@@ -3,14 +3,48 @@ create table if not exists mysql.qqueue_usrGrps(
     id int not null auto_increment,
     name char(64) not null,
     priority int not null,
+    maxRunning int not null default 0,
+    maxPending int not null default 0,
+    submitRate int not null default 0,
+    submitBurst int not null default 0,
+    usrMaxRunning int not null default 0,
+    usrMaxPending int not null default 0,
+    usrSubmitRate int not null default 0,
+    usrSubmitBurst int not null default 0,
     primary key (id),
     key id_name (name)
 ) engine=MyISAM default charset=utf8 collate=utf8_bin;
+create table if not exists mysql.qqueue_usrQuotas(
+    usrId int not null,
+    maxRunning int default null,
+    maxPending int default null,
+    submitRate int default null,
+    submitBurst int default null,
+    primary key (usrId)
+) engine=MyISAM default charset=utf8 collate=utf8_bin;
 create table if not exists mysql.qqueue_queues(
     id int not null auto_increment,
     name char(64) not null,
     priority int not null,
     timeout int not null,
+    preemptible bool not null default 0,
+    agingRate int not null default 0,
+    agingCap int not null default 0,
+    recoveryPolicy int not null default 0,
+    recoveryMaxRuntime int not null default 0,
+    killWait bool not null default 1,
+    cpuSet varchar(255) not null default '',
+    numaNode int not null default -1,
+    niceValue int not null default 0,
+    ioClass int not null default 0,
+    ioLevel int not null default 4,
+    maxReadRows bigint not null default 0,
+    maxReadBytes bigint not null default 0,
+    resultEngine varchar(64) not null default '',
+    resultRowFormat varchar(64) not null default '',
+    resultCompression int not null default 0,
+    resultDataDir varchar(511) not null default '',
+    resultNoBinlog bool not null default 0,
     primary key (id),
     key id_name (name)
 ) engine=MyISAM default charset=utf8 collate=utf8_bin;
@@ -32,6 +66,17 @@ create table if not exists mysql.qqueue_jobs(
     actualQuery text,
     error char(255) default null,
     comment text,
+    preemptCount int not null default 0,
+    effPriority int not null default 0,
+    jobFlags int not null default 0,
+    lastStmt int not null default 0,
+    throttleTime bigint not null default 0,
+    outputFile varchar(512) default null,
+    outputSize bigint not null default 0,
+    parentJob bigint not null default 0,
+    subJobs int not null default 0,
+    chunksDone int not null default 0,
+    chunkPos bigint not null default 0,
     primary key (id),
     key id_priority (status asc, priority desc, timeSubmit asc)
 ) engine=InnoDB default charset=utf8 collate=utf8_bin;
@@ -53,6 +98,17 @@ create table if not exists mysql.qqueue_history(
     actualQuery text,
     error char(255) default null,
     comment text,
+    preemptCount int not null default 0,
+    effPriority int not null default 0,
+    jobFlags int not null default 0,
+    lastStmt int not null default 0,
+    throttleTime bigint not null default 0,
+    outputFile varchar(512) default null,
+    outputSize bigint not null default 0,
+    parentJob bigint not null default 0,
+    subJobs int not null default 0,
+    chunksDone int not null default 0,
+    chunkPos bigint not null default 0,
     primary key (id),
     key id_priority (status asc, priority desc, timeSubmit asc)
 ) engine=InnoDB default charset=utf8 collate=utf8_bin;
@@ -64,13 +120,22 @@ INSTALL PLUGIN qqueue SONAME 'daemon_jobqueue.so';
 CREATE FUNCTION qqueue_addUsrGrp RETURNS INTEGER SONAME 'daemon_jobqueue.so';
 CREATE FUNCTION qqueue_updateUsrGrp RETURNS INTEGER SONAME 'daemon_jobqueue.so';
 CREATE FUNCTION qqueue_flushUsrGrps RETURNS INTEGER SONAME 'daemon_jobqueue.so';
+CREATE FUNCTION qqueue_setUsrGrpOption RETURNS INTEGER SONAME 'daemon_jobqueue.so';
+CREATE FUNCTION qqueue_setUsrQuota RETURNS INTEGER SONAME 'daemon_jobqueue.so';
 CREATE FUNCTION qqueue_addQueue RETURNS INTEGER SONAME 'daemon_jobqueue.so';
 CREATE FUNCTION qqueue_updateQueue RETURNS INTEGER SONAME 'daemon_jobqueue.so';
 CREATE FUNCTION qqueue_flushQueues RETURNS INTEGER SONAME 'daemon_jobqueue.so';
+CREATE FUNCTION qqueue_setQueueOption RETURNS INTEGER SONAME 'daemon_jobqueue.so';
 CREATE FUNCTION qqueue_addJob RETURNS INTEGER SONAME 'daemon_jobqueue.so';
+CREATE FUNCTION qqueue_reserveJobIds RETURNS INTEGER SONAME 'daemon_jobqueue.so';
 CREATE FUNCTION qqueue_killJob RETURNS INTEGER SONAME 'daemon_jobqueue.so';
+CREATE FUNCTION qqueue_resumeJob RETURNS INTEGER SONAME 'daemon_jobqueue.so';
+CREATE FUNCTION qqueue_setJobPriority RETURNS INTEGER SONAME 'daemon_jobqueue.so';
+CREATE FUNCTION qqueue_cleanHistory RETURNS INTEGER SONAME 'daemon_jobqueue.so';
+CREATE FUNCTION qqueue_dumpEvents RETURNS INTEGER SONAME 'daemon_jobqueue.so';
 
 -- ADD A PROCEDURE TO mysql FOR CLEANING UP THE QUERY QUEUE FROM UNAVAILABLE TABLE
+-- (both procedures are kept for compatibility and call qqueue_cleanHistory)
 
 -- VERSION SETTING THE ENTRIES TO status=DELETED
 USE mysql;
@@ -78,14 +143,7 @@ DROP PROCEDURE IF EXISTS qqueue_clean_history;
 DELIMITER //
 CREATE PROCEDURE qqueue_clean_history ()
 BEGIN
-  UPDATE mysql.qqueue_history AS a 
-    LEFT OUTER JOIN information_schema.tables AS b 
-        ON a.resultDBName=b.TABLE_SCHEMA 
-            AND a.resultTableName = b.TABLE_NAME 
-    SET a.status=2 
-    WHERE a.status=4 
-        AND b.TABLE_NAME IS NULL
-        AND b.TABLE_SCHEMA IS NULL;
+  DO qqueue_cleanHistory(0);
 END //
 DELIMITER ;
 
@@ -95,12 +153,6 @@ DROP PROCEDURE IF EXISTS qqueue_wipe_history;
 DELIMITER //
 CREATE PROCEDURE qqueue_wipe_history ()
 BEGIN
-  DELETE a.* FROM mysql.qqueue_history AS a 
-    LEFT OUTER JOIN information_schema.tables AS b 
-        ON a.resultDBName=b.TABLE_SCHEMA 
-            AND a.resultTableName = b.TABLE_NAME 
-    WHERE a.status=4 
-        AND b.TABLE_NAME IS NULL
-        AND b.TABLE_SCHEMA IS NULL;
+  DO qqueue_cleanHistory(1);
 END //
 DELIMITER ;
\ No newline at end of file
@@ -0,0 +1,428 @@
+/* Copyright (c) 2012, 2013, Adrian M. Partl, eScience Group at the
+   Leibniz Institut for Astrophysics, Potsdam
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; version 2 of the License.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA */
+
+
+/*****************************************************************
+ ********                   qqueue_bench                   *******
+ *****************************************************************
+ *
+ * submit benchmark of the query queue. a number of client threads
+ * call qqueue_addJob on a running server as fast as they can and
+ * the throughput and the latencies of the submissions are reported.
+ * the mode of the queue is taken from @@qqueue_journal, which can
+ * only be set at server start: run the benchmark once with the
+ * journal and once without to compare them.
+ *
+ * the jobs are submitted with paqu_flag set and the query DO 0, so
+ * that they neither create result tables nor keep the workers busy.
+ * they end up in the history with the comment qqueue_bench.
+ *
+ * for the contention between submitters, run it with -c 64 -r: the
+ * reader reads the jobs table the way the dispatcher does while the
+ * submitters run, and its latencies show how long the submissions
+ * hold up the table. -e submits with ids from qqueue_reserveJobIds
+ * instead of letting the queue pick them.
+ *
+ * usage: qqueue_bench [options] -g usrGrp -q queue
+ *
+ *   -h host, -P port, -S socket, -u user, -p password
+ *                            connection to the server (local socket, root)
+ *   -c n                     concurrent submitters (8)
+ *   -n n                     jobs per submitter (1000)
+ *   -U id                    user id of the jobs (1)
+ *   -d db                    result database of the jobs (test)
+ *   -r                       read the jobs table while submitting
+ *   -e                       submit with reserved explicit ids
+ *
+ *****************************************************************
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <mysql.h>
+
+#define BENCH_MAX_QUERY 1024
+
+static const char *host = NULL;
+static unsigned int port = 0;
+static const char *socketPath = NULL;
+static const char *user = "root";
+static const char *password = NULL;
+static const char *usrGrp = NULL;
+static const char *queue = NULL;
+static const char *resultDb = "test";
+static long long usrId = 1;
+static int numSubmitters = 8;
+static long long jobsPerSubmitter = 1000;
+static bool withReader = false;
+static bool explicitIds = false;
+static volatile bool submitting = true;
+
+struct benchSubmitter {
+    pthread_t thread;
+    int index;
+    long long *latencies;                   //microseconds of each submission
+    long long numDone;
+    long long numFailed;
+};
+
+struct benchReader {
+    pthread_t thread;
+    long long *latencies;
+    long long numDone;
+    long long maxDone;
+};
+
+static long long nowUsec() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static MYSQL *connectServer() {
+    MYSQL *conn = mysql_init(NULL);
+    if (conn == NULL)
+        return NULL;
+
+    if (mysql_real_connect(conn, host, user, password, NULL, port, socketPath, 0) == NULL) {
+        fprintf(stderr, "qqueue_bench: could not connect: %s\n", mysql_error(conn));
+        mysql_close(conn);
+        return NULL;
+    }
+
+    return conn;
+}
+
+static void *submitter(void *arg) {
+    benchSubmitter *sub = (benchSubmitter *) arg;
+    char query[BENCH_MAX_QUERY];
+
+    mysql_thread_init();
+
+    MYSQL *conn = connectServer();
+    if (conn == NULL) {
+        sub->numFailed = jobsPerSubmitter;
+        mysql_thread_end();
+        return NULL;
+    }
+
+    //explicit ids come from one reserved range per submitter
+    long long firstId = 0;
+    if (explicitIds == true) {
+        snprintf(query, sizeof(query), "SELECT qqueue_reserveJobIds(%lli)", jobsPerSubmitter);
+        MYSQL_RES *res = mysql_query(conn, query) == 0 ? mysql_store_result(conn) : NULL;
+        MYSQL_ROW row = res != NULL ? mysql_fetch_row(res) : NULL;
+        if (row != NULL && row[0] != NULL)
+            firstId = atoll(row[0]);
+        if (res != NULL)
+            mysql_free_result(res);
+
+        if (firstId <= 0) {
+            fprintf(stderr, "qqueue_bench: could not reserve ids: %s\n", mysql_error(conn));
+            sub->numFailed = jobsPerSubmitter;
+            mysql_close(conn);
+            mysql_thread_end();
+            return NULL;
+        }
+    }
+
+    //the result tables are never created, but their names have to be unique
+    long long pid = (long long) getpid();
+    for (long long i = 0; i < jobsPerSubmitter; i++) {
+        char id[32];
+        if (explicitIds == true)
+            snprintf(id, sizeof(id), "%lli", firstId + i);
+        else
+            strcpy(id, "NULL");
+
+        snprintf(query, sizeof(query), "SELECT qqueue_addJob(%s, %lli, '%s', '%s', 'DO 0', '%s', "
+                 "'qqbench_%lli_%i_%lli', 'qqueue_bench', 1, 'DO 0')",
+                 id, usrId, usrGrp, queue, resultDb, pid, sub->index, i);
+
+        long long start = nowUsec();
+        int error = mysql_query(conn, query);
+        if (error == 0) {
+            MYSQL_RES *res = mysql_store_result(conn);
+            if (res != NULL)
+                mysql_free_result(res);
+        }
+        long long end = nowUsec();
+
+        if (error != 0) {
+            if (sub->numFailed++ == 0)
+                fprintf(stderr, "qqueue_bench: submission failed: %s\n", mysql_error(conn));
+            continue;
+        }
+
+        sub->latencies[sub->numDone++] = end - start;
+    }
+
+    mysql_close(conn);
+    mysql_thread_end();
+
+    return NULL;
+}
+
+//reads the jobs table like the dispatcher until the submitters are done
+static void *reader(void *arg) {
+    benchReader *rd = (benchReader *) arg;
+
+    mysql_thread_init();
+
+    MYSQL *conn = connectServer();
+    if (conn == NULL) {
+        mysql_thread_end();
+        return NULL;
+    }
+
+    while (submitting == true && rd->numDone < rd->maxDone) {
+        long long start = nowUsec();
+        int error = mysql_query(conn, "SELECT COUNT(*) FROM mysql.qqueue_jobs WHERE status = 0");
+        if (error == 0) {
+            MYSQL_RES *res = mysql_store_result(conn);
+            if (res != NULL)
+                mysql_free_result(res);
+        }
+        long long end = nowUsec();
+
+        if (error != 0) {
+            fprintf(stderr, "qqueue_bench: reading the jobs table failed: %s\n", mysql_error(conn));
+            break;
+        }
+
+        rd->latencies[rd->numDone++] = end - start;
+    }
+
+    mysql_close(conn);
+    mysql_thread_end();
+
+    return NULL;
+}
+
+//returns -1 if the plugin is not loaded, otherwise whether the journal is used
+static int journalMode() {
+    MYSQL *conn = connectServer();
+    if (conn == NULL)
+        return -1;
+
+    int mode = -1;
+    if (mysql_query(conn, "SELECT @@qqueue_journal") == 0) {
+        MYSQL_RES *res = mysql_store_result(conn);
+        MYSQL_ROW row = res != NULL ? mysql_fetch_row(res) : NULL;
+        if (row != NULL && row[0] != NULL)
+            mode = atoi(row[0]);
+        if (res != NULL)
+            mysql_free_result(res);
+    } else {
+        fprintf(stderr, "qqueue_bench: %s\n", mysql_error(conn));
+    }
+
+    mysql_close(conn);
+
+    return mode;
+}
+
+static int cmpLongLong(const void *a, const void *b) {
+    long long x = *(const long long *) a;
+    long long y = *(const long long *) b;
+
+    if (x < y)
+        return -1;
+    if (x > y)
+        return 1;
+    return 0;
+}
+
+static long long percentile(long long *values, long long n, double p) {
+    long long pos = (long long) (p * (n - 1) + 0.5);
+    return values[pos];
+}
+
+static void printLatencies(const char *name, long long *latencies, long long n) {
+    qsort(latencies, n, sizeof(long long), cmpLongLong);
+
+    printf("%s p50 %.3f  p90 %.3f  p99 %.3f  max %.3f\n", name,
+           percentile(latencies, n, 0.5) / 1000.0, percentile(latencies, n, 0.9) / 1000.0,
+           percentile(latencies, n, 0.99) / 1000.0, latencies[n - 1] / 1000.0);
+}
+
+static void usage() {
+    fprintf(stderr, "usage: qqueue_bench [-h host] [-P port] [-S socket] [-u user] [-p password]\n"
+                    "                    [-c submitters] [-n jobsPerSubmitter] [-U usrId] [-d resultDb]\n"
+                    "                    [-r] [-e] -g usrGrp -q queue\n");
+}
+
+int main(int argc, char **argv) {
+    int opt;
+
+    while ((opt = getopt(argc, argv, "h:P:S:u:p:c:n:U:d:g:q:re")) != -1) {
+        switch (opt) {
+            case 'h':
+                host = optarg;
+                break;
+            case 'P':
+                port = (unsigned int) atoi(optarg);
+                break;
+            case 'S':
+                socketPath = optarg;
+                break;
+            case 'u':
+                user = optarg;
+                break;
+            case 'p':
+                password = optarg;
+                break;
+            case 'c':
+                numSubmitters = atoi(optarg);
+                break;
+            case 'n':
+                jobsPerSubmitter = atoll(optarg);
+                break;
+            case 'U':
+                usrId = atoll(optarg);
+                break;
+            case 'd':
+                resultDb = optarg;
+                break;
+            case 'g':
+                usrGrp = optarg;
+                break;
+            case 'q':
+                queue = optarg;
+                break;
+            case 'r':
+                withReader = true;
+                break;
+            case 'e':
+                explicitIds = true;
+                break;
+            default:
+                usage();
+                return 1;
+        }
+    }
+
+    if (usrGrp == NULL || queue == NULL || numSubmitters < 1 || jobsPerSubmitter < 1) {
+        usage();
+        return 1;
+    }
+
+    if (mysql_library_init(0, NULL, NULL) != 0) {
+        fprintf(stderr, "qqueue_bench: could not initialise the client library\n");
+        return 1;
+    }
+
+    int mode = journalMode();
+    if (mode < 0) {
+        mysql_library_end();
+        return 1;
+    }
+
+    benchSubmitter *subs = (benchSubmitter *) calloc(numSubmitters, sizeof(benchSubmitter));
+    if (subs == NULL) {
+        fprintf(stderr, "qqueue_bench: out of memory\n");
+        return 1;
+    }
+
+    for (int i = 0; i < numSubmitters; i++) {
+        subs[i].index = i;
+        subs[i].latencies = (long long *) malloc(jobsPerSubmitter * sizeof(long long));
+        if (subs[i].latencies == NULL) {
+            fprintf(stderr, "qqueue_bench: out of memory\n");
+            return 1;
+        }
+    }
+
+    //the reader keeps up to one read per submission
+    benchReader rd;
+    rd.numDone = 0;
+    rd.maxDone = numSubmitters * jobsPerSubmitter;
+    rd.latencies = NULL;
+    if (withReader == true) {
+        rd.latencies = (long long *) malloc(rd.maxDone * sizeof(long long));
+        if (rd.latencies == NULL || pthread_create(&rd.thread, NULL, reader, &rd) != 0) {
+            fprintf(stderr, "qqueue_bench: could not start the reader\n");
+            return 1;
+        }
+    }
+
+    long long start = nowUsec();
+
+    int numStarted = 0;
+    for (; numStarted < numSubmitters; numStarted++) {
+        if (pthread_create(&subs[numStarted].thread, NULL, submitter, &subs[numStarted]) != 0) {
+            fprintf(stderr, "qqueue_bench: could not start submitter %i\n", numStarted);
+            break;
+        }
+    }
+
+    for (int i = 0; i < numStarted; i++)
+        pthread_join(subs[i].thread, NULL);
+
+    long long elapsed = nowUsec() - start;
+
+    submitting = false;
+    if (withReader == true)
+        pthread_join(rd.thread, NULL);
+
+    //all latencies go into one array for the percentiles
+    long long numDone = 0;
+    long long numFailed = 0;
+    for (int i = 0; i < numStarted; i++) {
+        numDone += subs[i].numDone;
+        numFailed += subs[i].numFailed;
+    }
+
+    long long *latencies = (long long *) malloc((numDone > 0 ? numDone : 1) * sizeof(long long));
+    if (latencies == NULL) {
+        fprintf(stderr, "qqueue_bench: out of memory\n");
+        return 1;
+    }
+
+    long long pos = 0;
+    for (int i = 0; i < numStarted; i++) {
+        memcpy(latencies + pos, subs[i].latencies, subs[i].numDone * sizeof(long long));
+        pos += subs[i].numDone;
+    }
+    printf("mode:         %s\n", mode == 1 ? "journal" : "tables");
+    printf("submitters:   %i\n", numStarted);
+    printf("submissions:  %lli (%lli failed)\n", numDone, numFailed);
+    printf("elapsed:      %.3f s\n", elapsed / 1000000.0);
+    printf("throughput:   %.1f jobs/s\n", elapsed > 0 ? numDone * 1000000.0 / elapsed : 0.0);
+
+    if (numDone > 0)
+        printLatencies("latency (ms):", latencies, numDone);
+
+    if (withReader == true) {
+        printf("reads:        %lli\n", rd.numDone);
+        if (rd.numDone > 0)
+            printLatencies("read (ms):   ", rd.latencies, rd.numDone);
+        free(rd.latencies);
+    }
+
+    free(latencies);
+    for (int i = 0; i < numSubmitters; i++)
+        free(subs[i].latencies);
+    free(subs);
+
+    mysql_library_end();
+
+    return numFailed > 0 ? 1 : 0;
+}
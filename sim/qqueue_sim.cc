@@ -0,0 +1,803 @@
+/* Copyright (c) 2012, 2013, Adrian M. Partl, eScience Group at the
+   Leibniz Institut for Astrophysics, Potsdam
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; version 2 of the License.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA */
+
+
+/*****************************************************************
+ ********                    qqueue_sim                    *******
+ *****************************************************************
+ *
+ * offline simulator of the query queue. replays a trace of jobs
+ * exported from mysql.qqueue_history in virtual time, scheduling
+ * them with the rules of sched_policy the way the daemon does:
+ *
+ *  - the daemon wakes up every intervalSec and fills all free
+ *    slots with the highest ranked pending jobs
+ *  - a job that ends hands its slot to the highest ranked pending
+ *    job right away
+ *  - if no slot was free at a wakeup, the highest ranked pending
+ *    job may preempt one running job. the preempted job starts
+ *    over later, keeping its submission time
+ *  - running jobs are killed at the first wakeup after they
+ *    reached the timeout of their queue
+ *  - a group never runs more than its maxRunning jobs at a time
+ *
+ * the other user and group quotas, kills, split and chunked jobs
+ * are not simulated.
+ * the measured runtime of a job is taken as the time it needs,
+ * whatever number of jobs runs next to it.
+ *
+ * usage: qqueue_sim [options] trace
+ *        qqueue_sim [options] -s numJobs
+ *
+ *   -p n                     qqueue_numQueriesParallel (2)
+ *   -i sec                   qqueue_intervalSec (5)
+ *   -m n                     qqueue_preemptMargin (10)
+ *   -x n                     qqueue_maxPreemptions (3)
+ *   -q id:prio:timeout[:agingRate:agingCap:preemptible]
+ *                            settings of a queue, repeatable
+ *   -g id:prio[:maxRunning]  settings of a user group, repeatable
+ *   -s n                     simulate n generated jobs instead of a trace
+ *   -r seed                  seed of the generated jobs (1)
+ *
+ * the trace has one job per line, separated by tabs or commas:
+ *   id, submission time (unix seconds), queue, user group, user,
+ *   priority, runtime (seconds)
+ * lines starting with # are skipped. the priority of a job is the
+ * product of the priorities of its group and queue if both are
+ * given with -g and -q, the one in the trace otherwise.
+ *
+ *****************************************************************
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include "../src/sched_policy.h"
+
+#define SIM_MAX_LINE 1024
+
+struct simQueue {
+    long long id;
+    long long priority;                     //0 if not given
+    long long timeout;                      //seconds, 0 for none
+    long long agingRate;
+    long long agingCap;
+    bool preemptible;
+
+    //statistics
+    long long numJobs;
+    long long numTimeouts;
+    long long numPreempted;
+    double busyMs;
+    double sumSlowdown;
+};
+
+struct simGroup {
+    long long id;
+    long long priority;                     //0 if not given
+    long long maxRunning;                   //0 for no limit
+    long long numRunning;
+};
+
+struct simJob {
+    long long id;
+    long long seq;                          //position in the trace
+    long long subMs;
+    long long runMs;
+    long long priority;
+    int usrId;
+    int queue;                              //index into the queues
+    int group;                              //index into the groups
+    int cls;
+    int preemptCount;
+    int effPriority;                        //when it was started
+    long long startMs;
+    long long endMs;
+    bool timedOut;
+    int heapPos;                            //in the heap of running jobs
+};
+
+//pending jobs with the same queue, group and priority are ranked by their
+//submission time alone, so only the oldest of each class is a candidate
+struct simClass {
+    int queue;
+    int group;
+    long long priority;
+    simJob **heap;
+    int numHeap;
+    int maxHeap;
+};
+
+static simQueue *queues = NULL;
+static int numQueues = 0;
+static simGroup *groups = NULL;
+static int numGroups = 0;
+static simClass *classes = NULL;
+static int numClasses = 0;
+
+static long long numSlots = 2;
+static long long intervalSec = 5;
+static long long preemptMargin = 10;
+static long long maxPreemptions = 3;
+
+static void *simAlloc(size_t size) {
+    void *ptr = malloc(size);
+    if (ptr == NULL) {
+        fprintf(stderr, "qqueue_sim: out of memory\n");
+        exit(1);
+    }
+    return ptr;
+}
+
+static void *simRealloc(void *ptr, size_t size) {
+    ptr = realloc(ptr, size);
+    if (ptr == NULL) {
+        fprintf(stderr, "qqueue_sim: out of memory\n");
+        exit(1);
+    }
+    return ptr;
+}
+
+static int findQueue(long long id) {
+    for (int i = 0; i < numQueues; i++) {
+        if (queues[i].id == id)
+            return i;
+    }
+
+    queues = (simQueue *) simRealloc(queues, (numQueues + 1) * sizeof(simQueue));
+    memset(&queues[numQueues], 0, sizeof(simQueue));
+    queues[numQueues].id = id;
+
+    return numQueues++;
+}
+
+static int findGroup(long long id) {
+    for (int i = 0; i < numGroups; i++) {
+        if (groups[i].id == id)
+            return i;
+    }
+
+    groups = (simGroup *) simRealloc(groups, (numGroups + 1) * sizeof(simGroup));
+    memset(&groups[numGroups], 0, sizeof(simGroup));
+    groups[numGroups].id = id;
+
+    return numGroups++;
+}
+
+static int findClass(int queue, int group, long long priority) {
+    for (int i = 0; i < numClasses; i++) {
+        if (classes[i].queue == queue && classes[i].group == group && classes[i].priority == priority)
+            return i;
+    }
+
+    classes = (simClass *) simRealloc(classes, (numClasses + 1) * sizeof(simClass));
+    memset(&classes[numClasses], 0, sizeof(simClass));
+    classes[numClasses].queue = queue;
+    classes[numClasses].group = group;
+    classes[numClasses].priority = priority;
+
+    return numClasses++;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+///// heaps                                 ////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+
+//pending order within a class: oldest submission first, then trace order
+static bool pendingBefore(simJob *j1, simJob *j2) {
+    if (j1->subMs != j2->subMs)
+        return j1->subMs < j2->subMs;
+    return j1->seq < j2->seq;
+}
+
+static int cmpSubmission(const void *a, const void *b) {
+    simJob *j1 = (simJob *) a;
+    simJob *j2 = (simJob *) b;
+
+    if (j1 == j2)
+        return 0;
+    return pendingBefore(j1, j2) == true ? -1 : 1;
+}
+
+static void classPush(simClass *cls, simJob *job) {
+    if (cls->numHeap == cls->maxHeap) {
+        cls->maxHeap = cls->maxHeap > 0 ? 2 * cls->maxHeap : 64;
+        cls->heap = (simJob **) simRealloc(cls->heap, cls->maxHeap * sizeof(simJob *));
+    }
+
+    int pos = cls->numHeap++;
+    while (pos > 0) {
+        int parent = (pos - 1) / 2;
+        if (pendingBefore(cls->heap[parent], job))
+            break;
+        cls->heap[pos] = cls->heap[parent];
+        pos = parent;
+    }
+    cls->heap[pos] = job;
+}
+
+static simJob *classPop(simClass *cls) {
+    simJob *top = cls->heap[0];
+    simJob *last = cls->heap[--cls->numHeap];
+
+    int pos = 0;
+    while (true) {
+        int child = 2 * pos + 1;
+        if (child >= cls->numHeap)
+            break;
+        if (child + 1 < cls->numHeap && pendingBefore(cls->heap[child + 1], cls->heap[child]))
+            child++;
+        if (pendingBefore(last, cls->heap[child]))
+            break;
+        cls->heap[pos] = cls->heap[child];
+        pos = child;
+    }
+    if (cls->numHeap > 0)
+        cls->heap[pos] = last;
+
+    return top;
+}
+
+//running jobs ordered by the time they end
+static simJob **running = NULL;
+static int numRunning = 0;
+
+static void runningSet(int pos, simJob *job) {
+    running[pos] = job;
+    job->heapPos = pos;
+}
+
+static void runningUp(int pos) {
+    simJob *job = running[pos];
+    while (pos > 0) {
+        int parent = (pos - 1) / 2;
+        if (running[parent]->endMs <= job->endMs)
+            break;
+        runningSet(pos, running[parent]);
+        pos = parent;
+    }
+    runningSet(pos, job);
+}
+
+static void runningDown(int pos) {
+    simJob *job = running[pos];
+    while (true) {
+        int child = 2 * pos + 1;
+        if (child >= numRunning)
+            break;
+        if (child + 1 < numRunning && running[child + 1]->endMs < running[child]->endMs)
+            child++;
+        if (job->endMs <= running[child]->endMs)
+            break;
+        runningSet(pos, running[child]);
+        pos = child;
+    }
+    runningSet(pos, job);
+}
+
+static void runningRemove(simJob *job) {
+    int pos = job->heapPos;
+    simJob *last = running[--numRunning];
+
+    if (pos == numRunning)
+        return;
+
+    runningSet(pos, last);
+    runningUp(pos);
+    runningDown(last->heapPos);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+///// scheduling                            ////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+
+static long long firstTickMs;
+
+//the first wakeup of the daemon at or after ms
+static long long tickAtOrAfter(long long ms) {
+    long long intervalMs = intervalSec * 1000;
+    long long n = (ms - firstTickMs + intervalMs - 1) / intervalMs;
+    if (n < 0)
+        n = 0;
+    return firstTickMs + n * intervalMs;
+}
+
+static int effectivePriority(simJob *job, long long nowMs) {
+    simQueue *queue = &queues[job->queue];
+    return (int) schedEffectivePriority(job->priority, queue->agingRate, queue->agingCap,
+                                        nowMs / 1000 - job->subMs / 1000);
+}
+
+//the class whose oldest job the daemon would start next, -1 if there is none
+static int bestClass(long long nowMs) {
+    int best = -1;
+    schedJob bestJob;
+
+    for (int i = 0; i < numClasses; i++) {
+        simClass *cls = &classes[i];
+        if (cls->numHeap == 0)
+            continue;
+
+        simGroup *group = &groups[cls->group];
+        if (group->maxRunning > 0 && group->numRunning >= group->maxRunning)
+            continue;
+
+        simJob *head = cls->heap[0];
+        schedJob candidate;
+        candidate.id = head->id;
+        candidate.subTime = head->subMs / 1000;
+        candidate.effPriority = effectivePriority(head, nowMs);
+        candidate.usrId = head->usrId;
+        candidate.usrGroup = (int) group->id;
+        candidate.status = 0;
+
+        if (best < 0 || schedJobCmp(&candidate, &bestJob) < 0 ||
+            (schedJobCmp(&candidate, &bestJob) == 0 && pendingBefore(head, classes[best].heap[0]))) {
+            best = i;
+            bestJob = candidate;
+        }
+    }
+
+    return best;
+}
+
+static void startJob(simJob *job, long long nowMs) {
+    simQueue *queue = &queues[job->queue];
+
+    job->effPriority = effectivePriority(job, nowMs);
+    job->startMs = nowMs;
+    job->endMs = nowMs + job->runMs;
+    job->timedOut = false;
+
+    //the timeout is noticed at the first wakeup after it has been reached
+    long long killMs = tickAtOrAfter(nowMs + queue->timeout * 1000);
+    if (schedTimedOut((killMs - nowMs) / 1000, queue->timeout) == true && killMs < job->endMs) {
+        job->endMs = killMs;
+        job->timedOut = true;
+    }
+
+    groups[job->group].numRunning++;
+    running[numRunning] = job;
+    job->heapPos = numRunning++;
+    runningUp(job->heapPos);
+}
+
+//returns false if no pending job can be started
+static bool startBestJob(long long nowMs) {
+    int cls = bestClass(nowMs);
+    if (cls < 0)
+        return false;
+
+    startJob(classPop(&classes[cls]), nowMs);
+    return true;
+}
+
+static void stopJob(simJob *job, long long nowMs) {
+    queues[job->queue].busyMs += nowMs - job->startMs;
+    groups[job->group].numRunning--;
+    runningRemove(job);
+}
+
+//at a wakeup without free slots, the best pending job may take the slot of the
+//lowest ranked running job that can be preempted
+static void preemptForBest(long long nowMs) {
+    int cls = bestClass(nowMs);
+    if (cls < 0)
+        return;
+
+    int pendingPriority = effectivePriority(classes[cls].heap[0], nowMs);
+
+    simJob *victim = NULL;
+    for (int i = 0; i < numRunning; i++) {
+        simJob *job = running[i];
+        simQueue *queue = &queues[job->queue];
+
+        if (schedCanPreempt(pendingPriority, job->effPriority, job->preemptCount, queue->preemptible,
+                            preemptMargin, maxPreemptions) == false)
+            continue;
+
+        if (victim == NULL || job->effPriority < victim->effPriority)
+            victim = job;
+    }
+
+    if (victim == NULL)
+        return;
+
+    stopJob(victim, nowMs);
+    victim->preemptCount++;
+    queues[victim->queue].numPreempted++;
+    classPush(&classes[victim->cls], victim);
+
+    startBestJob(nowMs);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+///// input                                 ////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+
+static simJob *jobs = NULL;
+static long long numJobs = 0;
+
+static void addJob(long long id, double subSec, long long queueId, long long groupId, long long usrId,
+                   long long priority, double runSec) {
+    static long long maxJobs = 0;
+
+    if (numJobs == maxJobs) {
+        maxJobs = maxJobs > 0 ? 2 * maxJobs : 1024;
+        jobs = (simJob *) simRealloc(jobs, maxJobs * sizeof(simJob));
+    }
+
+    simJob *job = &jobs[numJobs++];
+    memset(job, 0, sizeof(simJob));
+    job->id = id;
+    job->seq = numJobs - 1;
+    job->subMs = (long long) (subSec * 1000);
+    job->runMs = runSec > 0 ? (long long) (runSec * 1000) : 0;
+    job->priority = priority;
+    job->usrId = (int) usrId;
+    job->queue = findQueue(queueId);
+    job->group = findGroup(groupId);
+}
+
+static int readTrace(const char *path) {
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        fprintf(stderr, "qqueue_sim: could not open %s\n", path);
+        return 1;
+    }
+
+    char line[SIM_MAX_LINE];
+    long long lineNo = 0;
+    while (fgets(line, sizeof(line), file) != NULL) {
+        lineNo++;
+
+        if (line[0] == '#' || line[0] == '\n' || line[0] == '\r')
+            continue;
+
+        //jobs that never ran have no runtime (\N)
+        long long id, queueId, groupId, usrId, priority;
+        double subSec, runSec;
+        if (sscanf(line, "%lld%*[\t, ]%lf%*[\t, ]%lld%*[\t, ]%lld%*[\t, ]%lld%*[\t, ]%lld%*[\t, ]%lf",
+                   &id, &subSec, &queueId, &groupId, &usrId, &priority, &runSec) != 7) {
+            if (strstr(line, "\\N") == NULL)
+                fprintf(stderr, "qqueue_sim: skipping line %lld of %s\n", lineNo, path);
+            continue;
+        }
+
+        addJob(id, subSec, queueId, groupId, usrId, priority, runSec);
+    }
+
+    fclose(file);
+
+    return 0;
+}
+
+//deterministic jobs for trying out settings and for timing the simulator: three
+//queues, four groups, arrivals about as fast as two slots can take them
+static void generateJobs(long long count, unsigned long long seed) {
+    unsigned long long state = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+    double subSec = 1.0e9;
+
+    for (long long i = 0; i < count; i++) {
+        state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+        unsigned int r1 = (unsigned int) (state >> 33);
+        state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+        unsigned int r2 = (unsigned int) (state >> 33);
+
+        double u1 = (r1 + 1.0) / 2147483649.0;
+        double u2 = (r2 + 1.0) / 2147483649.0;
+
+        long long queueId = 1 + r1 % 3;
+        long long groupId = 1 + r2 % 4;
+
+        //short jobs in queue 1, long ones in queue 3
+        double meanRun = queueId == 1 ? 10.0 : (queueId == 2 ? 60.0 : 600.0);
+        double runSec = -meanRun * __builtin_log(u2);
+
+        subSec += -45.0 * __builtin_log(u1);
+
+        addJob(i + 1, subSec, queueId, groupId, i % 100, queueId * 10, runSec);
+    }
+}
+
+static int parseQueue(const char *arg) {
+    long long id, priority, timeout, agingRate = 0, agingCap = 0, preemptible = 0;
+
+    int n = sscanf(arg, "%lld:%lld:%lld:%lld:%lld:%lld", &id, &priority, &timeout, &agingRate, &agingCap,
+                   &preemptible);
+    if (n != 3 && n != 6) {
+        fprintf(stderr, "qqueue_sim: -q needs id:prio:timeout[:agingRate:agingCap:preemptible]\n");
+        return 1;
+    }
+
+    int idx = findQueue(id);
+    simQueue *queue = &queues[idx];
+    queue->priority = priority;
+    queue->timeout = timeout;
+    queue->agingRate = agingRate;
+    queue->agingCap = agingCap;
+    queue->preemptible = preemptible != 0;
+
+    return 0;
+}
+
+static int parseGroup(const char *arg) {
+    long long id, priority, maxRunning = 0;
+
+    int n = sscanf(arg, "%lld:%lld:%lld", &id, &priority, &maxRunning);
+    if (n != 2 && n != 3) {
+        fprintf(stderr, "qqueue_sim: -g needs id:prio[:maxRunning]\n");
+        return 1;
+    }
+
+    int idx = findGroup(id);
+    simGroup *group = &groups[idx];
+    group->priority = priority;
+    group->maxRunning = maxRunning;
+
+    return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+///// report                                ////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+
+static int cmpLongLong(const void *a, const void *b) {
+    long long v1 = *(const long long *) a;
+    long long v2 = *(const long long *) b;
+    return v1 < v2 ? -1 : (v1 > v2 ? 1 : 0);
+}
+
+static double percentile(long long *sorted, long long n, double p) {
+    if (n == 0)
+        return 0;
+
+    long long idx = (long long) (p * (n - 1) + 0.5);
+    return sorted[idx] / 1000.0;
+}
+
+static void printWaits(const char *name, long long *waits, long long n) {
+    double sum = 0;
+    for (long long i = 0; i < n; i++)
+        sum += waits[i];
+
+    qsort(waits, n, sizeof(long long), cmpLongLong);
+
+    printf("%-10s %10lld %10.1f %10.1f %10.1f %10.1f %10.1f\n", name, n,
+           n > 0 ? sum / n / 1000.0 : 0.0, percentile(waits, n, 0.5), percentile(waits, n, 0.9),
+           percentile(waits, n, 0.99), n > 0 ? waits[n - 1] / 1000.0 : 0.0);
+}
+
+static void report(long long startMs, long long endMs, double cpuSec) {
+    long long *waits = (long long *) simAlloc((numJobs > 0 ? numJobs : 1) * sizeof(long long));
+    double spanMs = endMs > startMs ? (double) (endMs - startMs) : 1.0;
+    double busyMs = 0;
+    long long numTimeouts = 0;
+    long long numPreempted = 0;
+
+    for (int q = 0; q < numQueues; q++) {
+        busyMs += queues[q].busyMs;
+        numTimeouts += queues[q].numTimeouts;
+        numPreempted += queues[q].numPreempted;
+    }
+
+    printf("jobs:               %lld\n", numJobs);
+    printf("slots:              %lld\n", numSlots);
+    printf("simulated time:     %.2f h\n", spanMs / 3600000.0);
+    printf("slot utilisation:   %.1f %%\n", 100.0 * busyMs / (spanMs * numSlots));
+    printf("timeouts:           %lld\n", numTimeouts);
+    printf("preemptions:        %lld\n", numPreempted);
+    printf("simulator runtime:  %.2f s\n\n", cpuSec);
+
+    printf("waiting time (s):\n");
+    printf("%-10s %10s %10s %10s %10s %10s %10s\n", "queue", "jobs", "mean", "p50", "p90", "p99", "max");
+
+    long long n = 0;
+    for (long long i = 0; i < numJobs; i++)
+        waits[n++] = jobs[i].startMs - jobs[i].subMs;
+    printWaits("all", waits, n);
+
+    for (int q = 0; q < numQueues; q++) {
+        n = 0;
+        for (long long i = 0; i < numJobs; i++) {
+            if (jobs[i].queue == q)
+                waits[n++] = jobs[i].startMs - jobs[i].subMs;
+        }
+
+        char name[32];
+        snprintf(name, sizeof(name), "%lld", queues[q].id);
+        printWaits(name, waits, n);
+    }
+
+    //slowdown is the time from submission to the end over the time the job needed.
+    //Jain's index over the mean slowdown of the queues is 1 if all of them are
+    //slowed down the same
+    printf("\nfairness:\n");
+    printf("%-10s %10s %12s %10s %10s\n", "queue", "jobs", "slot share", "slowdown", "timeouts");
+
+    double sumX = 0;
+    double sumX2 = 0;
+    int numX = 0;
+    for (int q = 0; q < numQueues; q++) {
+        simQueue *queue = &queues[q];
+        double slowdown = queue->numJobs > 0 ? queue->sumSlowdown / queue->numJobs : 0;
+
+        printf("%-10lld %10lld %11.1f%% %10.2f %10lld\n", queue->id, queue->numJobs,
+               busyMs > 0 ? 100.0 * queue->busyMs / busyMs : 0.0, slowdown, queue->numTimeouts);
+
+        if (queue->numJobs > 0) {
+            sumX += slowdown;
+            sumX2 += slowdown * slowdown;
+            numX++;
+        }
+    }
+
+    printf("Jain's fairness index: %.3f\n", numX > 0 && sumX2 > 0 ? sumX * sumX / (numX * sumX2) : 1.0);
+
+    free(waits);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+///// main                                  ////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+
+static void usage() {
+    fprintf(stderr, "usage: qqueue_sim [-p slots] [-i intervalSec] [-m preemptMargin] [-x maxPreemptions]\n"
+                    "                  [-q id:prio:timeout[:agingRate:agingCap:preemptible]]...\n"
+                    "                  [-g id:prio[:maxRunning]]... (trace | -s numJobs [-r seed])\n");
+}
+
+int main(int argc, char **argv) {
+    long long numGenerated = 0;
+    unsigned long long seed = 1;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "p:i:m:x:q:g:s:r:")) != -1) {
+        switch (opt) {
+            case 'p':
+                numSlots = atoll(optarg);
+                break;
+            case 'i':
+                intervalSec = atoll(optarg);
+                break;
+            case 'm':
+                preemptMargin = atoll(optarg);
+                break;
+            case 'x':
+                maxPreemptions = atoll(optarg);
+                break;
+            case 'q':
+                if (parseQueue(optarg) != 0)
+                    return 1;
+                break;
+            case 'g':
+                if (parseGroup(optarg) != 0)
+                    return 1;
+                break;
+            case 's':
+                numGenerated = atoll(optarg);
+                break;
+            case 'r':
+                seed = strtoull(optarg, NULL, 10);
+                break;
+            default:
+                usage();
+                return 1;
+        }
+    }
+
+    if (numSlots < 1 || intervalSec < 1 || (numGenerated <= 0 && optind != argc - 1)) {
+        usage();
+        return 1;
+    }
+
+    clock_t cpuStart = clock();
+
+    if (numGenerated > 0) {
+        generateJobs(numGenerated, seed);
+    } else if (readTrace(argv[optind]) != 0) {
+        return 1;
+    }
+
+    if (numJobs == 0) {
+        fprintf(stderr, "qqueue_sim: no jobs to simulate\n");
+        return 1;
+    }
+
+    //the trace is replayed in the order of submission
+    qsort(jobs, numJobs, sizeof(simJob), cmpSubmission);
+
+    for (long long i = 0; i < numJobs; i++) {
+        simJob *job = &jobs[i];
+        simQueue *queue = &queues[job->queue];
+        simGroup *group = &groups[job->group];
+
+        if (queue->priority > 0 && group->priority > 0)
+            job->priority = queue->priority * group->priority;
+
+        job->cls = findClass(job->queue, job->group, job->priority);
+    }
+
+    running = (simJob **) simAlloc(numSlots * sizeof(simJob *));
+
+    firstTickMs = jobs[0].subMs;
+    long long nowMs = firstTickMs;
+    long long nextTickMs = firstTickMs;
+    long long nextSubmit = 0;
+    long long numDone = 0;
+
+    while (numDone < numJobs) {
+        long long submitMs = nextSubmit < numJobs ? jobs[nextSubmit].subMs : -1;
+        long long endMs = numRunning > 0 ? running[0]->endMs : -1;
+
+        //nothing to do until the next job comes in
+        bool idle = numRunning == 0;
+        for (int i = 0; idle == true && i < numClasses; i++) {
+            if (classes[i].numHeap > 0)
+                idle = false;
+        }
+        if (idle == true && submitMs > nextTickMs)
+            nextTickMs = tickAtOrAfter(submitMs);
+
+        nowMs = nextTickMs;
+        if (endMs >= 0 && endMs < nowMs)
+            nowMs = endMs;
+        if (submitMs >= 0 && submitMs < nowMs)
+            nowMs = submitMs;
+
+        //jobs that end hand their slot to the next job right away
+        while (numRunning > 0 && running[0]->endMs == nowMs) {
+            simJob *job = running[0];
+            simQueue *queue = &queues[job->queue];
+
+            stopJob(job, nowMs);
+
+            queue->numJobs++;
+            if (job->timedOut == true)
+                queue->numTimeouts++;
+            if (job->runMs > 0)
+                queue->sumSlowdown += (double) (nowMs - job->subMs) / job->runMs;
+            else
+                queue->sumSlowdown += 1.0;
+            numDone++;
+
+            startBestJob(nowMs);
+        }
+
+        while (nextSubmit < numJobs && jobs[nextSubmit].subMs == nowMs) {
+            simJob *job = &jobs[nextSubmit++];
+            classPush(&classes[job->cls], job);
+        }
+
+        if (nowMs == nextTickMs) {
+            bool slotFree = numRunning < numSlots;
+
+            while (numRunning < numSlots && startBestJob(nowMs) == true)
+                ;
+
+            if (slotFree == false)
+                preemptForBest(nowMs);
+
+            nextTickMs += intervalSec * 1000;
+        }
+    }
+
+    report(jobs[0].subMs, nowMs, (double) (clock() - cpuStart) / CLOCKS_PER_SEC);
+
+    return 0;
+}
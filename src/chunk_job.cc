@@ -0,0 +1,226 @@
+/* Copyright (c) 2012, 2013, Adrian M. Partl, eScience Group at the
+   Leibniz Institut for Astrophysics, Potsdam
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; version 2 of the License.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA */
+
+
+/*****************************************************************
+ ********                    chunk_job                     *******
+ *****************************************************************
+ *
+ * a job flagged with QQUEUE_JOB_CHUNKED whose query is a plain
+ * select on a table with a single integer primary key does not
+ * run one CREATE TABLE ... SELECT. its result table is created
+ * empty, and the rows are added by one INSERT ... SELECT per range
+ * of qqueue_chunkKeys keys. each range is committed together with
+ * the number of chunks done and the key the next one starts at in
+ * the jobs row, so a job that is preempted, requeued after a
+ * restart or resumed with qqueue_resumeJob continues with the next
+ * range and never writes a range twice, as long as the result table
+ * is transactional as well.
+ *
+ *****************************************************************
+ */
+
+#define MYSQL_SERVER 1
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sql_class.h>
+#include "sys_tbl.h"
+#include "exec_query.h"
+#include "sql_query.h"
+#include "pk_range.h"
+#include "chunk_job.h"
+#include "throttle.h"
+
+#ifdef USE_PRAGMA_IMPLEMENTATION
+#pragma implementation
+#endif
+
+long chunkKeys;
+
+//runs a statement of a chunk, rolling back the chunk if it fails
+//returns 0 on success, 1 on failure with the error set on the job
+static int execChunkQuery(jobWorkerThd *jobArg, const char *query) {
+    char *queryError = NULL;
+
+    if (execSimpleQuery(jobArg->thd, query, &queryError) == 0)
+        return 0;
+
+    jobArg->error = queryError;
+
+    //a killed job leaves the transaction to the end of its thread
+    if (jobArg->thd->killed == 0) {
+        queryError = NULL;
+        if (execSimpleQuery(jobArg->thd, "ROLLBACK", &queryError) != 0 && queryError != NULL)
+            my_free(queryError);
+    }
+
+    return 1;
+}
+
+//writes the position of the job into the open transaction of its THD. the row is
+//written through the handler, the user of the job needs no rights on the mysql
+//schema, and it does not go into the binary log
+static int commitChunkPos(jobWorkerThd *jobArg, int chunksDone, longlong chunkPos) {
+    Open_tables_backup backup;
+    int error = 0;
+
+    ulonglong optionBits = jobArg->thd->variables.option_bits;
+    jobArg->thd->variables.option_bits &= ~OPTION_BIN_LOG;
+
+    TABLE *tbl = open_sysTbl(jobArg->thd, "qqueue_jobs", strlen("qqueue_jobs"), &backup, true, &error);
+    if (error || tbl == NULL) {
+        fprintf(stderr, "chunkedWorkload: error in opening jobs sys table: error: %i\n", error);
+        error = 1;
+    } else {
+        error = setQqueueJobsChunk(jobArg->job->id, chunksDone, chunkPos, tbl);
+    }
+    close_sysTbl(jobArg->thd, tbl, &backup);
+
+    jobArg->thd->variables.option_bits = optionBits;
+
+    if (error == 0)
+        return 0;
+
+    jobArg->error = my_strdup("Query queue - job worker ERROR: could not record the chunk position!", MYF(0));
+
+    char *queryError = NULL;
+    if (jobArg->thd->killed == 0 && execSimpleQuery(jobArg->thd, "ROLLBACK", &queryError) != 0 && queryError != NULL)
+        my_free(queryError);
+
+    return 1;
+}
+
+int chunkedWorkload(jobWorkerThd *jobArg) {
+    qqueue_jobs_row *job = jobArg->job;
+    qqueue_simple_select select;
+    qqueue_pk_range range;
+    char db[NAME_LEN + 1];
+    char table[NAME_LEN + 1];
+
+    //anything that cannot be cut into ranges is run in one go
+    if (parseSimpleSelect(job->query, &select) != 0 ||
+        splitTableName(select.table, select.tableLen, NULL, db, table) != 0 ||
+        getPkRange(jobArg->thd, db, table, &range) != 0) {
+        return workload(jobArg);
+    }
+
+    jobArg->error = NULL;
+
+    snprintf(jobArg->label, QQUEUE_JOB_LABEL_LEN, "JobWorker: job %lli U: %i P: %i",
+             job->id, job->usrId, job->priority);
+    thd_proc_info(jobArg->thd, jobArg->label);
+
+    char tableOptions[QQUEUE_TABLE_OPTIONS_LEN];
+    qqueue_queues_row *queue = getQueueByID(job->queue);
+    if (queue == NULL || buildResultTableOptions(queue, tableOptions, sizeof(tableOptions)) != 0)
+        tableOptions[0] = '\0';
+
+    char quotedDb[QQUEUE_QUOTED_LEN(QQUEUE_RESULTDBNAME_LEN)];
+    char quotedTable[QQUEUE_QUOTED_LEN(QQUEUE_RESULTTBLNAME_LEN)];
+    quoteName(job->resultDBName, quotedDb);
+    quoteName(job->resultTableName, quotedTable);
+
+    size_t queryLen = select.columnsLen + select.tableLen + select.whereLen + sizeof(quotedDb) +
+                      sizeof(quotedTable) + sizeof(tableOptions) + 4 * NAME_LEN + 256;
+    char *query = (char *) my_malloc(queryLen, MYF(0));
+    if (query == NULL) {
+        jobArg->error = my_strdup("Query queue - job worker ERROR: out of memory!", MYF(0));
+        return 1;
+    }
+
+    //the condition of the query may end in a comment, hence the line breaks
+    const char *where = select.where != NULL ? select.where : "TRUE";
+    int whereLen = select.where != NULL ? (int) select.whereLen : 4;
+
+    //all statements of a chunked job are written by the queue
+    ulonglong binlogBit = jobArg->thd->variables.option_bits & OPTION_BIN_LOG;
+    bool skipBinlog = jobSkipsBinlog(jobArg);
+    if (skipBinlog == true)
+        jobArg->thd->variables.option_bits &= ~OPTION_BIN_LOG;
+
+    longlong from = job->chunkPos;
+    if (job->chunksDone == 0) {
+        snprintf(query, queryLen, "CREATE TABLE %s.%s%s SELECT %.*s FROM %.*s WHERE FALSE", quotedDb, quotedTable,
+                 tableOptions, (int) select.columnsLen, select.columns, (int) select.tableLen, select.table);
+
+        if (execChunkQuery(jobArg, query) != 0) {
+            if (jobArg->thd->killed != 0)
+                jobArg->interrupted = true;
+            if (skipBinlog == true)
+                jobArg->thd->variables.option_bits |= binlogBit;
+            my_free(query);
+            return 0;
+        }
+
+        from = range.minPk;
+    }
+
+    bool done = false;
+    while (jobArg->thd->killed == 0) {
+        char cond[4 * NAME_LEN + 128];
+        longlong to = 0;
+        bool last = from > range.maxPk || (ulonglong) (range.maxPk - from) < (ulonglong) chunkKeys;
+
+        if (last == false)
+            to = from + chunkKeys;
+
+        jobArg->stmtIdx = job->chunksDone;
+        pkRangeCondition(&range, from, to, last, cond, sizeof(cond));
+
+        if (execChunkQuery(jobArg, "START TRANSACTION") != 0)
+            break;
+
+        snprintf(query, queryLen, "INSERT INTO %s.%s SELECT %.*s FROM %.*s WHERE (%.*s\n) AND %s",
+                 quotedDb, quotedTable, (int) select.columnsLen, select.columns,
+                 (int) select.tableLen, select.table, whereLen, where, cond);
+
+        if (execChunkQuery(jobArg, query) != 0)
+            break;
+
+        //once the last range is done, only keys added since are left. the position
+        //goes into the same transaction as the rows
+        longlong next = to;
+        if (last == true)
+            next = range.maxPk < LONGLONG_MAX ? range.maxPk + 1 : range.maxPk;
+
+        if (commitChunkPos(jobArg, job->chunksDone + 1, next) != 0 || execChunkQuery(jobArg, "COMMIT") != 0)
+            break;
+
+        job->chunksDone++;
+        job->chunkPos = next;
+
+        if (last == true) {
+            done = true;
+            break;
+        }
+
+        throttlePoint(jobArg);
+        from = to;
+    }
+
+    //the chunks committed so far stay, a rerun continues after them
+    if (done == false && jobArg->thd->killed != 0)
+        jobArg->interrupted = true;
+
+    if (skipBinlog == true)
+        jobArg->thd->variables.option_bits |= binlogBit;
+
+    my_free(query);
+
+    return 0;
+}
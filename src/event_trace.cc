@@ -0,0 +1,369 @@
+/* Copyright (c) 2012, 2013, Adrian M. Partl, eScience Group at the
+   Leibniz Institut for Astrophysics, Potsdam
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; version 2 of the License.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA */
+
+
+/*****************************************************************
+ ********                   event_trace                    *******
+ *****************************************************************
+ *
+ * lock-free ring buffer of the scheduling events of the jobs with
+ * monotonic nanosecond timestamps, shown in
+ * INFORMATION_SCHEMA.QQUEUE_EVENTS and written to a file by
+ * qqueue_dumpEvents()
+ *
+ *****************************************************************
+ */
+
+#define MYSQL_SERVER 1
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sql_class.h>
+#include <sql_show.h>
+#include <table.h>
+#include <mysql/plugin.h>
+#include "event_trace.h"
+
+#ifdef USE_PRAGMA_IMPLEMENTATION
+#pragma implementation
+#endif
+
+#define QQUEUE_TRACE_MAGIC "QQEV"
+#define QQUEUE_TRACE_VERSION 1
+#define QQUEUE_TRACE_RECORD 40
+
+//seq is odd while the entry is written and 2n+2 once event n is complete,
+//so a reader can tell a finished entry from a torn or overwritten one
+struct traceEntry {
+    volatile ulonglong seq;
+    ulonglong timeNs;
+    longlong jobId;
+    longlong arg;
+    uint32 type;
+};
+
+long traceEvents = 65536;
+
+struct st_mysql_information_schema qqueue_events_info = {MYSQL_INFORMATION_SCHEMA_INTERFACE_VERSION};
+
+static traceEntry *traceRing = NULL;
+static ulonglong traceMask = 0;
+static volatile ulonglong traceNext = 0;
+
+//difference between the wall clock and the monotonic clock when tracing started
+static longlong traceWallOffsetNs = 0;
+
+static ST_FIELD_INFO qqueueEventsFields[] = {
+    {"SEQ", 21, MYSQL_TYPE_LONGLONG, 0, MY_I_S_UNSIGNED, "Sequence", SKIP_OPEN_TABLE},
+    {"TIME_NS", 21, MYSQL_TYPE_LONGLONG, 0, MY_I_S_UNSIGNED, "Monotonic nanoseconds", SKIP_OPEN_TABLE},
+    {"JOB_ID", 21, MYSQL_TYPE_LONGLONG, 0, 0, "Job id", SKIP_OPEN_TABLE},
+    {"EVENT", 16, MYSQL_TYPE_STRING, 0, 0, "Event", SKIP_OPEN_TABLE},
+    {"DETAIL", 21, MYSQL_TYPE_LONGLONG, 0, 0, "Detail", SKIP_OPEN_TABLE},
+    {"REASON", 16, MYSQL_TYPE_STRING, 0, MY_I_S_MAYBE_NULL, "Reason", SKIP_OPEN_TABLE},
+    {0, 0, MYSQL_TYPE_NULL, 0, 0, 0, SKIP_OPEN_TABLE}
+};
+
+static ulonglong monotonicNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (ulonglong) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static const char *eventName(uint32 type) {
+    switch (type) {
+        case QQUEUE_EV_SUBMIT: return "SUBMIT";
+        case QQUEUE_EV_ENQUEUE: return "ENQUEUE";
+        case QQUEUE_EV_SKIP: return "SKIP";
+        case QQUEUE_EV_DISPATCH: return "DISPATCH";
+        case QQUEUE_EV_THREAD_START: return "THREAD_START";
+        case QQUEUE_EV_STATEMENT: return "STATEMENT";
+        case QQUEUE_EV_KILL: return "KILL";
+        case QQUEUE_EV_SIGNAL: return "SIGNAL";
+        case QQUEUE_EV_EXIT: return "EXIT";
+        case QQUEUE_EV_HISTORY: return "HISTORY";
+    }
+
+    return "UNKNOWN";
+}
+
+static const char *eventReason(uint32 type, longlong arg) {
+    if (type == QQUEUE_EV_SKIP) {
+        switch (arg) {
+            case QQUEUE_SKIP_QUOTA: return "quota";
+            case QQUEUE_SKIP_JOURNAL: return "journal";
+            case QQUEUE_SKIP_NO_SLOT: return "no slot";
+        }
+    } else if (type == QQUEUE_EV_KILL) {
+        switch (arg) {
+            case QQUEUE_KILL_BY_USER: return "kill";
+            case QQUEUE_KILL_BY_TIMEOUT: return "timeout";
+            case QQUEUE_KILL_BY_PREEMPTION: return "preempt";
+        }
+    } else if (type == QQUEUE_EV_SIGNAL) {
+        return arg ? "connection" : "query";
+    }
+
+    return NULL;
+}
+
+void initEventTrace() {
+    if (traceEvents <= 0)
+        return;
+
+    ulonglong size = 1;
+    while (size < (ulonglong) traceEvents)
+        size <<= 1;
+
+    traceRing = (traceEntry *) my_malloc(size * sizeof(traceEntry), MYF(MY_ZEROFILL));
+    if (traceRing == NULL) {
+        fprintf(stderr, "Query Queue: Could not allocate %llu trace events, tracing is off\n", size);
+        return;
+    }
+
+    traceMask = size - 1;
+    traceNext = 0;
+
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    traceWallOffsetNs = (longlong) ((ulonglong) ts.tv_sec * 1000000000ULL + ts.tv_nsec) - (longlong) monotonicNs();
+}
+
+void freeEventTrace() {
+    traceEntry *ring = traceRing;
+
+    traceRing = NULL;
+    traceMask = 0;
+
+    if (ring != NULL)
+        my_free(ring);
+}
+
+void traceEvent(int type, long long jobId, long long arg) {
+    traceEntry *ring = traceRing;
+    if (ring == NULL)
+        return;
+
+    ulonglong n = __sync_fetch_and_add(&traceNext, 1);
+    traceEntry *entry = &ring[n & traceMask];
+
+    entry->seq = 2 * n + 1;
+    __sync_synchronize();
+
+    entry->timeNs = monotonicNs();
+    entry->jobId = jobId;
+    entry->arg = arg;
+    entry->type = type;
+
+    __sync_synchronize();
+    entry->seq = 2 * n + 2;
+}
+
+//copies the complete entries out of the ring, the oldest first. entries that are
+//being written or have been overwritten while they were copied are left out
+static long long snapshotEvents(traceEntry **events, ulonglong *firstSeq) {
+    *events = NULL;
+    *firstSeq = 0;
+
+    traceEntry *ring = traceRing;
+    if (ring == NULL)
+        return 0;
+
+    ulonglong end = traceNext;
+    ulonglong size = traceMask + 1;
+    ulonglong start = end > size ? end - size : 0;
+
+    if (end == start)
+        return 0;
+
+    traceEntry *copy = (traceEntry *) my_malloc((end - start) * sizeof(traceEntry), MYF(0));
+    if (copy == NULL)
+        return -1;
+
+    long long count = 0;
+    for (ulonglong n = start; n < end; n++) {
+        traceEntry *entry = &ring[n & traceMask];
+
+        if (entry->seq != 2 * n + 2)
+            continue;
+        __sync_synchronize();
+
+        copy[count].timeNs = entry->timeNs;
+        copy[count].jobId = entry->jobId;
+        copy[count].arg = entry->arg;
+        copy[count].type = entry->type;
+
+        __sync_synchronize();
+        if (entry->seq != 2 * n + 2)
+            continue;
+
+        copy[count].seq = n;
+        count++;
+    }
+
+    *events = copy;
+    *firstSeq = start;
+    return count;
+}
+
+static int writeAll(int fd, const char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t written = write(fd, buf, len);
+        if (written < 0) {
+            if (errno == EINTR)
+                continue;
+            return 1;
+        }
+
+        buf += written;
+        len -= written;
+    }
+
+    return 0;
+}
+
+long long dumpEvents(const char *path, bool binary, char *message, size_t messageLen) {
+    traceEntry *events;
+    ulonglong firstSeq;
+
+    if (traceRing == NULL) {
+        snprintf(message, messageLen, "event tracing is disabled");
+        return -1;
+    }
+
+    long long count = snapshotEvents(&events, &firstSeq);
+    if (count < 0) {
+        snprintf(message, messageLen, "out of memory");
+        return -1;
+    }
+
+    //an existing file is never overwritten, the server writes with its own privileges
+    int fd = open(path, O_WRONLY | O_CREAT | O_EXCL, 0640);
+    if (fd < 0) {
+        snprintf(message, messageLen, "could not create %s: %s", path, strerror(errno));
+        if (events != NULL)
+            my_free(events);
+        return -1;
+    }
+
+    int err = 0;
+    char buf[256];
+
+    if (binary) {
+        //header: magic, version, record size, wall clock offset of TIME_NS
+        uchar header[16];
+        memcpy(header, QQUEUE_TRACE_MAGIC, 4);
+        int2store(header + 4, QQUEUE_TRACE_VERSION);
+        int2store(header + 6, QQUEUE_TRACE_RECORD);
+        int8store(header + 8, (ulonglong) traceWallOffsetNs);
+        err = writeAll(fd, (const char *) header, sizeof(header));
+
+        for (long long i = 0; i < count && !err; i++) {
+            uchar record[QQUEUE_TRACE_RECORD];
+            int8store(record, events[i].seq);
+            int8store(record + 8, events[i].timeNs);
+            int8store(record + 16, (ulonglong) events[i].jobId);
+            int8store(record + 24, (ulonglong) events[i].arg);
+            int4store(record + 32, events[i].type);
+            int4store(record + 36, 0);
+            err = writeAll(fd, (const char *) record, sizeof(record));
+        }
+    } else {
+        size_t len = snprintf(buf, sizeof(buf), "{\"wall_offset_ns\":%lld,\"first_seq\":%llu}\n",
+                              traceWallOffsetNs, firstSeq);
+        err = writeAll(fd, buf, len);
+
+        for (long long i = 0; i < count && !err; i++) {
+            const char *reason = eventReason(events[i].type, events[i].arg);
+
+            len = snprintf(buf, sizeof(buf), "{\"seq\":%llu,\"time_ns\":%llu,\"job_id\":%lld,\"event\":\"%s\",\"detail\":%lld",
+                           events[i].seq, events[i].timeNs, events[i].jobId, eventName(events[i].type), events[i].arg);
+            if (reason != NULL)
+                len += snprintf(buf + len, sizeof(buf) - len, ",\"reason\":\"%s\"", reason);
+            len += snprintf(buf + len, sizeof(buf) - len, "}\n");
+
+            err = writeAll(fd, buf, len);
+        }
+    }
+
+    if (close(fd) != 0)
+        err = 1;
+
+    if (events != NULL)
+        my_free(events);
+
+    if (err) {
+        snprintf(message, messageLen, "could not write %s: %s", path, strerror(errno));
+        return -1;
+    }
+
+    return count;
+}
+
+static int fillQqueueEvents(THD *thd, TABLE_LIST *tables, Item *cond) {
+    TABLE *table = tables->table;
+    traceEntry *events;
+    ulonglong firstSeq;
+
+    long long count = snapshotEvents(&events, &firstSeq);
+    if (count < 0)
+        return 1;
+
+    int err = 0;
+    for (long long i = 0; i < count; i++) {
+        restore_record(table, s->default_values);
+
+        const char *name = eventName(events[i].type);
+        const char *reason = eventReason(events[i].type, events[i].arg);
+
+        table->field[0]->store(events[i].seq, true);
+        table->field[1]->store(events[i].timeNs, true);
+        table->field[2]->store(events[i].jobId, false);
+        table->field[3]->store(name, strlen(name), system_charset_info);
+        table->field[4]->store(events[i].arg, false);
+
+        if (reason != NULL) {
+            table->field[5]->set_notnull();
+            table->field[5]->store(reason, strlen(reason), system_charset_info);
+        }
+
+        if (schema_table_store_record(thd, table)) {
+            err = 1;
+            break;
+        }
+    }
+
+    if (events != NULL)
+        my_free(events);
+
+    return err;
+}
+
+int qqueue_events_init(void *p) {
+    ST_SCHEMA_TABLE *schema = (ST_SCHEMA_TABLE *) p;
+
+    schema->fields_info = qqueueEventsFields;
+    schema->fill_table = fillQqueueEvents;
+
+    return 0;
+}
+
+int qqueue_events_deinit(void *p) {
+    return 0;
+}
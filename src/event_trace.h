@@ -0,0 +1,81 @@
+/* Copyright (c) 2012, 2013, Adrian M. Partl, eScience Group at the
+   Leibniz Institut for Astrophysics, Potsdam
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; version 2 of the License.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA */
+
+
+/*****************************************************************
+ ********                   event_trace                    *******
+ *****************************************************************
+ *
+ * lock-free ring buffer of the scheduling events of the jobs with
+ * monotonic nanosecond timestamps, shown in
+ * INFORMATION_SCHEMA.QQUEUE_EVENTS and written to a file by
+ * qqueue_dumpEvents()
+ *
+ *****************************************************************
+ */
+
+#ifndef __MYSQL_EVENT_TRACE__
+#define __MYSQL_EVENT_TRACE__
+
+#define MYSQL_SERVER 1
+
+#include <sql_class.h>
+#include <mysql/plugin.h>
+
+#ifdef USE_PRAGMA_IMPLEMENTATION
+#pragma implementation
+#endif
+
+//the argument of each event is given in brackets
+enum enum_trace_event {
+    QQUEUE_EV_SUBMIT = 1,                   //job added by qqueue_addJob (priority)
+    QQUEUE_EV_ENQUEUE,                      //job visible to the dispatcher as pending (preemptCount)
+    QQUEUE_EV_SKIP,                         //pending job passed over by the dispatcher (reason)
+    QQUEUE_EV_DISPATCH,                     //job given a slot (slot)
+    QQUEUE_EV_THREAD_START,                 //worker thread of the job is up (thread id)
+    QQUEUE_EV_STATEMENT,                    //statement of the job starts (statement index)
+    QQUEUE_EV_KILL,                         //kill requested (reason)
+    QQUEUE_EV_SIGNAL,                       //kill delivered to the worker (1 for KILL CONNECTION)
+    QQUEUE_EV_EXIT,                         //killed job has returned (microseconds since the kill)
+    QQUEUE_EV_HISTORY                       //job moved to the history (status)
+};
+
+#define QQUEUE_SKIP_QUOTA 1
+#define QQUEUE_SKIP_JOURNAL 2
+#define QQUEUE_SKIP_NO_SLOT 3
+
+#define QQUEUE_KILL_BY_USER 0
+#define QQUEUE_KILL_BY_TIMEOUT 1
+#define QQUEUE_KILL_BY_PREEMPTION 2
+
+//skips recorded per pass of the dispatcher, so that a long backlog of jobs
+//held back by their quotas does not flush the ring every round
+#define QQUEUE_TRACE_MAX_SKIPS 16
+
+extern long traceEvents;
+extern struct st_mysql_information_schema qqueue_events_info;
+
+void initEventTrace();
+void freeEventTrace();
+
+void traceEvent(int type, long long jobId, long long arg);
+
+long long dumpEvents(const char *path, bool binary, char *message, size_t messageLen);
+
+int qqueue_events_init(void *p);
+int qqueue_events_deinit(void *p);
+
+#endif
@@ -28,7 +28,6 @@
 
 #include <stdio.h>
 #include <stdlib.h>
-#include <cmath>
 #include <sql_class.h>
 #include <sql_parse.h>
 #include <sql_connect.h>
@@ -39,6 +38,18 @@
 #include "exec_query.h"
 #include "daemon_thd.h"
 #include "sql_query.h"
+#include "quota.h"
+#include "kill_reaper.h"
+#include "thd_sched.h"
+#include "throttle.h"
+#include "result_sink.h"
+#include "result_export.h"
+#include "split_job.h"
+#include "chunk_job.h"
+#include "pk_range.h"
+#include "journal.h"
+#include "event_trace.h"
+#include "query_queue.h"
 
 #ifdef WITH_PERFSCHEMA_STORAGE_ENGINE
 #include <storage/perfschema/pfs_server.h>
@@ -49,10 +60,45 @@
 #pragma implementation
 #endif
 
+//worker threads that have been created and not yet returned. they are detached,
+//the plugin waits for this to reach 0 before it frees what they use
+static volatile int numWorkers = 0;
+
+//jobs reading a single table show its size in INFORMATION_SCHEMA.QQUEUE_RUNNING.
+//the worker looks it up itself, nobody else may touch the tables of its THD.
+//sub-jobs only read a part of the table and get no estimate
+static void publishSourceRows(jobWorkerThd *jobArg) {
+    qqueue_simple_select select;
+    char db[NAME_LEN + 1];
+    char table[NAME_LEN + 1];
+
+    if (jobArg->job->parentJob != 0 || jobArg->job->query == NULL ||
+        parseSimpleSelect(jobArg->job->query, &select) != 0 ||
+        splitTableName(select.table, select.tableLen, NULL, db, table) != 0)
+        return;
+
+    longlong rows = getTableRows(jobArg->thd, db, table);
+    __sync_lock_test_and_set(&jobArg->sourceRows, rows);
+}
+
+//the THD of a job is only handed out and taken back with the queue locked, so that
+//INFORMATION_SCHEMA.QQUEUE_RUNNING never looks at a THD that is set up or torn down
+static void setJobThd(jobWorkerThd *jobArg, THD *thd) {
+    lockQueue();
+    jobArg->thd = thd;
+    unlockQueue();
+}
+
 pthread_handler_t worker_thread(void *arg) {
     jobWorkerThd *jobArg = (jobWorkerThd *) arg;
 
-    init_thread(&(jobArg->thd), "stating thread...", false);
+    THD *thd = NULL;
+    init_thread(&thd, "stating thread...", false);
+    setJobThd(jobArg, thd);
+    traceEvent(QQUEUE_EV_THREAD_START, jobArg->job->id, jobArg->thd->thread_id);
+    reaperAttachThd(jobArg);
+    schedJobStart(jobArg);
+    throttleJobStart(jobArg);
 
     Security_context *old;
     Security_context newContext;
@@ -60,8 +106,8 @@ pthread_handler_t worker_thread(void *arg) {
     LEX_STRING host;
     LEX_STRING db;
 
-    char *usrStr = my_strdup("root", MYF(0));
-    char *hostStr = my_strdup("localhost", MYF(0));
+    char *usrStr = jobArg->job->dupString("root");
+    char *hostStr = jobArg->job->dupString("localhost");
 
     user.str = usrStr;
     user.length = strlen(usrStr);
@@ -82,11 +128,40 @@ pthread_handler_t worker_thread(void *arg) {
 
     newContext.change_security_context(jobArg->thd, &user, &host, &db, &old);
 
+    //the job writes its own row from here on, which must not be overwritten by
+    //journal records that are still on their way to the tables
+    journalWaitApplied(jobArg->job->id);
+
+    if (jobArg->thd->killed == 0)
+        publishSourceRows(jobArg);
+
+    //split jobs only hand out their sub-jobs here and run again once they are done
     int err;
-    if (jobArg->thd->killed == 0) {
-        err = workload(jobArg);
+    if (jobArg->thd->killed != 0) {
+        jobArg->interrupted = true;
+    } else if (splitJobStart(jobArg) == 0) {
+        if ((jobArg->job->jobFlags & QQUEUE_JOB_CHUNKED) != 0)
+            err = chunkedWorkload(jobArg);
+        else
+            err = workload(jobArg);
     }
 
+    //the job is over, from here on kills and timeouts leave it to this thread. if
+    //one of them came first, the killing thread ends the job. thd->killed cannot
+    //tell, the reaper delivers kills later
+    bool endedByQueue = false;
+    bool preempted = false;
+    if (__sync_bool_compare_and_swap(&jobArg->endOwner, QQUEUE_END_OPEN, QQUEUE_END_BY_WORKER) == false) {
+        if (__sync_bool_compare_and_swap(&jobArg->endOwner, QQUEUE_END_PREEMPTED, QQUEUE_END_BY_WORKER) == true)
+            preempted = true;
+        else
+            endedByQueue = true;
+    }
+
+    //from here on the reaper leaves this thread alone
+    reaperJobExited(jobArg);
+    throttleJobEnd(jobArg);
+
     jobArg->thd->security_ctx->restore_security_context(jobArg->thd, old);
 
 #ifdef HAVE_PSI_THREAD_INTERFACE
@@ -97,67 +172,164 @@ pthread_handler_t worker_thread(void *arg) {
     PSI_THREAD_CALL(delete_current_thread)();
 #endif
 
-    //callback function to handle management of thread termination and processing
-    //of new thread
-    if (jobArg->thdTerm != NULL && jobArg->thd->killed == 0) 
-        (*jobArg->thdTerm)(jobArg);
-
-#ifndef __QQUEUE_NOWAIT_ON_KILL_TO_JOBRESTART__
-    if (jobArg->thd->killed != 0)
-        (*jobArg->thdKillHandler)(jobArg);
+    //a preempted job goes back to the queue instead of the history, unless it already
+    //waits for its sub-jobs or had finished before the kill reached it
+    bool requeue = preempted == true && jobArg->interrupted == true && jobArg->parked == false;
+    if (requeue == true) {
+        registerThreadPreempt(jobArg);
+    } else if (preempted == true) {
+        //the preemption came too late, the job ends like any other
+#if defined(MARIADB_BASE_VERSION) && MYSQL_VERSION_ID >= 50500
+        jobArg->thd->killed = NOT_KILLED;
+#else
+        jobArg->thd->killed = THD::NOT_KILLED;
 #endif
+    }
 
-    my_free(usrStr);
-    my_free(hostStr);
+    //callback function to handle management of thread termination. jobs killed or
+    //timed out are ended by the thread that killed them
+    if (jobArg->thdTerm != NULL && requeue == false && endedByQueue == false && jobArg->parked == false)
+        (*jobArg->thdTerm)(jobArg);
 
-    deinit_thread(&(jobArg->thd));
+    schedJobEnd(jobArg);
+    setJobThd(jobArg, NULL);
+    deinit_thread(&thd);
 
-    if (jobArg->error != NULL)
+    if (jobArg->error != NULL) {
         my_free(jobArg->error);
+        jobArg->error = NULL;
+    }
+
+    //the dispatcher gives the slot to the next job and frees this one, jobArg
+    //must not be touched after handing it over
+    if (jobArg->thdDone != NULL) {
+        (*jobArg->thdDone)(jobArg);
+    } else {
+        delete jobArg->job;
+        delete jobArg;
+    }
 
-    delete jobArg->job;
-    delete jobArg;
+    __sync_fetch_and_sub(&numWorkers, 1);
 
     my_thread_end();
     pthread_exit(0);
     return NULL;
 }
 
+//called after each completed statement of a job. resumable jobs record the
+//number of completed statements in the jobs table, so that they can continue
+//from there when they are run again
+static void checkpointStatement(jobWorkerThd *jobArg) {
+    jobArg->stmtIdx++;
+
+    if ((jobArg->job->jobFlags & QQUEUE_JOB_RESUMABLE) == 0)
+        return;
+
+    jobArg->job->lastStmt = jobArg->stmtIdx;
+
+    int error = 0;
+    Open_tables_backup backup;
+    TABLE *tbl = open_sysTbl(jobArg->thd, "qqueue_jobs", strlen("qqueue_jobs"), &backup, true, &error);
+    if ( error || (tbl == NULL && (error != HA_STATUS_NO_LOCK) ) ) {
+        if( error != HA_STATUS_NO_LOCK )
+            fprintf(stderr, "checkpointStatement: error in opening jobs sys table: error: %i\n", error);
+        close_sysTbl(jobArg->thd, tbl, &backup);
+        return;
+    }
+
+    setQqueueJobsLastStmt(jobArg->job->id, jobArg->job->lastStmt, tbl);
+
+    close_sysTbl(jobArg->thd, tbl, &backup);
+}
+
+//whether anything but white space is left of the query after the statement the
+//parser stopped at
+static bool statementsLeft(THD *thd, Parser_state *parser_state) {
+    const char *next = parser_state->m_lip.found_semicolon;
+    if (next == NULL)
+        return false;
+
+    const char *end = thd->query() + thd->query_length();
+    while (next < end && my_isspace(thd->charset(), *next))
+        next++;
+
+    return next < end;
+}
+
+//result tables of queues with resultNoBinlog can be rebuilt by running the job again,
+//there is no point in shipping them to the replicas. this only holds for jobs whose
+//statements have all been written by the queue: a single CREATE TABLE ... SELECT, the
+//sub-jobs of a split job and their merge. anything else is logged as usual
+bool jobSkipsBinlog(jobWorkerThd *jobArg) {
+    qqueue_jobs_row *job = jobArg->job;
+    qqueue_queues_row *queue = getQueueByID(job->queue);
+
+    if (queue == NULL || queue->resultNoBinlog == false)
+        return false;
+
+    if (job->parentJob != 0 || job->subJobs > 0)
+        return true;
+
+    if (job->paquFlag == 1 || (job->jobFlags & QQUEUE_JOB_OUTPUT_FILE) != 0 || job->actualQuery == NULL)
+        return false;
+
+    return skipSQLStatements(job->actualQuery, 1) == NULL;
+}
+
 int workload(jobWorkerThd *jobArg) {
-    char *jobDes;
-    char *queryCpy;
+    char *query = jobArg->job->actualQuery;
+    size_t queryLen = jobArg->job->actualQueryLen;
 
     jobArg->error = NULL;
 
-    jobDes = (char *) my_malloc(strlen(jobArg->job->actualQuery) +
-                                strlen("JobWorker: U:  P:  Q:  ") +
-                                (int) log10((jobArg->job->usrId > 0 ? jobArg->job->usrId : 1)) + 2 + 10, MYF(0)); //2 = \0 and log10 roundoff compensation - 10 = max number of digits for multiqueries
-    if (jobDes == NULL) {
-        fprintf(stderr, "init_worker_thread: unable to allocate enough memory\n");
-        jobArg->error = my_strdup("init_worker_thread: unable to allocate enough memory", MYF(0));
+    if (query == NULL) {
+        fprintf(stderr, "Query queue - job worker ERROR: job %lli has no query\n", jobArg->job->id);
+        jobArg->error = my_strdup("Query queue - job worker ERROR: invalid query!", MYF(0));
         return 1;
     }
 
-    //making memory larger due to invalid writes in mysql_parse at the position of the query. i have no clue why this
-    //happens and this is a dirty hack
-    queryCpy = (char *) my_malloc(strlen(jobArg->job->actualQuery) + 256, MYF(0));
-    memset(queryCpy, 0, strlen(jobArg->job->actualQuery) + 256);
-    strncpy(queryCpy, jobArg->job->actualQuery, strlen(jobArg->job->actualQuery));
-
+    //the query has been loaded into a padded buffer of the job and is parsed in place.
     //remove any whitespace from the end of the query
-    char *endOfQuery = queryCpy + strlen(queryCpy) - 1;
-    while (my_isspace(jobArg->thd->charset(), *endOfQuery)) {
-        *endOfQuery = '\0';
-        endOfQuery--;
+    while (queryLen > 0 && my_isspace(jobArg->thd->charset(), query[queryLen - 1])) {
+        queryLen--;
+        query[queryLen] = '\0';
+    }
+    jobArg->job->actualQueryLen = queryLen;
+
+    //the process list gets a short label instead of another copy of the query
+    snprintf(jobArg->label, QQUEUE_JOB_LABEL_LEN, "JobWorker: job %lli U: %i P: %i",
+             jobArg->job->id, jobArg->job->usrId, jobArg->job->priority);
+    thd_proc_info(jobArg->thd, jobArg->label);
+
+    //a resumable job that has been interrupted continues after its last completed statement
+    char *startOfQuery = query;
+    jobArg->stmtIdx = 0;
+    if ((jobArg->job->jobFlags & QQUEUE_JOB_RESUMABLE) != 0 && jobArg->job->lastStmt > 0) {
+        const char *resumeAt = skipSQLStatements(query, jobArg->job->lastStmt);
+        if (resumeAt != NULL) {
+            startOfQuery = (char *) resumeAt;
+            jobArg->stmtIdx = jobArg->job->lastStmt;
+            fprintf(stderr, "Query queue: resuming job %lli at statement %i\n", jobArg->job->id, jobArg->stmtIdx);
+        } else {
+            //the result table has been kept for the statements that are now run again
+            char dropQuery[QQUEUE_RESULTDBNAME_LEN + QQUEUE_RESULTTBLNAME_LEN + 64];
+            char *queryError = NULL;
+
+            fprintf(stderr, "Query queue: job %lli has no statement %i, running it from the start\n",
+                    jobArg->job->id, jobArg->job->lastStmt);
+            jobArg->job->lastStmt = 0;
+
+            snprintf(dropQuery, sizeof(dropQuery), "DROP TABLE IF EXISTS `%s`.`%s`",
+                     jobArg->job->resultDBName, jobArg->job->resultTableName);
+            if (execSimpleQuery(jobArg->thd, dropQuery, &queryError) != 0 && queryError != NULL)
+                my_free(queryError);
+        }
     }
-
-    sprintf(jobDes, "JobWorker: U: %i P: %i Q: %s", 120, 1, queryCpy);
-    thd_proc_info(jobArg->thd, jobDes);
 
     jobArg->thd->client_capabilities |= CLIENT_MULTI_STATEMENTS;
-    jobArg->thd->set_query(queryCpy, strlen(queryCpy));
+    jobArg->thd->set_query(startOfQuery, queryLen - (startOfQuery - query));
 
-    MYSQL_QUERY_START(queryCpy, jobArg->thd->thread_id,
+    MYSQL_QUERY_START(startOfQuery, jobArg->thd->thread_id,
                       (char *) (jobArg->thd->db ? jobArg->thd->db : ""),
                       &jobArg->thd->security_ctx->priv_user[0],
                       (char *) jobArg->thd->security_ctx->host_or_ip);
@@ -171,7 +343,27 @@ int workload(jobWorkerThd *jobArg) {
 
     jobArg->thd->init_for_queries();
 
-    mysql_parse(jobArg->thd, jobArg->thd->query(), strlen(jobArg->thd->query()), &parser_state);
+    //a job writing to a file gets the sink in place of its protocol, the result set
+    //of its last statement goes there instead of a result table
+    Protocol *protocol = jobArg->thd->protocol;
+    qqueue_result_sink *sink = NULL;
+    if ((jobArg->job->jobFlags & QQUEUE_JOB_OUTPUT_FILE) != 0) {
+        sink = new qqueue_result_sink(jobArg->thd, jobArg->job->jobFlags);
+        if (sink == NULL || sink->open(jobArg->job->id) != 0) {
+            delete sink;
+            jobArg->error = my_strdup("Query queue - job worker ERROR: could not create output file!", MYF(0));
+            return 1;
+        }
+        jobArg->thd->protocol = sink;
+    }
+
+    ulonglong binlogBit = jobArg->thd->variables.option_bits & OPTION_BIN_LOG;
+    bool skipBinlog = jobSkipsBinlog(jobArg);
+    if (skipBinlog == true)
+        jobArg->thd->variables.option_bits &= ~OPTION_BIN_LOG;
+
+    traceEvent(QQUEUE_EV_STATEMENT, jobArg->job->id, jobArg->stmtIdx);
+    mysql_parse(jobArg->thd, jobArg->thd->query(), jobArg->thd->query_length(), &parser_state);
 
     /*
       Multiple queries exits, execute them individually
@@ -186,7 +378,12 @@ int workload(jobWorkerThd *jobArg) {
         jobArg->thd->update_server_status();
         jobArg->thd->protocol->end_statement();
         query_cache_end_of_result(jobArg->thd);
-        ulong length = (ulong) strlen(jobArg->thd->query()) - (beginning_of_next_stmt - jobArg->thd->query());
+
+        checkpointStatement(jobArg);
+        throttlePoint(jobArg);
+        traceEvent(QQUEUE_EV_STATEMENT, jobArg->job->id, jobArg->stmtIdx);
+
+        ulong length = (ulong) jobArg->thd->query_length() - (beginning_of_next_stmt - jobArg->thd->query());
 
         /* Remove garbage at start of query */
         while (length > 0 && my_isspace(jobArg->thd->charset(), *beginning_of_next_stmt)) {
@@ -212,6 +409,13 @@ int workload(jobWorkerThd *jobArg) {
         mysql_parse(jobArg->thd, beginning_of_next_stmt, length, &parser_state);
     }
 
+    if (skipBinlog == true)
+        jobArg->thd->variables.option_bits |= binlogBit;
+
+    //a kill that comes in after the last statement has not stopped anything
+    if (jobArg->thd->killed != 0 && (jobArg->thd->is_error() || statementsLeft(jobArg->thd, &parser_state)))
+        jobArg->interrupted = true;
+
     if (jobArg->thd->is_error()) {
 
 #if MYSQL_VERSION_ID >= 50603
@@ -230,25 +434,38 @@ int workload(jobWorkerThd *jobArg) {
     jobArg->thd->update_server_status();
     jobArg->thd->protocol->end_statement();
     query_cache_end_of_result(jobArg->thd);
+
+    //the file only gets its final name if the job succeeded
+    if (sink != NULL) {
+        jobArg->thd->protocol = protocol;
+
+        if (jobArg->error == NULL && jobArg->interrupted == false &&
+            sink->finish(&jobArg->job->outputFile, &jobArg->job->outputSize, &jobArg->job->arena) != 0) {
+            jobArg->error = my_strdup("Query queue - job worker ERROR: could not write output file!", MYF(0));
+        }
+
+        delete sink;
+    }
+
 #if MYSQL_VERSION_ID >= 50603
     jobArg->thd->get_stmt_da()->reset_diagnostics_area();
 #else
     jobArg->thd->stmt_da->reset_diagnostics_area();
 #endif
 
-    my_free(queryCpy);
-    my_free(jobDes);
-
     return 0;
 }
 
 int init_worker_thread(jobWorkerThd *job) {
     pthread_attr_t attr;
 
+    __sync_fetch_and_add(&numWorkers, 1);
+
     pthread_attr_init(&attr);
     pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_JOINABLE);
     if (pthread_create(&(job->pthd), &attr, worker_thread, (void *) job) != 0) {
         fprintf(stderr, "Query queue - job worker ERROR: Could not create thread!\n");
+        __sync_fetch_and_sub(&numWorkers, 1);
         return 1;
     }
 
@@ -257,12 +474,32 @@ int init_worker_thread(jobWorkerThd *job) {
     return 0;
 }
 
+//blocks until all worker threads have returned. called once the daemon is gone
+//and no new workers are started
+void waitForWorkers() {
+    bool reported = false;
+
+    while (__sync_fetch_and_add(&numWorkers, 0) > 0) {
+        if (reported == false) {
+            fprintf(stderr, "Query queue: waiting for %i job worker(s) to return\n", numWorkers);
+            reported = true;
+        }
+
+        my_sleep(100000);
+    }
+}
+
 int registerThreadStart(jobWorkerThd *job) {
+    traceEvent(QQUEUE_EV_DISPATCH, job->job->id, job->slot);
+
     MYSQL_TIME localTime;
     current_thd->variables.time_zone->gmt_sec_to_TIME(&localTime, (my_time_t) my_time(0));
     job->job->timeExecute = localTime;
     job->job->status = QUEUE_RUNNING;
 
+    if (journalJob(job->job) == 0)
+        return 0;
+
     int error = 0;
     Open_tables_backup backup;
     TABLE *tbl = open_sysTbl(current_thd, "qqueue_jobs", strlen("qqueue_jobs"), &backup, true, &error);
@@ -279,31 +516,140 @@ int registerThreadStart(jobWorkerThd *job) {
     return 0;
 }
 
+//deletes the job from the jobs table and adds it to the history
+static int moveJobToHistory(qqueue_jobs_row *job) {
+    int error = 0;
+    Open_tables_backup backup;
+    TABLE *tbl = open_sysTbl(current_thd, "qqueue_jobs", strlen("qqueue_jobs"), &backup, true, &error);
+    if ( error || (tbl == NULL && (error != HA_STATUS_NO_LOCK) ) ) {
+        if( error != HA_STATUS_NO_LOCK )
+            fprintf(stderr, "moveJobToHistory: error in opening jobs sys table: error: %i\n", error);
+        close_sysTbl(current_thd, tbl, &backup);
+        return 1;
+    }
+
+    //updateQqueueJobsRow(job, tbl);
+    deleteQqueueJobsRow(job->id, tbl);
+
+    close_sysTbl(current_thd, tbl, &backup);
+
+    tbl = open_sysTbl(current_thd, "qqueue_history", strlen("qqueue_history"), &backup, true, &error);
+    if (error || tbl == NULL) {
+        fprintf(stderr, "moveJobToHistory: error in opening history sys table: error: %i\n", error);
+        close_sysTbl(current_thd, tbl, &backup);
+        return 1;
+    }
+
+    addQqueueJobsRow(job, tbl, job->id);
+
+    close_sysTbl(current_thd, tbl, &backup);
+
+    return 0;
+}
+
+//killed and timed out jobs are ended by the thread that killed them, while the
+//worker may still be running. their error must neither come from the worker nor
+//be allocated in the arena of the job the worker is using
+static const char *killedError = "Query queue: the job has been killed";
+static const char *timedOutError = "Query queue: the job has reached the timeout of its queue";
+
 int registerThreadEnd(jobWorkerThd *job, bool killed, bool timedOut) {
+    quotaJobEnded(job->job->usrId, job->job->usrGroup);
+
     MYSQL_TIME localTime;
     current_thd->variables.time_zone->gmt_sec_to_TIME(&localTime, (my_time_t) my_time(0));
     job->job->timeFinish = localTime;
+    job->job->throttleTime += job->throttleUsec / 1000;
 
     if (job->error != NULL && killed == false && timedOut == false) {
         job->job->status = QUEUE_ERROR;
-        strncpy(job->job->error, job->error, QQUEUE_ERROR_LEN);
     } else if (killed == true && timedOut == false) {
         job->job->status = QUEUE_KILLED;
-        if (job->error != NULL) {
-            strncpy(job->job->error, job->error, QQUEUE_ERROR_LEN);
-        } else {
-            job->job->error[0] = '\0';
-        }
     } else if (timedOut == true) {
         job->job->status = QUEUE_TIMEOUT;
-        if (job->error != NULL) {
-            strncpy(job->job->error, job->error, QQUEUE_ERROR_LEN);
-        } else {
-            job->job->error[0] = '\0';
-        }
     } else {
         job->job->status = QUEUE_SUCCESS;
-        job->job->error[0] = '\0';
+    }
+
+    if (timedOut == true) {
+        job->job->setStaticError(timedOutError);
+    } else if (killed == true) {
+        job->job->setStaticError(killedError);
+    } else if (job->job->status != QUEUE_SUCCESS) {
+        job->job->setError(job->error);
+    } else {
+        job->job->setError(NULL);
+    }
+
+    if (journalHistory(job->job) != 0 && moveJobToHistory(job->job) != 0)
+        return 1;
+
+    traceEvent(QQUEUE_EV_HISTORY, job->job->id, job->job->status);
+
+    //the export and the parent job read the row of the job from the tables
+    if (job->job->parentJob != 0 || (job->job->jobFlags & QQUEUE_JOB_EXPORT) != 0)
+        journalWaitApplied(job->job->id);
+
+    //the export is recorded in the history once it is done
+    if (job->job->status == QUEUE_SUCCESS && (job->job->jobFlags & QQUEUE_JOB_EXPORT) != 0 &&
+        (job->job->jobFlags & QQUEUE_JOB_OUTPUT_FILE) == 0) {
+        exportResultTable(job->job);
+    }
+
+    if (job->job->parentJob != 0)
+        subJobEnded(job->job);
+
+    return 0;
+}
+
+
+int registerThreadPreempt(jobWorkerThd *job) {
+    char *queryError = NULL;
+    char dropQuery[QQUEUE_RESULTDBNAME_LEN + QQUEUE_RESULTTBLNAME_LEN + 64];
+
+    //the job has been killed by the queue, lift the kill to be able to clean up
+    //after the job on this thread
+#if defined(MARIADB_BASE_VERSION) && MYSQL_VERSION_ID >= 50500
+    job->thd->killed = NOT_KILLED;
+#else
+    job->thd->killed = THD::NOT_KILLED;
+#endif
+
+    //get rid of anything the job has already written to its result table, otherwise
+    //the rerun would fail on an existing table. chunked jobs keep the chunks they
+    //committed and resumable jobs the statements they completed, both continue after them
+    if ((job->job->jobFlags & QQUEUE_JOB_RESUMABLE) == 0)
+        job->job->lastStmt = 0;
+
+    snprintf(dropQuery, sizeof(dropQuery), "DROP TABLE IF EXISTS `%s`.`%s`",
+             job->job->resultDBName, job->job->resultTableName);
+    if (job->job->keepsPartialResult() == false && execSimpleQuery(job->thd, dropQuery, &queryError) != 0) {
+        fprintf(stderr, "registerThreadPreempt: could not drop partial result table of job %lli: %s\n",
+                job->job->id, queryError != NULL ? queryError : "");
+        if (queryError != NULL)
+            my_free(queryError);
+    }
+
+#if defined(MARIADB_BASE_VERSION) && MYSQL_VERSION_ID >= 50500
+    job->thd->killed = KILL_QUERY;
+#else
+    job->thd->killed = THD::KILL_QUERY;
+#endif
+
+    //reset the job to pending, keeping its original submission time
+    MYSQL_TIME nullTime = {0, 0, 0, 0, 0, 0, 0, 0};
+    job->job->timeExecute = nullTime;
+    job->job->timeFinish = nullTime;
+    job->job->status = QUEUE_PENDING;
+    job->job->setError(NULL);
+    job->job->preemptCount++;
+    job->job->throttleTime += job->throttleUsec / 1000;
+    quotaJobRequeued(job->job->usrId, job->job->usrGroup);
+
+    if (journalJob(job->job) == 0) {
+        fprintf(stderr, "Query queue: job %lli has been preempted (%i times) and is pending again\n",
+                job->job->id, job->job->preemptCount);
+        return 0;
     }
 
     int error = 0;
@@ -311,26 +657,91 @@ int registerThreadEnd(jobWorkerThd *job, bool killed, bool timedOut) {
     TABLE *tbl = open_sysTbl(current_thd, "qqueue_jobs", strlen("qqueue_jobs"), &backup, true, &error);
     if ( error || (tbl == NULL && (error != HA_STATUS_NO_LOCK) ) ) {
         if( error != HA_STATUS_NO_LOCK )
-            fprintf(stderr, "registerThreadEnd: error in opening jobs sys table: error: %i\n", error);
+            fprintf(stderr, "registerThreadPreempt: error in opening jobs sys table: error: %i\n", error);
         close_sysTbl(current_thd, tbl, &backup);
         return 1;
     }
 
-    //updateQqueueJobsRow(job->job, tbl);
-    deleteQqueueJobsRow(job->job->id, tbl);
+    updateQqueueJobsRow(job->job, tbl);
 
     close_sysTbl(current_thd, tbl, &backup);
 
-    tbl = open_sysTbl(current_thd, "qqueue_history", strlen("qqueue_history"), &backup, true, &error);
-    if (error || tbl == NULL) {
-        fprintf(stderr, "registerThreadEnd: error in opening history sys table: error: %i\n", error);
-        close_sysTbl(current_thd, tbl, &backup);
+    traceEvent(QQUEUE_EV_ENQUEUE, job->job->id, job->job->preemptCount);
+
+    fprintf(stderr, "Query queue: job %lli has been preempted (%i times) and is pending again\n",
+            job->job->id, job->job->preemptCount);
+
+    return 0;
+}
+
+//sums up the handler reads of the worker thread. the worker has its own THD, so
+//these are the rows the job has looked at so far
+ulonglong jobRowsRead(THD *thd) {
+    return thd->status_var.ha_read_first_count +
+           thd->status_var.ha_read_last_count +
+           thd->status_var.ha_read_key_count +
+           thd->status_var.ha_read_next_count +
+           thd->status_var.ha_read_prev_count +
+           thd->status_var.ha_read_rnd_count +
+           thd->status_var.ha_read_rnd_next_count;
+}
+
+//executes a single statement on the given thread. results are not sent anywhere, so
+//this is only meant for DDL and the like
+int execSimpleQuery(THD *thd, const char *query, char **error) {
+    char *queryCpy;
+    int queryLen = strlen(query);
+
+    *error = NULL;
+
+    //same padding as for the job queries, mysql_parse writes beyond the query
+    queryCpy = (char *) my_malloc(queryLen + 256, MYF(0));
+    if (queryCpy == NULL) {
+        fprintf(stderr, "execSimpleQuery: unable to allocate enough memory\n");
+        return 1;
+    }
+    memset(queryCpy, 0, queryLen + 256);
+    strncpy(queryCpy, query, queryLen);
+
+    thd->clear_error();
+#if MYSQL_VERSION_ID >= 50603
+    thd->get_stmt_da()->reset_diagnostics_area();
+#else
+    thd->stmt_da->reset_diagnostics_area();
+#endif
+
+    thd->set_query_and_id(queryCpy, queryLen, thd->charset(), next_query_id());
+
+    Parser_state parser_state;
+    if (parser_state.init(thd, thd->query(), thd->query_length())) {
+        *error = my_strdup("execSimpleQuery: error initialising parser_state object!", MYF(0));
+        thd->set_query(NULL, 0);
+        my_free(queryCpy);
         return 1;
     }
 
-    addQqueueJobsRow(job->job, tbl, job->job->id);
+    mysql_parse(thd, thd->query(), thd->query_length(), &parser_state);
 
-    close_sysTbl(current_thd, tbl, &backup);
+    int result = 0;
+    if (thd->is_error()) {
+#if MYSQL_VERSION_ID >= 50603
+        *error = my_strdup(thd->get_stmt_da()->message(), MYF(0));
+#else
+        *error = my_strdup(thd->stmt_da->message(), MYF(0));
+#endif
+        result = 1;
+    }
 
-    return 0;
+    thd->update_server_status();
+    thd->protocol->end_statement();
+#if MYSQL_VERSION_ID >= 50603
+    thd->get_stmt_da()->reset_diagnostics_area();
+#else
+    thd->stmt_da->reset_diagnostics_area();
+#endif
+
+    thd->set_query(NULL, 0);
+    my_free(queryCpy);
+
+    return result;
 }
@@ -39,27 +39,141 @@
 #pragma implementation
 #endif
 
+#define QQUEUE_JOB_LABEL_LEN 64
+
+enum enum_qqueue_kill_state {
+    QQUEUE_KILL_NONE,
+    QQUEUE_KILL_REQUESTED,                  //handed to the reaper, not signalled yet
+    QQUEUE_KILL_QUERY,
+    QQUEUE_KILL_CONNECTION,
+    QQUEUE_KILL_ZOMBIE                      //did not react to KILL CONNECTION either
+};
+
+//who moves a job out of the queue once it is over. set once with a compare and swap,
+//so that a kill and the worker returning at the same time do not both end the job
+enum enum_qqueue_job_end {
+    QQUEUE_END_OPEN,                        //job is running
+    QQUEUE_END_PREEMPTED,                   //the worker requeues the job if the kill interrupted it
+    QQUEUE_END_BY_QUEUE,                    //killed or timed out, ended by the killing thread
+    QQUEUE_END_BY_WORKER                    //returned, ended by the worker
+};
+
+struct jobWorkerThd;
+
+enum enum_qqueue_completion_type {
+    QQUEUE_COMPLETION_RELEASE,              //slot of a job that is still being killed
+    QQUEUE_COMPLETION_DONE                  //worker has exited
+};
+
+//record a worker or the kill reaper hands to the dispatcher
+struct qqueue_completion {
+    qqueue_completion *next;
+    jobWorkerThd *job;
+    int type;
+};
+
 struct jobWorkerThd {
     qqueue_jobs_row *job;
     char *error;
-    int (*thdTerm)(jobWorkerThd *);
-    int (*thdKillHandler)(jobWorkerThd *);
+    int (*thdTerm)(jobWorkerThd *);         //called on the worker if the job ended normally
+    int (*thdDone)(jobWorkerThd *);         //takes over the job once the worker is done with it
     pthread_t pthd;
     THD *thd;
+    bool preempted;
+    bool interrupted;                       //a kill stopped the job before it was done
+    bool parked;                            //job waits for its sub-jobs outside of a slot
+    int slot;                               //slot of the queue the job runs in, -1 if none
+    pid_t tid;                              //kernel id of the worker thread
+    int numaNode;                           //node the worker is bound to, -1 if none
+    bool numaSpread;                        //node has been picked by qqueue_numaSpread
+    int stmtIdx;                            //index of the statement being executed
+    volatile longlong sourceRows;           //rows of the table a simple job reads, -1 if unknown
+    char label[QQUEUE_JOB_LABEL_LEN];       //shown as proc_info while the job starts
+
+    //kill handling, protected by the lock of the kill reaper
+    bool thdAttached;
+    int killState;
+    bool slotReleased;                      //slot already handed to another job
+    ulonglong killStart;
+    jobWorkerThd *killPrev;
+    jobWorkerThd *killNext;
+
+    //read limits, protected by the lock of the throttle
+    bool throttled;
+    long long maxReadRows;                  //rows per second, 0 for no limit
+    long long maxReadBytes;                 //bytes per second, 0 for no limit
+    double rowTokens;
+    double byteTokens;
+    ulonglong lastRows;
+    ulonglong lastBytes;
+    ulonglong throttleLast;
+    ulonglong throttleOwed;                 //microseconds the job is ahead of its limits
+    ulonglong throttleUsec;                 //time the job has been put to sleep
+    jobWorkerThd *throttlePrev;
+    jobWorkerThd *throttleNext;
+
+    qqueue_completion releaseNode;
+    qqueue_completion doneNode;
+    volatile int refs;                      //the worker and the threads ending a killed job
+    volatile int endOwner;                  //enum_qqueue_job_end
 
     jobWorkerThd() {
         job = NULL;
         error = NULL;
+        thdTerm = NULL;
+        thdDone = NULL;
         thd = NULL;
+        preempted = false;
+        interrupted = false;
+        parked = false;
+        slot = -1;
+        tid = 0;
+        numaNode = -1;
+        numaSpread = false;
+        sourceRows = -1;
+        stmtIdx = 0;
+        label[0] = '\0';
+        thdAttached = false;
+        killState = QQUEUE_KILL_NONE;
+        slotReleased = false;
+        killStart = 0;
+        killPrev = NULL;
+        killNext = NULL;
+        throttled = false;
+        maxReadRows = 0;
+        maxReadBytes = 0;
+        rowTokens = 0.0;
+        byteTokens = 0.0;
+        lastRows = 0;
+        lastBytes = 0;
+        throttleLast = 0;
+        throttleOwed = 0;
+        throttleUsec = 0;
+        throttlePrev = NULL;
+        throttleNext = NULL;
+        releaseNode.next = NULL;
+        releaseNode.job = this;
+        releaseNode.type = QQUEUE_COMPLETION_RELEASE;
+        doneNode.next = NULL;
+        doneNode.job = this;
+        doneNode.type = QQUEUE_COMPLETION_DONE;
+        refs = 1;
+        endOwner = QQUEUE_END_OPEN;
     }
 };
 
 int init_worker_thread(jobWorkerThd *job);
+void waitForWorkers();
 
 pthread_handler_t worker_thread(void *arg);
+bool jobSkipsBinlog(jobWorkerThd *jobArg);
 int workload(jobWorkerThd *jobArg);
 
 int registerThreadStart(jobWorkerThd *job);
 int registerThreadEnd(jobWorkerThd *job, bool killed, bool timedOut);
+int registerThreadPreempt(jobWorkerThd *job);
+
+int execSimpleQuery(THD *thd, const char *query, char **error);
+ulonglong jobRowsRead(THD *thd);
 
 #endif
\ No newline at end of file
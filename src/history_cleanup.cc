@@ -0,0 +1,321 @@
+/* Copyright (c) 2012, 2013, Adrian M. Partl, eScience Group at the
+   Leibniz Institut for Astrophysics, Potsdam
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; version 2 of the License.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA */
+
+/*****************************************************************
+ ********                history_cleanup                   *******
+ *****************************************************************
+ *
+ * functions for removing jobs from the history whose result
+ * tables do not exist anymore
+ *
+ *****************************************************************
+ */
+
+#define MYSQL_SERVER 1
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <mysql_version.h>
+#include <sql_class.h>
+#include <sql_base.h>
+#include <hash.h>
+#include <key.h>
+#include "sys_tbl.h"
+#include "internal_func.h"
+#include "history_cleanup.h"
+
+
+#ifdef USE_PRAGMA_IMPLEMENTATION
+#pragma implementation
+#endif
+
+extern mysql_mutex_t LOCK_jobs;
+
+//entry of the table cache. the name is "db\0table" for tables and "db" for
+//the databases that have already been listed
+struct historyTblEntry {
+    size_t length;
+    char name[1];
+};
+
+static uchar *historyTblKey(const uchar *record, size_t *length, my_bool not_used) {
+    historyTblEntry *entry = (historyTblEntry *) record;
+    *length = entry->length;
+    return (uchar *) entry->name;
+}
+
+static void historyTblFree(void *record) {
+    my_free(record);
+}
+
+static int addCacheEntry(HASH *cache, const char *db, const char *table) {
+    size_t dbLen = strlen(db);
+    size_t length = dbLen;
+    if (table != NULL)
+        length += 1 + strlen(table);
+
+    historyTblEntry *entry = (historyTblEntry *) my_malloc(sizeof(historyTblEntry) + length, MYF(0));
+    if (entry == NULL) {
+        fprintf(stderr, "cleanQqueueHistory: unable to allocate enough memory\n");
+        return 1;
+    }
+
+    memcpy(entry->name, db, dbLen);
+    if (table != NULL) {
+        entry->name[dbLen] = '\0';
+        memcpy(entry->name + dbLen + 1, table, length - dbLen - 1);
+    }
+    entry->name[length] = '\0';
+    entry->length = length;
+
+    if (my_hash_insert(cache, (uchar *) entry)) {
+        //already there
+        my_free(entry);
+    }
+
+    return 0;
+}
+
+//lists the databases of the server once per sweep
+static int loadDbList(THD *thd, HASH *dbList, bool *with_i_schema) {
+#if defined(MARIADB_BASE_VERSION) && MYSQL_VERSION_ID >= 100000
+    Dynamic_array<LEX_STRING*> db_names;
+#else
+    List<LEX_STRING> db_names;
+#endif
+    if (make_db_list(thd, &db_names, with_i_schema)) {
+        fprintf(stderr, "cleanQqueueHistory: could not retrieve list of databases\n");
+        return 1;
+    }
+
+    LEX_STRING *currDBStr;
+#if defined(MARIADB_BASE_VERSION) && MYSQL_VERSION_ID >= 100000
+    for (size_t i = 0; i < db_names.elements(); i++) {
+        currDBStr= db_names.at(i);
+#else
+    List_iterator<LEX_STRING> db_names_iter(db_names);
+    while ( (currDBStr = db_names_iter++) ) {
+#endif
+        if (addCacheEntry(dbList, currDBStr->str, NULL))
+            return 1;
+    }
+
+    return 0;
+}
+
+//loads the table names of a database into the cache. every database is listed
+//only once per sweep, databases that do not exist are cached as empty
+static int loadDbIntoCache(THD *thd, HASH *cache, HASH *dbCache, HASH *dbList, bool with_i_schema,
+                           const char *db) {
+    if (my_hash_search(dbCache, (const uchar *) db, strlen(db)) != NULL)
+        return 0;
+
+    if (addCacheEntry(dbCache, db, NULL))
+        return 1;
+
+    historyTblEntry *dbEntry = (historyTblEntry *) my_hash_search(dbList, (const uchar *) db, strlen(db));
+    if (dbEntry == NULL)
+        return 0;
+
+    LEX_STRING dbName;
+    dbName.str = dbEntry->name;
+    dbName.length = dbEntry->length;
+
+#if defined(MARIADB_BASE_VERSION) && MYSQL_VERSION_ID >= 100000
+    Dynamic_array<LEX_STRING*> table_names;
+#else
+    List<LEX_STRING> table_names;
+#endif
+    if (make_table_name_list(thd, &table_names, with_i_schema, &dbName)) {
+        fprintf(stderr, "cleanQqueueHistory: could not retrieve list of tables for database %s\n", db);
+        return 1;
+    }
+
+    LEX_STRING *currTblStr;
+#if defined(MARIADB_BASE_VERSION) && MYSQL_VERSION_ID >= 100000
+    for (size_t i = 0; i < table_names.elements(); i++) {
+        currTblStr= table_names.at(i);
+#else
+    List_iterator<LEX_STRING> tbl_names_iter(table_names);
+    while ( (currTblStr = tbl_names_iter++) ) {
+#endif
+        if (addCacheEntry(cache, db, currTblStr->str))
+            return 1;
+    }
+
+    return 0;
+}
+
+static bool resultTableExists(HASH *cache, const char *db, const char *table) {
+    char key[QQUEUE_RESULTDBNAME_LEN + QQUEUE_RESULTTBLNAME_LEN + 1];
+    size_t dbLen = strlen(db);
+    size_t tblLen = strlen(table);
+
+    if (dbLen + tblLen + 1 > sizeof(key))
+        return false;
+
+    memcpy(key, db, dbLen);
+    key[dbLen] = '\0';
+    memcpy(key + dbLen + 1, table, tblLen);
+
+    return my_hash_search(cache, (const uchar *) key, dbLen + 1 + tblLen) != NULL;
+}
+
+//walks the history table in primary key order and either marks the successful
+//jobs whose result table is gone as deleted or removes them from the history.
+//the history table is opened for one batch of batchSize rows at a time only,
+//so that the daemon and the workers can write to the history in between.
+//returns the number of changed rows or -1 on error
+longlong cleanQqueueHistory(THD *thd, bool wipe, int batchSize) {
+    HASH tableCache;
+    HASH dbCache;
+    HASH dbList;
+    bool with_i_schema = false;
+    longlong numChanged = 0;
+    ulonglong lastId = 0;
+    bool first = true;
+    bool done = false;
+    int error = 0;
+
+    if (batchSize < 1)
+        batchSize = 1;
+
+    if (my_hash_init(&tableCache, system_charset_info, 1024, 0, 0,
+                     (my_hash_get_key) historyTblKey, historyTblFree, 0) ||
+        my_hash_init(&dbCache, system_charset_info, 64, 0, 0,
+                     (my_hash_get_key) historyTblKey, historyTblFree, 0) ||
+        my_hash_init(&dbList, system_charset_info, 64, 0, 0,
+                     (my_hash_get_key) historyTblKey, historyTblFree, 0)) {
+        fprintf(stderr, "cleanQqueueHistory: unable to allocate enough memory\n");
+        return -1;
+    }
+
+    //the databases are listed once, their tables when the first job of a database comes up
+    if (loadDbList(thd, &dbList, &with_i_schema)) {
+        my_hash_free(&tableCache);
+        my_hash_free(&dbCache);
+        my_hash_free(&dbList);
+        return -1;
+    }
+
+    while (done == false && thd->killed == 0) {
+        Open_tables_backup backup;
+        TABLE *tbl = open_sysTbl(thd, "qqueue_history", strlen("qqueue_history"), &backup, true, &error);
+        if (error || tbl == NULL) {
+            fprintf(stderr, "cleanQqueueHistory: error in opening history sys table: error: %i\n", error);
+            close_sysTbl(thd, tbl, &backup);
+            numChanged = -1;
+            break;
+        }
+
+        tbl->use_all_columns();
+
+        if (tbl->file->ha_index_init(0, 1)) {
+            close_sysTbl(thd, tbl, &backup);
+            numChanged = -1;
+            break;
+        }
+
+        //position behind the last row of the previous batch
+        if (first == true) {
+#if MYSQL_VERSION_ID >= 50601 || (defined(MARIADB_BASE_VERSION) && MYSQL_VERSION_ID >= 50500)
+            error = tbl->file->ha_index_first(tbl->record[0]);
+#else
+            error = tbl->file->index_first(tbl->record[0]);
+#endif
+        } else {
+            tbl->field[0]->store(lastId, true);
+            uchar key[MAX_KEY_LENGTH];
+            key_copy(key, tbl->record[0], tbl->key_info, tbl->key_info->key_length);
+#if MYSQL_VERSION_ID >= 50601 || (defined(MARIADB_BASE_VERSION) && MYSQL_VERSION_ID >= 50500)
+            error = tbl->file->ha_index_read_map(tbl->record[0], key, HA_WHOLE_KEY, HA_READ_AFTER_KEY);
+#else
+            error = tbl->file->index_read_map(tbl->record[0], key, HA_WHOLE_KEY, HA_READ_AFTER_KEY);
+#endif
+        }
+
+        int numRows = 0;
+        while (error == 0 && numRows < batchSize) {
+            lastId = tbl->field[0]->val_int();
+            first = false;
+            numRows++;
+
+            if (tbl->field[7]->val_int() == QUEUE_SUCCESS) {
+                char buff[MAX_FIELD_WIDTH], buff2[MAX_FIELD_WIDTH];
+                String dbStr(buff, sizeof(buff), system_charset_info);
+                String tblStr(buff2, sizeof(buff2), system_charset_info);
+                tbl->field[8]->val_str(&dbStr);
+                tbl->field[9]->val_str(&tblStr);
+
+                if (loadDbIntoCache(thd, &tableCache, &dbCache, &dbList, with_i_schema, dbStr.c_ptr())) {
+                    numChanged = -1;
+                    done = true;
+                    break;
+                }
+
+                if (resultTableExists(&tableCache, dbStr.c_ptr(), tblStr.c_ptr()) == false) {
+                    int rowError;
+
+                    mysql_mutex_lock(&LOCK_jobs);
+                    if (wipe == true) {
+                        rowError = tbl->file->ha_delete_row(tbl->record[0]);
+                    } else {
+                        store_record(tbl, record[1]);
+                        tbl->field[7]->store(QUEUE_DELETED, false);
+                        rowError = tbl->file->ha_update_row(tbl->record[1], tbl->record[0]);
+                        if (rowError == HA_ERR_RECORD_IS_THE_SAME)
+                            rowError = 0;
+                    }
+                    mysql_mutex_unlock(&LOCK_jobs);
+
+                    if (rowError) {
+                        tbl->file->print_error(rowError, MYF(0));
+                        fprintf(stderr, "cleanQqueueHistory: error in changing history record: id: %lli error: %i\n",
+                                lastId, rowError);
+                    } else {
+                        numChanged++;
+                    }
+                }
+            }
+
+#if MYSQL_VERSION_ID >= 50601 || (defined(MARIADB_BASE_VERSION) && MYSQL_VERSION_ID >= 50500)
+            error = tbl->file->ha_index_next(tbl->record[0]);
+#else
+            error = tbl->file->index_next(tbl->record[0]);
+#endif
+        }
+
+        if (error == HA_ERR_END_OF_FILE || error == HA_ERR_KEY_NOT_FOUND) {
+            done = true;
+        } else if (error != 0) {
+            tbl->file->print_error(error, MYF(0));
+            numChanged = -1;
+            done = true;
+        }
+
+        tbl->file->ha_index_end();
+
+        //closing the table ends this batch
+        close_sysTbl(thd, tbl, &backup);
+    }
+
+    my_hash_free(&tableCache);
+    my_hash_free(&dbCache);
+    my_hash_free(&dbList);
+
+    return numChanged;
+}
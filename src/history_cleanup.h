@@ -0,0 +1,40 @@
+/* Copyright (c) 2012, 2013, Adrian M. Partl, eScience Group at the
+   Leibniz Institut for Astrophysics, Potsdam
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; version 2 of the License.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA */
+
+/*****************************************************************
+ ********                history_cleanup                   *******
+ *****************************************************************
+ *
+ * functions for removing jobs from the history whose result
+ * tables do not exist anymore
+ *
+ *****************************************************************
+ */
+
+#ifndef __MYSQL_HISTORY_CLEANUP__
+#define __MYSQL_HISTORY_CLEANUP__
+
+#define MYSQL_SERVER 1
+
+#include <sql_class.h>
+
+#ifdef USE_PRAGMA_IMPLEMENTATION
+#pragma implementation
+#endif
+
+longlong cleanQqueueHistory(THD *thd, bool wipe, int batchSize);
+
+#endif
@@ -0,0 +1,1037 @@
+/* Copyright (c) 2012, 2013, Adrian M. Partl, eScience Group at the
+   Leibniz Institut for Astrophysics, Potsdam
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; version 2 of the License.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA */
+
+
+/*****************************************************************
+ ********                     journal                      *******
+ *****************************************************************
+ *
+ * with qqueue_journal set, submitting, starting, preempting and
+ * ending a job does not write the jobs and history tables. the
+ * full row of the job is appended to qqueue.journal in the data
+ * directory instead, and the caller waits until the record is on
+ * disk. one writer thread flushes all records appended in the
+ * meantime with a single fdatasync (group commit), and an applier
+ * thread then brings the tables up to date in batches. the tables
+ * are a view of the journal that lags a few milliseconds behind.
+ *
+ * the dispatcher skips jobs that still have records waiting to be
+ * applied, and anything that writes the row of a job directly
+ * waits for them first. the lsn of the last applied record is
+ * kept in qqueue.journal.applied, records up to it are skipped
+ * when the journal is replayed at startup. it never passes a
+ * record that could not be applied, such records are retried
+ * together with everything after them. a record that still fails
+ * after QQUEUE_JOURNAL_MAX_RETRIES tries is moved to
+ * qqueue.journal.dead, so that it does not hold up the queue. the
+ * journal is emptied whenever all of it has been applied.
+ *
+ * a record consists of
+ *     uint32 length of the body
+ *     uint32 crc32 of the lsn and the body
+ *     uint64 lsn
+ *     body: the type of the record and all columns of the job
+ * replay stops at the first record that is incomplete or does not
+ * match its checksum.
+ *
+ *****************************************************************
+ */
+
+#define MYSQL_SERVER 1
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <zlib.h>
+#include <mysql_version.h>
+#include <sql_class.h>
+#include <mysqld.h>
+#include <hash.h>
+#include "daemon_thd.h"
+#include "sys_tbl.h"
+#include "journal.h"
+#include "event_trace.h"
+
+#ifdef USE_PRAGMA_IMPLEMENTATION
+#pragma implementation
+#endif
+
+#define QQUEUE_JOURNAL_JOB 1                //the job is written to the jobs table
+#define QQUEUE_JOURNAL_HISTORY 2            //the job is moved to the history
+#define QQUEUE_JOURNAL_HEADER 16
+#define QQUEUE_JOURNAL_RETRY_SEC 1          //wait before records that failed are applied again
+#define QQUEUE_JOURNAL_MAX_RETRIES 10       //failed tries before a record goes to the dead letter file
+#define QQUEUE_JOURNAL_WAIT_SEC 30          //longest wait for the records of a job to be applied
+
+my_bool journalMode;
+
+struct journalRecord {
+    journalRecord *next;
+    ulonglong lsn;
+    long long jobId;
+    int type;
+    int retries;                            //times the record could not be written to the tables
+    uchar *buf;                             //header and body
+    size_t len;
+};
+
+//number of records of a job that have not been applied yet
+struct journalBusy {
+    long long id;
+    int count;
+};
+
+mysql_mutex_t LOCK_journal;
+mysql_cond_t COND_journal_write;
+mysql_cond_t COND_journal_synced;
+mysql_cond_t COND_journal_apply;
+mysql_cond_t COND_journal_applied;
+
+static int journalFd = -1;
+static int appliedFd = -1;
+static off_t journalSize = 0;
+static bool journalRunning = false;
+static bool journalFailed = false;
+static bool journalStop = false;
+static bool writerDone = false;
+static bool applying = false;
+static bool applyFailed = false;
+static ulonglong nextLsn = 1;
+static ulonglong syncedLsn = 0;
+static journalRecord *appendFirst = NULL;
+static journalRecord *appendLast = NULL;
+static journalRecord *applyFirst = NULL;
+static journalRecord *applyLast = NULL;
+static HASH busyJobs;
+static pthread_t writerThread;
+static pthread_t applierThread;
+
+static void busyFree(void *record) {
+    my_free(record);
+}
+
+static void putInt(String *buf, longlong value) {
+    char tmp[8];
+    int8store(tmp, value);
+    buf->append(tmp, 8);
+}
+
+//NULL is written as length -1
+static void putString(String *buf, const char *str, size_t len) {
+    if (str == NULL) {
+        putInt(buf, -1);
+        return;
+    }
+
+    putInt(buf, (longlong) len);
+    buf->append(str, len);
+}
+
+static void putString(String *buf, const char *str) {
+    putString(buf, str, str != NULL ? strlen(str) : 0);
+}
+
+static void putTime(String *buf, const MYSQL_TIME *time) {
+    putInt(buf, time->year);
+    putInt(buf, time->month);
+    putInt(buf, time->day);
+    putInt(buf, time->hour);
+    putInt(buf, time->minute);
+    putInt(buf, time->second);
+    putInt(buf, time->second_part);
+    putInt(buf, time->neg);
+    putInt(buf, time->time_type);
+}
+
+static void serializeJob(String *buf, int type, qqueue_jobs_row *job) {
+    putInt(buf, type);
+    putInt(buf, job->id);
+    putInt(buf, job->usrId);
+    putInt(buf, job->usrGroup);
+    putInt(buf, job->queue);
+    putInt(buf, job->priority);
+    putInt(buf, job->effPriority);
+    putInt(buf, job->preemptCount);
+    putInt(buf, job->jobFlags);
+    putInt(buf, job->lastStmt);
+    putInt(buf, job->throttleTime);
+    putInt(buf, job->outputSize);
+    putInt(buf, job->parentJob);
+    putInt(buf, job->subJobs);
+    putInt(buf, job->chunksDone);
+    putInt(buf, job->chunkPos);
+    putInt(buf, job->status);
+    putInt(buf, job->paquFlag);
+    putTime(buf, &job->timeSubmit);
+    putTime(buf, &job->timeExecute);
+    putTime(buf, &job->timeFinish);
+    putString(buf, job->mysqlUserName);
+    putString(buf, job->query);
+    putString(buf, job->actualQuery, job->actualQueryLen);
+    putString(buf, job->resultDBName);
+    putString(buf, job->resultTableName);
+    putString(buf, job->error);
+    putString(buf, job->comment);
+    putString(buf, job->outputFile);
+}
+
+struct journalReader {
+    const uchar *pos;
+    const uchar *end;
+    bool failed;
+};
+
+static longlong getInt(journalReader *reader) {
+    if (reader->failed == true || reader->end - reader->pos < 8) {
+        reader->failed = true;
+        return 0;
+    }
+
+    longlong value = sint8korr(reader->pos);
+    reader->pos += 8;
+
+    return value;
+}
+
+//copies the string into the arena of the job
+static char *getString(journalReader *reader, qqueue_jobs_row *job, size_t *len) {
+    longlong strLen = getInt(reader);
+
+    if (reader->failed == true || strLen < 0)
+        return NULL;
+
+    if (reader->end - reader->pos < strLen) {
+        reader->failed = true;
+        return NULL;
+    }
+
+    char *str = (char *) job->alloc(strLen + 1);
+    if (str == NULL) {
+        reader->failed = true;
+        return NULL;
+    }
+
+    memcpy(str, reader->pos, strLen);
+    str[strLen] = '\0';
+    reader->pos += strLen;
+
+    if (len != NULL)
+        *len = strLen;
+
+    return str;
+}
+
+static void getTime(journalReader *reader, MYSQL_TIME *time) {
+    time->year = (uint) getInt(reader);
+    time->month = (uint) getInt(reader);
+    time->day = (uint) getInt(reader);
+    time->hour = (uint) getInt(reader);
+    time->minute = (uint) getInt(reader);
+    time->second = (uint) getInt(reader);
+    time->second_part = (ulong) getInt(reader);
+    time->neg = (my_bool) getInt(reader);
+    time->time_type = (enum enum_mysql_timestamp_type) getInt(reader);
+}
+
+//returns NULL if the body is damaged
+static qqueue_jobs_row *deserializeJob(const uchar *body, size_t len, int *type) {
+    journalReader reader = {body, body + len, false};
+    qqueue_jobs_row *job = new qqueue_jobs_row();
+
+    *type = (int) getInt(&reader);
+    job->id = getInt(&reader);
+    job->usrId = (int) getInt(&reader);
+    job->usrGroup = (int) getInt(&reader);
+    job->queue = (int) getInt(&reader);
+    job->priority = (int) getInt(&reader);
+    job->effPriority = (int) getInt(&reader);
+    job->preemptCount = (int) getInt(&reader);
+    job->jobFlags = (int) getInt(&reader);
+    job->lastStmt = (int) getInt(&reader);
+    job->throttleTime = getInt(&reader);
+    job->outputSize = getInt(&reader);
+    job->parentJob = getInt(&reader);
+    job->subJobs = (int) getInt(&reader);
+    job->chunksDone = (int) getInt(&reader);
+    job->chunkPos = getInt(&reader);
+    job->status = (enum enum_queue_status) getInt(&reader);
+    job->paquFlag = (my_bool) getInt(&reader);
+    getTime(&reader, &job->timeSubmit);
+    getTime(&reader, &job->timeExecute);
+    getTime(&reader, &job->timeFinish);
+    job->mysqlUserName = getString(&reader, job, NULL);
+    job->query = getString(&reader, job, NULL);
+
+    size_t queryLen = 0;
+    char *actualQuery = getString(&reader, job, &queryLen);
+    job->setActualQuery(actualQuery, queryLen);
+
+    job->resultDBName = getString(&reader, job, NULL);
+    job->resultTableName = getString(&reader, job, NULL);
+    job->error = getString(&reader, job, NULL);
+    job->comment = getString(&reader, job, NULL);
+    job->outputFile = getString(&reader, job, NULL);
+
+    if (reader.failed == true) {
+        delete job;
+        return NULL;
+    }
+
+    return job;
+}
+
+static journalRecord *newRecord(int type, qqueue_jobs_row *job) {
+    String body;
+    serializeJob(&body, type, job);
+
+    journalRecord *record = (journalRecord *) my_malloc(sizeof(journalRecord) + QQUEUE_JOURNAL_HEADER + body.length(),
+                                                        MYF(0));
+    if (record == NULL)
+        return NULL;
+
+    record->next = NULL;
+    record->lsn = 0;
+    record->jobId = job->id;
+    record->type = type;
+    record->retries = 0;
+    record->buf = (uchar *) (record + 1);
+    record->len = QQUEUE_JOURNAL_HEADER + body.length();
+
+    int4store(record->buf, (uint32) body.length());
+    memcpy(record->buf + QQUEUE_JOURNAL_HEADER, body.ptr(), body.length());
+
+    return record;
+}
+
+//the lsn is only known once the record is queued
+static void sealRecord(journalRecord *record, ulonglong lsn) {
+    record->lsn = lsn;
+    int8store(record->buf + 8, lsn);
+    int4store(record->buf + 4, (uint32) crc32(0, (const Bytef *) (record->buf + 8), record->len - 8));
+}
+
+//changes the number of unapplied records of a job, the journal must be locked
+static void busyAdd(long long id, int delta) {
+    journalBusy *busy = (journalBusy *) my_hash_search(&busyJobs, (const uchar *) &id, sizeof(long long));
+
+    if (busy == NULL) {
+        if (delta <= 0)
+            return;
+
+        busy = (journalBusy *) my_malloc(sizeof(journalBusy), MYF(0));
+        if (busy == NULL)
+            return;
+
+        busy->id = id;
+        busy->count = 0;
+
+        if (my_hash_insert(&busyJobs, (uchar *) busy)) {
+            my_free(busy);
+            return;
+        }
+    }
+
+    busy->count += delta;
+
+    if (busy->count <= 0)
+        my_hash_delete(&busyJobs, (uchar *) busy);
+}
+
+static bool isBusy(long long id) {
+    return my_hash_search(&busyJobs, (const uchar *) &id, sizeof(long long)) != NULL;
+}
+
+//records are applied more than once after a crash, so they overwrite whatever is there
+//returns 0 on success, the error of the handler otherwise
+static int upsertJob(qqueue_jobs_row *job, TABLE *tbl) {
+    int error = updateQqueueJobsRow(job, tbl);
+
+    if (error == HA_ERR_KEY_NOT_FOUND || error == HA_ERR_END_OF_FILE)
+        error = addQqueueJobsRow(job, tbl, job->id);
+
+    return error;
+}
+
+//writes the records to the tables in their order. the history rows of the batch go
+//first, so that a job only leaves the jobs table once it is in the history. nothing
+//after a record that could not be written is applied, the applied position must not
+//pass it
+//returns the first record that has not been applied, NULL if all of them have been
+static journalRecord *applyRecords(journalRecord *first) {
+    journalRecord *failed = NULL;
+    bool haveHistory = false;
+
+    for (journalRecord *record = first; record != NULL; record = record->next) {
+        if (record->type == QQUEUE_JOURNAL_HISTORY)
+            haveHistory = true;
+    }
+
+    int error = 0;
+    Open_tables_backup backup;
+    TABLE *tbl;
+
+    if (haveHistory == true) {
+        tbl = open_sysTbl(current_thd, "qqueue_history", strlen("qqueue_history"), &backup, true, &error);
+        if (error || tbl == NULL) {
+            fprintf(stderr, "Query queue - journal ERROR: error in opening history sys table: error: %i\n", error);
+            close_sysTbl(current_thd, tbl, &backup);
+            return first;
+        }
+
+        for (journalRecord *record = first; record != NULL; record = record->next) {
+            if (record->type != QQUEUE_JOURNAL_HISTORY)
+                continue;
+
+            int type;
+            qqueue_jobs_row *job = deserializeJob(record->buf + QQUEUE_JOURNAL_HEADER,
+                                                  record->len - QQUEUE_JOURNAL_HEADER, &type);
+            if (job == NULL)
+                continue;
+
+            error = upsertJob(job, tbl);
+            delete job;
+
+            if (error != 0) {
+                fprintf(stderr, "Query queue - journal ERROR: could not apply record %llu: error: %i\n",
+                        record->lsn, error);
+                record->retries++;
+                failed = record;
+                break;
+            }
+        }
+
+        close_sysTbl(current_thd, tbl, &backup);
+    }
+
+    tbl = open_sysTbl(current_thd, "qqueue_jobs", strlen("qqueue_jobs"), &backup, true, &error);
+    if (error || tbl == NULL) {
+        fprintf(stderr, "Query queue - journal ERROR: error in opening jobs sys table: error: %i\n", error);
+        close_sysTbl(current_thd, tbl, &backup);
+        return first;
+    }
+
+    for (journalRecord *record = first; record != failed; record = record->next) {
+        int type;
+        qqueue_jobs_row *job = deserializeJob(record->buf + QQUEUE_JOURNAL_HEADER,
+                                              record->len - QQUEUE_JOURNAL_HEADER, &type);
+        if (job == NULL) {
+            fprintf(stderr, "Query queue - journal ERROR: record %llu is damaged, skipping it\n", record->lsn);
+            continue;
+        }
+
+        if (type == QQUEUE_JOURNAL_JOB) {
+            error = upsertJob(job, tbl);
+
+            //a pending job is seen by the dispatcher from here on
+            if (error == 0 && job->status == QUEUE_PENDING)
+                traceEvent(QQUEUE_EV_ENQUEUE, job->id, job->preemptCount);
+        } else {
+            //the job is in the history already
+            error = deleteQqueueJobsRow(job->id, tbl);
+            if (error == HA_ERR_KEY_NOT_FOUND || error == HA_ERR_END_OF_FILE)
+                error = 0;
+        }
+
+        delete job;
+
+        if (error != 0) {
+            fprintf(stderr, "Query queue - journal ERROR: could not apply record %llu: error: %i\n",
+                    record->lsn, error);
+            record->retries++;
+            failed = record;
+            break;
+        }
+    }
+
+    close_sysTbl(current_thd, tbl, &backup);
+
+    return failed;
+}
+
+static void storeAppliedLsn(ulonglong lsn) {
+    uchar buf[8];
+    int8store(buf, lsn);
+
+    if (pwrite(appliedFd, buf, sizeof(buf), 0) != sizeof(buf) || fdatasync(appliedFd) != 0)
+        fprintf(stderr, "Query queue - journal ERROR: could not store applied position: %s\n", strerror(errno));
+}
+
+static int writeAll(int fd, const uchar *buf, size_t len) {
+    while (len > 0) {
+        ssize_t written = write(fd, buf, len);
+
+        if (written < 0) {
+            if (errno == EINTR)
+                continue;
+            return 1;
+        }
+
+        buf += written;
+        len -= written;
+    }
+
+    return 0;
+}
+
+//keeps a record that cannot be applied in qqueue.journal.dead, in the format of
+//the journal. the tables do not get the change of the job it holds
+static void deadLetterRecord(journalRecord *record) {
+    char path[FN_REFLEN];
+    snprintf(path, sizeof(path), "%s/%s.dead", mysql_real_data_home, QQUEUE_JOURNAL_FILE);
+
+    fprintf(stderr, "Query queue - journal ERROR: record %llu of job %lli could not be applied %i times, "
+            "it is moved to %s\n", record->lsn, record->jobId, record->retries, path);
+
+    int fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0660);
+    if (fd < 0 || writeAll(fd, record->buf, record->len) != 0 || fdatasync(fd) != 0)
+        fprintf(stderr, "Query queue - journal ERROR: could not write %s: %s, record %llu is lost\n",
+                path, strerror(errno), record->lsn);
+
+    if (fd >= 0)
+        close(fd);
+}
+
+pthread_handler_t journal_writer(void *p) {
+    my_thread_init();
+
+    mysql_mutex_lock(&LOCK_journal);
+
+    while (true) {
+        if (appendFirst == NULL) {
+            //once everything is in the tables, the journal starts from scratch
+            if (applyFirst == NULL && applying == false && applyFailed == false && journalSize > 0) {
+                if (ftruncate(journalFd, 0) == 0)
+                    journalSize = 0;
+                else
+                    fprintf(stderr, "Query queue - journal ERROR: could not truncate journal: %s\n", strerror(errno));
+            }
+
+            if (journalStop == true)
+                break;
+
+            mysql_cond_wait(&COND_journal_write, &LOCK_journal);
+            continue;
+        }
+
+        //everything that has come in since the last flush goes to disk in one go
+        journalRecord *first = appendFirst;
+        journalRecord *last = appendLast;
+        appendFirst = NULL;
+        appendLast = NULL;
+        mysql_mutex_unlock(&LOCK_journal);
+
+        int error = 0;
+        size_t written = 0;
+        for (journalRecord *record = first; record != NULL && error == 0; record = record->next) {
+            if (writeAll(journalFd, record->buf, record->len) != 0)
+                error = errno;
+            written += record->len;
+        }
+
+        if (error == 0 && fdatasync(journalFd) != 0)
+            error = errno;
+
+        mysql_mutex_lock(&LOCK_journal);
+
+        if (error == 0) {
+            journalSize += written;
+            syncedLsn = last->lsn;
+
+            if (applyLast != NULL)
+                applyLast->next = first;
+            else
+                applyFirst = first;
+            applyLast = last;
+
+            mysql_cond_signal(&COND_journal_apply);
+        } else {
+            //the callers write the tables themselves from now on
+            fprintf(stderr, "Query queue - journal ERROR: could not write journal: %s, the journal is switched off\n",
+                    strerror(error));
+            journalFailed = true;
+
+            while (first != NULL) {
+                journalRecord *record = first;
+                first = record->next;
+                busyAdd(record->jobId, -1);
+                my_free(record);
+            }
+
+            mysql_cond_broadcast(&COND_journal_applied);
+        }
+
+        mysql_cond_broadcast(&COND_journal_synced);
+    }
+
+    writerDone = true;
+    mysql_cond_signal(&COND_journal_apply);
+    mysql_mutex_unlock(&LOCK_journal);
+
+    my_thread_end();
+    pthread_exit(0);
+
+    return NULL;
+}
+
+pthread_handler_t journal_applier(void *p) {
+    THD *thd = NULL;
+
+    init_thread(&thd, "Journal applier", true);
+
+    mysql_mutex_lock(&LOCK_journal);
+
+    while (true) {
+        if (applyFirst == NULL) {
+            if (writerDone == true)
+                break;
+
+            thd_proc_info(thd, "Waiting for the journal");
+            mysql_cond_wait(&COND_journal_apply, &LOCK_journal);
+            continue;
+        }
+
+        journalRecord *first = applyFirst;
+        journalRecord *last = applyLast;
+        applyFirst = NULL;
+        applyLast = NULL;
+        applying = true;
+        mysql_mutex_unlock(&LOCK_journal);
+
+        thd_proc_info(thd, "Applying the journal");
+
+        journalRecord *failed = applyRecords(first);
+
+        //a record that keeps failing does not hold up everything behind it, it is
+        //set aside and the applied position moves past it
+        bool deadLetter = false;
+        if (failed != NULL && failed->retries >= QQUEUE_JOURNAL_MAX_RETRIES) {
+            deadLetterRecord(failed);
+            failed = failed->next;
+            deadLetter = true;
+        }
+
+        journalRecord *lastApplied = NULL;
+        for (journalRecord *record = first; record != failed; record = record->next)
+            lastApplied = record;
+
+        if (lastApplied != NULL)
+            storeAppliedLsn(lastApplied->lsn);
+
+        mysql_mutex_lock(&LOCK_journal);
+
+        while (first != failed) {
+            journalRecord *record = first;
+            first = record->next;
+            busyAdd(record->jobId, -1);
+            my_free(record);
+        }
+
+        //the records from the failed one on go back to the front of the queue and are
+        //tried again. their jobs stay busy, so nothing overwrites them in the meantime
+        applyFailed = failed != NULL;
+        if (failed != NULL) {
+            last->next = applyFirst;
+            if (applyFirst == NULL)
+                applyLast = last;
+            applyFirst = failed;
+        }
+
+        applying = false;
+        mysql_cond_broadcast(&COND_journal_applied);
+        mysql_cond_signal(&COND_journal_write);
+
+        if (failed != NULL) {
+            //on shutdown the records are left in the journal for the next start
+            if (writerDone == true) {
+                fprintf(stderr, "Query queue - journal ERROR: records from lsn %llu on could not be applied, "
+                        "they are replayed at the next start\n", failed->lsn);
+
+                while (applyFirst != NULL) {
+                    journalRecord *record = applyFirst;
+                    applyFirst = record->next;
+                    busyAdd(record->jobId, -1);
+                    my_free(record);
+                }
+                applyLast = NULL;
+                mysql_cond_broadcast(&COND_journal_applied);
+                continue;
+            }
+
+            //the records behind a dead letter are tried right away
+            if (deadLetter == true)
+                continue;
+
+            thd_proc_info(thd, "Waiting to retry the journal");
+
+            struct timespec deltaTime = {0, 0};
+            deltaTime.tv_sec = time(NULL) + QQUEUE_JOURNAL_RETRY_SEC;
+            mysql_cond_timedwait(&COND_journal_apply, &LOCK_journal, &deltaTime);
+        }
+    }
+
+    mysql_mutex_unlock(&LOCK_journal);
+
+    deinit_thread(&thd);
+    my_thread_end();
+    pthread_exit(0);
+
+    return NULL;
+}
+
+//applies the records of the journal that are newer than the applied position
+//returns 0 on success, 1 if the journal could not be read or applied
+static int replayJournal(const char *path, ulonglong appliedLsn, ulonglong *lastLsn) {
+    *lastLsn = appliedLsn;
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return errno == ENOENT ? 0 : 1;
+
+    struct stat fileStat;
+    if (fstat(fd, &fileStat) != 0) {
+        close(fd);
+        return 1;
+    }
+
+    size_t size = fileStat.st_size;
+    if (size == 0) {
+        close(fd);
+        return 0;
+    }
+
+    uchar *data = (uchar *) my_malloc(size, MYF(0));
+    if (data == NULL) {
+        close(fd);
+        return 1;
+    }
+
+    size_t done = 0;
+    while (done < size) {
+        ssize_t bytes = read(fd, data + done, size - done);
+        if (bytes < 0 && errno == EINTR)
+            continue;
+        if (bytes <= 0)
+            break;
+        done += bytes;
+    }
+    close(fd);
+    size = done;
+
+    journalRecord *first = NULL;
+    journalRecord *last = NULL;
+    int numRecords = 0;
+    size_t pos = 0;
+
+    while (pos + QQUEUE_JOURNAL_HEADER <= size) {
+        size_t len = uint4korr(data + pos);
+        uint32 crc = uint4korr(data + pos + 4);
+        ulonglong lsn = uint8korr(data + pos + 8);
+
+        if (len > size - pos - QQUEUE_JOURNAL_HEADER ||
+            crc != (uint32) crc32(0, (const Bytef *) (data + pos + 8), len + 8)) {
+            fprintf(stderr, "Query queue - journal: replay stops at incomplete record at offset %lu\n", (ulong) pos);
+            break;
+        }
+
+        if (lsn > appliedLsn) {
+            journalRecord *record = (journalRecord *) my_malloc(sizeof(journalRecord), MYF(0));
+            if (record == NULL)
+                break;
+
+            record->next = NULL;
+            record->lsn = lsn;
+            record->jobId = 0;
+            record->type = (int) sint8korr(data + pos + QQUEUE_JOURNAL_HEADER);
+            record->retries = 0;
+            record->buf = data + pos;
+            record->len = QQUEUE_JOURNAL_HEADER + len;
+
+            if (last != NULL)
+                last->next = record;
+            else
+                first = record;
+            last = record;
+
+            numRecords++;
+            *lastLsn = lsn;
+        }
+
+        pos += QQUEUE_JOURNAL_HEADER + len;
+    }
+
+    int result = 0;
+    if (first != NULL) {
+        fprintf(stderr, "Query queue - journal: replaying %i records\n", numRecords);
+
+        journalRecord *failed = applyRecords(first);
+
+        journalRecord *lastApplied = NULL;
+        for (journalRecord *record = first; record != failed; record = record->next)
+            lastApplied = record;
+
+        if (lastApplied != NULL)
+            storeAppliedLsn(lastApplied->lsn);
+
+        result = failed != NULL ? 1 : 0;
+    }
+
+    while (first != NULL) {
+        journalRecord *record = first;
+        first = record->next;
+        my_free(record);
+    }
+    my_free(data);
+
+    return result;
+}
+
+//replays what the last run left in the journal and starts the writer and the
+//applier. called by the daemon before it looks at the jobs table
+int startJournal() {
+    char path[FN_REFLEN];
+    char appliedPath[FN_REFLEN];
+    pthread_attr_t attr;
+
+    if (journalMode == false || journalRunning == true)
+        return 0;
+
+    snprintf(path, sizeof(path), "%s/%s", mysql_real_data_home, QQUEUE_JOURNAL_FILE);
+    snprintf(appliedPath, sizeof(appliedPath), "%s/%s.applied", mysql_real_data_home, QQUEUE_JOURNAL_FILE);
+
+    appliedFd = open(appliedPath, O_RDWR | O_CREAT, 0660);
+    if (appliedFd < 0) {
+        fprintf(stderr, "Query queue - journal ERROR: could not open %s: %s\n", appliedPath, strerror(errno));
+        return 1;
+    }
+
+    uchar buf[8];
+    ulonglong appliedLsn = 0;
+    if (pread(appliedFd, buf, sizeof(buf), 0) == sizeof(buf))
+        appliedLsn = uint8korr(buf);
+
+    //a journal that cannot be applied is kept aside, the tables are written directly
+    ulonglong lastLsn;
+    if (replayJournal(path, appliedLsn, &lastLsn) != 0) {
+        char failedPath[FN_REFLEN];
+        snprintf(failedPath, sizeof(failedPath), "%s.failed", path);
+        rename(path, failedPath);
+        fprintf(stderr, "Query queue - journal ERROR: could not replay the journal, it has been moved to %s\n",
+                failedPath);
+        close(appliedFd);
+        appliedFd = -1;
+        return 1;
+    }
+
+    journalFd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0660);
+    if (journalFd < 0 || ftruncate(journalFd, 0) != 0) {
+        fprintf(stderr, "Query queue - journal ERROR: could not open %s: %s\n", path, strerror(errno));
+        if (journalFd >= 0)
+            close(journalFd);
+        close(appliedFd);
+        journalFd = -1;
+        appliedFd = -1;
+        return 1;
+    }
+
+    if (my_hash_init(&busyJobs, &my_charset_bin, 256, offsetof(journalBusy, id), sizeof(long long),
+                     0, busyFree, 0)) {
+        fprintf(stderr, "Query queue - journal ERROR: unable to allocate enough memory\n");
+        close(journalFd);
+        close(appliedFd);
+        journalFd = -1;
+        appliedFd = -1;
+        return 1;
+    }
+
+    mysql_mutex_init(0, &LOCK_journal, MY_MUTEX_INIT_FAST);
+    mysql_cond_init(0, &COND_journal_write, NULL);
+    mysql_cond_init(0, &COND_journal_synced, NULL);
+    mysql_cond_init(0, &COND_journal_apply, NULL);
+    mysql_cond_init(0, &COND_journal_applied, NULL);
+
+    journalSize = 0;
+    journalFailed = false;
+    journalStop = false;
+    writerDone = false;
+    applying = false;
+    applyFailed = false;
+    nextLsn = lastLsn + 1;
+    syncedLsn = lastLsn;
+
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_JOINABLE);
+    if (pthread_create(&writerThread, &attr, journal_writer, NULL) != 0) {
+        fprintf(stderr, "Query queue - journal ERROR: Could not create thread!\n");
+        pthread_attr_destroy(&attr);
+        my_hash_free(&busyJobs);
+        close(journalFd);
+        close(appliedFd);
+        journalFd = -1;
+        appliedFd = -1;
+        return 1;
+    }
+
+    if (pthread_create(&applierThread, &attr, journal_applier, NULL) != 0) {
+        fprintf(stderr, "Query queue - journal ERROR: Could not create thread!\n");
+        mysql_mutex_lock(&LOCK_journal);
+        journalStop = true;
+        mysql_cond_signal(&COND_journal_write);
+        mysql_mutex_unlock(&LOCK_journal);
+        pthread_join(writerThread, NULL);
+        pthread_attr_destroy(&attr);
+        my_hash_free(&busyJobs);
+        close(journalFd);
+        close(appliedFd);
+        journalFd = -1;
+        appliedFd = -1;
+        return 1;
+    }
+    pthread_attr_destroy(&attr);
+
+    journalRunning = true;
+
+    fprintf(stderr, "Query queue - journal: started at lsn %llu\n", nextLsn);
+
+    return 0;
+}
+
+//everything journaled so far is written and applied before the threads exit
+void stopJournal() {
+    if (journalRunning == false)
+        return;
+
+    mysql_mutex_lock(&LOCK_journal);
+    journalStop = true;
+    mysql_cond_signal(&COND_journal_write);
+    mysql_mutex_unlock(&LOCK_journal);
+
+    pthread_join(writerThread, NULL);
+    pthread_join(applierThread, NULL);
+
+    journalRunning = false;
+
+    close(journalFd);
+    close(appliedFd);
+    journalFd = -1;
+    appliedFd = -1;
+
+    my_hash_free(&busyJobs);
+    mysql_cond_destroy(&COND_journal_applied);
+    mysql_cond_destroy(&COND_journal_apply);
+    mysql_cond_destroy(&COND_journal_synced);
+    mysql_cond_destroy(&COND_journal_write);
+    mysql_mutex_destroy(&LOCK_journal);
+}
+
+//waits until the tables show the latest state of the job, but not longer than
+//QQUEUE_JOURNAL_WAIT_SEC. the journal must be locked
+//returns 0 once the records of the job are applied, 1 if the wait timed out
+static int waitApplied(long long id) {
+    struct timespec deltaTime = {0, 0};
+    deltaTime.tv_sec = time(NULL) + QQUEUE_JOURNAL_WAIT_SEC;
+
+    while (isBusy(id) == true) {
+        if (mysql_cond_timedwait(&COND_journal_applied, &LOCK_journal, &deltaTime) != 0 && isBusy(id) == true) {
+            fprintf(stderr, "Query queue - journal ERROR: records of job %lli are not applied after %i seconds, "
+                    "going on without them\n", id, QQUEUE_JOURNAL_WAIT_SEC);
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+//queues a record and waits until it is on disk
+//returns 0 if the record is in the journal, 1 if the caller has to write the table itself
+static int appendRecord(int type, qqueue_jobs_row *job) {
+    if (journalMode == false || journalRunning == false)
+        return 1;
+
+    journalRecord *record = newRecord(type, job);
+    if (record == NULL)
+        return 1;
+
+    mysql_mutex_lock(&LOCK_journal);
+
+    int result = 1;
+    if (journalFailed == false && journalStop == false) {
+        sealRecord(record, nextLsn++);
+
+        if (appendLast != NULL)
+            appendLast->next = record;
+        else
+            appendFirst = record;
+        appendLast = record;
+
+        busyAdd(job->id, 1);
+        mysql_cond_signal(&COND_journal_write);
+
+        ulonglong lsn = record->lsn;
+        while (syncedLsn < lsn && journalFailed == false)
+            mysql_cond_wait(&COND_journal_synced, &LOCK_journal);
+
+        result = syncedLsn >= lsn ? 0 : 1;
+    } else {
+        my_free(record);
+    }
+
+    //older records must not overwrite what the caller writes now
+    if (result != 0)
+        waitApplied(job->id);
+
+    mysql_mutex_unlock(&LOCK_journal);
+
+    return result;
+}
+
+//the job is written to the jobs table
+int journalJob(qqueue_jobs_row *job) {
+    return appendRecord(QQUEUE_JOURNAL_JOB, job);
+}
+
+//the job is moved from the jobs table to the history
+int journalHistory(qqueue_jobs_row *job) {
+    return appendRecord(QQUEUE_JOURNAL_HISTORY, job);
+}
+
+//whether the tables do not show the latest state of the job yet
+bool journalJobBusy(long long id) {
+    if (journalRunning == false)
+        return false;
+
+    mysql_mutex_lock(&LOCK_journal);
+    bool busy = isBusy(id);
+    mysql_mutex_unlock(&LOCK_journal);
+
+    return busy;
+}
+
+//waits until the tables show the latest state of the job
+//returns 0 if they do, 1 if the records of the job could not be applied in time
+int journalWaitApplied(long long id) {
+    if (journalRunning == false)
+        return 0;
+
+    mysql_mutex_lock(&LOCK_journal);
+    int result = waitApplied(id);
+    mysql_mutex_unlock(&LOCK_journal);
+
+    return result;
+}
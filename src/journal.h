@@ -0,0 +1,54 @@
+/* Copyright (c) 2012, 2013, Adrian M. Partl, eScience Group at the
+   Leibniz Institut for Astrophysics, Potsdam
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; version 2 of the License.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA */
+
+
+/*****************************************************************
+ ********                     journal                      *******
+ *****************************************************************
+ *
+ * append-only journal of the job state changes on the hot path,
+ * flushed with group commit. the jobs and history tables are
+ * brought up to date from it in the background
+ *
+ *****************************************************************
+ */
+
+#ifndef __MYSQL_JOURNAL__
+#define __MYSQL_JOURNAL__
+
+#define MYSQL_SERVER 1
+
+#include <sql_class.h>
+#include "sys_tbl.h"
+
+#ifdef USE_PRAGMA_IMPLEMENTATION
+#pragma implementation
+#endif
+
+#define QQUEUE_JOURNAL_FILE "qqueue.journal"
+
+extern my_bool journalMode;
+
+int startJournal();
+void stopJournal();
+
+int journalJob(qqueue_jobs_row *job);
+int journalHistory(qqueue_jobs_row *job);
+
+bool journalJobBusy(long long id);
+int journalWaitApplied(long long id);
+
+#endif
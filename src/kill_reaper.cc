@@ -0,0 +1,313 @@
+/* Copyright (c) 2012, 2013, Adrian M. Partl, eScience Group at the
+   Leibniz Institut for Astrophysics, Potsdam
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; version 2 of the License.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA */
+
+/*****************************************************************
+ ********                   kill_reaper                    *******
+ *****************************************************************
+ *
+ * thread delivering the kills of the queue to the job workers,
+ * escalating them and releasing the slots of stuck workers
+ *
+ *****************************************************************
+ */
+
+#define MYSQL_SERVER 1
+
+#include <stdio.h>
+#include <mysql_version.h>
+#include <sql_class.h>
+#include <mysql/plugin.h>
+#include "daemon_thd.h"
+#include "exec_query.h"
+#include "query_queue.h"
+#include "kill_reaper.h"
+#include "event_trace.h"
+
+#ifdef USE_PRAGMA_IMPLEMENTATION
+#pragma implementation
+#endif
+
+long killGrace;
+long maxZombies;
+
+static long killRequests = 0;
+static long killEscalations = 0;
+static long killExits = 0;
+static long long killLatencyTotal = 0;
+static long long killLatencyMax = 0;
+static long long killLatencyLast = 0;
+static long numZombies = 0;
+static long numZombiesReleased = 0;
+
+SHOW_VAR qqueue_kill_status[] = {
+    {"Qqueue_kill_requests", (char *) &killRequests, SHOW_LONG},
+    {"Qqueue_kill_escalations", (char *) &killEscalations, SHOW_LONG},
+    {"Qqueue_kill_exits", (char *) &killExits, SHOW_LONG},
+    {"Qqueue_kill_latency_total_ms", (char *) &killLatencyTotal, SHOW_LONGLONG},
+    {"Qqueue_kill_latency_max_ms", (char *) &killLatencyMax, SHOW_LONGLONG},
+    {"Qqueue_kill_latency_last_ms", (char *) &killLatencyLast, SHOW_LONGLONG},
+    {"Qqueue_zombies", (char *) &numZombies, SHOW_LONG},
+    {"Qqueue_zombies_released", (char *) &numZombiesReleased, SHOW_LONG},
+    {0, 0, SHOW_UNDEF}
+};
+
+mysql_mutex_t LOCK_reaper;
+mysql_cond_t COND_reaper;
+static pthread_t reaper_thread;
+static bool reaperInitialised = false;
+static bool reaperStop = false;
+
+//jobs that are being killed. the lock of the reaper keeps the worker from
+//tearing down its THD while it is signalled
+static jobWorkerThd *killList = NULL;
+
+static ulonglong reaperNow() {
+#if defined(MARIADB_BASE_VERSION) && MYSQL_VERSION_ID >= 50500
+    return microsecond_interval_timer();
+#else
+    return my_micro_time();
+#endif
+}
+
+//signals the THD of the worker directly instead of looking it up in the thread list
+static void signalJob(jobWorkerThd *job, bool killConnection) {
+    THD *thd = job->thd;
+
+    traceEvent(QQUEUE_EV_SIGNAL, job->job->id, killConnection ? 1 : 0);
+
+    mysql_mutex_lock(&thd->LOCK_thd_data);
+#if defined(MARIADB_BASE_VERSION) && MYSQL_VERSION_ID >= 50500
+    thd->awake(killConnection ? KILL_CONNECTION : KILL_QUERY);
+#else
+    thd->awake(killConnection ? THD::KILL_CONNECTION : THD::KILL_QUERY);
+#endif
+    mysql_mutex_unlock(&thd->LOCK_thd_data);
+}
+
+static void unlinkJob(jobWorkerThd *job) {
+    if (job->killPrev != NULL)
+        job->killPrev->killNext = job->killNext;
+    else
+        killList = job->killNext;
+
+    if (job->killNext != NULL)
+        job->killNext->killPrev = job->killPrev;
+
+    job->killPrev = NULL;
+    job->killNext = NULL;
+}
+
+//one round of the reaper. kills are sent as KILL QUERY first, after qqueue_killGrace
+//seconds as KILL CONNECTION. a worker that still has not returned after another
+//qqueue_killGrace seconds is a zombie and gets its slot released as long as there
+//are less than qqueue_maxZombies of them. needs to be called with the reaper locked
+static void reapJobs() {
+    ulonglong now = reaperNow();
+    ulonglong grace = (ulonglong) killGrace * 1000000ULL;
+
+    for (jobWorkerThd *job = killList; job != NULL; job = job->killNext) {
+        //the worker has not set up its THD yet, it will see the kill when it does
+        if (job->thdAttached == false)
+            continue;
+
+        switch (job->killState) {
+            case QQUEUE_KILL_REQUESTED:
+                signalJob(job, false);
+                job->killState = QQUEUE_KILL_QUERY;
+                break;
+            case QQUEUE_KILL_QUERY:
+                if (now - job->killStart >= grace) {
+                    signalJob(job, true);
+                    job->killState = QQUEUE_KILL_CONNECTION;
+                    killEscalations++;
+                }
+                break;
+            case QQUEUE_KILL_CONNECTION:
+                if (now - job->killStart >= 2 * grace) {
+                    fprintf(stderr, "Query queue reaper: job %lli does not react to KILL CONNECTION\n",
+                            job->job->id);
+                    job->killState = QQUEUE_KILL_ZOMBIE;
+                    numZombies++;
+                    if (job->slotReleased == true)
+                        numZombiesReleased++;
+                }
+                break;
+            default:
+                break;
+        }
+
+        if (job->killState == QQUEUE_KILL_ZOMBIE && job->slotReleased == false &&
+                numZombiesReleased < maxZombies) {
+            fprintf(stderr, "Query queue reaper: releasing the slot of job %lli\n", job->job->id);
+            job->slotReleased = true;
+            numZombiesReleased++;
+
+            releaseJobSlot(job);
+        }
+    }
+}
+
+pthread_handler_t kill_reaper(void *p) {
+    THD *thd = NULL;
+    struct timespec deltaTime = {0, 0};
+
+    init_thread(&thd, "Kill reaper", true);
+
+    mysql_mutex_lock(&LOCK_reaper);
+
+    while (reaperStop == false) {
+        reapJobs();
+
+        deltaTime.tv_sec = time(NULL) + 1;
+        mysql_cond_timedwait(&COND_reaper, &LOCK_reaper, &deltaTime);
+    }
+
+    mysql_mutex_unlock(&LOCK_reaper);
+
+    deinit_thread(&thd);
+    my_thread_end();
+    pthread_exit(0);
+
+    return NULL;
+}
+
+int startKillReaper() {
+    pthread_attr_t attr;
+
+    if (reaperInitialised == true)
+        return 0;
+
+    mysql_mutex_init(0, &LOCK_reaper, MY_MUTEX_INIT_FAST);
+    mysql_cond_init(0, &COND_reaper, NULL);
+    reaperStop = false;
+
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_JOINABLE);
+    if (pthread_create(&reaper_thread, &attr, kill_reaper, NULL) != 0) {
+        fprintf(stderr, "Query queue - kill reaper ERROR: Could not create thread!\n");
+        pthread_attr_destroy(&attr);
+        mysql_cond_destroy(&COND_reaper);
+        mysql_mutex_destroy(&LOCK_reaper);
+        return 1;
+    }
+    pthread_attr_destroy(&attr);
+
+    reaperInitialised = true;
+
+    return 0;
+}
+
+void stopKillReaper() {
+    if (reaperInitialised == false)
+        return;
+
+    mysql_mutex_lock(&LOCK_reaper);
+    reaperStop = true;
+    mysql_cond_signal(&COND_reaper);
+    mysql_mutex_unlock(&LOCK_reaper);
+
+    pthread_join(reaper_thread, NULL);
+
+    mysql_cond_destroy(&COND_reaper);
+    mysql_mutex_destroy(&LOCK_reaper);
+
+    reaperInitialised = false;
+}
+
+//hands a running job to the reaper. if the queue of the job does not wait for its
+//workers to exit, the slot is given to the next job right away. returns 1 if the
+//job is already being killed
+int reaperKillJob(jobWorkerThd *job, bool waitForExit) {
+    mysql_mutex_lock(&LOCK_reaper);
+
+    if (job->killState != QQUEUE_KILL_NONE) {
+        mysql_mutex_unlock(&LOCK_reaper);
+        return 1;
+    }
+
+    job->killState = QQUEUE_KILL_REQUESTED;
+    job->killStart = reaperNow();
+    job->killPrev = NULL;
+    job->killNext = killList;
+    if (killList != NULL)
+        killList->killPrev = job;
+    killList = job;
+
+    killRequests++;
+
+    if (waitForExit == false) {
+        //start a new job before this one is actually properly killed
+        job->slotReleased = true;
+        releaseJobSlot(job);
+    }
+
+    mysql_cond_signal(&COND_reaper);
+    mysql_mutex_unlock(&LOCK_reaper);
+
+    return 0;
+}
+
+//called by the worker once its THD exists. a kill that came in before is
+//delivered right away, so that the job does not start at all
+void reaperAttachThd(jobWorkerThd *job) {
+    mysql_mutex_lock(&LOCK_reaper);
+
+    job->thdAttached = true;
+
+    if (job->killState == QQUEUE_KILL_REQUESTED) {
+        signalJob(job, false);
+        job->killState = QQUEUE_KILL_QUERY;
+    }
+
+    mysql_mutex_unlock(&LOCK_reaper);
+}
+
+//called by the worker when the job has returned. after this the reaper does not
+//touch the THD anymore. returns true if the slot of the job has already been given
+//to another job
+bool reaperJobExited(jobWorkerThd *job) {
+    bool slotReleased;
+
+    mysql_mutex_lock(&LOCK_reaper);
+
+    job->thdAttached = false;
+    slotReleased = job->slotReleased;
+
+    if (job->killState != QQUEUE_KILL_NONE) {
+        ulonglong waited = reaperNow() - job->killStart;
+        long long latency = (long long) waited / 1000;
+
+        traceEvent(QQUEUE_EV_EXIT, job->job->id, (long long) waited);
+
+        killExits++;
+        killLatencyLast = latency;
+        killLatencyTotal += latency;
+        if (latency > killLatencyMax)
+            killLatencyMax = latency;
+
+        if (job->killState == QQUEUE_KILL_ZOMBIE) {
+            numZombies--;
+            if (slotReleased == true)
+                numZombiesReleased--;
+        }
+
+        unlinkJob(job);
+    }
+
+    mysql_mutex_unlock(&LOCK_reaper);
+
+    return slotReleased;
+}
@@ -0,0 +1,51 @@
+/* Copyright (c) 2012, 2013, Adrian M. Partl, eScience Group at the
+   Leibniz Institut for Astrophysics, Potsdam
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; version 2 of the License.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA */
+
+/*****************************************************************
+ ********                   kill_reaper                    *******
+ *****************************************************************
+ *
+ * thread delivering the kills of the queue to the job workers,
+ * escalating them and releasing the slots of stuck workers
+ *
+ *****************************************************************
+ */
+
+#ifndef __MYSQL_KILL_REAPER__
+#define __MYSQL_KILL_REAPER__
+
+#define MYSQL_SERVER 1
+
+#include <sql_class.h>
+#include <mysql/plugin.h>
+#include "exec_query.h"
+
+#ifdef USE_PRAGMA_IMPLEMENTATION
+#pragma implementation
+#endif
+
+extern long killGrace;
+extern long maxZombies;
+extern SHOW_VAR qqueue_kill_status[];
+
+int startKillReaper();
+void stopKillReaper();
+
+int reaperKillJob(jobWorkerThd *job, bool waitForExit);
+void reaperAttachThd(jobWorkerThd *job);
+bool reaperJobExited(jobWorkerThd *job);
+
+#endif
@@ -0,0 +1,238 @@
+/* Copyright (c) 2012, 2013, Adrian M. Partl, eScience Group at the
+   Leibniz Institut for Astrophysics, Potsdam
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; version 2 of the License.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA */
+
+/*****************************************************************
+ ********                     pk_range                     *******
+ *****************************************************************
+ *
+ * primary key ranges of tables, used to split the work on a
+ * table into chunks
+ *
+ * only tables with a primary key on a single integer column are
+ * split. the ranges are computed on the key values, not on the
+ * rows, so gaps in the keys make for uneven chunks.
+ *
+ *****************************************************************
+ */
+
+#define MYSQL_SERVER 1
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sql_class.h>
+#include "exec_query.h"
+#include "result_sink.h"
+#include "pk_range.h"
+
+#ifdef USE_PRAGMA_IMPLEMENTATION
+#pragma implementation
+#endif
+
+//`name` with backticks doubled
+void quoteName(const char *name, char *out) {
+    *out++ = '`';
+    for (; *name != '\0'; name++) {
+        if (*name == '`')
+            *out++ = '`';
+        *out++ = *name;
+    }
+    *out++ = '`';
+    *out = '\0';
+}
+
+//'string' with quotes and backslashes escaped
+void quoteString(const char *str, char *out) {
+    *out++ = '\'';
+    for (; *str != '\0'; str++) {
+        if (*str == '\'' || *str == '\\')
+            *out++ = '\\';
+        *out++ = *str;
+    }
+    *out++ = '\'';
+    *out = '\0';
+}
+
+//splits a [db.]table name as written in a query, taking off the backticks
+//returns 0 on success, 1 if a part is too long
+int splitTableName(const char *name, size_t len, const char *defaultDb, char *db, char *table) {
+    char parts[2][NAME_LEN + 1];
+    int numParts = 0;
+    const char *end = name + len;
+
+    while (name < end && numParts < 2) {
+        size_t partLen = 0;
+
+        if (*name == '`') {
+            name++;
+            while (name < end && *name != '`') {
+                if (partLen >= NAME_LEN)
+                    return 1;
+                parts[numParts][partLen++] = *name++;
+            }
+            name++;
+        } else {
+            while (name < end && *name != '.') {
+                if (partLen >= NAME_LEN)
+                    return 1;
+                parts[numParts][partLen++] = *name++;
+            }
+        }
+
+        parts[numParts++][partLen] = '\0';
+
+        if (name < end && *name == '.')
+            name++;
+    }
+
+    if (numParts == 2) {
+        strcpy(db, parts[0]);
+        strcpy(table, parts[1]);
+    } else {
+        if (defaultDb == NULL)
+            return 1;
+        strmake(db, defaultDb, NAME_LEN);
+        strcpy(table, parts[0]);
+    }
+
+    return 0;
+}
+
+//runs an internal query and keeps the first row of its result
+static int queryValues(THD *thd, const char *query, qqueue_value_sink *sink) {
+    char *queryError = NULL;
+    Protocol *protocol = thd->protocol;
+
+    thd->protocol = sink;
+    int error = execSimpleQuery(thd, query, &queryError);
+    thd->protocol = protocol;
+
+    if (error != 0) {
+        fprintf(stderr, "Query queue: %s: %s\n", query, queryError != NULL ? queryError : "");
+        if (queryError != NULL)
+            my_free(queryError);
+        return 1;
+    }
+
+    return 0;
+}
+
+//the number of rows the storage engine reports for a table, -1 if unknown
+longlong getTableRows(THD *thd, const char *db, const char *table) {
+    char quotedDb[QQUEUE_QUOTED_LEN(NAME_LEN)];
+    char quotedTable[QQUEUE_QUOTED_LEN(NAME_LEN)];
+    char query[2 * QQUEUE_QUOTED_LEN(NAME_LEN) + 128];
+
+    quoteString(db, quotedDb);
+    quoteString(table, quotedTable);
+    snprintf(query, sizeof(query), "SELECT TABLE_ROWS FROM information_schema.TABLES "
+             "WHERE TABLE_SCHEMA = %s AND TABLE_NAME = %s", quotedDb, quotedTable);
+
+    qqueue_value_sink rowsSink(thd);
+    if (queryValues(thd, query, &rowsSink) != 0 || rowsSink.numRows != 1 || rowsSink.isNull[0])
+        return -1;
+
+    return strtoll(rowsSink.values[0].c_ptr_safe(), NULL, 10);
+}
+
+//looks for a primary key on a single integer column and its range
+//returns 0 on success, 1 if the table has no such key or is empty
+int getPkRange(THD *thd, const char *db, const char *table, qqueue_pk_range *range) {
+    char quotedDb[QQUEUE_QUOTED_LEN(NAME_LEN)];
+    char quotedTable[QQUEUE_QUOTED_LEN(NAME_LEN)];
+    char quotedPk[QQUEUE_QUOTED_LEN(NAME_LEN)];
+    char query[4 * QQUEUE_QUOTED_LEN(NAME_LEN) + 256];
+
+    strmake(range->db, db, NAME_LEN);
+    strmake(range->table, table, NAME_LEN);
+    range->pkName[0] = '\0';
+
+    quoteString(db, quotedDb);
+    quoteString(table, quotedTable);
+    snprintf(query, sizeof(query), "SELECT COLUMN_NAME, DATA_TYPE FROM information_schema.COLUMNS "
+             "WHERE TABLE_SCHEMA = %s AND TABLE_NAME = %s AND COLUMN_KEY = 'PRI'", quotedDb, quotedTable);
+
+    qqueue_value_sink keySink(thd);
+    if (queryValues(thd, query, &keySink) != 0 || keySink.numRows != 1 || keySink.isNull[0])
+        return 1;
+
+    const char *type = keySink.values[1].c_ptr_safe();
+    if (strcmp(type, "tinyint") != 0 && strcmp(type, "smallint") != 0 && strcmp(type, "mediumint") != 0 &&
+        strcmp(type, "int") != 0 && strcmp(type, "bigint") != 0)
+        return 1;
+
+    strmake(range->pkName, keySink.values[0].c_ptr_safe(), NAME_LEN);
+    quoteName(range->pkName, quotedPk);
+    quoteName(db, quotedDb);
+    quoteName(table, quotedTable);
+    snprintf(query, sizeof(query), "SELECT MIN(%s), MAX(%s) FROM %s.%s", quotedPk, quotedPk, quotedDb, quotedTable);
+
+    qqueue_value_sink rangeSink(thd);
+    if (queryValues(thd, query, &rangeSink) != 0 || rangeSink.numRows != 1 ||
+        rangeSink.isNull[0] || rangeSink.isNull[1]) {
+        range->pkName[0] = '\0';
+        return 1;
+    }
+
+    range->minPk = strtoll(rangeSink.values[0].c_ptr_safe(), NULL, 10);
+    range->maxPk = strtoll(rangeSink.values[1].c_ptr_safe(), NULL, 10);
+
+    return 0;
+}
+
+//number of chunks a range is split into: at most maxChunks, with at least
+//minKeys keys in each
+int pkRangeChunks(qqueue_pk_range *range, longlong maxChunks, longlong minKeys) {
+    //the number of keys overflows to 0 if the range spans all of bigint
+    ulonglong keys = (ulonglong) (range->maxPk - range->minPk) + 1;
+    ulonglong chunks = keys == 0 ? ~0ULL : keys;
+
+    if (minKeys > 1)
+        chunks = keys == 0 ? ~0ULL / minKeys : keys / minKeys;
+    if (chunks > (ulonglong) maxChunks)
+        chunks = maxChunks;
+    if (chunks > INT_MAX)
+        chunks = INT_MAX;
+
+    return chunks < 1 ? 1 : (int) chunks;
+}
+
+//the keys of a chunk are from <= key < to, the last chunk has no upper end. the
+//ranges are computed on the offset to the smallest key, so that they can span
+//all of bigint
+void pkRangeChunk(qqueue_pk_range *range, int numChunks, int chunk, longlong *from, longlong *to, bool *last) {
+    ulonglong span = (ulonglong) (range->maxPk - range->minPk) / numChunks + 1;
+
+    *from = (longlong) ((ulonglong) range->minPk + span * chunk);
+    *to = (longlong) ((ulonglong) *from + span);
+    *last = chunk == numChunks - 1;
+}
+
+//writes the condition selecting the keys of a chunk
+//returns 0 on success, 1 if the buffer is too small
+int pkRangeCondition(qqueue_pk_range *range, longlong from, longlong to, bool last, char *cond, size_t len) {
+    char quotedPk[QQUEUE_QUOTED_LEN(NAME_LEN)];
+    size_t written;
+
+    quoteName(range->pkName, quotedPk);
+
+    if (last == true)
+        written = snprintf(cond, len, "%s >= %lli", quotedPk, from);
+    else
+        written = snprintf(cond, len, "%s >= %lli AND %s < %lli", quotedPk, from, quotedPk, to);
+
+    return written >= len ? 1 : 0;
+}
@@ -0,0 +1,59 @@
+/* Copyright (c) 2012, 2013, Adrian M. Partl, eScience Group at the
+   Leibniz Institut for Astrophysics, Potsdam
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; version 2 of the License.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA */
+
+/*****************************************************************
+ ********                     pk_range                     *******
+ *****************************************************************
+ *
+ * primary key ranges of tables, used to split the work on a
+ * table into chunks
+ *
+ *****************************************************************
+ */
+
+#ifndef __MYSQL_PK_RANGE__
+#define __MYSQL_PK_RANGE__
+
+#define MYSQL_SERVER 1
+
+#include <sql_class.h>
+
+#ifdef USE_PRAGMA_IMPLEMENTATION
+#pragma implementation
+#endif
+
+//a quoted name or string can be twice as long as the original
+#define QQUEUE_QUOTED_LEN(len) (2 * (len) + 3)
+
+struct qqueue_pk_range {
+    char db[NAME_LEN + 1];
+    char table[NAME_LEN + 1];
+    char pkName[NAME_LEN + 1];
+    longlong minPk;
+    longlong maxPk;
+};
+
+void quoteName(const char *name, char *out);
+void quoteString(const char *str, char *out);
+int splitTableName(const char *name, size_t len, const char *defaultDb, char *db, char *table);
+
+longlong getTableRows(THD *thd, const char *db, const char *table);
+int getPkRange(THD *thd, const char *db, const char *table, qqueue_pk_range *range);
+int pkRangeChunks(qqueue_pk_range *range, longlong maxChunks, longlong minKeys);
+void pkRangeChunk(qqueue_pk_range *range, int numChunks, int chunk, longlong *from, longlong *to, bool *last);
+int pkRangeCondition(qqueue_pk_range *range, longlong from, longlong to, bool last, char *cond, size_t len);
+
+#endif
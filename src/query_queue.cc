@@ -44,6 +44,18 @@
 #include "plugin_init.h"
 #include "exec_query.h"
 #include "query_queue.h"
+#include "quota.h"
+#include "running_jobs.h"
+#include "kill_reaper.h"
+#include "thd_sched.h"
+#include "throttle.h"
+#include "result_sink.h"
+#include "result_export.h"
+#include "split_job.h"
+#include "chunk_job.h"
+#include "journal.h"
+#include "sched_policy.h"
+#include "event_trace.h"
 
 #ifdef __QQUEUE_DEBUG_LOCKS__
 #include <execinfo.h>
@@ -63,6 +75,9 @@
 long numQueriesParallel;
 long intervalSec;
 char recovery;
+char recoveryKeepPartial;
+long preemptMargin;
+long maxPreemptions;
 THD *thd;
 #if MYSQL_VERSION_ID >= 50505
 mysql_mutex_t qqueueKillMutex = PTHREAD_MUTEX_INITIALIZER;
@@ -73,6 +88,12 @@ pthread_cond_t qqueueKillCond = PTHREAD_COND_INITIALIZER;
 #endif
 
 static pthread_t daemon_thread;
+static volatile bool daemonStop = false;
+
+//finished jobs and released slots, pushed by the workers and the kill reaper
+//without locking and taken off by the daemon, which is the only thread
+//starting jobs
+static qqueue_completion * volatile completions = NULL;
 
 MYSQL_SYSVAR_LONG(numQueriesParallel, numQueriesParallel, NULL,
                   "Query queue number of parallel MySQL threads to execute", NULL, NULL, 2, 1, 10000000, 1);
@@ -80,22 +101,156 @@ MYSQL_SYSVAR_LONG(intervalSec, intervalSec, NULL,
                   "Query queue polling frequency of the head node", NULL, NULL, 5, 1, 10000000, 1);
 MYSQL_SYSVAR_BOOL(recovery, recovery, NULL,
                   "Query queue job recovery after queue restart", NULL, NULL, true);
+MYSQL_SYSVAR_BOOL(recoveryKeepPartial, recoveryKeepPartial, NULL,
+                  "Query queue renames partial result tables of recovered jobs to qqueue_partial_<job id> instead of dropping them", NULL, NULL, false);
+MYSQL_SYSVAR_LONG(preemptMargin, preemptMargin, NULL,
+                  "Query queue priority difference by which a pending job needs to outrank a running job in a preemptible queue to preempt it", NULL, NULL, 10, 1, 2147483647, 1);
+MYSQL_SYSVAR_LONG(maxPreemptions, maxPreemptions, NULL,
+                  "Query queue maximum number of times a single job can be preempted", NULL, NULL, 3, 0, 10000000, 1);
+MYSQL_SYSVAR_BOOL(numaSpread, numaSpread, NULL,
+                  "Query queue spreads the jobs of queues without a CPU set or NUMA node over the NUMA nodes", NULL, NULL, false);
+MYSQL_SYSVAR_LONG(killGrace, killGrace, NULL,
+                  "Query queue seconds a killed job gets before KILL QUERY is escalated to KILL CONNECTION and again before it is counted as a zombie", NULL, NULL, 10, 1, 10000000, 1);
+MYSQL_SYSVAR_LONG(maxZombies, maxZombies, NULL,
+                  "Query queue maximum number of zombie job threads whose slots are given to other jobs", NULL, NULL, 2, 0, 10000000, 1);
+
+MYSQL_SYSVAR_STR(spoolDir, spoolDir, PLUGIN_VAR_READONLY | PLUGIN_VAR_RQCMDARG,
+                 "Query queue directory the jobs writing their result to a file put it in", NULL, NULL, NULL);
+
+MYSQL_SYSVAR_LONG(exportThreads, exportThreads, PLUGIN_VAR_READONLY | PLUGIN_VAR_RQCMDARG,
+                  "Query queue number of low priority threads exporting result tables to qqueue_spoolDir", NULL, NULL, 2, 0, 64, 1);
+MYSQL_SYSVAR_LONG(exportChunks, exportChunks, NULL,
+                  "Query queue number of primary key ranges a result table is exported in parallel", NULL, NULL, 4, 1, QQUEUE_MAX_EXPORT_CHUNKS, 1);
+MYSQL_SYSVAR_LONG(splitJobs, splitJobs, NULL,
+                  "Query queue number of sub-jobs a job flagged to be split is run in", NULL, NULL, 4, 1, QQUEUE_MAX_SPLIT_JOBS, 1);
+MYSQL_SYSVAR_LONG(chunkKeys, chunkKeys, NULL,
+                  "Query queue number of primary key values of the table a chunked job reads that are written in one transaction", NULL, NULL, 1000000, 1, 2147483647, 1);
+MYSQL_SYSVAR_BOOL(journal, journalMode, PLUGIN_VAR_READONLY,
+                  "Query queue records job state changes in a journal in the data directory and updates the jobs and history tables in the background", NULL, NULL, false);
+MYSQL_SYSVAR_LONG(traceEvents, traceEvents, PLUGIN_VAR_READONLY | PLUGIN_VAR_RQCMDARG,
+                  "Query queue number of scheduling events kept in INFORMATION_SCHEMA.QQUEUE_EVENTS, rounded up to a power of two. 0 turns tracing off", NULL, NULL, 65536, 0, 16777216, 1);
 
 int queueRegisterThreadEnd(jobWorkerThd *job);
-int queueRegisterThreadKill(jobWorkerThd *job);
+int queueRegisterThreadDone(jobWorkerThd *job);
 
 struct st_mysql_sys_var *vars_system[] = {
     MYSQL_SYSVAR(numQueriesParallel),
     MYSQL_SYSVAR(intervalSec),
     MYSQL_SYSVAR(recovery),
+    MYSQL_SYSVAR(recoveryKeepPartial),
+    MYSQL_SYSVAR(preemptMargin),
+    MYSQL_SYSVAR(maxPreemptions),
+    MYSQL_SYSVAR(numaSpread),
+    MYSQL_SYSVAR(killGrace),
+    MYSQL_SYSVAR(maxZombies),
+    MYSQL_SYSVAR(spoolDir),
+    MYSQL_SYSVAR(exportThreads),
+    MYSQL_SYSVAR(exportChunks),
+    MYSQL_SYSVAR(splitJobs),
+    MYSQL_SYSVAR(chunkKeys),
+    MYSQL_SYSVAR(journal),
+    MYSQL_SYSVAR(traceEvents),
     NULL
 };
 
+#define QQUEUE_SLOT_EMPTY -1
+#define QQUEUE_SLOT_DELETED -2
+
+//a slot of a running job. slots are only changed with the queue locked, seq is odd
+//while that happens. readers that do not lock the queue retry until they see the
+//same even seq before and after reading the slot
+struct jobSlot {
+    volatile uint32 seq;
+    volatile longlong jobId;
+    jobWorkerThd * volatile job;
+};
+
+//entry of the map from job ids to slots
+struct slotHashEntry {
+    volatile longlong jobId;
+    volatile int slot;                      //QQUEUE_SLOT_EMPTY or QQUEUE_SLOT_DELETED if unused
+};
+
+//slots, free slot stack and id map of the queue. entries of the map only go back to
+//empty when the map is rebuilt, which happens under hashSeq
+struct slotTable {
+    int len;
+    jobSlot *slots;
+    int *freeStack;
+    int numFree;
+    int hashSize;                           //power of 2, at least twice len
+    slotHashEntry *hash;
+    int numDeleted;
+    volatile uint32 hashSeq;
+    slotTable *retired;                     //smaller tables replaced by resize()
+};
+
+static uint32 hashJobId(longlong id) {
+    return (uint32) (id ^ (id >> 32)) * 2654435761U;
+}
+
+static slotTable *newSlotTable(int len) {
+    slotTable *tbl = (slotTable *) my_malloc(sizeof(slotTable), MYF(MY_ZEROFILL));
+    if (tbl == NULL)
+        return NULL;
+
+    tbl->len = len;
+    tbl->hashSize = 1;
+    while (tbl->hashSize < 2 * len)
+        tbl->hashSize <<= 1;
+
+    tbl->slots = (jobSlot *) my_malloc(len * sizeof(jobSlot), MYF(MY_ZEROFILL));
+    tbl->freeStack = (int *) my_malloc(len * sizeof(int), MYF(0));
+    tbl->hash = (slotHashEntry *) my_malloc(tbl->hashSize * sizeof(slotHashEntry), MYF(0));
+    if (tbl->slots == NULL || tbl->freeStack == NULL || tbl->hash == NULL) {
+        my_free(tbl->slots);
+        my_free(tbl->freeStack);
+        my_free(tbl->hash);
+        my_free(tbl);
+        return NULL;
+    }
+
+    for (int i = 0; i < tbl->hashSize; i++) {
+        tbl->hash[i].jobId = 0;
+        tbl->hash[i].slot = QQUEUE_SLOT_EMPTY;
+    }
+
+    //hand out the lowest slots first
+    for (int i = 0; i < len; i++) {
+        tbl->freeStack[i] = len - 1 - i;
+    }
+    tbl->numFree = len;
+
+    return tbl;
+}
+
+static void freeSlotTable(slotTable *tbl) {
+    while (tbl != NULL) {
+        slotTable *retired = tbl->retired;
+
+        my_free(tbl->slots);
+        my_free(tbl->freeStack);
+        my_free(tbl->hash);
+        my_free(tbl);
+
+        tbl = retired;
+    }
+}
+
+//frees a job once neither its worker nor a thread that kills it needs it anymore
+static void releaseJob(jobWorkerThd *job) {
+    if (__sync_sub_and_fetch(&job->refs, 1) != 0)
+        return;
+
+    delete job->job;
+    delete job;
+}
+
 class activeQueueList {
 public:
     int len;
     int numActive;
-    jobWorkerThd **array;
+    slotTable * volatile table;
 
 #if MYSQL_VERSION_ID >= 50505
     mysql_mutex_t numActiveMutex;
@@ -107,7 +262,7 @@ public:
 #endif
 
     activeQueueList() {
-        array = NULL;
+        table = NULL;
         len = 0;
         numActive = 0;
 
@@ -119,71 +274,124 @@ public:
     }
 
     ~activeQueueList() {
-        if (array != NULL) {
+        if (table != NULL) {
             for (int i = 0; i < len; i++) {
-                if (array[i] != NULL) {
-                    if (array[i]->job != NULL) {
-                        delete array[i]->job;
+                jobWorkerThd *job = table->slots[i].job;
+                if (job != NULL) {
+                    if (job->job != NULL) {
+                        delete job->job;
                     }
-                    delete array[i];
+                    delete job;
                 }
             }
 
-            my_free(array);
+            freeSlotTable(table);
         }
     }
 
+    //the job in a slot, NULL if the slot is free. needs the queue locked
+    jobWorkerThd *jobAt(int slot) {
+        return table->slots[slot].job;
+    }
+
+    //the tables only grow. lock-free readers might still look at the old table,
+    //so it is kept until the plugin is unloaded
     int resize(long newLen) {
-        if (newLen > len) {
-            //make bigger
-            if (array != NULL) {
-                array = (jobWorkerThd **) my_realloc(array, newLen * sizeof (jobWorkerThd *), MYF(0));
+        if (newLen <= len)
+            return 0;
 
-                for (int i = 0; i < (newLen - len); i++) {
-                    array[len + i] = NULL;
-                }
+        slotTable *newTable = newSlotTable(newLen);
+        if (newTable == NULL)
+            return 1;
+
+        lockQueue();
+
+        newTable->numFree = 0;
+        for (int i = newLen - 1; i >= 0; i--) {
+            jobWorkerThd *job = (i < len) ? table->slots[i].job : NULL;
+
+            if (job != NULL) {
+                newTable->slots[i].jobId = job->job->id;
+                newTable->slots[i].job = job;
+                hashInsert(newTable, job->job->id, i);
             } else {
-                array = (jobWorkerThd **) my_malloc(newLen * sizeof (jobWorkerThd *), MYF(0));
-                memset(array, 0, newLen * sizeof (jobWorkerThd *));
+                newTable->freeStack[newTable->numFree++] = i;
             }
+        }
 
-            //check if successful
-            if (array == NULL)
-                return 1;
+        newTable->retired = table;
+        __sync_synchronize();
+        table = newTable;
+        len = newLen;
 
-            len = newLen;
-        }
+        unlockQueue();
 
         return 0;
     }
 
+    //lock-free lookup of the slot a job runs in, -1 if it is not running
+    int findSlot(longlong id) {
+        slotTable *tbl = table;
+        int found;
+
+        if (tbl == NULL)
+            return -1;
+
+        while (true) {
+            uint32 seq = tbl->hashSeq;
+            __sync_synchronize();
+            if ((seq & 1) != 0)
+                continue;
+
+            found = -1;
+            uint32 mask = tbl->hashSize - 1;
+            uint32 pos = hashJobId(id) & mask;
+            for (int n = 0; n < tbl->hashSize; n++, pos = (pos + 1) & mask) {
+                int slot = tbl->hash[pos].slot;
+                __sync_synchronize();
+
+                if (slot == QQUEUE_SLOT_EMPTY)
+                    break;
+
+                if (slot >= 0 && tbl->hash[pos].jobId == id) {
+                    found = slot;
+                    break;
+                }
+            }
+
+            __sync_synchronize();
+            if (tbl->hashSeq == seq)
+                break;
+        }
+
+        //the slot might have been given to another job in the meantime
+        if (found < 0 || readSlotJobId(tbl, found) != id)
+            return -1;
+
+        return found;
+    }
+
     int registerJob(qqueue_jobs_row *thisJob) {
         lockQueue();
 
+        if (table == NULL || table->numFree <= 0) {
+            unlockQueue();
+            return 1;
+        }
+
         jobWorkerThd *job = new jobWorkerThd();
         job->job = thisJob;
-        job->thd = new THD;
         job->thdTerm = queueRegisterThreadEnd;
-        job->thdKillHandler = queueRegisterThreadKill;
+        job->thdDone = queueRegisterThreadDone;
 
-        if (len - numActive <= 0)
-            return 1;
-
-        //look for a free spot in the array
-        for (int i = 0; i < len; i++) {
-            if (array[i] == NULL) {
-                array[i] = job;
-                break;
-            }
-        }
+        setSlot(table->freeStack[--table->numFree], job);
+        numActive++;
 
         //register start of execution
         registerThreadStart(job);
 
         init_worker_thread(job);
 
-        numActive++;
-
         unlockQueue();
 
         return 0;
@@ -192,13 +400,12 @@ public:
     int unregisterJob(jobWorkerThd *thisJob) {
         lockQueue();
 
-        //look for this job in the array and unregister
-        for (int i = 0; i < len; i++) {
-            if (array[i] == thisJob) {
-                array[i] = NULL;
-                numActive--;
-                break;
-            }
+        if (thisJob->slot >= 0) {
+            int slot = thisJob->slot;
+
+            clearSlot(slot);
+            table->freeStack[table->numFree++] = slot;
+            numActive--;
         }
 
         unlockQueue();
@@ -207,99 +414,375 @@ public:
     }
 
     int unregisterAndStartNewJob(jobWorkerThd *thisJob) {
-        //look for this job in the array and unregister
-        for (int i = 0; i < len; i++) {
-            if (array[i] == thisJob) {
-
-                int error = 0;
-                Open_tables_backup backup;
-                TABLE *tbl = open_sysTbl(current_thd, "qqueue_jobs", strlen("qqueue_jobs"), &backup, false, &error);
-                if ( error || (tbl == NULL && (error != HA_STATUS_NO_LOCK) ) ) {
-                    if( error != HA_STATUS_NO_LOCK )
-                        fprintf(stderr, "registerThreadEnd: error in opening jobs sys table: error: %i\n", error);
-                    unregisterJob(array[i]);
-                    close_sysTbl(current_thd, tbl, &backup);
-                    return 1;
-                }
+        if (thisJob->slot < 0)
+            return 0;
+
+        int error = 0;
+        Open_tables_backup backup;
+        TABLE *tbl = open_sysTbl(current_thd, "qqueue_jobs", strlen("qqueue_jobs"), &backup, false, &error);
+        if ( error || (tbl == NULL && (error != HA_STATUS_NO_LOCK) ) ) {
+            if( error != HA_STATUS_NO_LOCK )
+                fprintf(stderr, "registerThreadEnd: error in opening jobs sys table: error: %i\n", error);
+            unregisterJob(thisJob);
+            close_sysTbl(current_thd, tbl, &backup);
+            return 1;
+        }
+
+        qqueue_jobs_row **jobArray = getHighestPriorityJob(tbl, 1, true);
+        close_sysTbl(current_thd, tbl, &backup);
 
-                qqueue_jobs_row **jobArray = getHighestPriorityJob(tbl, 1);
-                close_sysTbl(current_thd, tbl, &backup);
+        if (jobArray == NULL || jobArray[0] == NULL) {
+            unregisterJob(thisJob);
+        } else {
+            jobWorkerThd *job = new jobWorkerThd();
+            job->job = jobArray[0];
+            job->thdTerm = queueRegisterThreadEnd;
+            job->thdDone = queueRegisterThreadDone;
 
-                if (jobArray == NULL) {
-                    unregisterJob(array[i]);
-                } else {
-                    if (jobArray[0] != NULL) {
-                        jobWorkerThd *job = new jobWorkerThd();
-                        job->job = jobArray[0];
-                        job->thdTerm = queueRegisterThreadEnd;
-                        job->thdKillHandler = queueRegisterThreadKill;
+            lockQueue();
 
-                        array[i] = job;
+            int slot = thisJob->slot;
+            clearSlot(slot);
+            setSlot(slot, job);
 
-                        //register start of execution
-                        registerThreadStart(job);
+            //register start of execution
+            registerThreadStart(job);
 
-                        init_worker_thread(job);
-                    } else {
-                        unregisterJob(array[i]);
-                    }
-                }
+            init_worker_thread(job);
 
-                if(jobArray != NULL)
-                    my_free(jobArray);
-                break;
-            }
+            unlockQueue();
         }
 
+        if(jobArray != NULL)
+            my_free(jobArray);
+
         return 0;
     }
 
+    //whether the queue of a job waits for a killed worker to exit before it
+    //starts the next job
+    bool waitOnKill(jobWorkerThd *thisJob) {
+        qqueue_queues_row *queue = getQueueByID(thisJob->job->queue);
+
+        return queue == NULL || queue->killWait == true;
+    }
+
     int killJob(ulong id) {
-        //look for this job in the array and kill
-        bool found = 0;
+        //most kills are for jobs that are not running (anymore), these are
+        //answered without taking the lock
+        int slot = findSlot(id);
+        if (slot < 0)
+            return 0;
+
+        lockQueue();
+
+        jobWorkerThd *thisJob = table->slots[slot].job;
+        if (thisJob == NULL || thisJob->job->id != id || thisJob->job->status != QUEUE_RUNNING) {
+            unlockQueue();
+            return 0;
+        }
+
+        //kill job, the reaper delivers the kill. a worker that has already returned
+        //ends the job itself
+        if (retireJob(thisJob, QUEUE_KILLED) == false) {
+            unlockQueue();
+            return 0;
+        }
+
+        traceEvent(QQUEUE_EV_KILL, id, QQUEUE_KILL_BY_USER);
+
+        unlockQueue();
+
+        //moving the job to the history needs the tables, which is done without
+        //holding up the queue
+        registerThreadEnd(thisJob, true, false);
+        releaseJob(thisJob);
+
+        return 1;
+    }
+
+    //returns the running job that should give its slot to a pending job with the
+    //given priority, or NULL if no running job qualifies for preemption. needs to be
+    //called with the queue locked
+    jobWorkerThd *findPreemptionVictim(int pendingPriority) {
+        jobWorkerThd *victim = NULL;
 
         for (int i = 0; i < len; i++) {
-            if (array[i] != NULL) {
-                if (array[i]->job->id == id) {
-                    //kill job
-                    registerThreadEnd(array[i], true, false);
-                    sql_kill(array[i]->thd, array[i]->thd->thread_id, 0);
-                    
-#ifdef __QQUEUE_NOWAIT_ON_KILL_TO_JOBRESTART__
-                    //start a new job before this one is actually properly killed
-                    queueRegisterThreadKill(array[i]);
-#endif
+            jobWorkerThd *job = table->slots[i].job;
 
-                    found = 1;
-                    break;
-                }
-            }
+            if (job == NULL || job->thd == NULL || job->preempted == true ||
+                job->job->status != QUEUE_RUNNING || job->endOwner != QQUEUE_END_OPEN)
+                continue;
+
+            qqueue_queues_row *queue = getQueueByID(job->job->queue);
+            if (queue == NULL || schedCanPreempt(pendingPriority, job->job->effPriority, job->job->preemptCount,
+                                                 queue->preemptible, preemptMargin, maxPreemptions) == false)
+                continue;
+
+            if (victim == NULL || job->job->effPriority < victim->job->effPriority)
+                victim = job;
         }
 
-        return found;
+        return victim;
     }
 
-    int timeoutJob(jobWorkerThd *thisJob) {
-        //kill job
-        registerThreadEnd(thisJob, false, true);
-        sql_kill(thisJob->thd, thisJob->thd->thread_id, 0);
+    //needs to be called with the queue locked
+    int preemptJob(jobWorkerThd *thisJob) {
+        //a worker that has already returned keeps its job
+        if (__sync_bool_compare_and_swap(&thisJob->endOwner, QQUEUE_END_OPEN, QQUEUE_END_PREEMPTED) == false)
+            return 1;
 
-#ifdef __QQUEUE_NOWAIT_ON_KILL_TO_JOBRESTART__
-        //start a new job before this one is actually properly killed
-        queueRegisterThreadKill(thisJob);
-#endif
+        //kill job, the worker will put it back into the queue once it is gone
+        thisJob->preempted = true;
+        traceEvent(QQUEUE_EV_KILL, thisJob->job->id, QQUEUE_KILL_BY_PREEMPTION);
+        reaperKillJob(thisJob, waitOnKill(thisJob));
 
         return 0;
     }
 
+    //needs to be called with the queue locked. returns 1 if the job has been
+    //killed, the caller then ends it with registerThreadEnd once the queue is
+    //unlocked and lets go of it with releaseJob
+    int timeoutJob(jobWorkerThd *thisJob) {
+        //a job that has already been killed or timed out is on its way out
+        if (thisJob->job->status != QUEUE_RUNNING)
+            return 0;
+
+        //kill job, the reaper delivers the kill
+        if (retireJob(thisJob, QUEUE_TIMEOUT) == false)
+            return 0;
+
+        traceEvent(QQUEUE_EV_KILL, thisJob->job->id, QQUEUE_KILL_BY_TIMEOUT);
+
+        return 1;
+    }
+
+private:
+    //needs to be called with the queue locked. returns false if the worker has
+    //already claimed the end of the job, it is then left alone. otherwise the
+    //status keeps other kills and timeouts away from the job and the reference
+    //keeps it from being freed by the daemon before the killing thread has ended it.
+    //a kill overrides a preemption that has not been picked up by the worker yet
+    bool retireJob(jobWorkerThd *thisJob, enum enum_queue_status status) {
+        if (__sync_bool_compare_and_swap(&thisJob->endOwner, QQUEUE_END_OPEN, QQUEUE_END_BY_QUEUE) == false &&
+            __sync_bool_compare_and_swap(&thisJob->endOwner, QQUEUE_END_PREEMPTED, QQUEUE_END_BY_QUEUE) == false)
+            return false;
+
+        thisJob->job->status = status;
+        __sync_add_and_fetch(&thisJob->refs, 1);
+        reaperKillJob(thisJob, waitOnKill(thisJob));
+
+        return true;
+    }
+
+    static longlong readSlotJobId(slotTable *tbl, int slot) {
+        jobSlot *s = &tbl->slots[slot];
+
+        while (true) {
+            uint32 seq = s->seq;
+            __sync_synchronize();
+            if ((seq & 1) != 0)
+                continue;
+
+            longlong id = s->jobId;
+
+            __sync_synchronize();
+            if (s->seq == seq)
+                return id;
+        }
+    }
+
+    static void hashInsert(slotTable *tbl, longlong id, int slot) {
+        uint32 mask = tbl->hashSize - 1;
+        uint32 pos = hashJobId(id) & mask;
+
+        while (tbl->hash[pos].slot >= 0) {
+            pos = (pos + 1) & mask;
+        }
+
+        if (tbl->hash[pos].slot == QQUEUE_SLOT_DELETED)
+            tbl->numDeleted--;
+
+        //readers check the slot first, so the id has to be there before it
+        tbl->hash[pos].jobId = id;
+        __sync_synchronize();
+        tbl->hash[pos].slot = slot;
+    }
+
+    static void hashRemove(slotTable *tbl, longlong id, int slot) {
+        uint32 mask = tbl->hashSize - 1;
+        uint32 pos = hashJobId(id) & mask;
+
+        for (int n = 0; n < tbl->hashSize; n++, pos = (pos + 1) & mask) {
+            if (tbl->hash[pos].slot == QQUEUE_SLOT_EMPTY)
+                return;
+
+            if (tbl->hash[pos].slot == slot && tbl->hash[pos].jobId == id) {
+                tbl->hash[pos].slot = QQUEUE_SLOT_DELETED;
+                tbl->numDeleted++;
+                break;
+            }
+        }
+
+        //too many deleted entries make lookups long, start over
+        if (tbl->numDeleted > tbl->hashSize / 4) {
+            tbl->hashSeq++;
+            __sync_synchronize();
+
+            for (int i = 0; i < tbl->hashSize; i++) {
+                tbl->hash[i].slot = QQUEUE_SLOT_EMPTY;
+            }
+            tbl->numDeleted = 0;
+
+            for (int i = 0; i < tbl->len; i++) {
+                if (tbl->slots[i].job != NULL)
+                    hashInsert(tbl, tbl->slots[i].jobId, i);
+            }
+
+            __sync_synchronize();
+            tbl->hashSeq++;
+        }
+    }
+
+    void setSlot(int slot, jobWorkerThd *job) {
+        jobSlot *s = &table->slots[slot];
+
+        s->seq++;
+        __sync_synchronize();
+        s->jobId = job->job->id;
+        s->job = job;
+        __sync_synchronize();
+        s->seq++;
+
+        job->slot = slot;
+        hashInsert(table, job->job->id, slot);
+    }
+
+    void clearSlot(int slot) {
+        jobSlot *s = &table->slots[slot];
+        jobWorkerThd *job = s->job;
+
+        if (job == NULL)
+            return;
+
+        //the slot is emptied before the id leaves the map, a rebuild of the map in
+        //hashRemove would put the id back otherwise. readers check the id of the slot
+        longlong id = s->jobId;
+
+        s->seq++;
+        __sync_synchronize();
+        s->jobId = 0;
+        s->job = NULL;
+        __sync_synchronize();
+        s->seq++;
+
+        hashRemove(table, id, slot);
+
+        job->slot = -1;
+    }
 };
 
 activeQueueList queueList;
 
+static void pushCompletion(qqueue_completion *node) {
+    qqueue_completion *head;
+
+    do {
+        head = completions;
+        node->next = head;
+    } while (__sync_bool_compare_and_swap(&completions, head, node) == false);
+
+    //wake up the daemon
+#if MYSQL_VERSION_ID >= 50505
+    mysql_mutex_lock(&qqueueKillMutex);
+    mysql_cond_signal(&qqueueKillCond);
+    mysql_mutex_unlock(&qqueueKillMutex);
+#else
+    pthread_mutex_lock(&qqueueKillMutex);
+    pthread_cond_signal(&qqueueKillCond);
+    pthread_mutex_unlock(&qqueueKillMutex);
+#endif
+}
+
+//takes all records pushed so far and hands the slots they free to the next
+//jobs. only called by the daemon
+static void processCompletions() {
+    qqueue_completion *head = __sync_lock_test_and_set(&completions, (qqueue_completion *) NULL);
+    qqueue_completion *ordered = NULL;
+
+    //the records are stacked, restore the order in which they were pushed. the
+    //release of a slot always comes before the end of its job
+    while (head != NULL) {
+        qqueue_completion *next = head->next;
+        head->next = ordered;
+        ordered = head;
+        head = next;
+    }
+
+    while (ordered != NULL) {
+        qqueue_completion *node = ordered;
+        jobWorkerThd *job = node->job;
+        ordered = node->next;
+
+        if (node->type == QQUEUE_COMPLETION_RELEASE) {
+            queueList.unregisterAndStartNewJob(job);
+            continue;
+        }
+
+        if (job->slotReleased == false)
+            queueList.unregisterAndStartNewJob(job);
+
+        releaseJob(job);
+    }
+}
+
+//kills the next running job from the given slot on that has reached the timeout of
+//its queue and returns it, NULL if there is none
+static jobWorkerThd *killTimedOutJob(time_t now, int *nextSlot) {
+    jobWorkerThd *timedOut = NULL;
+
+    lockQueue();
+
+    for (; *nextSlot < queueList.len && timedOut == NULL; (*nextSlot)++) {
+        jobWorkerThd *job = queueList.jobAt(*nextSlot);
+
+        if (job == NULL)
+            continue;
+
+        //the worker has not started yet or is handing the job back
+        if (job->thd == NULL)
+            continue;
+
+        //a preempted job is already on its way back to the queue
+        if (job->preempted == true)
+            continue;
+
+        THD *currThd = job->thd;
+
+#if !defined(MARIADB_BASE_VERSION) && MYSQL_VERSION_ID >= 50605
+        if (currThd->start_time.tv_sec) {
+            int runtime = (longlong) (now - currThd->start_time.tv_sec);
+#else
+        if (currThd->start_time) {
+            int runtime = (longlong) (now - currThd->start_time);
+#endif
+            qqueue_queues_row *queue = getQueueByID(job->job->queue);
+
+            if (queue != NULL && schedTimedOut(runtime, queue->timeout) == true &&
+                queueList.timeoutJob(job) == 1) {
+                timedOut = job;
+            }
+        }
+    }
+
+    unlockQueue();
+
+    return timedOut;
+}
+
 pthread_handler_t qqueue_daemon(void *p) {
     THD *thd = (THD *) p;
     bool res;
-    int tmp;
 
     my_thread_init();
     res = post_init_daemon_thread(thd);
@@ -313,16 +796,37 @@ pthread_handler_t qqueue_daemon(void *p) {
     get_date(time_str, GETDATE_DATE_TIME, 0);
     fprintf(stderr, "Query queue daemon thread started at %s\n", time_str);
 
+    //whatever the journal holds from the last run goes to the tables before they are
+    //looked at
+    startJournal();
+
     //we need to clean up the queue first. it could be, that the server stopped and
-    //some jobs were left hanging in the wild. we offer two options: either set them
-    //all to an error state or set them to pending again (which would fail if tables
-    //need to be created an they are already there... this is NOT handeled yet.)
+    //some jobs were left hanging in the wild. each queue decides whether they are set
+    //to an error state or to pending again, queues without a policy follow qqueue_recovery.
+    //partial result tables of requeued jobs are removed. the daemon starts dispatching
+    //right after this.
     int numChanges = 0;
     if (recovery == true) {
-        numChanges = resetJobQueue(QUEUE_PENDING);
+        numChanges = resetJobQueue(QUEUE_PENDING, recoveryKeepPartial);
+    } else {
+        numChanges = resetJobQueue(QUEUE_ERROR, recoveryKeepPartial);
+    }
+
+    //split jobs whose last sub-job ended while the server went down
+    resumeSplitJobs();
+
+    //new jobs get ids after all the ids in the tables
+    seedJobIds();
+
+    //count the jobs left in the queue for the quotas
+    tbl = open_sysTbl(current_thd, "qqueue_jobs", strlen("qqueue_jobs"), &backup, false, &error);
+    if (error || tbl == NULL) {
+        fprintf(stderr, "qqueue_daemon: error in opening jobs sys table for the quotas: error: %i\n", error);
+        rebuildQuotaCounters(NULL);
     } else {
-        numChanges = resetJobQueue(QUEUE_ERROR);
+        rebuildQuotaCounters(tbl);
     }
+    close_sysTbl(current_thd, tbl, &backup);
 
     thd->proc_info = "Daemon running";
 
@@ -332,6 +836,8 @@ pthread_handler_t qqueue_daemon(void *p) {
             break;
         }
 
+        processCompletions();
+
         int error = 0;
         tbl = open_sysTbl(current_thd, "qqueue_jobs", strlen("qqueue_jobs"), &backup, false, &error);
         if (error || (tbl == NULL && error != HA_STATUS_NO_LOCK) ) {
@@ -348,7 +854,7 @@ pthread_handler_t qqueue_daemon(void *p) {
 
         int numEmptySlots = queueList.len - numActiveJobs;
 
-        qqueue_jobs_row **jobArray = getHighestPriorityJob(tbl, numEmptySlots);
+        qqueue_jobs_row **jobArray = getHighestPriorityJob(tbl, numEmptySlots, true);
 
 #ifdef __QQUEUE_DEBUG__
         fprintf(stderr, "Empty slots: %i\n", numEmptySlots);
@@ -357,8 +863,8 @@ pthread_handler_t qqueue_daemon(void *p) {
                 if (jobArray[i] == NULL)
                     break;
 
-                fprintf(stderr, "Job: %i, Status: %i, Priority: %i Query: %s\n", jobArray[i]->id, jobArray[i]->status,
-                        jobArray[i]->priority, jobArray[i]->query);
+                fprintf(stderr, "Job: %i, Status: %i, Priority: %i (effective %i) Query: %s\n", jobArray[i]->id, jobArray[i]->status,
+                        jobArray[i]->priority, jobArray[i]->effPriority, jobArray[i]->query);
             }
         }
 #endif
@@ -373,49 +879,70 @@ pthread_handler_t qqueue_daemon(void *p) {
             if (jobArray[i] == NULL)
                 break;
 
-            queueList.registerJob(jobArray[i]);
+            if (queueList.registerJob(jobArray[i]) != 0) {
+                //no slot left, the job stays pending
+                traceEvent(QQUEUE_EV_SKIP, jobArray[i]->id, QQUEUE_SKIP_NO_SLOT);
+                quotaJobRequeued(jobArray[i]->usrId, jobArray[i]->usrGroup);
+                delete jobArray[i];
+            }
         }
 
         if(jobArray != NULL)
             my_free(jobArray);
 
-        //check if running queries have reached their timeout
-        lockQueue();
+        //if all slots are taken, check if a pending job outranks a running job in a
+        //preemptible queue. only one job is preempted per round, the freed slot is
+        //handed to the highest priority pending job when the victim has ended
+        if (numEmptySlots <= 0) {
+            error = 0;
+            tbl = open_sysTbl(current_thd, "qqueue_jobs", strlen("qqueue_jobs"), &backup, false, &error);
+
+            //without the table there is no preemption this round, the timeouts are still checked
+            qqueue_jobs_row **pendingArray = NULL;
+            if (error || tbl == NULL) {
+                if (error != HA_STATUS_NO_LOCK)
+                    fprintf(stderr, "qqueue_daemon: error in opening jobs sys table: error: %i\n", error);
+            } else {
+                pendingArray = getHighestPriorityJob(tbl, 1, false);
+            }
 
-        time_t now = my_time(0);
-        for (int i = 0; i < queueList.len; i++) {
-            if (queueList.array[i] == NULL)
-                continue;
+            close_sysTbl(current_thd, tbl, &backup);
 
-            if (queueList.array[i]->thd == NULL) {
-                //this job has been killed/removed, so get rid of the job
-                unlockQueue();
+            if (pendingArray != NULL) {
+                if (pendingArray[0] != NULL) {
+                    lockQueue();
 
-                queueList.unregisterJob(queueList.array[i]);
-                continue;
-            }
+                    jobWorkerThd *victim = queueList.findPreemptionVictim(pendingArray[0]->effPriority);
 
-            THD *currThd = queueList.array[i]->thd;
+                    if (victim != NULL) {
+                        fprintf(stderr, "Query queue daemon: preempting job %lli (priority %i) for job %lli (priority %i)\n",
+                                victim->job->id, victim->job->effPriority,
+                                pendingArray[0]->id, pendingArray[0]->effPriority);
 
-#if !defined(MARIADB_BASE_VERSION) && MYSQL_VERSION_ID >= 50605
-            if (currThd->start_time.tv_sec) {
-                int runtime = (longlong) (now - currThd->start_time.tv_sec);
-#else
-            if (currThd->start_time) {
-                int runtime = (longlong) (now - currThd->start_time);
-#endif
-                qqueue_queues_row *queue = getQueueByID(queueList.array[i]->job->queue);
+                        queueList.preemptJob(victim);
+                    }
 
-                if (runtime >= queue->timeout) {
-                    //kill query
                     unlockQueue();
 
-                    queueList.timeoutJob(queueList.array[i]);
+                    delete pendingArray[0];
                 }
+
+                my_free(pendingArray);
             }
         }
 
-        unlockQueue();
+        //check if running queries have reached their timeout. the timed out jobs are
+        //ended one by one with the queue unlocked
+        time_t now = my_time(0);
+        int nextSlot = 0;
+        jobWorkerThd *timedOut;
+        while ( (timedOut = killTimedOutJob(now, &nextSlot)) != NULL ) {
+            registerThreadEnd(timedOut, false, true);
+            releaseJob(timedOut);
+        }
+
+        //tells the next start until when the running jobs ran
+        touchHeartbeat();
 
         //get the time for sleep
         for (int i = 0; i < intervalSec; i++) {
@@ -427,15 +954,17 @@ pthread_handler_t qqueue_daemon(void *p) {
             deltaTime.tv_sec = time(NULL) + 1;
 #if MYSQL_VERSION_ID >= 50505
             mysql_mutex_lock(&qqueueKillMutex);
-            tmp = mysql_cond_timedwait(&qqueueKillCond, &qqueueKillMutex, &deltaTime);
+            if (daemonStop == false && completions == NULL)
+                mysql_cond_timedwait(&qqueueKillCond, &qqueueKillMutex, &deltaTime);
             mysql_mutex_unlock(&qqueueKillMutex);
 #else
             pthread_mutex_lock(&qqueueKillMutex);
-            tmp = pthread_cond_timedwait(&qqueueKillCond, &qqueueKillMutex, &deltaTime);
+            if (daemonStop == false && completions == NULL)
+                pthread_cond_timedwait(&qqueueKillCond, &qqueueKillMutex, &deltaTime);
             pthread_mutex_unlock(&qqueueKillMutex);
 #endif
 
-            if (tmp != ETIMEDOUT) {
+            if (daemonStop == true) {
 #if defined(MARIADB_BASE_VERSION) && MYSQL_VERSION_ID >= 50500
                 thd->killed = KILL_CONNECTION;
 #else
@@ -443,6 +972,9 @@ pthread_handler_t qqueue_daemon(void *p) {
 #endif
                 break;
             }
+
+            //freed slots are handed to the next jobs right away
+            processCompletions();
         }
     }
 
@@ -467,6 +999,32 @@ static int qqueue_plugin_init(void *p) {
 
     THD *new_thd = NULL;
 
+    if (initQuotas()) {
+        fprintf(stderr, "Query queue - query_queue ERROR: Could not initialise quotas!\n");
+        return 1;
+    }
+
+    initThdSched();
+    initSplitJobs();
+    initEventTrace();
+
+    if (startKillReaper()) {
+        fprintf(stderr, "Query queue - query_queue ERROR: Could not start kill reaper!\n");
+        freeSplitJobs();
+        freeQuotas();
+        freeEventTrace();
+        return 1;
+    }
+
+    //jobs run without their read limits if the throttle is not there
+    if (startThrottle()) {
+        fprintf(stderr, "Query queue - query_queue ERROR: Could not start throttle, read limits are not enforced!\n");
+    }
+
+    if (startResultExport()) {
+        fprintf(stderr, "Query queue - query_queue ERROR: Could not start result export, results are not exported!\n");
+    }
+
     if (!(new_thd = new THD)) {
         fprintf(stderr, "Query queue - query_queue ERROR: Could not create thread!\n");
         return 1;
@@ -483,6 +1041,8 @@ static int qqueue_plugin_init(void *p) {
 
     new_thd->security_ctx->master_access |= SUPER_ACL;
 
+    daemonStop = false;
+
     pthread_attr_init(&attr);
     pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_JOINABLE);
     if (pthread_create(&daemon_thread, &attr, qqueue_daemon, new_thd) != 0) {
@@ -499,6 +1059,12 @@ static int qqueue_plugin_init(void *p) {
         delete new_thd;
         mysql_cond_broadcast(&COND_thread_count);
         mysql_mutex_unlock(&LOCK_thread_count);
+        stopResultExport();
+        stopThrottle();
+        stopKillReaper();
+        freeSplitJobs();
+        freeQuotas();
+        freeEventTrace();
         fprintf(stderr, "Query queue - query_queue ERROR: Could not create thread!\n");
         return 1;
     }
@@ -522,6 +1088,8 @@ static int qqueue_plugin_init(void *p) {
             loadQqueueQueues(tbl);
         }
         close_sysTbl(current_thd, tbl, &backup);
+
+        loadUsrQuotas();
     }
 
     setPluginInstalled();
@@ -541,12 +1109,29 @@ static int qqueue_plugin_deinit(void *p) {
 #endif
     }
 #if MYSQL_VERSION_ID >= 50505
+    mysql_mutex_lock(&qqueueKillMutex);
+    daemonStop = true;
     mysql_cond_signal(&qqueueKillCond);
+    mysql_mutex_unlock(&qqueueKillMutex);
 #else
+    pthread_mutex_lock(&qqueueKillMutex);
+    daemonStop = true;
     pthread_cond_signal(&qqueueKillCond);
+    pthread_mutex_unlock(&qqueueKillMutex);
 #endif
     pthread_join(daemon_thread, NULL);
 
+    //the workers use everything below, the trace ring included
+    waitForWorkers();
+
+    stopJournal();
+    stopResultExport();
+    stopThrottle();
+    stopKillReaper();
+    freeSplitJobs();
+    freeQuotas();
+    freeEventTrace();
+
     get_date(time_str, GETDATE_DATE_TIME, 0);
     fprintf(stderr, "Query queue daemon stopped at %s\n", time_str);
 
@@ -558,36 +1143,76 @@ static int qqueue_plugin_deinit(void *p) {
 int queueRegisterThreadEnd(jobWorkerThd *job) {
     registerThreadEnd(job, false, false);
 
-    queueList.unregisterAndStartNewJob(job);
+    return 0;
+}
+
+//the worker is done with the job, the daemon starts the next one and frees it
+int queueRegisterThreadDone(jobWorkerThd *job) {
+    pushCompletion(&job->doneNode);
 
     return 0;
 }
 
-int queueRegisterThreadKill(jobWorkerThd *job) {
-    //fooling mysql to properly register things...
-#if defined(MARIADB_BASE_VERSION) && MYSQL_VERSION_ID >= 50500
+int registerJobKill(ulong id) {
+    queueList.killJob(id);
 
-#else
-    job->thd->killed = THD::NOT_KILLED;
-#endif
+    return 0;
+}
 
-    queueList.unregisterAndStartNewJob(job);
+//changes the OS priorities of the worker of a running job. returns 1 if the job
+//is not running and 2 if the priorities could not be set
+int setRunningJobPriority(longlong id, int niceValue, int ioClass, int ioLevel) {
+    int slot = queueList.findSlot(id);
+    if (slot < 0)
+        return 1;
 
-#if defined(MARIADB_BASE_VERSION) && MYSQL_VERSION_ID >= 50500
+    lockQueue();
 
-#else
-    job->thd->killed = THD::KILL_QUERY;
-#endif
+    jobWorkerThd *job = queueList.jobAt(slot);
+    if (job == NULL || job->job->id != id || job->tid == 0) {
+        unlockQueue();
+        return 1;
+    }
 
-    return 0;
+    int result = schedSetThreadPriority(job->tid, niceValue, ioClass, ioLevel) != 0 ? 2 : 0;
+
+    unlockQueue();
+
+    return result;
 }
 
-int registerJobKill(ulong id) {
-    queueList.killJob(id);
+//gives the slot of a job that is being killed to the next job without
+//waiting for its worker to exit
+int releaseJobSlot(jobWorkerThd *job) {
+    pushCompletion(&job->releaseNode);
 
     return 0;
 }
 
+//calls the callback for every running job with the queue locked. the job
+//must not be kept beyond the callback. stops at the first callback that
+//does not return 0 and returns its result
+int iterateRunningJobs(runningJobCallback callback, void *arg) {
+    int result = 0;
+
+    lockQueue();
+
+    for (int i = 0; i < queueList.len; i++) {
+        jobWorkerThd *job = queueList.jobAt(i);
+
+        if (job == NULL || job->thd == NULL)
+            continue;
+
+        result = callback(job, arg);
+        if (result != 0)
+            break;
+    }
+
+    unlockQueue();
+
+    return result;
+}
+
 void lockQueue() {
 #if MYSQL_VERSION_ID >= 50505
     mysql_mutex_lock(&queueList.numActiveMutex);
@@ -633,8 +1258,36 @@ mysql_declare_plugin(vars) {
     qqueue_plugin_init,
     qqueue_plugin_deinit,
     0x0100,
-    NULL,
+    qqueue_kill_status,
     vars_system,
     NULL
+},
+{
+    MYSQL_INFORMATION_SCHEMA_PLUGIN,
+    &qqueue_running_info,
+    "QQUEUE_RUNNING",
+    "Adrian M. Partl",
+    "Progress of the jobs running in the query queue",
+    PLUGIN_LICENSE_GPL,
+    qqueue_running_init,
+    qqueue_running_deinit,
+    0x0100,
+    NULL,
+    NULL,
+    NULL
+},
+{
+    MYSQL_INFORMATION_SCHEMA_PLUGIN,
+    &qqueue_events_info,
+    "QQUEUE_EVENTS",
+    "Adrian M. Partl",
+    "Scheduling events of the jobs in the query queue",
+    PLUGIN_LICENSE_GPL,
+    qqueue_events_init,
+    qqueue_events_deinit,
+    0x0100,
+    NULL,
+    NULL,
+    NULL
 }
 mysql_declare_plugin_end;
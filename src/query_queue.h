@@ -30,11 +30,18 @@
 
 #define MYSQL_SERVER 1
 
+#include "exec_query.h"
+
 #ifdef USE_PRAGMA_IMPLEMENTATION
 #pragma implementation
 #endif
 
+typedef int (*runningJobCallback)(jobWorkerThd *job, void *arg);
+
 int registerJobKill(ulong id);
+int releaseJobSlot(jobWorkerThd *job);
+int setRunningJobPriority(longlong id, int niceValue, int ioClass, int ioLevel);
+int iterateRunningJobs(runningJobCallback callback, void *arg);
 void lockQueue();
 void unlockQueue();
 
@@ -0,0 +1,590 @@
+/* Copyright (c) 2012, 2013, Adrian M. Partl, eScience Group at the
+   Leibniz Institut for Astrophysics, Potsdam
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; version 2 of the License.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA */
+
+/*****************************************************************
+ ********                      quota                       *******
+ *****************************************************************
+ *
+ * in memory counters of running and pending jobs per user and
+ * user group for enforcing the quotas
+ *
+ * the counters are built from the jobs table when the daemon starts,
+ * submissions are refused until then. a counter without jobs and
+ * with a full token bucket is dropped, it would be created the same
+ * way again.
+ *
+ *****************************************************************
+ */
+
+#define MYSQL_SERVER 1
+
+#include <mysql_version.h>
+#include <sql_class.h>
+#include <sql_base.h>
+#include <records.h>
+#include <hash.h>
+#include <stddef.h>
+#include "sys_tbl.h"
+#include "quota.h"
+
+#ifdef USE_PRAGMA_IMPLEMENTATION
+#pragma implementation
+#endif
+
+//counters of one user or one user group. the submission rate is
+//limited with a token bucket that is refilled with submitRate tokens
+//per minute up to submitBurst tokens.
+struct quotaCounter {
+    long long id;
+    int running;
+    int pending;
+    double tokens;
+    ulonglong lastRefill;
+    int rate;                               //limits the bucket was last refilled with
+    int burst;
+};
+
+//effective limits of a user in a user group, 0 for no limit
+struct quotaLimits {
+    int grpMaxRunning;
+    int grpMaxPending;
+    int grpSubmitRate;
+    int grpSubmitBurst;
+    int usrMaxRunning;
+    int usrMaxPending;
+    int usrSubmitRate;
+    int usrSubmitBurst;
+};
+
+mysql_mutex_t LOCK_quota;
+static HASH usrCounters;
+static HASH grpCounters;
+static HASH usrOverrides;
+static bool quotasInitialised = false;
+static bool countersBuilt = false;          //set once the daemon counted the jobs table
+
+static void quotaFree(void *record) {
+    my_free(record);
+}
+
+static ulonglong quotaNow() {
+#if defined(MARIADB_BASE_VERSION) && MYSQL_VERSION_ID >= 50500
+    return microsecond_interval_timer();
+#else
+    return my_micro_time();
+#endif
+}
+
+int initQuotas() {
+    if (quotasInitialised == true)
+        return 0;
+
+    mysql_mutex_init(0, &LOCK_quota, MY_MUTEX_INIT_FAST);
+
+    if (my_hash_init(&usrCounters, &my_charset_bin, 256, offsetof(quotaCounter, id), sizeof(long long),
+                     0, quotaFree, 0) ||
+        my_hash_init(&grpCounters, &my_charset_bin, 64, offsetof(quotaCounter, id), sizeof(long long),
+                     0, quotaFree, 0) ||
+        my_hash_init(&usrOverrides, &my_charset_bin, 64, offsetof(qqueue_usrQuota_row, usrId), sizeof(long long),
+                     0, quotaFree, 0)) {
+        fprintf(stderr, "QQuery initQuotas: unable to allocate enough memory\n");
+        return 1;
+    }
+
+    countersBuilt = false;
+    quotasInitialised = true;
+
+    return 0;
+}
+
+void freeQuotas() {
+    if (quotasInitialised == false)
+        return;
+
+    my_hash_free(&usrCounters);
+    my_hash_free(&grpCounters);
+    my_hash_free(&usrOverrides);
+    mysql_mutex_destroy(&LOCK_quota);
+
+    quotasInitialised = false;
+}
+
+static int readQuotaField(Field *field) {
+    if (field->is_null())
+        return QQUEUE_QUOTA_INHERIT;
+
+    return (int) field->val_int();
+}
+
+void loadQqueueUsrQuotas(TABLE *fromThisTable) {
+    int error;
+
+    mysql_mutex_lock(&LOCK_quota);
+
+    READ_RECORD read_record_info;
+    init_read_record(&read_record_info, current_thd, fromThisTable, NULL, 1, 0, FALSE);
+    fromThisTable->use_all_columns();
+
+    my_hash_reset(&usrOverrides);
+
+    while(!(error = read_record_info.read_record(&read_record_info))) {
+        qqueue_usrQuota_row *aRow = (qqueue_usrQuota_row *) my_malloc(sizeof(qqueue_usrQuota_row), MYF(0));
+        if (aRow == NULL) {
+            fprintf(stderr, "QQuery loadQqueueUsrQuotas: No memory to allocate quota row\n");
+            break;
+        }
+
+        aRow->usrId = fromThisTable->field[0]->val_int();
+        aRow->maxRunning = readQuotaField(fromThisTable->field[1]);
+        aRow->maxPending = readQuotaField(fromThisTable->field[2]);
+        aRow->submitRate = readQuotaField(fromThisTable->field[3]);
+        aRow->submitBurst = readQuotaField(fromThisTable->field[4]);
+
+        if (my_hash_insert(&usrOverrides, (uchar *) aRow)) {
+            my_free(aRow);
+        }
+    }
+
+    end_read_record(&read_record_info);
+
+    mysql_mutex_unlock(&LOCK_quota);
+}
+
+static void storeQuotaField(Field *field, int value) {
+    if (value == QQUEUE_QUOTA_INHERIT) {
+        field->set_null();
+    } else {
+        field->set_notnull();
+        field->store(value, false);
+    }
+}
+
+int setQqueueUsrQuotaRow(qqueue_usrQuota_row *thisRow, TABLE *toThisTable) {
+    int error;
+    bool exists;
+
+    error = retrRowAtPKId(toThisTable, thisRow->usrId);
+    exists = (error == 0);
+
+    if (exists == true) {
+        store_record(toThisTable, record[1]);
+    } else {
+        empty_record(toThisTable);
+    }
+
+    toThisTable->use_all_columns();
+
+    toThisTable->field[0]->store(thisRow->usrId, false);
+    storeQuotaField(toThisTable->field[1], thisRow->maxRunning);
+    storeQuotaField(toThisTable->field[2], thisRow->maxPending);
+    storeQuotaField(toThisTable->field[3], thisRow->submitRate);
+    storeQuotaField(toThisTable->field[4], thisRow->submitBurst);
+
+    if (exists == true) {
+        error = toThisTable->file->ha_update_row(toThisTable->record[1], toThisTable->record[0]);
+        if (error == HA_ERR_RECORD_IS_THE_SAME)
+            error = 0;
+    } else {
+        error = toThisTable->file->ha_write_row(toThisTable->record[0]);
+    }
+
+    if (error) {
+        toThisTable->file->print_error(error, MYF(0));
+        fprintf(stderr, "QQuery: Error in storing quota of user: %lli error: %i\n", thisRow->usrId, error);
+        return error;
+    }
+
+    loadUsrQuotas();
+
+    return 0;
+}
+
+void loadUsrQuotas() {
+    int error;
+    Open_tables_backup backup;
+    TABLE *tbl = open_sysTbl(current_thd, "qqueue_usrQuotas", strlen("qqueue_usrQuotas"), &backup, false, &error);
+    if (error || tbl == NULL) {
+        fprintf(stderr, "QQuery: error in opening usrQuotas sys table: error %i\n", error);
+    } else {
+        loadQqueueUsrQuotas(tbl);
+    }
+    close_sysTbl(current_thd, tbl, &backup);
+}
+
+//fetches the limits before LOCK_quota is taken, since the user groups
+//might need to be loaded from disk
+static void getQuotaLimits(int usrId, int usrGroup, quotaLimits *limits) {
+    memset(limits, 0, sizeof(quotaLimits));
+
+    qqueue_usrGrp_row *grp = getUsrGrpByID(usrGroup);
+    if (grp != NULL) {
+        limits->grpMaxRunning = grp->maxRunning;
+        limits->grpMaxPending = grp->maxPending;
+        limits->grpSubmitRate = grp->submitRate;
+        limits->grpSubmitBurst = grp->submitBurst;
+        limits->usrMaxRunning = grp->usrMaxRunning;
+        limits->usrMaxPending = grp->usrMaxPending;
+        limits->usrSubmitRate = grp->usrSubmitRate;
+        limits->usrSubmitBurst = grp->usrSubmitBurst;
+    }
+}
+
+//applies the per user overrides. needs LOCK_quota
+static void applyUsrOverride(int usrId, quotaLimits *limits) {
+    long long key = usrId;
+    qqueue_usrQuota_row *override = (qqueue_usrQuota_row *) my_hash_search(&usrOverrides, (const uchar *) &key,
+                                                                             sizeof(long long));
+    if (override == NULL)
+        return;
+
+    if (override->maxRunning != QQUEUE_QUOTA_INHERIT)
+        limits->usrMaxRunning = override->maxRunning;
+    if (override->maxPending != QQUEUE_QUOTA_INHERIT)
+        limits->usrMaxPending = override->maxPending;
+    if (override->submitRate != QQUEUE_QUOTA_INHERIT)
+        limits->usrSubmitRate = override->submitRate;
+    if (override->submitBurst != QQUEUE_QUOTA_INHERIT)
+        limits->usrSubmitBurst = override->submitBurst;
+}
+
+//returns the counter with the given id and creates it if needed. needs LOCK_quota
+static quotaCounter *getCounter(HASH *counters, long long id) {
+    quotaCounter *counter = (quotaCounter *) my_hash_search(counters, (const uchar *) &id, sizeof(long long));
+
+    if (counter != NULL)
+        return counter;
+
+    counter = (quotaCounter *) my_malloc(sizeof(quotaCounter), MYF(0));
+    if (counter == NULL)
+        return NULL;
+
+    counter->id = id;
+    counter->running = 0;
+    counter->pending = 0;
+    counter->tokens = 0;
+    counter->lastRefill = 0;
+    counter->rate = 0;
+    counter->burst = 0;
+
+    if (my_hash_insert(counters, (uchar *) counter)) {
+        my_free(counter);
+        return NULL;
+    }
+
+    return counter;
+}
+
+//refills the token bucket and returns true if a token is available
+static bool refillTokens(quotaCounter *counter, int rate, int burst, ulonglong now) {
+    counter->rate = rate;
+    if (rate <= 0)
+        return true;
+
+    if (burst <= 0)
+        burst = rate;
+    counter->burst = burst;
+
+    //a fresh counter starts with a full bucket
+    if (counter->lastRefill == 0) {
+        counter->tokens = burst;
+    } else if (now > counter->lastRefill) {
+        counter->tokens += (double) (now - counter->lastRefill) * rate / 60000000.0;
+    }
+
+    if (counter->tokens > burst)
+        counter->tokens = burst;
+
+    counter->lastRefill = now;
+
+    return counter->tokens >= 1.0;
+}
+
+static void decCounter(int *value) {
+    if (*value > 0)
+        (*value)--;
+}
+
+//removes a counter that has no jobs left and whose bucket has filled up again,
+//a new one starts the same way. needs LOCK_quota
+static void dropIdleCounter(HASH *counters, quotaCounter *counter) {
+    if (counter == NULL || counter->running > 0 || counter->pending > 0)
+        return;
+
+    if (counter->rate > 0 && counter->lastRefill != 0) {
+        ulonglong now = quotaNow();
+        double tokens = counter->tokens;
+        if (now > counter->lastRefill)
+            tokens += (double) (now - counter->lastRefill) * counter->rate / 60000000.0;
+
+        if (tokens < counter->burst)
+            return;
+    }
+
+    my_hash_delete(counters, (uchar *) counter);
+}
+
+//checks the pending limits and the submission rate of a new job and counts it
+//as pending. returns 0 if the job may be queued, otherwise 1 and a message
+//stating the limit that has been hit
+int quotaReserveSubmit(int usrId, int usrGroup, char *message, int messageLen) {
+    quotaLimits limits;
+    getQuotaLimits(usrId, usrGroup, &limits);
+
+    mysql_mutex_lock(&LOCK_quota);
+
+    //jobs submitted before the counters are built would be counted twice or not at all
+    if (countersBuilt == false) {
+        mysql_mutex_unlock(&LOCK_quota);
+        snprintf(message, messageLen, "qqueue_addJob() the queue is still starting up, try again later");
+        return 1;
+    }
+
+    applyUsrOverride(usrId, &limits);
+
+    quotaCounter *usr = getCounter(&usrCounters, usrId);
+    quotaCounter *grp = getCounter(&grpCounters, usrGroup);
+
+    if (usr == NULL || grp == NULL) {
+        mysql_mutex_unlock(&LOCK_quota);
+        snprintf(message, messageLen, "qqueue_addJob() no memory for quota counters");
+        return 1;
+    }
+
+    if (limits.usrMaxPending > 0 && usr->pending >= limits.usrMaxPending) {
+        mysql_mutex_unlock(&LOCK_quota);
+        snprintf(message, messageLen, "qqueue_addJob() quota exceeded: user %i already has %i pending jobs (limit %i)",
+                 usrId, usr->pending, limits.usrMaxPending);
+        return 1;
+    }
+
+    if (limits.grpMaxPending > 0 && grp->pending >= limits.grpMaxPending) {
+        mysql_mutex_unlock(&LOCK_quota);
+        snprintf(message, messageLen, "qqueue_addJob() quota exceeded: user group %i already has %i pending jobs (limit %i)",
+                 usrGroup, grp->pending, limits.grpMaxPending);
+        return 1;
+    }
+
+    ulonglong now = quotaNow();
+
+    if (refillTokens(usr, limits.usrSubmitRate, limits.usrSubmitBurst, now) == false) {
+        mysql_mutex_unlock(&LOCK_quota);
+        snprintf(message, messageLen, "qqueue_addJob() quota exceeded: user %i may only submit %i jobs per minute",
+                 usrId, limits.usrSubmitRate);
+        return 1;
+    }
+
+    if (refillTokens(grp, limits.grpSubmitRate, limits.grpSubmitBurst, now) == false) {
+        mysql_mutex_unlock(&LOCK_quota);
+        snprintf(message, messageLen, "qqueue_addJob() quota exceeded: user group %i may only submit %i jobs per minute",
+                 usrGroup, limits.grpSubmitRate);
+        return 1;
+    }
+
+    if (limits.usrSubmitRate > 0)
+        usr->tokens -= 1.0;
+    if (limits.grpSubmitRate > 0)
+        grp->tokens -= 1.0;
+
+    usr->pending++;
+    grp->pending++;
+
+    mysql_mutex_unlock(&LOCK_quota);
+
+    return 0;
+}
+
+//a pending job has been removed from the queue
+void quotaJobDeleted(int usrId, int usrGroup) {
+    mysql_mutex_lock(&LOCK_quota);
+
+    quotaCounter *usr = getCounter(&usrCounters, usrId);
+    quotaCounter *grp = getCounter(&grpCounters, usrGroup);
+
+    if (usr != NULL)
+        decCounter(&usr->pending);
+    if (grp != NULL)
+        decCounter(&grp->pending);
+
+    dropIdleCounter(&usrCounters, usr);
+    dropIdleCounter(&grpCounters, grp);
+
+    mysql_mutex_unlock(&LOCK_quota);
+}
+
+//checks the running limits. needs LOCK_quota
+static bool checkRunning(int usrId, int usrGroup, quotaLimits *limits, quotaCounter **usr, quotaCounter **grp) {
+    applyUsrOverride(usrId, limits);
+
+    *usr = getCounter(&usrCounters, usrId);
+    *grp = getCounter(&grpCounters, usrGroup);
+
+    if (*usr != NULL && limits->usrMaxRunning > 0 && (*usr)->running >= limits->usrMaxRunning)
+        return false;
+
+    if (*grp != NULL && limits->grpMaxRunning > 0 && (*grp)->running >= limits->grpMaxRunning)
+        return false;
+
+    return true;
+}
+
+//returns true if a job of this user would not exceed the running limits
+bool quotaCanStart(int usrId, int usrGroup) {
+    quotaLimits limits;
+    quotaCounter *usr;
+    quotaCounter *grp;
+    getQuotaLimits(usrId, usrGroup, &limits);
+
+    mysql_mutex_lock(&LOCK_quota);
+    bool result = checkRunning(usrId, usrGroup, &limits, &usr, &grp);
+    mysql_mutex_unlock(&LOCK_quota);
+
+    return result;
+}
+
+//same as quotaCanStart, but counts the job as running if it may start
+bool quotaTryStart(int usrId, int usrGroup) {
+    quotaLimits limits;
+    quotaCounter *usr;
+    quotaCounter *grp;
+    getQuotaLimits(usrId, usrGroup, &limits);
+
+    mysql_mutex_lock(&LOCK_quota);
+    bool result = checkRunning(usrId, usrGroup, &limits, &usr, &grp);
+
+    if (result == true) {
+        if (usr != NULL) {
+            decCounter(&usr->pending);
+            usr->running++;
+        }
+        if (grp != NULL) {
+            decCounter(&grp->pending);
+            grp->running++;
+        }
+    }
+
+    mysql_mutex_unlock(&LOCK_quota);
+
+    return result;
+}
+
+//a running job has finished, failed or has been killed
+void quotaJobEnded(int usrId, int usrGroup) {
+    mysql_mutex_lock(&LOCK_quota);
+
+    quotaCounter *usr = getCounter(&usrCounters, usrId);
+    quotaCounter *grp = getCounter(&grpCounters, usrGroup);
+
+    if (usr != NULL)
+        decCounter(&usr->running);
+    if (grp != NULL)
+        decCounter(&grp->running);
+
+    dropIdleCounter(&usrCounters, usr);
+    dropIdleCounter(&grpCounters, grp);
+
+    mysql_mutex_unlock(&LOCK_quota);
+}
+
+//a running job has been set to pending again
+void quotaJobRequeued(int usrId, int usrGroup) {
+    mysql_mutex_lock(&LOCK_quota);
+
+    quotaCounter *usr = getCounter(&usrCounters, usrId);
+    quotaCounter *grp = getCounter(&grpCounters, usrGroup);
+
+    if (usr != NULL) {
+        decCounter(&usr->running);
+        usr->pending++;
+    }
+    if (grp != NULL) {
+        decCounter(&grp->running);
+        grp->pending++;
+    }
+
+    mysql_mutex_unlock(&LOCK_quota);
+}
+
+//pending jobs that the queue added itself, like the sub-jobs of a split job.
+//they are counted, but not held against the limits
+void quotaJobsAdded(int usrId, int usrGroup, int count) {
+    mysql_mutex_lock(&LOCK_quota);
+
+    quotaCounter *usr = getCounter(&usrCounters, usrId);
+    quotaCounter *grp = getCounter(&grpCounters, usrGroup);
+
+    if (usr != NULL)
+        usr->pending += count;
+    if (grp != NULL)
+        grp->pending += count;
+
+    mysql_mutex_unlock(&LOCK_quota);
+}
+
+//counts the pending and running jobs in the jobs table from scratch. this is
+//only needed when the daemon starts, afterwards the counters follow every
+//change of the job status. submissions are accepted once this is done, without
+//the table the counters start from zero
+int rebuildQuotaCounters(TABLE *fromJobsTable) {
+    int error;
+
+    mysql_mutex_lock(&LOCK_quota);
+
+    my_hash_reset(&usrCounters);
+    my_hash_reset(&grpCounters);
+    countersBuilt = true;
+
+    if (fromJobsTable == NULL) {
+        mysql_mutex_unlock(&LOCK_quota);
+        return 1;
+    }
+
+    READ_RECORD read_record_info;
+    init_read_record(&read_record_info, current_thd, fromJobsTable, NULL, 1, 0, FALSE);
+    fromJobsTable->use_all_columns();
+
+    while(!(error = read_record_info.read_record(&read_record_info))) {
+        int usrId = (int) fromJobsTable->field[2]->val_int();
+        int usrGroup = (int) fromJobsTable->field[3]->val_int();
+        int status = (int) fromJobsTable->field[7]->val_int();
+
+        if (status != QUEUE_PENDING && status != QUEUE_RUNNING)
+            continue;
+
+        quotaCounter *usr = getCounter(&usrCounters, usrId);
+        quotaCounter *grp = getCounter(&grpCounters, usrGroup);
+
+        if (usr == NULL || grp == NULL) {
+            end_read_record(&read_record_info);
+            mysql_mutex_unlock(&LOCK_quota);
+            fprintf(stderr, "QQuery rebuildQuotaCounters: No memory to allocate quota counters\n");
+            return 1;
+        }
+
+        if (status == QUEUE_PENDING) {
+            usr->pending++;
+            grp->pending++;
+        } else {
+            usr->running++;
+            grp->running++;
+        }
+    }
+
+    end_read_record(&read_record_info);
+
+    mysql_mutex_unlock(&LOCK_quota);
+
+    return 0;
+}
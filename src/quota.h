@@ -0,0 +1,66 @@
+/* Copyright (c) 2012, 2013, Adrian M. Partl, eScience Group at the
+   Leibniz Institut for Astrophysics, Potsdam
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; version 2 of the License.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA */
+
+/*****************************************************************
+ ********                      quota                       *******
+ *****************************************************************
+ *
+ * in memory counters of running and pending jobs per user and
+ * user group for enforcing the quotas
+ *
+ *****************************************************************
+ */
+
+#ifndef __MYSQL_QUOTA__
+#define __MYSQL_QUOTA__
+
+#define MYSQL_SERVER 1
+
+#include <sql_class.h>
+
+#ifdef USE_PRAGMA_IMPLEMENTATION
+#pragma implementation
+#endif
+
+#define QQUEUE_QUOTA_INHERIT -1
+
+//per user override of the user group quota. fields set to
+//QQUEUE_QUOTA_INHERIT take the value of the user group
+struct qqueue_usrQuota_row {
+    long long usrId;
+    int maxRunning;
+    int maxPending;
+    int submitRate;
+    int submitBurst;
+};
+
+int initQuotas();
+void freeQuotas();
+
+void loadQqueueUsrQuotas(TABLE *fromThisTable);
+void loadUsrQuotas();
+int setQqueueUsrQuotaRow(qqueue_usrQuota_row *thisRow, TABLE *toThisTable);
+int rebuildQuotaCounters(TABLE *fromJobsTable);
+
+int quotaReserveSubmit(int usrId, int usrGroup, char *message, int messageLen);
+void quotaJobDeleted(int usrId, int usrGroup);
+bool quotaCanStart(int usrId, int usrGroup);
+bool quotaTryStart(int usrId, int usrGroup);
+void quotaJobEnded(int usrId, int usrGroup);
+void quotaJobRequeued(int usrId, int usrGroup);
+void quotaJobsAdded(int usrId, int usrGroup, int count);
+
+#endif
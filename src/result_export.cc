@@ -0,0 +1,512 @@
+/* Copyright (c) 2012, 2013, Adrian M. Partl, eScience Group at the
+   Leibniz Institut for Astrophysics, Potsdam
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; version 2 of the License.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA */
+
+/*****************************************************************
+ ********                  result_export                   *******
+ *****************************************************************
+ *
+ * pool of low priority threads exporting the result tables of
+ * finished jobs to columnar files
+ *
+ * a table with a single integer primary key is split into
+ * qqueue_exportChunks ranges that the threads of the pool export
+ * in parallel, each to a gzip file of its own. the first chunk
+ * carries the header of the columnar format. once all chunks are
+ * there, they are concatenated (gzip allows concatenated members)
+ * and the end of the file is appended. the result table is read
+ * with the privileges of the user that submitted the job.
+ *
+ *****************************************************************
+ */
+
+#define MYSQL_SERVER 1
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <zlib.h>
+#include <mysql_version.h>
+#include <sql_class.h>
+#include "daemon_thd.h"
+#include "sys_tbl.h"
+#include "exec_query.h"
+#include "thd_sched.h"
+#include "result_sink.h"
+#include "pk_range.h"
+#include "result_export.h"
+
+#ifdef USE_PRAGMA_IMPLEMENTATION
+#pragma implementation
+#endif
+
+long exportThreads;
+long exportChunks;
+
+struct exportTask {
+    long long jobId;
+    char user[USERNAME_LENGTH + 1];         //the export reads with the privileges of this user
+    char db[QQUEUE_RESULTDBNAME_LEN];
+    char table[QQUEUE_RESULTTBLNAME_LEN];
+    char path[FN_REFLEN];
+    qqueue_pk_range range;                  //no key name if the table is exported in one piece
+    bool preparing;                         //a thread is looking for the primary key
+    bool prepared;
+    int numChunks;
+    int nextChunk;
+    int chunksDone;
+    bool failed;
+    exportTask *next;
+};
+
+mysql_mutex_t LOCK_export;
+mysql_cond_t COND_export;
+static pthread_t *exportThreadIds = NULL;
+static int numExportThreads = 0;
+static bool exportInitialised = false;
+static bool exportStop = false;
+
+//exports in the order the jobs finished
+static exportTask *exportFirst = NULL;
+static exportTask *exportLast = NULL;
+
+static void chunkPath(exportTask *task, int chunk, char *path, size_t len) {
+    snprintf(path, len, "%s.%i", task->path, chunk);
+}
+
+//switches the thread to the user of the job, so that an export cannot read
+//anything its job could not have read
+//returns 0 on success, 1 if the user is not known
+static int changeToJobUser(THD *thd, exportTask *task, Security_context *newContext, Security_context **old) {
+    LEX_STRING user;
+    LEX_STRING host;
+    LEX_STRING db;
+
+    user.str = task->user;
+    user.length = strlen(task->user);
+    host.str = (char *) "localhost";
+    host.length = strlen("localhost");
+    db.str = task->db;
+    db.length = strlen(task->db);
+
+    if (newContext->change_security_context(thd, &user, &host, &db, old)) {
+        fprintf(stderr, "Query queue - result export ERROR: job %lli: no account for user %s@localhost\n",
+                task->jobId, task->user);
+        thd->clear_error();
+        return 1;
+    }
+
+    return 0;
+}
+
+//looks for a single integer primary key and its range, the table is exported
+//in one piece without one
+static void prepareTask(THD *thd, exportTask *task) {
+    Security_context *old;
+    Security_context newContext;
+
+    task->numChunks = 1;
+    task->range.pkName[0] = '\0';
+
+    if (changeToJobUser(thd, task, &newContext, &old) != 0) {
+        task->failed = true;
+        return;
+    }
+
+    if (exportChunks > 1 && getPkRange(thd, task->db, task->table, &task->range) == 0)
+        task->numChunks = pkRangeChunks(&task->range, exportChunks, 1);
+    else
+        task->range.pkName[0] = '\0';
+
+    thd->security_ctx->restore_security_context(thd, old);
+}
+
+static int exportChunk(THD *thd, exportTask *task, int chunk) {
+    char db[QQUEUE_QUOTED_LEN(NAME_LEN)];
+    char table[QQUEUE_QUOTED_LEN(NAME_LEN)];
+    char cond[2 * QQUEUE_QUOTED_LEN(NAME_LEN) + 64];
+    char query[sizeof(db) + sizeof(table) + sizeof(cond) + 64];
+    char path[FN_REFLEN];
+    char *queryError = NULL;
+
+    quoteName(task->db, db);
+    quoteName(task->table, table);
+
+    if (task->range.pkName[0] == '\0') {
+        snprintf(query, sizeof(query), "SELECT * FROM %s.%s", db, table);
+    } else {
+        longlong from;
+        longlong to;
+        bool last;
+
+        pkRangeChunk(&task->range, task->numChunks, chunk, &from, &to, &last);
+        pkRangeCondition(&task->range, from, to, last, cond, sizeof(cond));
+        snprintf(query, sizeof(query), "SELECT * FROM %s.%s WHERE %s", db, table, cond);
+    }
+
+    chunkPath(task, chunk, path, sizeof(path));
+
+    qqueue_result_sink *sink = new qqueue_result_sink(thd, QQUEUE_JOB_OUTPUT_COLUMNAR | QQUEUE_JOB_OUTPUT_GZIP);
+    if (sink == NULL)
+        return 1;
+
+    sink->setSections(chunk == 0, false);
+    if (sink->openPath(path) != 0) {
+        delete sink;
+        return 1;
+    }
+
+    Security_context *old;
+    Security_context newContext;
+    if (changeToJobUser(thd, task, &newContext, &old) != 0) {
+        delete sink;
+        return 1;
+    }
+
+    Protocol *protocol = thd->protocol;
+    thd->protocol = sink;
+    int error = execSimpleQuery(thd, query, &queryError);
+    thd->protocol = protocol;
+
+    thd->security_ctx->restore_security_context(thd, old);
+
+    if (error != 0) {
+        fprintf(stderr, "Query queue - result export ERROR: job %lli: %s\n", task->jobId,
+                queryError != NULL ? queryError : "");
+        if (queryError != NULL)
+            my_free(queryError);
+    } else {
+        char *outPath;
+        long long size;
+        error = sink->finish(&outPath, &size, NULL);
+    }
+
+    delete sink;
+
+    return error;
+}
+
+//puts the chunks together into the final file and removes them
+static int mergeChunks(exportTask *task, long long *size) {
+    char path[FN_REFLEN];
+    char partPath[FN_REFLEN];
+    char buff[IO_SIZE * 16];
+    int error = 0;
+
+    *size = 0;
+    snprintf(partPath, sizeof(partPath), "%s.part", task->path);
+
+    FILE *out = fopen(partPath, "wb");
+    if (out == NULL) {
+        fprintf(stderr, "Query queue - result export ERROR: could not create %s: %s\n", partPath, strerror(errno));
+        return 1;
+    }
+
+    for (int chunk = 0; chunk < task->numChunks; chunk++) {
+        chunkPath(task, chunk, path, sizeof(path));
+
+        FILE *in = fopen(path, "rb");
+        if (in == NULL) {
+            error = 1;
+            continue;
+        }
+
+        size_t len;
+        while ((len = fread(buff, 1, sizeof(buff), in)) > 0) {
+            if (fwrite(buff, 1, len, out) != len) {
+                error = 1;
+                break;
+            }
+        }
+
+        fclose(in);
+        unlink(path);
+    }
+
+    if (fclose(out) != 0)
+        error = 1;
+
+    //the end of the file as a gzip member of its own
+    if (error == 0) {
+        uchar end[4];
+        int4store(end, 0);
+
+        gzFile gzfile = gzopen(partPath, "ab");
+        if (gzfile == NULL || gzwrite(gzfile, end, 4) != 4)
+            error = 1;
+        if (gzfile != NULL && gzclose(gzfile) != Z_OK)
+            error = 1;
+    }
+
+    if (error != 0 || rename(partPath, task->path) != 0) {
+        fprintf(stderr, "Query queue - result export ERROR: could not write %s\n", task->path);
+        unlink(partPath);
+        return 1;
+    }
+
+    struct stat fileStat;
+    if (stat(task->path, &fileStat) == 0)
+        *size = (long long) fileStat.st_size;
+
+    return 0;
+}
+
+static void finishTask(exportTask *task) {
+    char path[FN_REFLEN];
+    long long size;
+
+    if (task->failed == true || mergeChunks(task, &size) != 0) {
+        for (int chunk = 0; chunk < task->numChunks; chunk++) {
+            chunkPath(task, chunk, path, sizeof(path));
+            unlink(path);
+        }
+
+        fprintf(stderr, "Query queue - result export ERROR: export of job %lli failed\n", task->jobId);
+        return;
+    }
+
+    int error = 0;
+    Open_tables_backup backup;
+    TABLE *tbl = open_sysTbl(current_thd, "qqueue_history", strlen("qqueue_history"), &backup, true, &error);
+    if (error || tbl == NULL) {
+        fprintf(stderr, "Query queue - result export ERROR: error in opening history sys table: error: %i\n", error);
+        close_sysTbl(current_thd, tbl, &backup);
+        return;
+    }
+
+    setQqueueJobsOutput(task->jobId, task->path, size, tbl);
+
+    close_sysTbl(current_thd, tbl, &backup);
+}
+
+//removes a task from the list, needs to be called with the export locked
+static void removeTask(exportTask *task) {
+    exportTask *prev = NULL;
+
+    for (exportTask *curr = exportFirst; curr != NULL; curr = curr->next) {
+        if (curr == task)
+            break;
+        prev = curr;
+    }
+
+    if (prev != NULL)
+        prev->next = task->next;
+    else
+        exportFirst = task->next;
+
+    if (exportLast == task)
+        exportLast = prev;
+
+    task->next = NULL;
+}
+
+//the first task with work left, needs to be called with the export locked
+static exportTask *nextTask() {
+    for (exportTask *task = exportFirst; task != NULL; task = task->next) {
+        if (task->prepared == false && task->preparing == false)
+            return task;
+        if (task->prepared == true && task->nextChunk < task->numChunks)
+            return task;
+    }
+
+    return NULL;
+}
+
+pthread_handler_t export_worker(void *p) {
+    THD *thd = NULL;
+
+    init_thread(&thd, "Result export", true);
+
+    //exports must not get in the way of the jobs and the clients
+    schedSetThreadPriority((pid_t) syscall(SYS_gettid), 19, QQUEUE_IOPRIO_CLASS_IDLE, 0);
+
+    mysql_mutex_lock(&LOCK_export);
+
+    while (exportStop == false) {
+        exportTask *task = nextTask();
+        if (task == NULL) {
+            thd_proc_info(thd, "Waiting for exports");
+            mysql_cond_wait(&COND_export, &LOCK_export);
+            continue;
+        }
+
+        if (task->prepared == false) {
+            task->preparing = true;
+            mysql_mutex_unlock(&LOCK_export);
+
+            thd_proc_info(thd, "Preparing export");
+            prepareTask(thd, task);
+
+            mysql_mutex_lock(&LOCK_export);
+            task->preparing = false;
+            task->prepared = true;
+            mysql_cond_broadcast(&COND_export);
+            continue;
+        }
+
+        int chunk = task->nextChunk++;
+        mysql_mutex_unlock(&LOCK_export);
+
+        thd_proc_info(thd, "Exporting result table");
+        int error = exportChunk(thd, task, chunk);
+
+        mysql_mutex_lock(&LOCK_export);
+        if (error != 0)
+            task->failed = true;
+
+        //the thread doing the last chunk puts the file together
+        if (++task->chunksDone == task->numChunks) {
+            removeTask(task);
+            mysql_mutex_unlock(&LOCK_export);
+
+            thd_proc_info(thd, "Finishing export");
+            finishTask(task);
+            my_free(task);
+
+            mysql_mutex_lock(&LOCK_export);
+        }
+    }
+
+    mysql_mutex_unlock(&LOCK_export);
+
+    deinit_thread(&thd);
+    my_thread_end();
+    pthread_exit(0);
+
+    return NULL;
+}
+
+int startResultExport() {
+    pthread_attr_t attr;
+
+    //the files go to the spool directory, there is nothing to do without one
+    if (exportInitialised == true || exportThreads <= 0 || spoolDir == NULL || spoolDir[0] == '\0')
+        return 0;
+
+    exportThreadIds = (pthread_t *) my_malloc(exportThreads * sizeof(pthread_t), MYF(MY_ZEROFILL));
+    if (exportThreadIds == NULL) {
+        fprintf(stderr, "Query queue - result export ERROR: unable to allocate enough memory\n");
+        return 1;
+    }
+
+    mysql_mutex_init(0, &LOCK_export, MY_MUTEX_INIT_FAST);
+    mysql_cond_init(0, &COND_export, NULL);
+    exportStop = false;
+    numExportThreads = 0;
+
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_JOINABLE);
+    for (long i = 0; i < exportThreads; i++) {
+        if (pthread_create(&exportThreadIds[numExportThreads], &attr, export_worker, NULL) != 0) {
+            fprintf(stderr, "Query queue - result export ERROR: Could not create thread!\n");
+            break;
+        }
+        numExportThreads++;
+    }
+    pthread_attr_destroy(&attr);
+
+    exportInitialised = true;
+
+    if (numExportThreads == 0) {
+        stopResultExport();
+        return 1;
+    }
+
+    return 0;
+}
+
+//exports that have not been finished are dropped, together with their chunks
+void stopResultExport() {
+    char path[FN_REFLEN];
+
+    if (exportInitialised == false)
+        return;
+
+    mysql_mutex_lock(&LOCK_export);
+    exportStop = true;
+    mysql_cond_broadcast(&COND_export);
+    mysql_mutex_unlock(&LOCK_export);
+
+    for (int i = 0; i < numExportThreads; i++)
+        pthread_join(exportThreadIds[i], NULL);
+
+    while (exportFirst != NULL) {
+        exportTask *task = exportFirst;
+        exportFirst = task->next;
+
+        for (int chunk = 0; chunk < task->numChunks; chunk++) {
+            chunkPath(task, chunk, path, sizeof(path));
+            unlink(path);
+        }
+
+        fprintf(stderr, "Query queue - result export: export of job %lli dropped\n", task->jobId);
+        my_free(task);
+    }
+    exportLast = NULL;
+
+    my_free(exportThreadIds);
+    exportThreadIds = NULL;
+    numExportThreads = 0;
+
+    mysql_cond_destroy(&COND_export);
+    mysql_mutex_destroy(&LOCK_export);
+
+    exportInitialised = false;
+}
+
+//hands the result table of a job that succeeded to the pool
+int exportResultTable(qqueue_jobs_row *job) {
+    if (exportInitialised == false) {
+        fprintf(stderr, "Query queue - result export ERROR: no export threads, job %lli is not exported\n", job->id);
+        return 1;
+    }
+
+    if (job->resultDBName == NULL || job->resultTableName == NULL || job->mysqlUserName == NULL)
+        return 1;
+
+    exportTask *task = (exportTask *) my_malloc(sizeof(exportTask), MYF(MY_ZEROFILL));
+    if (task == NULL) {
+        fprintf(stderr, "Query queue - result export ERROR: unable to allocate enough memory\n");
+        return 1;
+    }
+
+    task->jobId = job->id;
+    strmake(task->user, job->mysqlUserName, USERNAME_LENGTH);
+    strmake(task->db, job->resultDBName, QQUEUE_RESULTDBNAME_LEN - 1);
+    strmake(task->table, job->resultTableName, QQUEUE_RESULTTBLNAME_LEN - 1);
+    if ((size_t) snprintf(task->path, sizeof(task->path), "%s/qqueue_%lli.qcol.gz", spoolDir, job->id) >=
+        sizeof(task->path) - 16) {
+        fprintf(stderr, "Query queue - result export ERROR: spool path of job %lli is too long\n", job->id);
+        my_free(task);
+        return 1;
+    }
+
+    mysql_mutex_lock(&LOCK_export);
+
+    if (exportLast != NULL)
+        exportLast->next = task;
+    else
+        exportFirst = task;
+    exportLast = task;
+
+    mysql_cond_signal(&COND_export);
+    mysql_mutex_unlock(&LOCK_export);
+
+    return 0;
+}
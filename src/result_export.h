@@ -0,0 +1,49 @@
+/* Copyright (c) 2012, 2013, Adrian M. Partl, eScience Group at the
+   Leibniz Institut for Astrophysics, Potsdam
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; version 2 of the License.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA */
+
+/*****************************************************************
+ ********                  result_export                   *******
+ *****************************************************************
+ *
+ * pool of low priority threads exporting the result tables of
+ * finished jobs to columnar files
+ *
+ *****************************************************************
+ */
+
+#ifndef __MYSQL_RESULT_EXPORT__
+#define __MYSQL_RESULT_EXPORT__
+
+#define MYSQL_SERVER 1
+
+#include <sql_class.h>
+#include "sys_tbl.h"
+
+#ifdef USE_PRAGMA_IMPLEMENTATION
+#pragma implementation
+#endif
+
+#define QQUEUE_MAX_EXPORT_CHUNKS 1024
+
+extern long exportThreads;
+extern long exportChunks;
+
+int startResultExport();
+void stopResultExport();
+
+int exportResultTable(qqueue_jobs_row *job);
+
+#endif
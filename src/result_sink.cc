@@ -0,0 +1,545 @@
+/* Copyright (c) 2012, 2013, Adrian M. Partl, eScience Group at the
+   Leibniz Institut for Astrophysics, Potsdam
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; version 2 of the License.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA */
+
+/*****************************************************************
+ ********                   result_sink                    *******
+ *****************************************************************
+ *
+ * writes the result set of a job to a file in the spool directory
+ * instead of a result table
+ *
+ * the sink replaces the protocol of the worker THD, so the rows
+ * arrive already converted to text by the server. they are
+ * written either as CSV or in a simple columnar format:
+ *
+ *   "QQCOL001", uint32 number of columns
+ *   per column: uint8 kind, uint32 length of the name, name
+ *   blocks: uint32 number of rows (0 ends the file)
+ *      per column: uint32 length, null bitmap, values of the rows
+ *      that are not NULL (int64, double or uint32 length + bytes)
+ *
+ * all numbers are little endian. the file is written to
+ * <name>.part and renamed once the job has succeeded.
+ *
+ *****************************************************************
+ */
+
+#define MYSQL_SERVER 1
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <mysql_com.h>
+#include <sql_class.h>
+#include "sys_tbl.h"
+#include "result_sink.h"
+
+#ifdef USE_PRAGMA_IMPLEMENTATION
+#pragma implementation
+#endif
+
+#define QQUEUE_SINK_MAGIC "QQCOL001"
+
+char *spoolDir;
+
+qqueue_result_sink::qqueue_result_sink(THD *thd, int flags) : Protocol_text(thd) {
+    jobFlags = flags;
+    filePath[0] = '\0';
+    partPath[0] = '\0';
+    file = NULL;
+    gzfile = NULL;
+    gotResult = false;
+    failed = false;
+    writeHeader = true;
+    writeTrailer = true;
+    numCols = 0;
+    kinds = NULL;
+    columns = NULL;
+    nulls = NULL;
+    values = NULL;
+    lengths = NULL;
+    blockRows = 0;
+    blockBytes = 0;
+}
+
+qqueue_result_sink::~qqueue_result_sink() {
+    discard();
+
+    delete [] kinds;
+    delete [] columns;
+    delete [] nulls;
+    delete [] values;
+    delete [] lengths;
+}
+
+//splits a row in the text protocol packet into its fields: a length coded string
+//for each field, or 251 for NULL
+static void decodeTextRow(String *packet, uint numCols, uchar **values, ulong *lengths) {
+    uchar *pos = (uchar *) packet->ptr();
+    uchar *end = pos + packet->length();
+
+    for (uint col = 0; col < numCols; col++) {
+        if (pos >= end || *pos == 251) {
+            values[col] = NULL;
+            lengths[col] = 0;
+            pos++;
+        } else {
+            lengths[col] = net_field_length(&pos);
+            values[col] = pos;
+            pos += lengths[col];
+        }
+    }
+}
+
+int qqueue_result_sink::open(long long jobId) {
+    const char *ext = (jobFlags & QQUEUE_JOB_OUTPUT_COLUMNAR) != 0 ? "qcol" : "csv";
+    bool compress = (jobFlags & QQUEUE_JOB_OUTPUT_GZIP) != 0;
+    char path[FN_REFLEN];
+
+    if (spoolDir == NULL || spoolDir[0] == '\0') {
+        fprintf(stderr, "Query queue - result sink ERROR: qqueue_spoolDir is not set\n");
+        return 1;
+    }
+
+    if ((size_t) snprintf(path, sizeof(path), "%s/qqueue_%lli.%s%s", spoolDir, jobId,
+                          ext, compress ? ".gz" : "") >= sizeof(path)) {
+        fprintf(stderr, "Query queue - result sink ERROR: spool path of job %lli is too long\n", jobId);
+        return 1;
+    }
+
+    return openPath(path);
+}
+
+int qqueue_result_sink::openPath(const char *path) {
+    if (strlen(path) + strlen(".part") >= sizeof(partPath)) {
+        fprintf(stderr, "Query queue - result sink ERROR: path %s is too long\n", path);
+        return 1;
+    }
+
+    strcpy(filePath, path);
+    snprintf(partPath, sizeof(partPath), "%s.part", filePath);
+
+    if ((jobFlags & QQUEUE_JOB_OUTPUT_GZIP) != 0)
+        gzfile = gzopen(partPath, "wb");
+    else
+        file = fopen(partPath, "wb");
+
+    if (file == NULL && gzfile == NULL) {
+        fprintf(stderr, "Query queue - result sink ERROR: could not create %s: %s\n",
+                partPath, strerror(errno));
+        partPath[0] = '\0';
+        return 1;
+    }
+
+    return 0;
+}
+
+void qqueue_result_sink::setSections(bool header, bool trailer) {
+    writeHeader = header;
+    writeTrailer = trailer;
+}
+
+int qqueue_result_sink::writeBytes(const void *data, size_t len) {
+    if (len == 0)
+        return 0;
+
+    if (gzfile != NULL)
+        return gzwrite(gzfile, data, (unsigned) len) == (int) len ? 0 : 1;
+
+    return fwrite(data, 1, len, file) == len ? 0 : 1;
+}
+
+//only one result set fits into a file. the file is started over for each result set,
+//so that it holds the one of the last statement that returned rows
+int qqueue_result_sink::restart() {
+    char path[FN_REFLEN];
+
+    if (gzfile != NULL) {
+        gzclose(gzfile);
+        gzfile = NULL;
+    }
+
+    if (file != NULL) {
+        fclose(file);
+        file = NULL;
+    }
+
+    delete [] kinds;
+    delete [] columns;
+    delete [] nulls;
+    delete [] values;
+    delete [] lengths;
+    kinds = NULL;
+    columns = NULL;
+    nulls = NULL;
+    values = NULL;
+    lengths = NULL;
+
+    numCols = 0;
+    blockRows = 0;
+    blockBytes = 0;
+    gotResult = false;
+
+    strcpy(path, filePath);
+    return openPath(path);
+}
+
+bool qqueue_result_sink::send_result_set_metadata(List<Item> *list, uint flags) {
+    if (gotResult == true && restart() != 0) {
+        failed = true;
+        my_printf_error(ER_UNKNOWN_ERROR, "Query queue: the output file of the job could not be created", MYF(0));
+        return true;
+    }
+
+    if (file == NULL && gzfile == NULL) {
+        my_printf_error(ER_UNKNOWN_ERROR, "Query queue: the output file of the job could not be created", MYF(0));
+        return true;
+    }
+
+    gotResult = true;
+    numCols = list->elements;
+    kinds = new int[numCols];
+    values = new uchar *[numCols];
+    lengths = new ulong[numCols];
+    if (kinds == NULL || values == NULL || lengths == NULL) {
+        failed = true;
+        return true;
+    }
+
+    Item *item;
+    List_iterator_fast<Item> itemIter(*list);
+    uint col = 0;
+    int error = 0;
+    uchar buff[8];
+
+    if ((jobFlags & QQUEUE_JOB_OUTPUT_COLUMNAR) != 0) {
+        columns = new String[numCols];
+        nulls = new String[numCols];
+        if (columns == NULL || nulls == NULL) {
+            failed = true;
+            return true;
+        }
+
+        if (writeHeader == true) {
+            error |= writeBytes(QQUEUE_SINK_MAGIC, 8);
+            int4store(buff, numCols);
+            error |= writeBytes(buff, 4);
+        }
+    }
+
+    while ( (item = itemIter++) ) {
+        const char *name = item->name != NULL ? item->name : "";
+        size_t nameLen = strlen(name);
+
+        switch (item->field_type()) {
+            case MYSQL_TYPE_TINY:
+            case MYSQL_TYPE_SHORT:
+            case MYSQL_TYPE_INT24:
+            case MYSQL_TYPE_LONG:
+            case MYSQL_TYPE_LONGLONG:
+            case MYSQL_TYPE_YEAR:
+                kinds[col] = item->unsigned_flag ? QQUEUE_SINK_UINT : QQUEUE_SINK_INT;
+                break;
+            case MYSQL_TYPE_FLOAT:
+            case MYSQL_TYPE_DOUBLE:
+                kinds[col] = QQUEUE_SINK_DOUBLE;
+                break;
+            default:
+                kinds[col] = QQUEUE_SINK_BYTES;
+                break;
+        }
+
+        if (writeHeader == false) {
+            //only the kinds are needed
+        } else if ((jobFlags & QQUEUE_JOB_OUTPUT_COLUMNAR) != 0) {
+            buff[0] = (uchar) kinds[col];
+            error |= writeBytes(buff, 1);
+            int4store(buff, nameLen);
+            error |= writeBytes(buff, 4);
+            error |= writeBytes(name, nameLen);
+        } else {
+            if (col > 0)
+                error |= writeBytes(",", 1);
+            error |= writeCsvField(name, nameLen);
+        }
+
+        col++;
+    }
+
+    if (writeHeader == true && (jobFlags & QQUEUE_JOB_OUTPUT_COLUMNAR) == 0)
+        error |= writeBytes("\n", 1);
+
+    if (error != 0) {
+        failed = true;
+        my_printf_error(ER_UNKNOWN_ERROR, "Query queue: could not write to the output file of the job", MYF(0));
+        return true;
+    }
+
+    return prepare_for_send(numCols);
+}
+
+bool qqueue_result_sink::write() {
+    decodeTextRow(packet, numCols, values, lengths);
+
+    int error;
+    if ((jobFlags & QQUEUE_JOB_OUTPUT_COLUMNAR) != 0)
+        error = bufferRowColumnar();
+    else
+        error = writeRowCsv();
+
+    if (error != 0) {
+        failed = true;
+        my_printf_error(ER_UNKNOWN_ERROR, "Query queue: could not write to the output file of the job", MYF(0));
+        return true;
+    }
+
+    return false;
+}
+
+//fields with separators, quotes or line breaks are quoted, NULL is written as \N.
+//backslashes are doubled, so that a field holding \N can be told from NULL
+int qqueue_result_sink::writeCsvField(const char *value, size_t len) {
+    if (value == NULL)
+        return writeBytes("\\N", 2);
+
+    bool quote = false;
+    bool escape = false;
+    for (size_t i = 0; i < len; i++) {
+        if (value[i] == ',' || value[i] == '"' || value[i] == '\r' || value[i] == '\n')
+            quote = true;
+        else if (value[i] == '\\')
+            escape = true;
+    }
+
+    if (quote == false && escape == false)
+        return writeBytes(value, len);
+
+    int error = quote ? writeBytes("\"", 1) : 0;
+    const char *start = value;
+    for (size_t i = 0; i < len; i++) {
+        if ((quote == true && value[i] == '"') || value[i] == '\\') {
+            error |= writeBytes(start, value + i + 1 - start);
+            error |= writeBytes(value + i, 1);
+            start = value + i + 1;
+        }
+    }
+    error |= writeBytes(start, value + len - start);
+    if (quote == true)
+        error |= writeBytes("\"", 1);
+
+    return error;
+}
+
+int qqueue_result_sink::writeRowCsv() {
+    int error = 0;
+
+    for (uint col = 0; col < numCols; col++) {
+        if (col > 0)
+            error |= writeBytes(",", 1);
+        error |= writeCsvField((const char *) values[col], lengths[col]);
+    }
+
+    error |= writeBytes("\n", 1);
+
+    return error;
+}
+
+int qqueue_result_sink::bufferRowColumnar() {
+    uchar buff[8];
+    char number[64];
+
+    for (uint col = 0; col < numCols; col++) {
+        if (blockRows % 8 == 0)
+            nulls[col].append('\0');
+
+        if (values[col] == NULL) {
+            char *bits = (char *) nulls[col].ptr();
+            bits[nulls[col].length() - 1] |= (char) (1 << (blockRows % 8));
+            continue;
+        }
+
+        switch (kinds[col]) {
+            case QQUEUE_SINK_INT:
+            case QQUEUE_SINK_UINT:
+            case QQUEUE_SINK_DOUBLE: {
+                size_t len = lengths[col] < sizeof(number) - 1 ? lengths[col] : sizeof(number) - 1;
+                memcpy(number, values[col], len);
+                number[len] = '\0';
+
+                if (kinds[col] == QQUEUE_SINK_INT) {
+                    longlong val = strtoll(number, NULL, 10);
+                    int8store(buff, val);
+                } else if (kinds[col] == QQUEUE_SINK_UINT) {
+                    ulonglong val = strtoull(number, NULL, 10);
+                    int8store(buff, val);
+                } else {
+                    double val = strtod(number, NULL);
+                    float8store(buff, val);
+                }
+
+                if (columns[col].append((const char *) buff, 8))
+                    return 1;
+                blockBytes += 8;
+                break;
+            }
+            default:
+                int4store(buff, lengths[col]);
+                if (columns[col].append((const char *) buff, 4) ||
+                    columns[col].append((const char *) values[col], lengths[col]))
+                    return 1;
+                blockBytes += 4 + lengths[col];
+                break;
+        }
+    }
+
+    blockRows++;
+
+    if (blockRows >= QQUEUE_SINK_BLOCK_ROWS || blockBytes >= QQUEUE_SINK_BLOCK_BYTES)
+        return flushBlock();
+
+    return 0;
+}
+
+int qqueue_result_sink::flushBlock() {
+    uchar buff[4];
+    int error = 0;
+
+    if (blockRows == 0)
+        return 0;
+
+    int4store(buff, blockRows);
+    error |= writeBytes(buff, 4);
+
+    for (uint col = 0; col < numCols; col++) {
+        int4store(buff, nulls[col].length() + columns[col].length());
+        error |= writeBytes(buff, 4);
+        error |= writeBytes(nulls[col].ptr(), nulls[col].length());
+        error |= writeBytes(columns[col].ptr(), columns[col].length());
+
+        nulls[col].length(0);
+        columns[col].length(0);
+    }
+
+    blockRows = 0;
+    blockBytes = 0;
+
+    return error;
+}
+
+//closes the file and gives it its final name. path and size of the file are
+//returned for the history, the path is only copied if root is given
+int qqueue_result_sink::finish(char **path, long long *size, MEM_ROOT *root) {
+    int error = failed ? 1 : 0;
+    uchar buff[4];
+
+    *path = NULL;
+    *size = 0;
+
+    if (file == NULL && gzfile == NULL)
+        return 1;
+
+    if ((jobFlags & QQUEUE_JOB_OUTPUT_COLUMNAR) != 0 && gotResult == true) {
+        error |= flushBlock();
+        if (writeTrailer == true) {
+            int4store(buff, 0);
+            error |= writeBytes(buff, 4);
+        }
+    }
+
+    if (gzfile != NULL) {
+        error |= gzclose(gzfile) != Z_OK ? 1 : 0;
+        gzfile = NULL;
+    } else {
+        error |= fclose(file) != 0 ? 1 : 0;
+        file = NULL;
+    }
+
+    if (error != 0 || rename(partPath, filePath) != 0) {
+        fprintf(stderr, "Query queue - result sink ERROR: could not write %s: %s\n", filePath, strerror(errno));
+        unlink(partPath);
+        partPath[0] = '\0';
+        return 1;
+    }
+    partPath[0] = '\0';
+
+    struct stat fileStat;
+    if (stat(filePath, &fileStat) == 0)
+        *size = (long long) fileStat.st_size;
+
+    if (root != NULL)
+        *path = strdup_root(root, filePath);
+
+    return 0;
+}
+
+//throws away whatever has been written so far
+void qqueue_result_sink::discard() {
+    if (gzfile != NULL) {
+        gzclose(gzfile);
+        gzfile = NULL;
+    }
+
+    if (file != NULL) {
+        fclose(file);
+        file = NULL;
+    }
+
+    if (partPath[0] != '\0') {
+        unlink(partPath);
+        partPath[0] = '\0';
+    }
+}
+
+qqueue_value_sink::qqueue_value_sink(THD *thd) : Protocol_text(thd) {
+    numCols = 0;
+    numRows = 0;
+    for (uint col = 0; col < QQUEUE_VALUE_SINK_COLS; col++)
+        isNull[col] = true;
+}
+
+bool qqueue_value_sink::send_result_set_metadata(List<Item> *list, uint flags) {
+    numCols = list->elements;
+    numRows = 0;
+
+    if (numCols > QQUEUE_VALUE_SINK_COLS) {
+        my_printf_error(ER_UNKNOWN_ERROR, "Query queue: too many columns in internal query", MYF(0));
+        return true;
+    }
+
+    return prepare_for_send(numCols);
+}
+
+bool qqueue_value_sink::write() {
+    uchar *values[QQUEUE_VALUE_SINK_COLS];
+    ulong lengths[QQUEUE_VALUE_SINK_COLS];
+
+    if (numRows++ > 0)
+        return false;
+
+    decodeTextRow(packet, numCols, values, lengths);
+
+    for (uint col = 0; col < numCols; col++) {
+        isNull[col] = values[col] == NULL;
+        if (values[col] != NULL && this->values[col].copy((const char *) values[col], lengths[col],
+                                                           &my_charset_bin))
+            return true;
+    }
+
+    return false;
+}
@@ -0,0 +1,115 @@
+/* Copyright (c) 2012, 2013, Adrian M. Partl, eScience Group at the
+   Leibniz Institut for Astrophysics, Potsdam
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; version 2 of the License.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA */
+
+/*****************************************************************
+ ********                   result_sink                    *******
+ *****************************************************************
+ *
+ * writes the result set of a job to a file in the spool directory
+ * instead of a result table
+ *
+ *****************************************************************
+ */
+
+#ifndef __MYSQL_RESULT_SINK__
+#define __MYSQL_RESULT_SINK__
+
+#define MYSQL_SERVER 1
+
+#include <stdio.h>
+#include <zlib.h>
+#include <sql_class.h>
+#include <protocol.h>
+#include "sys_tbl.h"
+
+#ifdef USE_PRAGMA_IMPLEMENTATION
+#pragma implementation
+#endif
+
+//rows of the columnar format that are buffered before a block is written
+#define QQUEUE_SINK_BLOCK_ROWS 65536
+#define QQUEUE_SINK_BLOCK_BYTES (16 * 1024 * 1024)
+
+extern char *spoolDir;
+
+enum enum_qqueue_sink_kind {
+    QQUEUE_SINK_INT,
+    QQUEUE_SINK_UINT,
+    QQUEUE_SINK_DOUBLE,
+    QQUEUE_SINK_BYTES
+};
+
+//takes the place of the protocol of a job worker. the rows the server sends are
+//taken from the text protocol packets and written to the output file
+class qqueue_result_sink : public Protocol_text {
+public:
+    qqueue_result_sink(THD *thd, int jobFlags);
+    virtual ~qqueue_result_sink();
+
+    virtual bool send_result_set_metadata(List<Item> *list, uint flags);
+    virtual bool write();
+
+    int open(long long jobId);
+    int openPath(const char *path);
+    void setSections(bool header, bool trailer);
+    int finish(char **path, long long *size, MEM_ROOT *root);
+    void discard();
+
+private:
+    int restart();
+    int writeBytes(const void *data, size_t len);
+    int writeCsvField(const char *value, size_t len);
+    int writeRowCsv();
+    int bufferRowColumnar();
+    int flushBlock();
+
+    int jobFlags;
+    char filePath[FN_REFLEN];
+    char partPath[FN_REFLEN];
+    FILE *file;
+    gzFile gzfile;
+    bool gotResult;
+    bool failed;
+    bool writeHeader;                       //chunks of an export share the header of the first one
+    bool writeTrailer;
+
+    uint numCols;
+    int *kinds;
+    String *columns;                        //buffered block of the columnar format
+    String *nulls;
+    uchar **values;                         //fields of the current row
+    ulong *lengths;
+    uint blockRows;
+    size_t blockBytes;
+};
+
+//keeps the first row of a result set, for queries run by the queue itself
+#define QQUEUE_VALUE_SINK_COLS 4
+
+class qqueue_value_sink : public Protocol_text {
+public:
+    qqueue_value_sink(THD *thd);
+
+    virtual bool send_result_set_metadata(List<Item> *list, uint flags);
+    virtual bool write();
+
+    uint numCols;
+    ulonglong numRows;
+    String values[QQUEUE_VALUE_SINK_COLS];
+    bool isNull[QQUEUE_VALUE_SINK_COLS];
+};
+
+#endif
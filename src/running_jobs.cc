@@ -0,0 +1,210 @@
+/* Copyright (c) 2012, 2013, Adrian M. Partl, eScience Group at the
+   Leibniz Institut for Astrophysics, Potsdam
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; version 2 of the License.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA */
+
+/*****************************************************************
+ ********                  running_jobs                    *******
+ *****************************************************************
+ *
+ * INFORMATION_SCHEMA.QQUEUE_RUNNING table showing the progress
+ * of the jobs that are currently executed by the queue
+ *
+ *****************************************************************
+ */
+
+#define MYSQL_SERVER 1
+
+#include <mysql_version.h>
+#include <sql_class.h>
+#include <sql_show.h>
+#include <table.h>
+#include <mysql/plugin.h>
+#include "sys_tbl.h"
+#include "exec_query.h"
+#include "query_queue.h"
+#include "running_jobs.h"
+#include "thd_sched.h"
+
+#ifdef USE_PRAGMA_IMPLEMENTATION
+#pragma implementation
+#endif
+
+#define QQUEUE_STAGE_LEN 64
+
+struct st_mysql_information_schema qqueue_running_info = {MYSQL_INFORMATION_SCHEMA_INTERFACE_VERSION};
+
+static ST_FIELD_INFO qqueueRunningFields[] = {
+    {"JOB_ID", 21, MYSQL_TYPE_LONGLONG, 0, 0, "Job id", SKIP_OPEN_TABLE},
+    {"USR_ID", 11, MYSQL_TYPE_LONG, 0, 0, "User id", SKIP_OPEN_TABLE},
+    {"QUEUE", QQUEUE_NAME_LEN, MYSQL_TYPE_STRING, 0, 0, "Queue", SKIP_OPEN_TABLE},
+    {"THREAD_ID", 21, MYSQL_TYPE_LONGLONG, 0, MY_I_S_UNSIGNED, "Thread id", SKIP_OPEN_TABLE},
+    {"ELAPSED", 21, MYSQL_TYPE_LONGLONG, 0, 0, "Elapsed seconds", SKIP_OPEN_TABLE},
+    {"STATEMENT", 11, MYSQL_TYPE_LONG, 0, 0, "Statement", SKIP_OPEN_TABLE},
+    {"STAGE", QQUEUE_STAGE_LEN, MYSQL_TYPE_STRING, 0, MY_I_S_MAYBE_NULL, "Stage", SKIP_OPEN_TABLE},
+    {"ROWS_EXAMINED", 21, MYSQL_TYPE_LONGLONG, 0, MY_I_S_UNSIGNED, "Rows examined", SKIP_OPEN_TABLE},
+    {"SOURCE_ROWS", 21, MYSQL_TYPE_LONGLONG, 0, MY_I_S_MAYBE_NULL, "Rows of the source table", SKIP_OPEN_TABLE},
+    {"ETA", 21, MYSQL_TYPE_LONGLONG, 0, MY_I_S_MAYBE_NULL, "Remaining seconds", SKIP_OPEN_TABLE},
+    {"CPU", 11, MYSQL_TYPE_LONG, 0, MY_I_S_MAYBE_NULL, "CPU", SKIP_OPEN_TABLE},
+    {"NUMA_NODE", 11, MYSQL_TYPE_LONG, 0, MY_I_S_MAYBE_NULL, "NUMA node", SKIP_OPEN_TABLE},
+    {"BOUND_NODE", 11, MYSQL_TYPE_LONG, 0, MY_I_S_MAYBE_NULL, "Bound to NUMA node", SKIP_OPEN_TABLE},
+    {"MIGRATIONS", 21, MYSQL_TYPE_LONGLONG, 0, MY_I_S_MAYBE_NULL, "CPU migrations", SKIP_OPEN_TABLE},
+    {0, 0, MYSQL_TYPE_NULL, 0, 0, 0, SKIP_OPEN_TABLE}
+};
+
+//snapshot of a running job, taken while the queue is locked
+struct runningJobInfo : public Sql_alloc {
+    longlong id;
+    int usrId;
+    int queue;
+    ulonglong threadId;
+    longlong elapsed;
+    int stmtIdx;
+    char stage[QQUEUE_STAGE_LEN];
+    ulonglong rowsExamined;
+    longlong sourceRows;
+    pid_t tid;
+    int boundNode;
+};
+
+static int snapshotJob(jobWorkerThd *job, void *arg) {
+    List<runningJobInfo> *jobList = (List<runningJobInfo> *) arg;
+    THD *thd = job->thd;
+    time_t now = my_time(0);
+
+    runningJobInfo *info = new runningJobInfo;
+    if (info == NULL)
+        return 1;
+
+    info->id = job->job->id;
+    info->usrId = job->job->usrId;
+    info->queue = job->job->queue;
+    info->threadId = thd->thread_id;
+    info->stmtIdx = job->stmtIdx;
+    info->tid = job->tid;
+    info->boundNode = job->numaNode;
+    info->rowsExamined = jobRowsRead(thd);
+    info->sourceRows = __sync_fetch_and_add(&job->sourceRows, 0);
+    info->stage[0] = '\0';
+
+#if !defined(MARIADB_BASE_VERSION) && MYSQL_VERSION_ID >= 50605
+    info->elapsed = thd->start_time.tv_sec ? (longlong) (now - thd->start_time.tv_sec) : 0;
+#else
+    info->elapsed = thd->start_time ? (longlong) (now - thd->start_time) : 0;
+#endif
+
+    //the stage is taken the same way SHOW PROCESSLIST gets the query of a thread
+    mysql_mutex_lock(&thd->LOCK_thd_data);
+
+    if (thd->proc_info != NULL)
+        strmake(info->stage, thd->proc_info, QQUEUE_STAGE_LEN - 1);
+
+    mysql_mutex_unlock(&thd->LOCK_thd_data);
+
+    jobList->push_back(info);
+
+    return 0;
+}
+
+static int fillQqueueRunning(THD *thd, TABLE_LIST *tables, Item *cond) {
+    TABLE *table = tables->table;
+    List<runningJobInfo> jobList;
+
+    //copy everything first, so that the queue is not locked while the rows are stored
+    if (iterateRunningJobs(snapshotJob, &jobList) != 0)
+        return 1;
+
+    runningJobInfo *info;
+    List_iterator<runningJobInfo> jobIter(jobList);
+    while ( (info = jobIter++) ) {
+        restore_record(table, s->default_values);
+
+        table->field[0]->store(info->id, false);
+        table->field[1]->store(info->usrId, false);
+
+        qqueue_queues_row *queue = getQueueByID(info->queue);
+        if (queue != NULL) {
+            table->field[2]->store(queue->name, strlen(queue->name), system_charset_info);
+        }
+
+        table->field[3]->store(info->threadId, true);
+        table->field[4]->store(info->elapsed, false);
+        table->field[5]->store(info->stmtIdx, false);
+
+        if (info->stage[0] != '\0') {
+            table->field[6]->set_notnull();
+            table->field[6]->store(info->stage, strlen(info->stage), system_charset_info);
+        }
+
+        table->field[7]->store(info->rowsExamined, true);
+
+        if (info->sourceRows >= 0) {
+            table->field[8]->set_notnull();
+            table->field[8]->store(info->sourceRows, false);
+
+            //assume the remaining rows are read at the same speed as the ones before
+            if (info->rowsExamined > 0 && info->rowsExamined < (ulonglong) info->sourceRows) {
+                double eta = (double) info->elapsed * (info->sourceRows - info->rowsExamined) /
+                             info->rowsExamined;
+                table->field[9]->set_notnull();
+                table->field[9]->store((longlong) eta, false);
+            }
+        }
+
+        //where the worker runs is read from /proc, outside of the queue lock
+        if (info->tid != 0) {
+            longlong migrations;
+            int cpu = schedThreadCpu(info->tid, &migrations);
+
+            if (cpu >= 0) {
+                table->field[10]->set_notnull();
+                table->field[10]->store(cpu, false);
+
+                int node = schedNodeOfCpu(cpu);
+                if (node >= 0) {
+                    table->field[11]->set_notnull();
+                    table->field[11]->store(node, false);
+                }
+            }
+
+            if (migrations >= 0) {
+                table->field[13]->set_notnull();
+                table->field[13]->store(migrations, false);
+            }
+        }
+
+        if (info->boundNode >= 0) {
+            table->field[12]->set_notnull();
+            table->field[12]->store(info->boundNode, false);
+        }
+
+        if (schema_table_store_record(thd, table))
+            return 1;
+    }
+
+    return 0;
+}
+
+int qqueue_running_init(void *p) {
+    ST_SCHEMA_TABLE *schema = (ST_SCHEMA_TABLE *) p;
+
+    schema->fields_info = qqueueRunningFields;
+    schema->fill_table = fillQqueueRunning;
+
+    return 0;
+}
+
+int qqueue_running_deinit(void *p) {
+    return 0;
+}
@@ -0,0 +1,44 @@
+/* Copyright (c) 2012, 2013, Adrian M. Partl, eScience Group at the
+   Leibniz Institut for Astrophysics, Potsdam
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; version 2 of the License.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA */
+
+/*****************************************************************
+ ********                  running_jobs                    *******
+ *****************************************************************
+ *
+ * INFORMATION_SCHEMA.QQUEUE_RUNNING table showing the progress
+ * of the jobs that are currently executed by the queue
+ *
+ *****************************************************************
+ */
+
+#ifndef __MYSQL_RUNNING_JOBS__
+#define __MYSQL_RUNNING_JOBS__
+
+#define MYSQL_SERVER 1
+
+#include <sql_class.h>
+#include <mysql/plugin.h>
+
+#ifdef USE_PRAGMA_IMPLEMENTATION
+#pragma implementation
+#endif
+
+extern struct st_mysql_information_schema qqueue_running_info;
+
+int qqueue_running_init(void *p);
+int qqueue_running_deinit(void *p);
+
+#endif
@@ -0,0 +1,88 @@
+/* Copyright (c) 2012, 2013, Adrian M. Partl, eScience Group at the
+   Leibniz Institut for Astrophysics, Potsdam
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; version 2 of the License.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA */
+
+
+/*****************************************************************
+ ********                   sched_policy                   *******
+ *****************************************************************
+ *
+ * the rules the daemon schedules jobs by, shared with the offline
+ * simulator
+ *
+ *****************************************************************
+ */
+
+#include "sched_policy.h"
+
+int schedJobCmp(const void *job1, const void *job2) {
+    const schedJob *j1 = (const schedJob *) job1;
+    const schedJob *j2 = (const schedJob *) job2;
+
+    //status asc
+    if (j1->status < j2->status) {
+        return -1;
+    } else if (j1->status > j2->status) {
+        return 1;
+    } else {
+        //effective priority desc
+        if (j1->effPriority > j2->effPriority) {
+            return -1;
+        } else if (j1->effPriority < j2->effPriority) {
+            return 1;
+        } else {
+            //time asc
+            if (j1->subTime < j2->subTime) {
+                return -1;
+            } else if (j1->subTime > j2->subTime) {
+                return 1;
+            }
+
+            return 0;
+        }
+    }
+}
+
+//the priority grows by agingRate per hour of waiting, up to agingCap
+long long schedEffectivePriority(long long priority, long long agingRate, long long agingCap, long long waited) {
+    if (agingRate <= 0 || waited <= 0)
+        return priority;
+
+    long long bonus = waited * agingRate / 3600;
+    if (agingCap > 0 && bonus > agingCap)
+        bonus = agingCap;
+
+    return priority + bonus;
+}
+
+bool schedTimedOut(long long runtime, long long timeout) {
+    if (timeout <= 0)
+        return false;
+
+    return runtime >= timeout;
+}
+
+//only jobs in preemptible queues that have not been preempted too often, and only
+//if the pending job outranks them by at least the margin
+bool schedCanPreempt(long long pendingPriority, long long runningPriority, int preemptCount,
+                     bool preemptible, long long preemptMargin, long long maxPreemptions) {
+    if (preemptible == false)
+        return false;
+
+    if (preemptCount >= maxPreemptions)
+        return false;
+
+    return pendingPriority >= runningPriority + preemptMargin;
+}
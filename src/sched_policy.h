@@ -0,0 +1,60 @@
+/* Copyright (c) 2012, 2013, Adrian M. Partl, eScience Group at the
+   Leibniz Institut for Astrophysics, Potsdam
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; version 2 of the License.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA */
+
+
+/*****************************************************************
+ ********                   sched_policy                   *******
+ *****************************************************************
+ *
+ * the rules the daemon schedules jobs by: the order of pending
+ * jobs, aging of their priority, timeouts and preemption. nothing
+ * in here depends on the server, so that the offline simulator in
+ * sim/ schedules exactly like the queue does
+ *
+ *****************************************************************
+ */
+
+#ifndef __MYSQL_SCHED_POLICY__
+#define __MYSQL_SCHED_POLICY__
+
+//compact descriptor of a job used for scheduling. the job itself is only
+//read from the table once it has been selected
+struct schedJob {
+    long long id;
+    long long subTime;                      //submission time in seconds
+    int effPriority;
+    int usrId;
+    int usrGroup;
+    char status;
+};
+
+//qsort comparator: pending jobs first, then effective priority descending,
+//then the oldest submission first
+int schedJobCmp(const void *job1, const void *job2);
+
+//priority of a job that has been waiting for waited seconds in a queue with the
+//given aging rate (per hour) and cap (0 for none)
+long long schedEffectivePriority(long long priority, long long agingRate, long long agingCap, long long waited);
+
+//whether a job that has been running for runtime seconds has reached the timeout
+//of its queue (0 for none)
+bool schedTimedOut(long long runtime, long long timeout);
+
+//whether a running job may give its slot to a pending job with pendingPriority
+bool schedCanPreempt(long long pendingPriority, long long runningPriority, int preemptCount,
+                     bool preemptible, long long preemptMargin, long long maxPreemptions);
+
+#endif
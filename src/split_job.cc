@@ -0,0 +1,470 @@
+/* Copyright (c) 2012, 2013, Adrian M. Partl, eScience Group at the
+   Leibniz Institut for Astrophysics, Potsdam
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; version 2 of the License.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA */
+
+
+/*****************************************************************
+ ********                    split_job                     *******
+ *****************************************************************
+ *
+ * jobs flagged with QQUEUE_JOB_SPLIT whose query is a plain select
+ * on a table with a single integer primary key are run in key
+ * ranges by sub-jobs. the first time the job is picked up, its
+ * worker adds one sub-job per range, each writing the rows of its
+ * range to a table of its own, and leaves the job waiting without
+ * a slot. the last sub-job to end sets the job pending again, and
+ * the next time the job runs, it puts the tables of the sub-jobs
+ * together into its result table.
+ *
+ *****************************************************************
+ */
+
+#define MYSQL_SERVER 1
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sql_class.h>
+#include <tztime.h>
+#include "sys_tbl.h"
+#include "exec_query.h"
+#include "sql_query.h"
+#include "quota.h"
+#include "pk_range.h"
+#include "query_queue.h"
+#include "split_job.h"
+#include "event_trace.h"
+
+#ifdef USE_PRAGMA_IMPLEMENTATION
+#pragma implementation
+#endif
+
+long splitJobs;
+
+static mysql_mutex_t LOCK_split;
+
+void initSplitJobs() {
+    mysql_mutex_init(0, &LOCK_split, MY_MUTEX_INIT_FAST);
+}
+
+void freeSplitJobs() {
+    mysql_mutex_destroy(&LOCK_split);
+}
+
+//name of the table sub-job i of a job writes to
+static void subJobTableName(long long parentId, int i, char *name) {
+    snprintf(name, QQUEUE_RESULTTBLNAME_LEN, "qqueue_split_%lli_%i", parentId, i);
+}
+
+//the same, quoted and qualified with the result database of the job
+static void subJobTable(qqueue_jobs_row *job, int i, char *table) {
+    char name[QQUEUE_RESULTTBLNAME_LEN];
+    char quotedDb[QQUEUE_QUOTED_LEN(QQUEUE_RESULTDBNAME_LEN)];
+    char quotedName[QQUEUE_QUOTED_LEN(QQUEUE_RESULTTBLNAME_LEN)];
+
+    subJobTableName(job->id, i, name);
+    quoteName(job->resultDBName, quotedDb);
+    quoteName(name, quotedName);
+
+    sprintf(table, "%s.%s", quotedDb, quotedName);
+}
+
+#define QQUEUE_SUBJOB_TABLE_LEN (QQUEUE_QUOTED_LEN(QQUEUE_RESULTDBNAME_LEN) + QQUEUE_QUOTED_LEN(QQUEUE_RESULTTBLNAME_LEN) + 1)
+
+//drops the tables of the sub-jobs of a job
+void dropSubJobTables(THD *thd, qqueue_jobs_row *job) {
+    char table[QQUEUE_SUBJOB_TABLE_LEN];
+    char query[QQUEUE_SUBJOB_TABLE_LEN + 32];
+
+    for (int i = 0; i < job->subJobs; i++) {
+        char *queryError = NULL;
+
+        subJobTable(job, i, table);
+        snprintf(query, sizeof(query), "DROP TABLE IF EXISTS %s", table);
+
+        if (execSimpleQuery(thd, query, &queryError) != 0) {
+            fprintf(stderr, "dropSubJobTables: could not drop %s: %s\n", table,
+                    queryError != NULL ? queryError : "");
+            if (queryError != NULL)
+                my_free(queryError);
+        }
+    }
+}
+
+//adds the sub-jobs of a job and leaves the job waiting for them
+//returns 0 if the job is run as it is, 1 if it has been split
+static int splitQuery(jobWorkerThd *jobArg) {
+    qqueue_jobs_row *job = jobArg->job;
+    qqueue_simple_select select;
+    qqueue_pk_range range;
+    char db[NAME_LEN + 1];
+    char table[NAME_LEN + 1];
+
+    //anything that cannot be split is run as a whole
+    if (splitJobs < 2 || parseSimpleSelect(job->query, &select) != 0)
+        return 0;
+
+    //the key of the table is looked up in the database the query names
+    if (splitTableName(select.table, select.tableLen, NULL, db, table) != 0 ||
+        getPkRange(jobArg->thd, db, table, &range) != 0)
+        return 0;
+
+    int numSubJobs = pkRangeChunks(&range, splitJobs, 1);
+    if (numSubJobs < 2)
+        return 0;
+
+    size_t queryLen = select.columnsLen + select.tableLen + select.whereLen +
+                      QQUEUE_SUBJOB_TABLE_LEN + 4 * NAME_LEN + 256;
+    char *query = (char *) my_malloc(queryLen, MYF(0));
+    if (query == NULL)
+        return 0;
+
+    MYSQL_TIME localTime;
+    current_thd->variables.time_zone->gmt_sec_to_TIME(&localTime, (my_time_t) my_time(0));
+    MYSQL_TIME nullTime = {0, 0, 0, 0, 0, 0, 0, 0};
+
+    List<qqueue_jobs_row> subJobList;
+    ulonglong firstId = newJobIdRange(numSubJobs);
+    for (int i = 0; i < numSubJobs; i++) {
+        char subTable[QQUEUE_SUBJOB_TABLE_LEN];
+        char subTableName[QQUEUE_RESULTTBLNAME_LEN];
+        char cond[4 * NAME_LEN + 128];
+        longlong from;
+        longlong to;
+        bool last;
+
+        pkRangeChunk(&range, numSubJobs, i, &from, &to, &last);
+        pkRangeCondition(&range, from, to, last, cond, sizeof(cond));
+        subJobTable(job, i, subTable);
+
+        //the condition of the query may end in a comment, hence the line break
+        if (select.where != NULL) {
+            snprintf(query, queryLen, "CREATE TABLE %s SELECT %.*s FROM %.*s WHERE (%.*s\n) AND %s", subTable,
+                     (int) select.columnsLen, select.columns, (int) select.tableLen, select.table,
+                     (int) select.whereLen, select.where, cond);
+        } else {
+            snprintf(query, queryLen, "CREATE TABLE %s SELECT %.*s FROM %.*s WHERE %s", subTable,
+                     (int) select.columnsLen, select.columns, (int) select.tableLen, select.table, cond);
+        }
+
+        qqueue_jobs_row *subJob = new qqueue_jobs_row();
+        subJob->id = firstId + i;
+        subJob->usrId = job->usrId;
+        subJob->usrGroup = job->usrGroup;
+        subJob->queue = job->queue;
+        subJob->priority = job->priority;
+        subJob->effPriority = job->effPriority;
+        subJob->status = QUEUE_PENDING;
+        subJob->paquFlag = 1;
+        subJob->parentJob = job->id;
+        subJob->timeSubmit = localTime;
+        subJob->timeExecute = nullTime;
+        subJob->timeFinish = nullTime;
+        subJob->mysqlUserName = subJob->dupString(job->mysqlUserName);
+        subJob->query = subJob->dupString(query);
+        subJob->setActualQuery(query, strlen(query));
+        subJob->resultDBName = subJob->dupString(job->resultDBName);
+        subJobTableName(job->id, i, subTableName);
+        subJob->resultTableName = subJob->dupString(subTableName);
+        subJob->comment = subJob->dupString(job->comment);
+
+        subJobList.push_back(subJob);
+    }
+
+    my_free(query);
+
+    //the job gives up its slot while the sub-jobs run
+    job->status = QUEUE_WAITING;
+    job->subJobs = numSubJobs;
+
+    int error = 0;
+    int added = 0;
+    Open_tables_backup backup;
+    TABLE *tbl = open_sysTbl(current_thd, "qqueue_jobs", strlen("qqueue_jobs"), &backup, true, &error);
+    if (error || tbl == NULL) {
+        fprintf(stderr, "splitQuery: error in opening jobs sys table: error: %i\n", error);
+        close_sysTbl(current_thd, tbl, &backup);
+        job->status = QUEUE_RUNNING;
+        job->subJobs = 0;
+        subJobList.delete_elements();
+        return 0;
+    }
+
+    qqueue_jobs_row *subJob;
+    List_iterator<qqueue_jobs_row> subJobIter(subJobList);
+    while ( (subJob = subJobIter++) ) {
+        if (addQqueueJobsRow(subJob, tbl, subJob->id) != 0)
+            break;
+        added++;
+    }
+
+    //if not all sub-jobs are there, the job runs as a whole
+    if (added < numSubJobs || updateQqueueJobsRow(job, tbl) != 0) {
+        fprintf(stderr, "splitQuery: could not add the sub-jobs of job %lli, running it as a whole\n", job->id);
+
+        subJobIter.rewind();
+        for (int i = 0; i < added && (subJob = subJobIter++); i++)
+            deleteQqueueJobsRow(subJob->id, tbl);
+
+        close_sysTbl(current_thd, tbl, &backup);
+        job->status = QUEUE_RUNNING;
+        job->subJobs = 0;
+        subJobList.delete_elements();
+        return 0;
+    }
+
+    close_sysTbl(current_thd, tbl, &backup);
+
+    subJobIter.rewind();
+    while ( (subJob = subJobIter++) )
+        traceEvent(QQUEUE_EV_ENQUEUE, subJob->id, 0);
+    subJobList.delete_elements();
+
+    quotaJobEnded(job->usrId, job->usrGroup);
+    quotaJobsAdded(job->usrId, job->usrGroup, numSubJobs);
+
+    jobArg->parked = true;
+
+    return 1;
+}
+
+//replaces the query of a job whose sub-jobs are done by one that puts their tables together
+//returns 0 if the job is run, 1 if it failed
+static int mergeSubJobs(jobWorkerThd *jobArg) {
+    qqueue_jobs_row *job = jobArg->job;
+
+    //a sub-job that did not make it fails the whole job
+    if (job->error != NULL) {
+        jobArg->error = my_strdup(job->error, MYF(0));
+        dropSubJobTables(jobArg->thd, job);
+        return 1;
+    }
+
+    char tableOptions[QQUEUE_TABLE_OPTIONS_LEN];
+    qqueue_queues_row *queue = getQueueByID(job->queue);
+    if (queue == NULL || buildResultTableOptions(queue, tableOptions, sizeof(tableOptions)) != 0)
+        tableOptions[0] = '\0';
+
+    char quotedDb[QQUEUE_QUOTED_LEN(QQUEUE_RESULTDBNAME_LEN)];
+    char quotedTable[QQUEUE_QUOTED_LEN(QQUEUE_RESULTTBLNAME_LEN)];
+    quoteName(job->resultDBName, quotedDb);
+    quoteName(job->resultTableName, quotedTable);
+
+    size_t queryLen = sizeof(quotedDb) + sizeof(quotedTable) + sizeof(tableOptions) +
+                      job->subJobs * (QQUEUE_SUBJOB_TABLE_LEN + 32) + 64;
+    char *query = (char *) my_malloc(queryLen, MYF(0));
+    if (query == NULL) {
+        jobArg->error = my_strdup("Out of memory when merging the sub-jobs", MYF(0));
+        return 1;
+    }
+
+    //the tables of the sub-jobs are only dropped once the result table is there, a job
+    //preempted before that merges them again
+    char subTable[QQUEUE_SUBJOB_TABLE_LEN];
+    size_t pos = snprintf(query, queryLen, "CREATE TABLE %s.%s%s ", quotedDb, quotedTable, tableOptions);
+    for (int i = 0; i < job->subJobs; i++) {
+        subJobTable(job, i, subTable);
+        pos += snprintf(query + pos, queryLen - pos, "%sSELECT * FROM %s", i > 0 ? " UNION ALL " : "", subTable);
+    }
+
+    pos += snprintf(query + pos, queryLen - pos, "; DROP TABLE IF EXISTS ");
+    for (int i = 0; i < job->subJobs; i++) {
+        subJobTable(job, i, subTable);
+        pos += snprintf(query + pos, queryLen - pos, "%s%s", i > 0 ? ", " : "", subTable);
+    }
+
+    job->setActualQuery(query, pos);
+    my_free(query);
+
+    return 0;
+}
+
+//called on the worker before the job runs
+//returns 0 if the worker runs the job, 1 if it has been split or failed
+int splitJobStart(jobWorkerThd *job) {
+    if ((job->job->jobFlags & QQUEUE_JOB_SPLIT) == 0 || job->job->parentJob != 0)
+        return 0;
+
+    if (job->job->subJobs > 0)
+        return mergeSubJobs(job);
+
+    return splitQuery(job);
+}
+
+//called once a sub-job has been moved to the history. the job it belongs to takes over
+//its accounting and is set pending again once all its sub-jobs are done
+void subJobEnded(qqueue_jobs_row *job) {
+    if (job->parentJob == 0)
+        return;
+
+    //the sub-jobs of a job may end at the same time
+    mysql_mutex_lock(&LOCK_split);
+
+    int error = 0;
+    Open_tables_backup backup;
+    TABLE *tbl = open_sysTbl(current_thd, "qqueue_jobs", strlen("qqueue_jobs"), &backup, true, &error);
+    if (error || tbl == NULL) {
+        fprintf(stderr, "subJobEnded: error in opening jobs sys table: error: %i\n", error);
+        close_sysTbl(current_thd, tbl, &backup);
+        mysql_mutex_unlock(&LOCK_split);
+        return;
+    }
+
+    qqueue_jobs_row *parent = getJobFromID(tbl, job->parentJob);
+
+    //the job has been killed, nobody needs the rows anymore
+    if (parent == NULL || parent->status != QUEUE_WAITING) {
+        close_sysTbl(current_thd, tbl, &backup);
+        mysql_mutex_unlock(&LOCK_split);
+
+        char query[QQUEUE_RESULTDBNAME_LEN + QQUEUE_RESULTTBLNAME_LEN + 64];
+        char *queryError = NULL;
+        snprintf(query, sizeof(query), "DROP TABLE IF EXISTS `%s`.`%s`", job->resultDBName, job->resultTableName);
+        if (execSimpleQuery(current_thd, query, &queryError) != 0 && queryError != NULL)
+            my_free(queryError);
+
+        if (parent != NULL)
+            delete parent;
+        return;
+    }
+
+    if (job->status != QUEUE_SUCCESS && parent->error == NULL) {
+        char message[QQUEUE_ERROR_LEN];
+        snprintf(message, sizeof(message), "Sub-job %lli did not succeed: %s", job->id,
+                 job->error != NULL ? job->error : "killed");
+        parent->setError(message);
+    }
+
+    parent->throttleTime += job->throttleTime;
+
+    if (countQqueueSubJobs(parent->id, tbl) == 0) {
+        parent->status = QUEUE_PENDING;
+        quotaJobsAdded(parent->usrId, parent->usrGroup, 1);
+    }
+
+    updateQqueueJobsRow(parent, tbl);
+
+    close_sysTbl(current_thd, tbl, &backup);
+    mysql_mutex_unlock(&LOCK_split);
+
+    delete parent;
+}
+
+//kills the sub-jobs of a job that has been deleted. pending ones go to the history
+//right away, running ones are handed to the reaper
+void killSubJobs(long long parentId) {
+    List<qqueue_jobs_row> subJobList;
+
+    int error = 0;
+    Open_tables_backup backup;
+    TABLE *tbl = open_sysTbl(current_thd, "qqueue_jobs", strlen("qqueue_jobs"), &backup, true, &error);
+    if (error || tbl == NULL) {
+        fprintf(stderr, "killSubJobs: error in opening jobs sys table: error: %i\n", error);
+        close_sysTbl(current_thd, tbl, &backup);
+        return;
+    }
+
+    READ_RECORD read_record_info;
+    init_read_record(&read_record_info, current_thd, tbl, NULL, 1, 0, FALSE);
+    tbl->use_all_columns();
+
+    while (!(read_record_info.read_record(&read_record_info))) {
+        if (sysTblInt(tbl, 24, 0) == parentId)
+            subJobList.push_back(extractJobFromTable(tbl));
+    }
+
+    end_read_record(&read_record_info);
+
+    MYSQL_TIME localTime;
+    current_thd->variables.time_zone->gmt_sec_to_TIME(&localTime, (my_time_t) my_time(0));
+
+    List<qqueue_jobs_row> deletedList;
+    qqueue_jobs_row *subJob;
+    List_iterator<qqueue_jobs_row> subJobIter(subJobList);
+    while ( (subJob = subJobIter++) ) {
+        if (subJob->status == QUEUE_PENDING && deleteQqueueJobsRow(subJob->id, tbl) == 0) {
+            quotaJobDeleted(subJob->usrId, subJob->usrGroup);
+            subJob->status = QUEUE_DELETED;
+            subJob->timeFinish = localTime;
+            deletedList.push_back(subJob);
+        }
+    }
+
+    close_sysTbl(current_thd, tbl, &backup);
+
+    subJobIter.rewind();
+    while ( (subJob = subJobIter++) ) {
+        if (subJob->status == QUEUE_RUNNING)
+            registerJobKill(subJob->id);
+    }
+
+    if (deletedList.is_empty() == false) {
+        tbl = open_sysTbl(current_thd, "qqueue_history", strlen("qqueue_history"), &backup, true, &error);
+        if (error || tbl == NULL) {
+            fprintf(stderr, "killSubJobs: error in opening history sys table: error: %i\n", error);
+        } else {
+            List_iterator<qqueue_jobs_row> deletedIter(deletedList);
+            while ( (subJob = deletedIter++) ) {
+                addQqueueJobsRow(subJob, tbl, subJob->id);
+            }
+        }
+        close_sysTbl(current_thd, tbl, &backup);
+    }
+
+    subJobList.delete_elements();
+}
+
+//jobs still waiting after a restart whose sub-jobs are all gone are set pending again.
+//this is only needed if the server went down while the last sub-job ended
+//returns the number of jobs set pending
+int resumeSplitJobs() {
+    List<qqueue_jobs_row> waitingList;
+    int count = 0;
+
+    int error = 0;
+    Open_tables_backup backup;
+    TABLE *tbl = open_sysTbl(current_thd, "qqueue_jobs", strlen("qqueue_jobs"), &backup, true, &error);
+    if (error || tbl == NULL) {
+        fprintf(stderr, "resumeSplitJobs: error in opening jobs sys table: error: %i\n", error);
+        close_sysTbl(current_thd, tbl, &backup);
+        return -1;
+    }
+
+    READ_RECORD read_record_info;
+    init_read_record(&read_record_info, current_thd, tbl, NULL, 1, 0, FALSE);
+    tbl->use_all_columns();
+
+    while (!(read_record_info.read_record(&read_record_info))) {
+        if (tbl->field[7]->val_int() == QUEUE_WAITING)
+            waitingList.push_back(extractJobFromTable(tbl));
+    }
+
+    end_read_record(&read_record_info);
+
+    qqueue_jobs_row *job;
+    List_iterator<qqueue_jobs_row> waitingIter(waitingList);
+    while ( (job = waitingIter++) ) {
+        if (countQqueueSubJobs(job->id, tbl) == 0) {
+            job->status = QUEUE_PENDING;
+            updateQqueueJobsRow(job, tbl);
+            count++;
+        }
+    }
+
+    close_sysTbl(current_thd, tbl, &backup);
+    waitingList.delete_elements();
+
+    return count;
+}
@@ -0,0 +1,54 @@
+/* Copyright (c) 2012, 2013, Adrian M. Partl, eScience Group at the
+   Leibniz Institut for Astrophysics, Potsdam
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; version 2 of the License.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA */
+
+
+/*****************************************************************
+ ********                    split_job                     *******
+ *****************************************************************
+ *
+ * jobs that are split into sub-jobs, each reading a primary key
+ * range of the table the query scans
+ *
+ *****************************************************************
+ */
+
+#ifndef __MYSQL_SPLIT_JOB__
+#define __MYSQL_SPLIT_JOB__
+
+#define MYSQL_SERVER 1
+
+#include <sql_class.h>
+#include "sys_tbl.h"
+#include "exec_query.h"
+
+#ifdef USE_PRAGMA_IMPLEMENTATION
+#pragma implementation
+#endif
+
+#define QQUEUE_MAX_SPLIT_JOBS 64
+
+extern long splitJobs;
+
+void initSplitJobs();
+void freeSplitJobs();
+
+int splitJobStart(jobWorkerThd *job);
+void subJobEnded(qqueue_jobs_row *job);
+void killSubJobs(long long parentId);
+void dropSubJobTables(THD *thd, qqueue_jobs_row *job);
+int resumeSplitJobs();
+
+#endif
@@ -29,6 +29,8 @@
 #include <stdlib.h>
 #include <sql_list.h>
 #include <ctype.h>
+#include <strings.h>
+#include <mysql_version.h>
 #include "sql_query.h"
 
 
@@ -38,7 +40,8 @@
 
 #define PLACEHOLDER_STRING "/*@GEN_RES_TABLE_HERE*/"
 
-int addResultTableSQLAtPlaceholder(const char *inQuery, char **outQuery, char *db, char *table) {
+int addResultTableSQLAtPlaceholder(const char *inQuery, char **outQuery, char *db, char *table,
+                                   const char *tableOptions) {
     //find the placeholder string in the query
     const char placeholderString[] = PLACEHOLDER_STRING;
 
@@ -53,14 +56,14 @@ int addResultTableSQLAtPlaceholder(const char *inQuery, char **outQuery, char *d
     int prePend = plcStr - inQuery;
 
     //build create table select string
-    int strLen = strlen(db) + strlen(table) + 5 + strlen("CREATE TABLE  ");
+    int strLen = strlen(db) + strlen(table) + strlen(tableOptions) + 5 + strlen("CREATE TABLE  ");
     char *addStr = (char *)malloc(strLen);
     if (addStr == NULL) {
         fprintf(stderr, "addResultTableSQLAtPlaceholder: unable to allocate enough memory\n");
         return 1;
     }
 
-    sprintf(addStr, " CREATE TABLE %s.%s ", db, table);
+    sprintf(addStr, " CREATE TABLE %s.%s%s ", db, table, tableOptions);
 
     //build output string
     *outQuery = (char *)malloc(strlen(inQuery) + strLen);
@@ -82,7 +85,8 @@ int addResultTableSQLAtPlaceholder(const char *inQuery, char **outQuery, char *d
     return 0;
 }
 
-int addResultTableSQL(const char *inQuery, char **outQuery, char *db, char *table) {
+int addResultTableSQL(const char *inQuery, char **outQuery, char *db, char *table,
+                      const char *tableOptions) {
     //create a copy of the in string
     int numTok = 0;
     char *uppCseStrCpy;
@@ -124,14 +128,14 @@ int addResultTableSQL(const char *inQuery, char **outQuery, char *db, char *tabl
     }
 
     //build create table select string
-    int strLen = strlen(db) + strlen(table) + 5 + strlen("CREATE TABLE  ");
+    int strLen = strlen(db) + strlen(table) + strlen(tableOptions) + 5 + strlen("CREATE TABLE  ");
     char *addStr = (char *)malloc(strLen);
     if (addStr == NULL) {
         fprintf(stderr, "addResultTableSQL: unable to allocate enough memory\n");
         return 1;
     }
 
-    sprintf(addStr, "CREATE TABLE %s.%s ", db, table);
+    sprintf(addStr, "CREATE TABLE %s.%s%s ", db, table, tableOptions);
 
     //build output string
     *outQuery = (char *)malloc(strlen(inQuery) + strLen);
@@ -154,10 +158,87 @@ int addResultTableSQL(const char *inQuery, char **outQuery, char *db, char *tabl
     return 0;
 }
 
+static bool isSQLIdentifier(const char *str) {
+    if (str[0] == '\0')
+        return false;
+
+    for (const char *curr = str; *curr != '\0'; curr++) {
+        if (!isalnum(*curr) && *curr != '_')
+            return false;
+    }
+
+    return true;
+}
+
+//builds the table options the result tables of a queue are created with, like
+//" ENGINE=InnoDB ROW_FORMAT=COMPRESSED KEY_BLOCK_SIZE=8". the options are put
+//verbatim into the DDL, so anything that is not a plain name or a sane path is
+//refused.
+//returns 0 on success, 1 if an option is invalid
+int buildResultTableOptions(qqueue_queues_row *queue, char *tableOptions, size_t len) {
+    size_t pos = 0;
+
+    tableOptions[0] = '\0';
+
+    if (queue->resultEngine[0] != '\0') {
+        if (isSQLIdentifier(queue->resultEngine) == false) {
+            fprintf(stderr, "buildResultTableOptions: invalid engine '%s' in queue %s\n",
+                    queue->resultEngine, queue->name);
+            return 1;
+        }
+
+        pos += snprintf(tableOptions + pos, len - pos, " ENGINE=%s", queue->resultEngine);
+    }
+
+    if (queue->resultRowFormat[0] != '\0') {
+        if (isSQLIdentifier(queue->resultRowFormat) == false) {
+            fprintf(stderr, "buildResultTableOptions: invalid row format '%s' in queue %s\n",
+                    queue->resultRowFormat, queue->name);
+            return 1;
+        }
+
+        pos += snprintf(tableOptions + pos, len - pos, " ROW_FORMAT=%s", queue->resultRowFormat);
+    }
+
+    if (queue->resultCompression != 0) {
+        int size = queue->resultCompression;
+        if (size != 1 && size != 2 && size != 4 && size != 8 && size != 16) {
+            fprintf(stderr, "buildResultTableOptions: invalid compression %i in queue %s\n",
+                    size, queue->name);
+            return 1;
+        }
+
+        //compression implies the compressed row format if no other one is given
+        if (queue->resultRowFormat[0] == '\0' && pos < len)
+            pos += snprintf(tableOptions + pos, len - pos, " ROW_FORMAT=COMPRESSED");
+
+        if (pos < len)
+            pos += snprintf(tableOptions + pos, len - pos, " KEY_BLOCK_SIZE=%i", size);
+    }
+
+    if (queue->resultDataDir[0] != '\0') {
+        if (queue->resultDataDir[0] != '/' || strpbrk(queue->resultDataDir, "'\\") != NULL) {
+            fprintf(stderr, "buildResultTableOptions: invalid data directory '%s' in queue %s\n",
+                    queue->resultDataDir, queue->name);
+            return 1;
+        }
+
+        if (pos < len)
+            pos += snprintf(tableOptions + pos, len - pos, " DATA DIRECTORY='%s'", queue->resultDataDir);
+    }
+
+    if (pos >= len) {
+        fprintf(stderr, "buildResultTableOptions: options of queue %s are too long\n", queue->name);
+        return 1;
+    }
+
+    return 0;
+}
+
 //loops though a multiline query to see, if there is no query that points into
 //nirvana...
 //returns 0 on success, 1 one fail
-int validateMultiSQL(const char *inQuery) {
+int validateMultiSQL(const char *inQuery, bool allowLastSelect) {
     //create a copy of the in string
     int numTok = 0;
     char *uppCseStrCpy;
@@ -199,6 +280,19 @@ int validateMultiSQL(const char *inQuery) {
     char *selectPt;
     char *createPt;
     while ( (currStr = tokenList_iter++) ) {
+        //the list is reversed, the first statement that is not empty is the last one.
+        //a job writing to a file sends the result of that one to the client
+        if (allowLastSelect == true) {
+            const char *curr = currStr;
+            while (*curr != '\0' && isspace(*curr))
+                curr++;
+
+            if (*curr != '\0')
+                allowLastSelect = false;
+
+            continue;
+        }
+
         selectPt = strstr(currStr, "SELECT ");
         if (selectPt != NULL) {
             //each select, needs to come with a create...
@@ -206,6 +300,7 @@ int validateMultiSQL(const char *inQuery) {
 
             if (createPt == NULL) {
                 //found a bad guy, give up and let upper routine raise alarm
+                free(uppCseStrCpy);
                 return 1;
             }
 
@@ -248,4 +343,280 @@ int splitQueries(const char *inQuery, query_list **outQueryList) {
     }
 
     return numTok;
-}
\ No newline at end of file
+}
+
+//checks whether a comment starting at /* is run by this server like the lexer
+//does it: /*! ... */ always, /*!NNNNN ... */ if the server is at least version
+//NNNNN and /*M! ... */ on MariaDB only. returns the start of the contents of
+//an executable comment, otherwise NULL
+static const char *executableComment(const char *comment) {
+    const char *currPos = comment + 2;
+
+    if (*currPos == 'M' && *(currPos + 1) == '!') {
+#ifndef MARIADB_BASE_VERSION
+        return NULL;
+#endif
+        currPos++;
+    }
+
+    if (*currPos != '!')
+        return NULL;
+    currPos++;
+
+    //version numbers have five digits, MariaDB also takes six
+    int numDigits = 0;
+    while (numDigits < 6 && isdigit((unsigned char) currPos[numDigits]))
+        numDigits++;
+
+#ifdef MARIADB_BASE_VERSION
+    if (numDigits < 5)
+        numDigits = 0;
+#else
+    numDigits = numDigits >= 5 ? 5 : 0;
+#endif
+
+    long version = 0;
+    for (int i = 0; i < numDigits; i++)
+        version = version * 10 + (currPos[i] - '0');
+
+    if (numDigits > 0) {
+        if (version > MYSQL_VERSION_ID)
+            return NULL;
+        currPos += numDigits;
+    }
+
+    return currPos;
+}
+
+//returns a pointer to the beginning of statement numStmts (counting from 0) in a
+//multi statement query or NULL, if the query has less statements. semicolons in
+//strings, quoted identifiers and comments do not end a statement, but those in
+//comments the server executes do.
+const char *skipSQLStatements(const char *inQuery, int numStmts) {
+    const char *currPos = inQuery;
+    char quote = '\0';
+    bool inExecutableComment = false;
+
+    while (numStmts > 0 && *currPos != '\0') {
+        if (quote != '\0') {
+            if (*currPos == '\\' && quote != '`' && *(currPos + 1) != '\0') {
+                currPos++;
+            } else if (*currPos == quote) {
+                quote = '\0';
+            }
+        } else if (*currPos == '\'' || *currPos == '"' || *currPos == '`') {
+            quote = *currPos;
+        } else if (*currPos == '#' ||
+                   (*currPos == '-' && *(currPos + 1) == '-' &&
+                    (*(currPos + 2) == ' ' || *(currPos + 2) == '\t'))) {
+            //comment up to the end of the line
+            while (*currPos != '\0' && *currPos != '\n')
+                currPos++;
+            continue;
+        } else if (*currPos == '/' && *(currPos + 1) == '*' && inExecutableComment == false) {
+            const char *contents = executableComment(currPos);
+            if (contents != NULL) {
+                inExecutableComment = true;
+                currPos = contents;
+                continue;
+            }
+
+            const char *endOfComment = strstr(currPos + 2, "*/");
+            if (endOfComment == NULL)
+                return NULL;
+            currPos = endOfComment + 2;
+            continue;
+        } else if (*currPos == '*' && *(currPos + 1) == '/' && inExecutableComment == true) {
+            inExecutableComment = false;
+            currPos += 2;
+            continue;
+        } else if (*currPos == ';') {
+            numStmts--;
+        }
+
+        currPos++;
+    }
+
+    if (numStmts > 0)
+        return NULL;
+
+    //remove any whitespace from the start of the statement
+    while (*currPos != '\0' && isspace((unsigned char) *currPos))
+        currPos++;
+
+    if (*currPos == '\0')
+        return NULL;
+
+    return currPos;
+}
+
+//words that make a query more than a filter or a projection of a single table
+static const char *complexWords[] = {
+    "SELECT", "UNION", "JOIN", "STRAIGHT_JOIN", "GROUP", "ORDER", "LIMIT", "HAVING", "INTO",
+    "DISTINCT", "DISTINCTROW", "PROCEDURE", "FOR", "LOCK", "WINDOW", "OVER",
+    "COUNT", "SUM", "AVG", "MIN", "MAX", "GROUP_CONCAT", "STD", "STDDEV", "STDDEV_POP",
+    "STDDEV_SAMP", "VARIANCE", "VAR_POP", "VAR_SAMP", "BIT_AND", "BIT_OR", "BIT_XOR",
+    NULL
+};
+
+static bool isWordChar(char c) {
+    return isalnum((unsigned char) c) || c == '_' || c == '$';
+}
+
+static bool isComplexWord(const char *word, size_t len) {
+    for (int i = 0; complexWords[i] != NULL; i++) {
+        if (strlen(complexWords[i]) == len && strncasecmp(complexWords[i], word, len) == 0)
+            return true;
+    }
+
+    return false;
+}
+
+//checks that a table reference is a plain [db.]table name
+static bool isTableName(const char *table, size_t len) {
+    const char *end = table + len;
+    int parts = 0;
+
+    while (table < end) {
+        if (*table == '`') {
+            const char *close = table + 1;
+            while (close < end && *close != '`')
+                close++;
+            if (close >= end || close == table + 1)
+                return false;
+            table = close + 1;
+        } else if (isWordChar(*table)) {
+            while (table < end && isWordChar(*table))
+                table++;
+        } else {
+            return false;
+        }
+
+        parts++;
+        if (table < end) {
+            if (*table != '.' || parts == 2)
+                return false;
+            table++;
+            if (table == end)
+                return false;
+        }
+    }
+
+    return parts > 0;
+}
+
+//finds the parts of a query of the form SELECT <columns> FROM <table> [WHERE <condition>],
+//reading from a single table without aggregation, sorting, limits or subqueries.
+//queries like this can be run over ranges of the table and the results put together
+//returns 0 on success, 1 if the query does not have this form
+int parseSimpleSelect(const char *query, qqueue_simple_select *select) {
+    const char *currPos = query;
+    const char *fromPos = NULL;
+    const char *wherePos = NULL;
+    const char *endPos = NULL;
+    int depth = 0;
+    int words = 0;
+
+    memset(select, 0, sizeof(qqueue_simple_select));
+
+    while (*currPos != '\0') {
+        if (*currPos == '\'' || *currPos == '"' || *currPos == '`') {
+            char quote = *currPos++;
+            while (*currPos != '\0' && *currPos != quote) {
+                if (*currPos == '\\' && quote != '`' && *(currPos + 1) != '\0')
+                    currPos++;
+                currPos++;
+            }
+            if (*currPos == '\0')
+                return 1;
+            currPos++;
+            continue;
+        } else if (*currPos == '#' ||
+                   (*currPos == '-' && *(currPos + 1) == '-' &&
+                    (*(currPos + 2) == ' ' || *(currPos + 2) == '\t'))) {
+            while (*currPos != '\0' && *currPos != '\n')
+                currPos++;
+            continue;
+        } else if (*currPos == '/' && *(currPos + 1) == '*') {
+            const char *endOfComment = strstr(currPos + 2, "*/");
+            if (endOfComment == NULL)
+                return 1;
+            currPos = endOfComment + 2;
+            continue;
+        } else if (*currPos == '(') {
+            depth++;
+        } else if (*currPos == ')') {
+            if (--depth < 0)
+                return 1;
+        } else if (*currPos == ';' && depth == 0) {
+            //only a single statement
+            endPos = currPos;
+            for (currPos++; *currPos != '\0'; currPos++) {
+                if (!isspace((unsigned char) *currPos))
+                    return 1;
+            }
+            break;
+        } else if (isWordChar(*currPos) && (currPos == query || !isWordChar(*(currPos - 1)))) {
+            const char *word = currPos;
+            while (isWordChar(*currPos))
+                currPos++;
+            size_t len = currPos - word;
+
+            if (words++ == 0) {
+                if (len != 6 || strncasecmp(word, "SELECT", 6) != 0)
+                    return 1;
+                select->columns = currPos;
+            } else if (depth == 0 && fromPos == NULL && len == 4 && strncasecmp(word, "FROM", 4) == 0) {
+                fromPos = word;
+                select->table = currPos;
+            } else if (depth == 0 && fromPos != NULL && wherePos == NULL && len == 5 &&
+                       strncasecmp(word, "WHERE", 5) == 0) {
+                wherePos = word;
+                select->where = currPos;
+            } else if (isComplexWord(word, len)) {
+                return 1;
+            }
+            continue;
+        }
+
+        currPos++;
+    }
+
+    if (depth != 0 || fromPos == NULL)
+        return 1;
+
+    if (endPos == NULL)
+        endPos = currPos;
+
+    select->columnsLen = fromPos - select->columns;
+    select->tableLen = (wherePos != NULL ? wherePos : endPos) - select->table;
+    if (wherePos != NULL)
+        select->whereLen = endPos - select->where;
+
+    //strip the whitespace around the parts
+    while (select->columnsLen > 0 && isspace((unsigned char) *select->columns)) {
+        select->columns++;
+        select->columnsLen--;
+    }
+    while (select->columnsLen > 0 && isspace((unsigned char) select->columns[select->columnsLen - 1]))
+        select->columnsLen--;
+    while (select->tableLen > 0 && isspace((unsigned char) *select->table)) {
+        select->table++;
+        select->tableLen--;
+    }
+    while (select->tableLen > 0 && isspace((unsigned char) select->table[select->tableLen - 1]))
+        select->tableLen--;
+    while (select->whereLen > 0 && isspace((unsigned char) select->where[select->whereLen - 1]))
+        select->whereLen--;
+
+    if (select->columnsLen == 0 || isTableName(select->table, select->tableLen) == false)
+        return 1;
+
+    if (wherePos != NULL && select->whereLen == 0)
+        return 1;
+
+    if (wherePos == NULL)
+        select->where = NULL;
+
+    return 0;
+}
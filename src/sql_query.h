@@ -29,6 +29,7 @@
 #define MYSQL_SERVER 1
 #include <sql_class.h>
 #include <my_global.h>
+#include "sys_tbl.h"
 
 #ifdef USE_PRAGMA_IMPLEMENTATION
 #pragma implementation
@@ -57,11 +58,31 @@ public:
     int len;
 };
 
-int addResultTableSQLAtPlaceholder(const char *inQuery, char **outQuery, char *db, char *table);
-int addResultTableSQL(const char *inQuery, char **outQuery, char *db, char *table);
+//space needed for the options of a result table
+#define QQUEUE_TABLE_OPTIONS_LEN (2 * QQUEUE_ENGINE_LEN + FN_REFLEN + 128)
 
-int validateMultiSQL(const char *inQuery);
+int addResultTableSQLAtPlaceholder(const char *inQuery, char **outQuery, char *db, char *table,
+                                   const char *tableOptions);
+int addResultTableSQL(const char *inQuery, char **outQuery, char *db, char *table,
+                      const char *tableOptions);
+int buildResultTableOptions(qqueue_queues_row *queue, char *tableOptions, size_t len);
+
+int validateMultiSQL(const char *inQuery, bool allowLastSelect);
 
 int splitQueries(const char *inQuery, query_list **outQueryList);
 
+const char *skipSQLStatements(const char *inQuery, int numStmts);
+
+//parts of a query that reads from a single table, pointing into the query
+struct qqueue_simple_select {
+    const char *columns;
+    size_t columnsLen;
+    const char *table;                      //[db.]table as written in the query
+    size_t tableLen;
+    const char *where;                      //condition of the WHERE clause, NULL if there is none
+    size_t whereLen;
+};
+
+int parseSimpleSelect(const char *query, qqueue_simple_select *select);
+
 #endif
\ No newline at end of file
@@ -36,7 +36,19 @@
 #include <mysql.h>
 #include <key.h>
 #include <sql_insert.h>
+#include <mysqld.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <utime.h>
+#include <sys/stat.h>
 #include "sys_tbl.h"
+#include "exec_query.h"
+#include "quota.h"
+#include "split_job.h"
+#include "journal.h"
+#include "sched_policy.h"
+#include "event_trace.h"
 
 
 #ifdef USE_PRAGMA_IMPLEMENTATION
@@ -53,16 +65,40 @@ int checkUsrGrpExisist(qqueue_usrGrp_row *thisRow);
 int checkQueueExisist(qqueue_queues_row *thisRow);
 void loadUsrGrps();
 void loadQueues();
-qqueue_jobs_row *extractJobFromTable(TABLE *fromThisTable);
 
-struct sortElement {
-    long long id;
-    long long status;
-    long long priority;
-    MYSQL_TIME subTime;
+static const qqueue_option usrGrpOptions[] = {
+    {"maxRunning", 3, QQUEUE_OPTION_INT},
+    {"maxPending", 4, QQUEUE_OPTION_INT},
+    {"submitRate", 5, QQUEUE_OPTION_INT},
+    {"submitBurst", 6, QQUEUE_OPTION_INT},
+    {"usrMaxRunning", 7, QQUEUE_OPTION_INT},
+    {"usrMaxPending", 8, QQUEUE_OPTION_INT},
+    {"usrSubmitRate", 9, QQUEUE_OPTION_INT},
+    {"usrSubmitBurst", 10, QQUEUE_OPTION_INT},
+    {NULL, 0, QQUEUE_OPTION_INT}
 };
 
-int jobCmp( const void *job1, const void *job2);
+static const qqueue_option queueOptions[] = {
+    {"preemptible", 4, QQUEUE_OPTION_INT},
+    {"agingRate", 5, QQUEUE_OPTION_INT},
+    {"agingCap", 6, QQUEUE_OPTION_INT},
+    {"recoveryPolicy", 7, QQUEUE_OPTION_INT},
+    {"recoveryMaxRuntime", 8, QQUEUE_OPTION_INT},
+    {"killWait", 9, QQUEUE_OPTION_INT},
+    {"cpuSet", 10, QQUEUE_OPTION_STRING},
+    {"numaNode", 11, QQUEUE_OPTION_INT},
+    {"nice", 12, QQUEUE_OPTION_INT},
+    {"ioClass", 13, QQUEUE_OPTION_INT},
+    {"ioLevel", 14, QQUEUE_OPTION_INT},
+    {"maxReadRows", 15, QQUEUE_OPTION_INT},
+    {"maxReadBytes", 16, QQUEUE_OPTION_INT},
+    {"resultEngine", 17, QQUEUE_OPTION_STRING},
+    {"resultRowFormat", 18, QQUEUE_OPTION_STRING},
+    {"resultCompression", 19, QQUEUE_OPTION_INT},
+    {"resultDataDir", 20, QQUEUE_OPTION_STRING},
+    {"resultNoBinlog", 21, QQUEUE_OPTION_INT},
+    {NULL, 0, QQUEUE_OPTION_INT}
+};
 
 TABLE *open_sysTbl(THD *thd, const char *tblName,
                    int tblNameLen, Open_tables_backup *tblBackup,
@@ -120,9 +156,57 @@ int retrRowAtPKId(TABLE *table, ulonglong id) {
     return error;
 }
 
+//returns false if the table lacks columns of the first version. tables of older
+//versions are used without their newer columns until they are upgraded
+bool checkSysTblFields(TABLE *table, uint minFields, uint numFields) {
+    if (table->s->fields < minFields) {
+        fprintf(stderr, "QQuery: System table %s is not correctly set up. Not the correct number of columns found.\n",
+                table->s->table_name.str);
+        return false;
+    }
+
+    if (table->s->fields < numFields) {
+        fprintf(stderr, "QQuery: System table %s has %u of %u columns, run upgrade_qqueue.sql to use all features.\n",
+                table->s->table_name.str, table->s->fields, numFields);
+    }
+
+    return true;
+}
+
+bool sysTblHasField(TABLE *table, uint idx) {
+    return idx < table->s->fields;
+}
+
+longlong sysTblInt(TABLE *table, uint idx, longlong defVal) {
+    if (idx >= table->s->fields)
+        return defVal;
+
+    return table->field[idx]->val_int();
+}
+
+//returns false if the column is missing, str is left alone then
+bool sysTblStr(TABLE *table, uint idx, String *str) {
+    if (idx >= table->s->fields)
+        return false;
+
+    table->field[idx]->val_str(str);
+    return true;
+}
+
+void sysTblStoreInt(TABLE *table, uint idx, longlong value) {
+    if (idx >= table->s->fields)
+        return;
+
+    table->field[idx]->set_notnull();
+    table->field[idx]->store(value, false);
+}
+
 void loadQqueueUsrGrps(TABLE *fromThisTable) {
     int error;
 
+    if (checkSysTblFields(fromThisTable, QQUEUE_USRGRPS_MIN_FIELDS, QQUEUE_USRGRPS_FIELDS) == false)
+        return;
+
     mysql_mutex_lock(&LOCK_usrGrps);
 
     READ_RECORD read_record_info;
@@ -141,6 +225,14 @@ void loadQqueueUsrGrps(TABLE *fromThisTable) {
         aRow->id = fromThisTable->field[0]->val_int();
         strcpy(aRow->name, newString.c_ptr());
         aRow->priority = (int) fromThisTable->field[2]->val_int();
+        aRow->maxRunning = (int) sysTblInt(fromThisTable, 3, aRow->maxRunning);
+        aRow->maxPending = (int) sysTblInt(fromThisTable, 4, aRow->maxPending);
+        aRow->submitRate = (int) sysTblInt(fromThisTable, 5, aRow->submitRate);
+        aRow->submitBurst = (int) sysTblInt(fromThisTable, 6, aRow->submitBurst);
+        aRow->usrMaxRunning = (int) sysTblInt(fromThisTable, 7, aRow->usrMaxRunning);
+        aRow->usrMaxPending = (int) sysTblInt(fromThisTable, 8, aRow->usrMaxPending);
+        aRow->usrSubmitRate = (int) sysTblInt(fromThisTable, 9, aRow->usrSubmitRate);
+        aRow->usrSubmitBurst = (int) sysTblInt(fromThisTable, 10, aRow->usrSubmitBurst);
 
         usrGrps.push_back(aRow);
     }
@@ -153,7 +245,9 @@ void loadQqueueUsrGrps(TABLE *fromThisTable) {
     qqueue_usrGrp_row *aRow;
     I_List_iterator<qqueue_usrGrp_row> usrGrpIter(usrGrps);
     while (aRow = usrGrpIter++) {
-        fprintf(stderr, "id: %i name: %s priority: %i\n", aRow->id, aRow->name, aRow->priority);
+        fprintf(stderr, "id: %i name: %s priority: %i running: %i pending: %i rate: %i/min burst: %i\n",
+                aRow->id, aRow->name, aRow->priority, aRow->maxRunning, aRow->maxPending,
+                aRow->submitRate, aRow->submitBurst);
     }
 
     fprintf(stderr, "loadQqueueUsrGrps: end\n");
@@ -165,6 +259,9 @@ void loadQqueueUsrGrps(TABLE *fromThisTable) {
 void loadQqueueQueues(TABLE *fromThisTable) {
     int error;
 
+    if (checkSysTblFields(fromThisTable, QQUEUE_QUEUES_MIN_FIELDS, QQUEUE_QUEUES_FIELDS) == false)
+        return;
+
     mysql_mutex_lock(&LOCK_queues);
 
     READ_RECORD read_record_info;
@@ -184,6 +281,28 @@ void loadQqueueQueues(TABLE *fromThisTable) {
         strcpy(aRow->name, newString.c_ptr());
         aRow->priority = (int) fromThisTable->field[2]->val_int();
         aRow->timeout = fromThisTable->field[3]->val_int();
+        aRow->preemptible = (my_bool) sysTblInt(fromThisTable, 4, aRow->preemptible);
+        aRow->agingRate = (int) sysTblInt(fromThisTable, 5, aRow->agingRate);
+        aRow->agingCap = (int) sysTblInt(fromThisTable, 6, aRow->agingCap);
+        aRow->recoveryPolicy = (int) sysTblInt(fromThisTable, 7, aRow->recoveryPolicy);
+        aRow->recoveryMaxRuntime = sysTblInt(fromThisTable, 8, aRow->recoveryMaxRuntime);
+        aRow->killWait = (my_bool) sysTblInt(fromThisTable, 9, aRow->killWait);
+        if (sysTblStr(fromThisTable, 10, &newString) == true)
+            strmake(aRow->cpuSet, newString.c_ptr(), QQUEUE_CPUSET_LEN - 1);
+        aRow->numaNode = (int) sysTblInt(fromThisTable, 11, aRow->numaNode);
+        aRow->niceValue = (int) sysTblInt(fromThisTable, 12, aRow->niceValue);
+        aRow->ioClass = (int) sysTblInt(fromThisTable, 13, aRow->ioClass);
+        aRow->ioLevel = (int) sysTblInt(fromThisTable, 14, aRow->ioLevel);
+        aRow->maxReadRows = sysTblInt(fromThisTable, 15, aRow->maxReadRows);
+        aRow->maxReadBytes = sysTblInt(fromThisTable, 16, aRow->maxReadBytes);
+        if (sysTblStr(fromThisTable, 17, &newString) == true)
+            strmake(aRow->resultEngine, newString.c_ptr(), QQUEUE_ENGINE_LEN - 1);
+        if (sysTblStr(fromThisTable, 18, &newString) == true)
+            strmake(aRow->resultRowFormat, newString.c_ptr(), QQUEUE_ENGINE_LEN - 1);
+        aRow->resultCompression = (int) sysTblInt(fromThisTable, 19, aRow->resultCompression);
+        if (sysTblStr(fromThisTable, 20, &newString) == true)
+            strmake(aRow->resultDataDir, newString.c_ptr(), FN_REFLEN - 1);
+        aRow->resultNoBinlog = (my_bool) sysTblInt(fromThisTable, 21, aRow->resultNoBinlog);
 
         queues.push_back(aRow);
     }
@@ -196,8 +315,8 @@ void loadQqueueQueues(TABLE *fromThisTable) {
     qqueue_queues_row *aRow;
     I_List_iterator<qqueue_queues_row> queuesIter(queues);
     while (aRow = queuesIter++) {
-        fprintf(stderr, "id: %i name: %s priority: %i timeout: %i\n", aRow->id, aRow->name,
-                aRow->priority, aRow->timeout);
+        fprintf(stderr, "id: %i name: %s priority: %i timeout: %i preemptible: %i aging: %i/h cap %i\n", aRow->id, aRow->name,
+                aRow->priority, aRow->timeout, aRow->preemptible, aRow->agingRate, aRow->agingCap);
     }
 
     fprintf(stderr, "loadQqueueQueueRow: end\n");
@@ -321,9 +440,10 @@ int addQqueueJobsRow(qqueue_jobs_row *thisRow, TABLE *toThisTable, ulonglong id)
     mysql_mutex_unlock(&LOCK_jobs);
 
     if (error) {
-        if(error == 121) {
-            //if this is a duplicate entry and has been already added elsewhere, just ignore it
-            return 0;
+        if(error == HA_ERR_FOUND_DUPP_KEY) {
+            //callers that write rows which may already be there ignore the result,
+            //new jobs must not take over the id of another one
+            return error;
         }
 
         toThisTable->file->print_error(error, MYF(0));
@@ -366,8 +486,8 @@ int updateQqueueJobsRow(qqueue_jobs_row *thisRow, TABLE *toThisTable) {
 }
 
 int setQqueueJobsRow(qqueue_jobs_row *thisRow, TABLE *toThisTable) {
-    //sanity check:
-    if (toThisTable->s->fields != 17) {
+    //sanity check, the columns after the first version are only written if they are there
+    if (toThisTable->s->fields < QQUEUE_JOBS_MIN_FIELDS) {
         return -1;
     }
 
@@ -399,9 +519,11 @@ int setQqueueJobsRow(qqueue_jobs_row *thisRow, TABLE *toThisTable) {
     toThisTable->field[7]->set_notnull();
     toThisTable->field[7]->store(thisRow->status, false);
     toThisTable->field[8]->set_notnull();
-    toThisTable->field[8]->store(thisRow->resultDBName, strlen(thisRow->resultDBName), system_charset_info);
+    toThisTable->field[8]->store(thisRow->resultDBName, thisRow->resultDBName ? strlen(thisRow->resultDBName) : 0,
+                                 system_charset_info);
     toThisTable->field[9]->set_notnull();
-    toThisTable->field[9]->store(thisRow->resultTableName, strlen(thisRow->resultTableName), system_charset_info);
+    toThisTable->field[9]->store(thisRow->resultTableName, thisRow->resultTableName ? strlen(thisRow->resultTableName) : 0,
+                                 system_charset_info);
     toThisTable->field[10]->set_notnull();
     toThisTable->field[10]->store(thisRow->paquFlag, false);
     toThisTable->field[11]->set_notnull();
@@ -424,18 +546,36 @@ int setQqueueJobsRow(qqueue_jobs_row *thisRow, TABLE *toThisTable) {
 #endif
     if (thisRow->actualQuery != NULL) {
         toThisTable->field[14]->set_notnull();
-        toThisTable->field[14]->store(thisRow->actualQuery, strlen(thisRow->actualQuery), system_charset_info);
+        toThisTable->field[14]->store(thisRow->actualQuery, thisRow->actualQueryLen, system_charset_info);
     } else {
         toThisTable->field[14]->set_null();
     }
     toThisTable->field[15]->set_notnull();
-    toThisTable->field[15]->store(thisRow->error, strlen(thisRow->error), system_charset_info);
+    toThisTable->field[15]->store(thisRow->error, thisRow->error ? strlen(thisRow->error) : 0, system_charset_info);
     if (thisRow->comment != NULL && strlen(thisRow->comment) != 0) {
         toThisTable->field[16]->set_notnull();
         toThisTable->field[16]->store(thisRow->comment, strlen(thisRow->comment), system_charset_info);
     } else {
         toThisTable->field[16]->set_null();
     }
+    sysTblStoreInt(toThisTable, 17, thisRow->preemptCount);
+    sysTblStoreInt(toThisTable, 18, thisRow->effPriority);
+    sysTblStoreInt(toThisTable, 19, thisRow->jobFlags);
+    sysTblStoreInt(toThisTable, 20, thisRow->lastStmt);
+    sysTblStoreInt(toThisTable, 21, thisRow->throttleTime);
+    if (sysTblHasField(toThisTable, 22) == true) {
+        if (thisRow->outputFile != NULL) {
+            toThisTable->field[22]->set_notnull();
+            toThisTable->field[22]->store(thisRow->outputFile, strlen(thisRow->outputFile), system_charset_info);
+        } else {
+            toThisTable->field[22]->set_null();
+        }
+    }
+    sysTblStoreInt(toThisTable, 23, thisRow->outputSize);
+    sysTblStoreInt(toThisTable, 24, thisRow->parentJob);
+    sysTblStoreInt(toThisTable, 25, thisRow->subJobs);
+    sysTblStoreInt(toThisTable, 26, thisRow->chunksDone);
+    sysTblStoreInt(toThisTable, 27, thisRow->chunkPos);
 
     return 0;
 }
@@ -463,6 +603,226 @@ int deleteQqueueJobsRow(ulonglong id, TABLE *toThisTable) {
     return 0;
 }
 
+//records the number of completed statements of a running job. only this
+//column is written, so that the checkpoint is cheap enough to be taken after
+//every statement
+int setQqueueJobsLastStmt(ulonglong id, int lastStmt, TABLE *toThisTable) {
+    int error;
+
+    //retrieve row
+    error = retrRowAtPKId(toThisTable, id);
+
+    if (error == HA_ERR_KEY_NOT_FOUND || error == HA_ERR_END_OF_FILE) {
+        return error;
+    }
+
+    //without the column of the checkpoint the job simply starts over
+    if (sysTblHasField(toThisTable, 20) == false)
+        return 0;
+
+    store_record(toThisTable, record[1]);
+    toThisTable->use_all_columns();
+
+    sysTblStoreInt(toThisTable, 20, lastStmt);
+
+    error = toThisTable->file->ha_update_row(toThisTable->record[1], toThisTable->record[0]);
+
+    if (error && error != HA_ERR_RECORD_IS_THE_SAME) {
+        toThisTable->file->print_error(error, MYF(0));
+        fprintf(stderr, "QQuery: Error in updating last statement of systbl qqueue_jobs record: id: %lli error: %i\n",
+                id, error);
+        return error;
+    }
+
+    return 0;
+}
+
+//records the chunks a chunked job has committed and the key the next one starts at
+int setQqueueJobsChunk(ulonglong id, int chunksDone, long long chunkPos, TABLE *toThisTable) {
+    int error;
+
+    if (sysTblHasField(toThisTable, 27) == false) {
+        fprintf(stderr, "QQuery: Chunked job %lli cannot record its position, run upgrade_qqueue.sql.\n", id);
+        return -1;
+    }
+
+    //retrieve row
+    error = retrRowAtPKId(toThisTable, id);
+
+    if (error == HA_ERR_KEY_NOT_FOUND || error == HA_ERR_END_OF_FILE) {
+        return error;
+    }
+
+    store_record(toThisTable, record[1]);
+    toThisTable->use_all_columns();
+
+    sysTblStoreInt(toThisTable, 26, chunksDone);
+    sysTblStoreInt(toThisTable, 27, chunkPos);
+
+    error = toThisTable->file->ha_update_row(toThisTable->record[1], toThisTable->record[0]);
+
+    if (error && error != HA_ERR_RECORD_IS_THE_SAME) {
+        toThisTable->file->print_error(error, MYF(0));
+        fprintf(stderr, "QQuery: Error in updating chunk position of systbl qqueue_jobs record: id: %lli error: %i\n",
+                id, error);
+        return error;
+    }
+
+    return 0;
+}
+
+//records the output file of a job, works on the jobs and the history table
+int setQqueueJobsOutput(ulonglong id, const char *outputFile, long long outputSize, TABLE *toThisTable) {
+    int error;
+
+    //retrieve row
+    error = retrRowAtPKId(toThisTable, id);
+
+    if (error == HA_ERR_KEY_NOT_FOUND || error == HA_ERR_END_OF_FILE) {
+        return error;
+    }
+
+    if (sysTblHasField(toThisTable, 23) == false) {
+        fprintf(stderr, "QQuery: The output file of job %lli is not recorded, run upgrade_qqueue.sql.\n", id);
+        return 0;
+    }
+
+    store_record(toThisTable, record[1]);
+    toThisTable->use_all_columns();
+
+    toThisTable->field[22]->set_notnull();
+    toThisTable->field[22]->store(outputFile, strlen(outputFile), system_charset_info);
+    sysTblStoreInt(toThisTable, 23, outputSize);
+
+    error = toThisTable->file->ha_update_row(toThisTable->record[1], toThisTable->record[0]);
+
+    if (error && error != HA_ERR_RECORD_IS_THE_SAME) {
+        toThisTable->file->print_error(error, MYF(0));
+        fprintf(stderr, "QQuery: Error in updating output file of record: id: %lli error: %i\n",
+                id, error);
+        return error;
+    }
+
+    return 0;
+}
+
+//number of sub-jobs of a job that are still in the jobs table
+int countQqueueSubJobs(ulonglong parentId, TABLE *fromThisTable) {
+    int count = 0;
+
+    READ_RECORD read_record_info;
+    init_read_record(&read_record_info, current_thd, fromThisTable, NULL, 1, 0, FALSE);
+    fromThisTable->use_all_columns();
+
+    while (!(read_record_info.read_record(&read_record_info))) {
+        if ((ulonglong) sysTblInt(fromThisTable, 24, 0) == parentId)
+            count++;
+    }
+
+    end_read_record(&read_record_info);
+
+    return count;
+}
+
+//ids are handed out by a counter that only ever goes up. it starts after the
+//largest id in the jobs and history tables, and never below the time in
+//microseconds shifted by 8 bits, the ids older versions of the queue used
+static volatile longlong nextJobId = 0;
+
+static longlong clockJobId() {
+#if defined(MARIADB_BASE_VERSION) && MYSQL_VERSION_ID >= 50500
+    return (longlong) (microsecond_interval_timer() << 8);
+#else
+    return (longlong) (my_micro_time() << 8);
+#endif
+}
+
+//makes sure the counter is at least at id. explicit ids of submitted jobs
+//move it as well, so that the counter never hands them out a second time
+void raiseJobIds(longlong id) {
+    longlong curr = nextJobId;
+
+    //an unused counter first starts from the clock
+    if (curr == 0) {
+        longlong clockId = clockJobId();
+        if (clockId > id)
+            id = clockId;
+    }
+
+    while (curr < id) {
+        longlong seen = __sync_val_compare_and_swap(&nextJobId, curr, id);
+        if (seen == curr)
+            break;
+        curr = seen;
+    }
+}
+
+static longlong maxJobIdInTable(TABLE *fromThisTable) {
+    longlong maxId = 0;
+
+    fromThisTable->use_all_columns();
+    if (fromThisTable->file->ha_index_init(0, true) != 0)
+        return 0;
+
+#if MYSQL_VERSION_ID >= 50601 || (defined(MARIADB_BASE_VERSION) && MYSQL_VERSION_ID >= 50500)
+    int error = fromThisTable->file->ha_index_last(fromThisTable->record[0]);
+#else
+    int error = fromThisTable->file->index_last(fromThisTable->record[0]);
+#endif
+    if (error == 0)
+        maxId = fromThisTable->field[0]->val_int();
+
+    fromThisTable->file->ha_index_end();
+
+    return maxId;
+}
+
+//moves the counter past every id in the jobs and history tables. called by the
+//daemon before it starts, ids handed out before that come from the clock
+int seedJobIds() {
+    const char *tables[] = {"qqueue_jobs", "qqueue_history"};
+    longlong maxId = clockJobId();
+
+    for (int i = 0; i < 2; i++) {
+        int error = 0;
+        Open_tables_backup backup;
+        TABLE *tbl = open_sysTbl(current_thd, tables[i], strlen(tables[i]), &backup, false, &error);
+        if (error || tbl == NULL) {
+            fprintf(stderr, "seedJobIds: error in opening sys table %s: error: %i\n", tables[i], error);
+            close_sysTbl(current_thd, tbl, &backup);
+            return 1;
+        }
+
+        //tables of older versions are reported once at start
+        checkSysTblFields(tbl, QQUEUE_JOBS_MIN_FIELDS, QQUEUE_JOBS_FIELDS);
+
+        longlong tblMax = maxJobIdInTable(tbl);
+        if (tblMax >= maxId)
+            maxId = tblMax + 1;
+
+        close_sysTbl(current_thd, tbl, &backup);
+    }
+
+    raiseJobIds(maxId);
+
+    return 0;
+}
+
+//reserves count consecutive ids and returns the first of them
+ulonglong newJobIdRange(int count) {
+    if (count < 1)
+        count = 1;
+
+    if (nextJobId == 0)
+        raiseJobIds(0);
+
+    return (ulonglong) __sync_fetch_and_add(&nextJobId, (longlong) count);
+}
+
+ulonglong newJobId() {
+    return newJobIdRange(1);
+}
+
 int updateQqueueUsrGrpRow(qqueue_usrGrp_row *thisRow, TABLE *toThisTable) {
     int error;
 
@@ -554,6 +914,94 @@ int updateQqueueQueuesRow(qqueue_queues_row *thisRow, TABLE *toThisTable) {
     return 0;
 }
 
+static const qqueue_option *findOption(const qqueue_option *options, const char *name) {
+    for (int i = 0; options[i].name != NULL; i++) {
+        if (strcmp(options[i].name, name) == 0) {
+            return &options[i];
+        }
+    }
+
+    return NULL;
+}
+
+const qqueue_option *getQueueOption(const char *name) {
+    return findOption(queueOptions, name);
+}
+
+const qqueue_option *getUsrGrpOption(const char *name) {
+    return findOption(usrGrpOptions, name);
+}
+
+//stores the value of an option in the row with the given id
+static int setQqueueOption(long long id, const qqueue_option *option,
+                           long long intValue, const char *strValue, TABLE *toThisTable) {
+    int error;
+
+    //retrieve row
+    error = retrRowAtPKId(toThisTable, id);
+
+    if (error == HA_ERR_KEY_NOT_FOUND || error == HA_ERR_END_OF_FILE) {
+        return error;
+    }
+
+    if (option->fieldIdx >= (int) toThisTable->s->fields) {
+        fprintf(stderr, "QQuery: Table is not correctly set up. Column for option %s not found, run upgrade_qqueue.sql.\n",
+                option->name);
+        return -1;
+    }
+
+    store_record(toThisTable, record[1]);
+    toThisTable->use_all_columns();
+
+    Field *field = toThisTable->field[option->fieldIdx];
+    if (option->type == QQUEUE_OPTION_STRING) {
+        if (strValue == NULL) {
+            field->set_null();
+        } else {
+            field->set_notnull();
+            field->store(strValue, strlen(strValue), system_charset_info);
+        }
+    } else {
+        field->set_notnull();
+        field->store(intValue, false);
+    }
+
+    error = toThisTable->file->ha_update_row(toThisTable->record[1], toThisTable->record[0]);
+
+    if (error && error != HA_ERR_RECORD_IS_THE_SAME) {
+        toThisTable->file->print_error(error, MYF(0));
+        fprintf(stderr, "QQuery: Error in updating option %s of record: id: %lli error: %i\n",
+                option->name, id, error);
+        return error;
+    }
+
+    return 0;
+}
+
+int setQqueueQueuesOption(long long queueId, const qqueue_option *option,
+                          long long intValue, const char *strValue, TABLE *toThisTable) {
+    int error = setQqueueOption(queueId, option, intValue, strValue, toThisTable);
+
+    if (error == 0) {
+        //reload queues list
+        loadQueues();
+    }
+
+    return error;
+}
+
+int setQqueueUsrGrpsOption(long long usrGrpId, const qqueue_option *option,
+                           long long intValue, const char *strValue, TABLE *toThisTable) {
+    int error = setQqueueOption(usrGrpId, option, intValue, strValue, toThisTable);
+
+    if (error == 0) {
+        //reload groups list
+        loadUsrGrps();
+    }
+
+    return error;
+}
+
 int checkUsrGrpExisist(qqueue_usrGrp_row *thisRow) {
     //check if a user group with this name already exists...
     loadUsrGrps();
@@ -626,6 +1074,22 @@ qqueue_usrGrp_row *getUsrGrp(char *usrGrp) {
     return NULL;
 }
 
+qqueue_usrGrp_row *getUsrGrpByID(long long id) {
+    if (usrGrps.is_empty() == true) {
+        loadUsrGrps();
+    }
+
+    qqueue_usrGrp_row *aRow;
+    I_List_iterator<qqueue_usrGrp_row> usrGrpIter(usrGrps);
+    while ( (aRow = usrGrpIter++) ) {
+        if (aRow->id == id) {
+            return aRow;
+        }
+    }
+
+    return NULL;
+}
+
 qqueue_queues_row *getQueue(char *queue) {
     if (queues.is_empty() == true) {
         loadQueues();
@@ -642,11 +1106,9 @@ qqueue_queues_row *getQueue(char *queue) {
     return NULL;
 }
 
-qqueue_queues_row *getQueueByID(long long id) {
-    if (queues.is_empty() == true) {
-        loadQueues();
-    }
-
+//looks the queue up in the queues already read, never reads their table. used
+//while a table scan is open, where loading the queues would nest another one
+static qqueue_queues_row *findQueueByID(long long id) {
     qqueue_queues_row *aRow;
     I_List_iterator<qqueue_queues_row> queueIter(queues);
     while ( (aRow = queueIter++) ) {
@@ -658,26 +1120,30 @@ qqueue_queues_row *getQueueByID(long long id) {
     return NULL;
 }
 
-int jobCmp( const void *job1, const void *job2) {
-    sortElement *j1 = (sortElement *) job1;
-    sortElement *j2 = (sortElement *) job2;
-
-    //status asc
-    if (j1->status < j2->status) {
-        return -1;
-    } else if (j1->status > j2->status) {
-        return 1;
-    } else {
-        //priority desc
-        if (j1->priority > j2->priority) {
-            return -1;
-        } else if (j1->priority < j2->priority) {
-            return 1;
-        } else {
-            //time asc
-            return my_time_compare(&(j1->subTime), &(j2->subTime));
-        }
+qqueue_queues_row *getQueueByID(long long id) {
+    if (queues.is_empty() == true) {
+        loadQueues();
     }
+
+    return findQueueByID(id);
+}
+
+static longlong timeToSeconds(const MYSQL_TIME *t) {
+    return (longlong) calc_daynr(t->year, t->month, t->day) * 86400LL +
+           t->hour * 3600LL + t->minute * 60LL + t->second;
+}
+
+//effective priority of a job that has been waiting since subTime. the priority
+//grows by the agingRate of the queue per hour of waiting, up to agingCap. this
+//is only evaluated when ordering the jobs and never written back to the jobs table.
+//the queues must have been loaded before, this is called during a scan of the jobs
+long long getEffectivePriority(long long priority, long long queueId, const MYSQL_TIME *subTime,
+                               longlong now) {
+    qqueue_queues_row *queue = findQueueByID(queueId);
+    if (queue == NULL)
+        return priority;
+
+    return schedEffectivePriority(priority, queue->agingRate, queue->agingCap, now - timeToSeconds(subTime));
 }
 
 bool checkIfResultTableExists(TABLE *inThisTable, char *database, char *tblName) {
@@ -715,15 +1181,187 @@ bool checkIfResultTableExists(TABLE *inThisTable, char *database, char *tblName)
     return found;
 }
 
+//result tables of submissions that have been checked against the jobs table but
+//are not in it yet
+struct resultTableReservation {
+    resultTableReservation *next;
+    long long jobId;                        //journaled job the table belongs to, 0 before
+    char database[QQUEUE_RESULTDBNAME_LEN];
+    char tblName[QQUEUE_RESULTTBLNAME_LEN];
+};
+
+static resultTableReservation *resultReservations = NULL;
+
+static bool isReservation(resultTableReservation *reservation, const char *database, const char *tblName) {
+    return strncmp(reservation->database, database, QQUEUE_RESULTDBNAME_LEN - 1) == 0 &&
+           strncmp(reservation->tblName, tblName, QQUEUE_RESULTTBLNAME_LEN - 1) == 0;
+}
+
+//returns false if another submission has already reserved the table
+bool reserveResultTable(const char *database, const char *tblName) {
+    resultTableReservation *reservation = (resultTableReservation *) my_malloc(sizeof(resultTableReservation), MYF(0));
+    if (reservation == NULL)
+        return false;
+
+    reservation->jobId = 0;
+    strmake(reservation->database, database, QQUEUE_RESULTDBNAME_LEN - 1);
+    strmake(reservation->tblName, tblName, QQUEUE_RESULTTBLNAME_LEN - 1);
+
+    bool found = false;
+
+    mysql_mutex_lock(&LOCK_jobs);
+
+    resultTableReservation **prev = &resultReservations;
+    while (*prev != NULL) {
+        resultTableReservation *curr = *prev;
+
+        //journaled jobs are in the jobs table once their record has been applied
+        if (curr->jobId != 0 && journalJobBusy(curr->jobId) == false) {
+            *prev = curr->next;
+            my_free(curr);
+            continue;
+        }
+
+        if (isReservation(curr, database, tblName) == true)
+            found = true;
+
+        prev = &curr->next;
+    }
+
+    if (found == false) {
+        reservation->next = resultReservations;
+        resultReservations = reservation;
+    }
+
+    mysql_mutex_unlock(&LOCK_jobs);
+
+    if (found == true)
+        my_free(reservation);
+
+    return found == false;
+}
+
+//ends the reservation once the job is in the jobs table or has not been added. a job
+//that went to the journal keeps the table reserved until its record is applied
+void releaseResultTable(const char *database, const char *tblName, long long journaledJobId) {
+    mysql_mutex_lock(&LOCK_jobs);
+
+    resultTableReservation **prev = &resultReservations;
+    while (*prev != NULL) {
+        resultTableReservation *curr = *prev;
+
+        if (curr->jobId == 0 && isReservation(curr, database, tblName) == true) {
+            if (journaledJobId != 0 && journalJobBusy(journaledJobId) == true) {
+                curr->jobId = journaledJobId;
+            } else {
+                *prev = curr->next;
+                my_free(curr);
+            }
+            break;
+        }
+
+        prev = &curr->next;
+    }
+
+    mysql_mutex_unlock(&LOCK_jobs);
+}
+
+//ids of submissions that have been checked against the jobs table but are not in it
+//yet. with the journal, the row of a job only shows up once its record is applied
+struct jobIdReservation {
+    jobIdReservation *next;
+    long long id;
+    bool journaled;                         //kept until the record of the job is applied
+};
+
+static jobIdReservation *jobIdReservations = NULL;
+
+//returns false if the id is taken by a submission that is not in the jobs table yet
+bool reserveJobId(long long id) {
+    jobIdReservation *reservation = (jobIdReservation *) my_malloc(sizeof(jobIdReservation), MYF(0));
+    if (reservation == NULL)
+        return false;
+
+    reservation->id = id;
+    reservation->journaled = false;
+
+    bool found = false;
+
+    mysql_mutex_lock(&LOCK_jobs);
+
+    jobIdReservation **prev = &jobIdReservations;
+    while (*prev != NULL) {
+        jobIdReservation *curr = *prev;
+
+        if (curr->journaled == true && journalJobBusy(curr->id) == false) {
+            *prev = curr->next;
+            my_free(curr);
+            continue;
+        }
+
+        if (curr->id == id)
+            found = true;
+
+        prev = &curr->next;
+    }
+
+    if (found == false) {
+        reservation->next = jobIdReservations;
+        jobIdReservations = reservation;
+    }
+
+    mysql_mutex_unlock(&LOCK_jobs);
+
+    if (found == true)
+        my_free(reservation);
+
+    return found == false;
+}
+
+//ends the reservation of an id once the job is in the jobs table or has not been
+//added. a journaled job keeps its id reserved until its record is applied
+void releaseJobId(long long id, bool journaled) {
+    mysql_mutex_lock(&LOCK_jobs);
+
+    jobIdReservation **prev = &jobIdReservations;
+    while (*prev != NULL) {
+        jobIdReservation *curr = *prev;
+
+        if (curr->id == id && curr->journaled == false) {
+            if (journaled == true && journalJobBusy(id) == true) {
+                curr->journaled = true;
+            } else {
+                *prev = curr->next;
+                my_free(curr);
+            }
+            break;
+        }
+
+        prev = &curr->next;
+    }
+
+    mysql_mutex_unlock(&LOCK_jobs);
+}
+
 //this function returns a NULL terminated array of rows
-//i.e. an array with numJobs+1 entries
-qqueue_jobs_row **getHighestPriorityJob(TABLE *fromThisTable, int numJobs) {
+//i.e. an array with numJobs+1 entries. jobs of users or groups that already run
+//their maximum number of jobs are skipped. if reserveQuota is set, the returned
+//jobs are counted as running right away.
+qqueue_jobs_row **getHighestPriorityJob(TABLE *fromThisTable, int numJobs, bool reserveQuota) {
     int error;
 
     int numTotalJobs = 0;
 
     READ_RECORD read_record_info;
 
+    //the quota checks below need the user groups and the priorities need the
+    //queues, which might have to be read from their tables first. that is done
+    //before LOCK_jobs is taken and the jobs are scanned
+    if (usrGrps.is_empty() == true)
+        loadUsrGrps();
+    if (queues.is_empty() == true)
+        loadQueues();
+
     mysql_mutex_lock(&LOCK_jobs);
     if (fromThisTable->file->ha_table_flags() & HA_STATS_RECORDS_IS_EXACT) {
         numTotalJobs = fromThisTable->file->stats.records;
@@ -744,13 +1382,17 @@ qqueue_jobs_row **getHighestPriorityJob(TABLE *fromThisTable, int numJobs) {
     //this internally (i.e. select * from mysql.qqueue_jobs where status = 0 order by
     //priority desc, timeSubmit asc)
 
-    sortElement *sortArray = (sortElement *)my_malloc(numTotalJobs * sizeof(sortElement), MYF(0));
+    schedJob *sortArray = (schedJob *)my_malloc(numTotalJobs * sizeof(schedJob), MYF(0));
 
     if (sortArray == NULL) {
         fprintf(stderr, "QQuery getHighestPrioJob: No memory to allocate sorting arrays\n");
         return NULL;
     }
 
+    MYSQL_TIME localTime;
+    current_thd->variables.time_zone->gmt_sec_to_TIME(&localTime, (my_time_t) my_time(0));
+    longlong now = timeToSeconds(&localTime);
+
     //fill arrays
     init_read_record(&read_record_info, current_thd, fromThisTable, NULL, 1, 0,FALSE);
     fromThisTable->use_all_columns();
@@ -761,10 +1403,17 @@ qqueue_jobs_row **getHighestPriorityJob(TABLE *fromThisTable, int numJobs) {
         if (error != 0)
             return NULL;
 
+        MYSQL_TIME subTime;
+        fromThisTable->field[11]->get_date(&subTime, 0);
+
         sortArray[i].id = fromThisTable->field[0]->val_int();
-        sortArray[i].status = fromThisTable->field[7]->val_int();
-        sortArray[i].priority = fromThisTable->field[5]->val_int();
-        fromThisTable->field[11]->get_date(&(sortArray[i].subTime), 0);
+        sortArray[i].usrId = fromThisTable->field[2]->val_int();
+        sortArray[i].usrGroup = fromThisTable->field[3]->val_int();
+        sortArray[i].status = (char) fromThisTable->field[7]->val_int();
+        sortArray[i].subTime = timeToSeconds(&subTime);
+        sortArray[i].effPriority = (int) getEffectivePriority(fromThisTable->field[5]->val_int(),
+                                                              fromThisTable->field[4]->val_int(),
+                                                              &subTime, now);
     }
 
     end_read_record(&read_record_info);
@@ -773,25 +1422,19 @@ qqueue_jobs_row **getHighestPriorityJob(TABLE *fromThisTable, int numJobs) {
 #ifdef __QQUEUE_DEBUG__
     fprintf(stderr, "Qqueue jobs sort: before sorting:\n");
     for (int i = 0; i < numTotalJobs; i++) {
-        fprintf(stderr, "%i %i %i %i %i %i %i %i %i\n", sortArray[i].id, sortArray[i].status,
-                sortArray[i].priority, sortArray[i].subTime.day,
-                sortArray[i].subTime.month, sortArray[i].subTime.year,
-                sortArray[i].subTime.hour, sortArray[i].subTime.minute,
-                sortArray[i].subTime.second);
+        fprintf(stderr, "%lli %i %i %lli\n", sortArray[i].id, sortArray[i].status,
+                sortArray[i].effPriority, sortArray[i].subTime);
     }
 #endif
 
     //sort arrays
-    my_qsort(sortArray, numTotalJobs, sizeof(sortElement), &jobCmp);
+    my_qsort(sortArray, numTotalJobs, sizeof(schedJob), &schedJobCmp);
 
 #ifdef __QQUEUE_DEBUG__
     fprintf(stderr, "Qqueue jobs sort: after sorting:\n");
     for (int i = 0; i < numTotalJobs; i++) {
-        fprintf(stderr, "%i %i %i %i %i %i %i %i %i\n", sortArray[i].id, sortArray[i].status,
-                sortArray[i].priority, sortArray[i].subTime.day,
-                sortArray[i].subTime.month, sortArray[i].subTime.year,
-                sortArray[i].subTime.hour, sortArray[i].subTime.minute,
-                sortArray[i].subTime.second);
+        fprintf(stderr, "%lli %i %i %lli\n", sortArray[i].id, sortArray[i].status,
+                sortArray[i].effPriority, sortArray[i].subTime);
     }
 #endif
 
@@ -801,13 +1444,37 @@ qqueue_jobs_row **getHighestPriorityJob(TABLE *fromThisTable, int numJobs) {
         return NULL;
     memset(result, 0, (numJobs + 1) * sizeof(qqueue_jobs_row *));
 
-    for (int i = 0; i < numJobs; i++) {
-        if (i >= numTotalJobs)
-            break;
+    int numResults = 0;
+    int numSkips = 0;
+    for (int i = 0; i < numTotalJobs && numResults < numJobs; i++) {
         if (sortArray[i].status != 0)
             break;
 
-        result[i] = getJobFromID(fromThisTable, sortArray[i].id);
+        //the row is older than the journal, the job might already be running
+        if (journalJobBusy(sortArray[i].id) == true) {
+            if (reserveQuota == true && numSkips++ < QQUEUE_TRACE_MAX_SKIPS)
+                traceEvent(QQUEUE_EV_SKIP, sortArray[i].id, QQUEUE_SKIP_JOURNAL);
+            continue;
+        }
+
+        if (reserveQuota == true) {
+            if (quotaTryStart(sortArray[i].usrId, sortArray[i].usrGroup) == false) {
+                if (numSkips++ < QQUEUE_TRACE_MAX_SKIPS)
+                    traceEvent(QQUEUE_EV_SKIP, sortArray[i].id, QQUEUE_SKIP_QUOTA);
+                continue;
+            }
+        } else {
+            if (quotaCanStart(sortArray[i].usrId, sortArray[i].usrGroup) == false)
+                continue;
+        }
+
+        result[numResults] = getJobFromID(fromThisTable, sortArray[i].id);
+        if (result[numResults] != NULL) {
+            result[numResults]->effPriority = sortArray[i].effPriority;
+            numResults++;
+        } else if (reserveQuota == true) {
+            quotaJobRequeued(sortArray[i].usrId, sortArray[i].usrGroup);
+        }
     }
 
     my_free(sortArray);
@@ -834,147 +1501,336 @@ qqueue_jobs_row *extractJobFromTable(TABLE *fromThisTable) {
     returnJob->id = fromThisTable->field[0]->val_int();
     String tmpStr1(buff1, sizeof(buff1), system_charset_info);
     fromThisTable->field[1]->val_str(&tmpStr1);
-    returnJob->mysqlUserName = my_strdup(tmpStr1.c_ptr(), MYF(0));
+    returnJob->mysqlUserName = returnJob->dupString(tmpStr1.c_ptr());
     returnJob->usrId = fromThisTable->field[2]->val_int();
     returnJob->usrGroup = fromThisTable->field[3]->val_int();
     returnJob->queue = fromThisTable->field[4]->val_int();
     returnJob->priority = fromThisTable->field[5]->val_int();
     String tmpStr(buff, sizeof(buff), system_charset_info);
     fromThisTable->field[6]->val_str(&tmpStr);
-    returnJob->query = my_strdup(tmpStr.c_ptr(), MYF(0));
+    returnJob->query = returnJob->dupString(tmpStr.c_ptr());
     returnJob->status = (enum_queue_status)fromThisTable->field[7]->val_int();
     String tmpStr2(buff2, sizeof(buff2), system_charset_info);
     fromThisTable->field[8]->val_str(&tmpStr2);
-    strncpy(returnJob->resultDBName, tmpStr2.c_ptr(), QQUEUE_RESULTDBNAME_LEN);
+    returnJob->resultDBName = returnJob->dupString(tmpStr2.c_ptr());
     String tmpStr3(buff3, sizeof(buff3), system_charset_info);
     fromThisTable->field[9]->val_str(&tmpStr3);
-    strncpy(returnJob->resultTableName, tmpStr3.c_ptr(), QQUEUE_RESULTTBLNAME_LEN);
+    returnJob->resultTableName = returnJob->dupString(tmpStr3.c_ptr());
     returnJob->paquFlag = fromThisTable->field[10]->val_int();
     fromThisTable->field[11]->get_date(&returnJob->timeSubmit, 0);
     fromThisTable->field[12]->get_date(&returnJob->timeExecute, 0);
     fromThisTable->field[13]->get_date(&returnJob->timeFinish, 0);
     String tmpStr4(buff4, sizeof(buff4), system_charset_info);
     fromThisTable->field[14]->val_str(&tmpStr4);
-    returnJob->actualQuery = my_strdup(tmpStr4.c_ptr(), MYF(0));
+    returnJob->setActualQuery(tmpStr4.ptr(), tmpStr4.length());
     String tmpStr5(buff5, sizeof(buff5), system_charset_info);
     fromThisTable->field[15]->val_str(&tmpStr5);
-    strncpy(returnJob->error, tmpStr5.c_ptr(), QQUEUE_ERROR_LEN);
+    returnJob->setError(tmpStr5.c_ptr());
     String tmpStr6(buff6, sizeof(buff6), system_charset_info);
     fromThisTable->field[16]->val_str(&tmpStr6);
-    returnJob->comment = my_strdup(tmpStr6.c_ptr(), MYF(0));
+    returnJob->comment = returnJob->dupString(tmpStr6.c_ptr());
+    //columns of later versions keep the defaults of the row if they are missing
+    returnJob->preemptCount = sysTblInt(fromThisTable, 17, returnJob->preemptCount);
+    returnJob->effPriority = sysTblInt(fromThisTable, 18, returnJob->priority);
+    returnJob->jobFlags = sysTblInt(fromThisTable, 19, returnJob->jobFlags);
+    returnJob->lastStmt = sysTblInt(fromThisTable, 20, returnJob->lastStmt);
+    returnJob->throttleTime = sysTblInt(fromThisTable, 21, returnJob->throttleTime);
+    if (sysTblHasField(fromThisTable, 22) == true && fromThisTable->field[22]->is_null() == false) {
+        String tmpStr7;
+        fromThisTable->field[22]->val_str(&tmpStr7);
+        returnJob->outputFile = returnJob->dupString(tmpStr7.c_ptr());
+    }
+    returnJob->outputSize = sysTblInt(fromThisTable, 23, returnJob->outputSize);
+    returnJob->parentJob = sysTblInt(fromThisTable, 24, returnJob->parentJob);
+    returnJob->subJobs = (int) sysTblInt(fromThisTable, 25, returnJob->subJobs);
+    returnJob->chunksDone = (int) sysTblInt(fromThisTable, 26, returnJob->chunksDone);
+    returnJob->chunkPos = sysTblInt(fromThisTable, 27, returnJob->chunkPos);
 
     return returnJob;
 }
 
-int resetJobQueue(enum_queue_status status) {
-    int error = 0;
-    ulonglong *workArray = NULL;
+static void heartbeatPath(char *path, size_t len) {
+    snprintf(path, len, "%s/%s", mysql_real_data_home, QQUEUE_HEARTBEAT_FILE);
+}
 
-    fprintf(stderr, "QQuery: Resetting the jobs list after restart\n");
+//the daemon touches the heartbeat file every round. after a restart its time
+//tells until when the jobs that were running actually ran
+void touchHeartbeat() {
+    static bool reported = false;
+    char path[FN_REFLEN];
+    heartbeatPath(path, sizeof(path));
+
+    if (utime(path, NULL) == 0)
+        return;
+
+    int fd = open(path, O_WRONLY | O_CREAT, 0660);
+    if (fd < 0) {
+        if (reported == false)
+            fprintf(stderr, "QQuery: could not create %s: %s\n", path, strerror(errno));
+        reported = true;
+        return;
+    }
 
+    close(fd);
+}
+
+//last time the daemon was seen alive, in the time of timeToSeconds. if the
+//heartbeat file is missing, the time since the jobs started is all there is
+static longlong lastHeartbeat(longlong now) {
+    char path[FN_REFLEN];
+    heartbeatPath(path, sizeof(path));
+
+    struct stat info;
+    if (stat(path, &info) != 0)
+        return now;
+
+    MYSQL_TIME seenTime;
+    current_thd->variables.time_zone->gmt_sec_to_TIME(&seenTime, (my_time_t) info.st_mtime);
+    longlong seen = timeToSeconds(&seenTime);
+
+    return seen < now ? seen : now;
+}
+
+//decides what happens to a job that was running when the queue went down. the
+//runtime of a job ends at lastSeen, the time the server went down does not count
+static enum_queue_status getRecoveryStatus(qqueue_jobs_row *job, enum_queue_status defaultStatus,
+                                           longlong lastSeen) {
+    qqueue_queues_row *queue = getQueueByID(job->queue);
+    if (queue == NULL)
+        return defaultStatus;
+
+    switch (queue->recoveryPolicy) {
+        case QUEUE_RECOVERY_REQUEUE:
+            return QUEUE_PENDING;
+        case QUEUE_RECOVERY_FAIL:
+            return QUEUE_ERROR;
+        case QUEUE_RECOVERY_REQUEUE_SHORT:
+            if (lastSeen - timeToSeconds(&job->timeExecute) < queue->recoveryMaxRuntime)
+                return QUEUE_PENDING;
+            return QUEUE_ERROR;
+        default:
+            return defaultStatus;
+    }
+}
+
+//whether the result table of a job is there, used when it could not be renamed
+static bool partialTableExists(qqueue_jobs_row *job) {
+    char query[QQUEUE_RESULTDBNAME_LEN + QQUEUE_RESULTTBLNAME_LEN + 64];
+    char *queryError = NULL;
+
+    snprintf(query, sizeof(query), "SELECT 1 FROM `%s`.`%s` LIMIT 0", job->resultDBName, job->resultTableName);
+    if (execSimpleQuery(current_thd, query, &queryError) == 0)
+        return true;
+
+    if (queryError != NULL)
+        my_free(queryError);
+
+    return false;
+}
+
+//moves requeued jobs that cannot run again from the jobs table to the history
+static void strandJobs(List<qqueue_jobs_row> *jobs) {
+    int error = 0;
     Open_tables_backup backup;
-    TABLE *inThisJobsTable = open_sysTbl(current_thd, "qqueue_jobs", strlen("qqueue_jobs"), &backup, false, &error);
-    if (error || (inThisJobsTable == NULL && error != HA_STATUS_NO_LOCK) ) {
+    qqueue_jobs_row *job;
+    List_iterator<qqueue_jobs_row> jobIter(*jobs);
+
+    TABLE *tbl = open_sysTbl(current_thd, "qqueue_history", strlen("qqueue_history"), &backup, true, &error);
+    if (error || tbl == NULL) {
+        //the jobs stay pending and will fail on their table, which is better than losing them
+        fprintf(stderr, "qqueue_daemon_reset: error in opening history sys table: error: %i\n", error);
+        close_sysTbl(current_thd, tbl, &backup);
+        return;
+    }
+
+    while ( (job = jobIter++) )
+        addQqueueJobsRow(job, tbl, job->id);
+
+    close_sysTbl(current_thd, tbl, &backup);
+
+    tbl = open_sysTbl(current_thd, "qqueue_jobs", strlen("qqueue_jobs"), &backup, true, &error);
+    if (error || tbl == NULL) {
         fprintf(stderr, "qqueue_daemon_reset: error in opening jobs sys table: error: %i\n", error);
-        close_sysTbl(current_thd, inThisJobsTable, &backup);
-        return -1;
+        close_sysTbl(current_thd, tbl, &backup);
+        return;
     }
 
-    READ_RECORD read_record_info;
-    init_read_record(&read_record_info, current_thd, inThisJobsTable, NULL, 1, 0, FALSE);
+    jobIter.rewind();
+    while ( (job = jobIter++) )
+        deleteQqueueJobsRow(job->id, tbl);
 
-    inThisJobsTable->use_all_columns();
+    close_sysTbl(current_thd, tbl, &backup);
+}
 
-    //first count the number of jobs we need to address
+//resets all jobs that have been running when the queue went down. the running
+//jobs are read in one pass over the status index and then either set to pending
+//or moved to the history according to the recovery policy of their queue. the
+//partial result tables of the jobs that are run again are dropped (or renamed if
+//keepPartial is set), otherwise their execution would fail.
+int resetJobQueue(enum_queue_status defaultStatus, bool keepPartial) {
+    int error = 0;
+    List<qqueue_jobs_row> requeuedJobs;
+    List<qqueue_jobs_row> failedJobs;
     int jobCount = 0;
-    while(!(error = read_record_info.read_record(&read_record_info))) {
-        if (inThisJobsTable->field[6]->val_int() != QUEUE_RUNNING)
-            continue;
 
-        jobCount++;
-    }
+    fprintf(stderr, "QQuery: Resetting the jobs list after restart\n");
 
-    end_read_record(&read_record_info);
+    if (defaultStatus != QUEUE_PENDING && defaultStatus != QUEUE_ERROR) {
+        fprintf(stderr, "QQuery: Reset query: unable to reset running queries to status %i.\n", defaultStatus);
+        return -1;
+    }
 
-    init_read_record(&read_record_info, current_thd, inThisJobsTable, NULL, 1, 0, FALSE);
+    MYSQL_TIME localTime;
+    current_thd->variables.time_zone->gmt_sec_to_TIME(&localTime, (my_time_t) my_time(0));
+    longlong lastSeen = lastHeartbeat(timeToSeconds(&localTime));
 
-    //allocate memory and add all the job ids we need to work with to the work array
-    workArray = (ulonglong *)my_malloc(jobCount * sizeof(ulonglong), MYF(0));
-    if (workArray == NULL) {
-        fprintf(stderr, "QQuery: Could not allocate memory to reset job queue\n");
+    Open_tables_backup backup;
+    TABLE *inThisJobsTable = open_sysTbl(current_thd, "qqueue_jobs", strlen("qqueue_jobs"), &backup, true, &error);
+    if (error || (inThisJobsTable == NULL && error != HA_STATUS_NO_LOCK) ) {
+        fprintf(stderr, "qqueue_daemon_reset: error in opening jobs sys table: error: %i\n", error);
+        close_sysTbl(current_thd, inThisJobsTable, &backup);
         return -1;
     }
 
-    int i = 0;
-    while(!(error = read_record_info.read_record(&read_record_info))) {
-        if (inThisJobsTable->field[6]->val_int() != QUEUE_RUNNING)
-            continue;
+    inThisJobsTable->use_all_columns();
 
-        workArray[i] = inThisJobsTable->field[0]->val_int();
-        i++;
+    //the second key of the jobs table starts with the status, read all running jobs through it
+    if ((error = inThisJobsTable->file->ha_index_init(1, 1))) {
+        fprintf(stderr, "qqueue_daemon_reset: error in initialising status index: error: %i\n", error);
+        close_sysTbl(current_thd, inThisJobsTable, &backup);
+        return -1;
     }
-    end_read_record(&read_record_info);
 
-    close_sysTbl(current_thd, inThisJobsTable, &backup);
+    uchar key[MAX_KEY_LENGTH];
+    inThisJobsTable->field[7]->store(QUEUE_RUNNING, false);
+    key_copy(key, inThisJobsTable->record[0], inThisJobsTable->key_info + 1, 0);
 
-    //and now do the usual magic of updating and moving the rows
-    for (int i = 0; i < jobCount; i++) {
-        error = 0;
-        inThisJobsTable = open_sysTbl(current_thd, "qqueue_jobs", strlen("qqueue_jobs"), &backup, false, &error);
-        if (error || (inThisJobsTable == NULL && error != HA_STATUS_NO_LOCK) ) {
-            fprintf(stderr, "qqueue_daemon_reset2: error in opening jobs sys table: error: %i\n", error);
-            close_sysTbl(current_thd, inThisJobsTable, &backup);
-            return -1;
+#if MYSQL_VERSION_ID >= 50601 || (defined(MARIADB_BASE_VERSION) && MYSQL_VERSION_ID >= 50500)
+    error = inThisJobsTable->file->ha_index_read_map(inThisJobsTable->record[0], key, 1, HA_READ_KEY_EXACT);
+#else
+    error = inThisJobsTable->file->index_read_map(inThisJobsTable->record[0], key, 1, HA_READ_KEY_EXACT);
+#endif
+    while (!error) {
+        qqueue_jobs_row *job = extractJobFromTable(inThisJobsTable);
+        job->status = getRecoveryStatus(job, defaultStatus, lastSeen);
+
+        if (job->status == QUEUE_PENDING) {
+            requeuedJobs.push_back(job);
+        } else {
+            failedJobs.push_back(job);
         }
 
-        //first get job
-        qqueue_jobs_row *job = getJobFromID(inThisJobsTable, workArray[i]);
-        job->status = status;
+        jobCount++;
 
-        if (status == QUEUE_ERROR) {
-            //if we set running queries as errors, we need to copy them over to the
-            //history table and add a meaningful error message
-            char errorMessage[QQUEUE_ERROR_LEN] = "Job was canceled due to a restart of the queue and/or the server";
-            strncpy(job->error, errorMessage, QQUEUE_ERROR_LEN);
+#if MYSQL_VERSION_ID >= 50601 || (defined(MARIADB_BASE_VERSION) && MYSQL_VERSION_ID >= 50500)
+        error = inThisJobsTable->file->ha_index_next_same(inThisJobsTable->record[0], key,
+                                                          inThisJobsTable->key_info[1].key_part[0].store_length);
+#else
+        error = inThisJobsTable->file->index_next_same(inThisJobsTable->record[0], key,
+                                                       inThisJobsTable->key_info[1].key_part[0].store_length);
+#endif
+    }
+
+    inThisJobsTable->file->ha_index_end();
+
+    //and now update the rows we found
+    MYSQL_TIME nullTime = {0, 0, 0, 0, 0, 0, 0, 0};
+    qqueue_jobs_row *job;
+    List_iterator<qqueue_jobs_row> requeuedIter(requeuedJobs);
+    while ( (job = requeuedIter++) ) {
+        job->timeExecute = nullTime;
+        job->setError(NULL);
+        //resumable jobs continue after their last completed statement
+        if ((job->jobFlags & QQUEUE_JOB_RESUMABLE) == 0)
+            job->lastStmt = 0;
+        updateQqueueJobsRow(job, inThisJobsTable);
+    }
 
-            deleteQqueueJobsRow(job->id, inThisJobsTable);
+    List_iterator<qqueue_jobs_row> failedIter(failedJobs);
+    while ( (job = failedIter++) ) {
+        //if we set running queries as errors, we need to copy them over to the
+        //history table and add a meaningful error message
+        job->setError("Job was canceled due to a restart of the queue and/or the server");
+        job->timeFinish = localTime;
 
-            close_sysTbl(current_thd, inThisJobsTable, &backup);
+        deleteQqueueJobsRow(job->id, inThisJobsTable);
+    }
+
+    close_sysTbl(current_thd, inThisJobsTable, &backup);
 
-            error = 0;
-            Open_tables_backup backup2;
-            TABLE *toThisHistoryTable = open_sysTbl(current_thd, "qqueue_history", strlen("qqueue_history"), &backup2, true, &error);
-            if (error || toThisHistoryTable == NULL) {
-                fprintf(stderr, "qqueue_daemon_reset: error in opening history sys table: error: %i\n", error);
-                close_sysTbl(current_thd, toThisHistoryTable, &backup2);
-                return 0;
+    if (failedJobs.is_empty() == false) {
+        error = 0;
+        TABLE *toThisHistoryTable = open_sysTbl(current_thd, "qqueue_history", strlen("qqueue_history"), &backup, true, &error);
+        if (error || toThisHistoryTable == NULL) {
+            fprintf(stderr, "qqueue_daemon_reset: error in opening history sys table: error: %i\n", error);
+            close_sysTbl(current_thd, toThisHistoryTable, &backup);
+        } else {
+            failedIter.rewind();
+            while ( (job = failedIter++) ) {
+                addQqueueJobsRow(job, toThisHistoryTable, job->id);
             }
 
-            addQqueueJobsRow(job, toThisHistoryTable, job->id);
+            close_sysTbl(current_thd, toThisHistoryTable, &backup);
+        }
+
+        //split jobs learn about their failed sub-jobs, failed split jobs leave no tables behind
+        failedIter.rewind();
+        while ( (job = failedIter++) ) {
+            if (job->parentJob != 0)
+                subJobEnded(job);
+            else if (job->subJobs > 0)
+                dropSubJobTables(current_thd, job);
+        }
+    }
 
-            close_sysTbl(current_thd, toThisHistoryTable, &backup2);
-        } else if (status == QUEUE_PENDING) {
-            //if we set running queries to pending for reexecution, we just update the status and hope
-            //everything is well. TODO: CHECK HERE FOR EXISTING TABLE IN FUTURE
+    //get rid of the partial results of the jobs that will run again. chunked jobs
+    //continue after the chunks they committed, resumable jobs after their statements
+    List<qqueue_jobs_row> strandedJobs;
+    requeuedIter.rewind();
+    while ( (job = requeuedIter++) ) {
+        char query[2 * QQUEUE_RESULTDBNAME_LEN + 2 * QQUEUE_RESULTTBLNAME_LEN + 128];
+        char *queryError = NULL;
 
-            //cheep version of updating a row, since I could not figure out how to do this properly with
-            //InnoDB... This will reset the job id though...
-            deleteQqueueJobsRow(job->id, inThisJobsTable);
-            addQqueueJobsRow(job, inThisJobsTable, job->id);
+        if (job->keepsPartialResult() == true)
+            continue;
 
-            close_sysTbl(current_thd, inThisJobsTable, &backup);
+        if (keepPartial == true) {
+            snprintf(query, sizeof(query), "RENAME TABLE `%s`.`%s` TO `%s`.`qqueue_partial_%lli`",
+                     job->resultDBName, job->resultTableName, job->resultDBName, job->id);
         } else {
-            fprintf(stderr, "QQuery: Reset query: unable to reset running queries to status %i.\n", status);
-            delete job;
+            snprintf(query, sizeof(query), "DROP TABLE IF EXISTS `%s`.`%s`",
+                     job->resultDBName, job->resultTableName);
+        }
 
-            close_sysTbl(current_thd, inThisJobsTable, &backup);
-            return -1;
+        if (execSimpleQuery(current_thd, query, &queryError) != 0) {
+            if (keepPartial == false) {
+                fprintf(stderr, "QQuery: could not remove partial result table of job %lli: %s\n",
+                        job->id, queryError != NULL ? queryError : "");
+            } else if (partialTableExists(job) == true) {
+                //renaming fails if there is no partial table, which is fine. otherwise the rows
+                //are kept where they are and the job, which could not create its table, fails
+                fprintf(stderr, "QQuery: could not rename partial result table of job %lli, keeping it: %s\n",
+                        job->id, queryError != NULL ? queryError : "");
+                job->status = QUEUE_ERROR;
+                job->setError("Job was canceled due to a restart of the queue and/or the server, "
+                              "its partial result table could not be renamed");
+                job->timeFinish = localTime;
+                strandedJobs.push_back(job);
+            }
         }
 
-        delete job;
+        if (queryError != NULL)
+            my_free(queryError);
     }
 
-    my_free(workArray);
+    if (strandedJobs.is_empty() == false)
+        strandJobs(&strandedJobs);
+
+    fprintf(stderr, "QQuery: Recovered %i jobs, %i pending again, %i moved to the history\n",
+            jobCount, requeuedJobs.elements - strandedJobs.elements, failedJobs.elements + strandedJobs.elements);
+
+    requeuedJobs.delete_elements();
+    failedJobs.delete_elements();
 
     return jobCount;
-}
\ No newline at end of file
+}
@@ -29,6 +29,7 @@
 #define MYSQL_SERVER 1
 
 #include <sql_class.h>
+#include <sql_cache.h>
 #include <mysql_time.h>
 #include <my_global.h>
 
@@ -40,6 +41,19 @@
 #define QQUEUE_RESULTDBNAME_LEN 128
 #define QQUEUE_RESULTTBLNAME_LEN 128
 #define QQUEUE_ERROR_LEN 1024
+#define QQUEUE_CPUSET_LEN 256
+#define QQUEUE_ENGINE_LEN 64
+#define QQUEUE_HEARTBEAT_FILE "qqueue.heartbeat"
+
+//flags of a job given to qqueue_addJob
+#define QQUEUE_JOB_RESUMABLE 1              //statements can be skipped once they completed
+#define QQUEUE_JOB_OUTPUT_CSV 2             //the result set goes to a CSV file in the spool directory
+#define QQUEUE_JOB_OUTPUT_COLUMNAR 4        //the result set goes to a columnar file in the spool directory
+#define QQUEUE_JOB_OUTPUT_GZIP 8            //the output file is compressed
+#define QQUEUE_JOB_EXPORT 16                //the result table is exported to a columnar file once the job succeeded
+#define QQUEUE_JOB_SPLIT 32                 //the query is run in primary key ranges by sub-jobs
+#define QQUEUE_JOB_CHUNKED 64               //the result is written in primary key ranges, one transaction each
+#define QQUEUE_JOB_OUTPUT_FILE (QQUEUE_JOB_OUTPUT_CSV | QQUEUE_JOB_OUTPUT_COLUMNAR)
 
 enum enum_queue_status {
     QUEUE_PENDING,
@@ -48,7 +62,16 @@ enum enum_queue_status {
     QUEUE_ERROR,
     QUEUE_SUCCESS,
     QUEUE_TIMEOUT,
-    QUEUE_KILLED
+    QUEUE_KILLED,
+    QUEUE_WAITING                           //waits for its sub-jobs
+};
+
+//what happens to the running jobs of a queue after a restart
+enum enum_queue_recovery {
+    QUEUE_RECOVERY_DEFAULT,                 //as set in qqueue_recovery
+    QUEUE_RECOVERY_REQUEUE,
+    QUEUE_RECOVERY_FAIL,
+    QUEUE_RECOVERY_REQUEUE_SHORT            //requeue if it ran less than recoveryMaxRuntime seconds
 };
 
 #if !defined(MARIADB_BASE_VERSION) && MYSQL_VERSION_ID >= 50605
@@ -60,6 +83,30 @@ public:
     int id;
     char name[QQUEUE_NAME_LEN];
     int priority;
+    //quotas of the group as a whole, 0 for no limit
+    int maxRunning;
+    int maxPending;
+    int submitRate;
+    int submitBurst;
+    //quotas of each user in the group, 0 for no limit
+    int usrMaxRunning;
+    int usrMaxPending;
+    int usrSubmitRate;
+    int usrSubmitBurst;
+
+    qqueue_usrGrp_row() {
+        id = 0;
+        name[0] = '\0';
+        priority = 0;
+        maxRunning = 0;
+        maxPending = 0;
+        submitRate = 0;
+        submitBurst = 0;
+        usrMaxRunning = 0;
+        usrMaxPending = 0;
+        usrSubmitRate = 0;
+        usrSubmitBurst = 0;
+    }
 };
 
 #if !defined(MARIADB_BASE_VERSION) && MYSQL_VERSION_ID >= 50605
@@ -72,8 +119,73 @@ public:
     char name[QQUEUE_NAME_LEN];
     int priority;
     long long timeout;
+    my_bool preemptible;
+    int agingRate;
+    int agingCap;
+    int recoveryPolicy;
+    long long recoveryMaxRuntime;
+    my_bool killWait;                       //start the next job only once a killed one has exited
+    char cpuSet[QQUEUE_CPUSET_LEN];         //CPUs the workers are bound to, empty for all
+    int numaNode;                           //NUMA node the workers are bound to, -1 for none
+    int niceValue;                          //nice value of the workers
+    int ioClass;                            //I/O scheduling class of the workers, 0 for none
+    int ioLevel;
+    long long maxReadRows;                  //rows a job may read per second, 0 for no limit
+    long long maxReadBytes;                 //bytes a job may read per second, 0 for no limit
+    //options of the result tables of the jobs, empty for the server's defaults
+    char resultEngine[QQUEUE_ENGINE_LEN];
+    char resultRowFormat[QQUEUE_ENGINE_LEN];
+    int resultCompression;                  //KEY_BLOCK_SIZE of compressed tables, 0 for none
+    char resultDataDir[FN_REFLEN];
+    my_bool resultNoBinlog;                 //jobs of the queue are not written to the binary log
+
+    qqueue_queues_row() {
+        id = 0;
+        name[0] = '\0';
+        priority = 0;
+        timeout = 0;
+        preemptible = 0;
+        agingRate = 0;
+        agingCap = 0;
+        recoveryPolicy = QUEUE_RECOVERY_DEFAULT;
+        recoveryMaxRuntime = 0;
+        killWait = 1;
+        cpuSet[0] = '\0';
+        numaNode = -1;
+        niceValue = 0;
+        ioClass = 0;
+        ioLevel = 4;
+        maxReadRows = 0;
+        maxReadBytes = 0;
+        resultEngine[0] = '\0';
+        resultRowFormat[0] = '\0';
+        resultCompression = 0;
+        resultDataDir[0] = '\0';
+        resultNoBinlog = 0;
+    }
+};
+
+enum enum_qqueue_option_type {
+    QQUEUE_OPTION_INT,
+    QQUEUE_OPTION_STRING
+};
+
+//options of queues and user groups that can be set through qqueue_setQueueOption()
+//and qqueue_setUsrGrpOption() and the column they are stored in
+struct qqueue_option {
+    const char *name;
+    int fieldIdx;
+    enum enum_qqueue_option_type type;
 };
 
+//block size of the arena holding the strings of a job
+#define QQUEUE_JOB_ARENA_BLOCK 1024
+
+//space mysql_parse needs behind a query, the same alloc_query reserves: the query
+//cache puts the length and name of the current database and its flags right after
+//the query text
+#define QQUEUE_QUERY_PADDING (1 + QUERY_CACHE_DB_LENGTH_SIZE + NAME_LEN + QUERY_CACHE_FLAGS_SIZE)
+
 #if !defined(MARIADB_BASE_VERSION) && MYSQL_VERSION_ID >= 50605
 class qqueue_jobs_row : public ilink<qqueue_jobs_row> {
 #else
@@ -81,40 +193,122 @@ class qqueue_jobs_row : public ilink {
 #endif
 public:
     long long id;
-    char *mysqlUserName;
     int usrId;
     int usrGroup;
     int queue;
     int priority;
-    char *query;
-    int queryLen;
+    int effPriority;
+    int preemptCount;
+    int jobFlags;
+    int lastStmt;                           //number of statements completed so far
+    long long throttleTime;                 //milliseconds the job was slowed down by its read limits
+    long long outputSize;                   //size of the output file in bytes
+    long long parentJob;                    //job this one is a sub-job of, 0 for none
+    int subJobs;                            //number of sub-jobs the job has been split into
+    int chunksDone;                         //number of chunks in the result table
+    long long chunkPos;                     //key the next chunk starts at
     enum enum_queue_status status;
-    char resultDBName[QQUEUE_RESULTDBNAME_LEN];
-    char resultTableName[QQUEUE_RESULTTBLNAME_LEN];
     my_bool paquFlag;
     MYSQL_TIME timeSubmit;
     MYSQL_TIME timeExecute;
     MYSQL_TIME timeFinish;
-    char *actualQuery;
-    char error[QQUEUE_ERROR_LEN];
+
+    //all strings of the job live in the arena and are freed together with the job
+    MEM_ROOT arena;
+    char *mysqlUserName;
+    char *query;
+    char *actualQuery;                      //padded for mysql_parse, see setActualQuery
+    size_t actualQueryLen;
+    char *resultDBName;
+    char *resultTableName;
+    char *error;                            //NULL if there is no error
     char *comment;
+    char *outputFile;                       //NULL if the job has not written a file
 
     qqueue_jobs_row() {
+        preemptCount = 0;
+        effPriority = 0;
+        jobFlags = 0;
+        lastStmt = 0;
+        throttleTime = 0;
+        outputSize = 0;
+        parentJob = 0;
+        subJobs = 0;
+        chunksDone = 0;
+        chunkPos = 0;
         mysqlUserName = NULL;
         actualQuery = NULL;
+        actualQueryLen = 0;
         query = NULL;
+        resultDBName = NULL;
+        resultTableName = NULL;
+        error = NULL;
         comment = NULL;
+        outputFile = NULL;
+
+#if defined(MARIADB_BASE_VERSION) && MYSQL_VERSION_ID >= 100000
+        init_alloc_root(&arena, QQUEUE_JOB_ARENA_BLOCK, 0, MYF(0));
+#else
+        init_alloc_root(&arena, QQUEUE_JOB_ARENA_BLOCK, 0);
+#endif
     }
 
     virtual ~qqueue_jobs_row() {
-        if (mysqlUserName)
-            my_free(mysqlUserName);
-        if (actualQuery)
-            my_free(actualQuery);
-        if (query)
-            my_free(query);
-        if (comment)
-            my_free(comment);
+        free_root(&arena, MYF(0));
+    }
+
+    //jobs that continue after their committed chunks or completed statements
+    //when they run again keep what they have written to their result table
+    bool keepsPartialResult() {
+        return chunksDone > 0 || ((jobFlags & QQUEUE_JOB_RESUMABLE) != 0 && lastStmt > 0);
+    }
+
+    //copies a string into the arena of the job
+    char *dupString(const char *str) {
+        if (str == NULL)
+            return NULL;
+
+        return strdup_root(&arena, str);
+    }
+
+    void *alloc(size_t size) {
+        return alloc_root(&arena, size);
+    }
+
+    //copies the query that is executed into the arena. the buffer is padded, so that
+    //the worker can hand it to the parser as it is
+    char *setActualQuery(const char *str, size_t len) {
+        if (str == NULL) {
+            actualQuery = NULL;
+            actualQueryLen = 0;
+            return NULL;
+        }
+
+        actualQuery = (char *) alloc_root(&arena, len + QQUEUE_QUERY_PADDING);
+        if (actualQuery == NULL) {
+            actualQueryLen = 0;
+            return NULL;
+        }
+
+        memcpy(actualQuery, str, len);
+        memset(actualQuery + len, 0, QQUEUE_QUERY_PADDING);
+        actualQueryLen = len;
+
+        return actualQuery;
+    }
+
+    void setError(const char *message) {
+        if (message == NULL || message[0] == '\0') {
+            error = NULL;
+        } else {
+            error = strmake_root(&arena, message, strnlen(message, QQUEUE_ERROR_LEN - 1));
+        }
+    }
+
+    //points the error at a message that lives as long as the plugin. the arena is
+    //not touched, so threads other than the worker of the job may call it
+    void setStaticError(const char *message) {
+        error = (char *) message;
     }
 };
 
@@ -126,24 +320,65 @@ void close_sysTbl(THD *thd, TABLE *table, Open_tables_backup *tblBackup);
 
 int retrRowAtPKId(TABLE *table, ulonglong id);
 
+//columns of the system tables in the first version of the queue and now. the
+//later columns are missing until upgrade_qqueue.sql has been run on an older
+//installation, they read as their defaults and are not written
+#define QQUEUE_USRGRPS_MIN_FIELDS 3
+#define QQUEUE_USRGRPS_FIELDS 11
+#define QQUEUE_QUEUES_MIN_FIELDS 4
+#define QQUEUE_QUEUES_FIELDS 22
+#define QQUEUE_JOBS_MIN_FIELDS 17
+#define QQUEUE_JOBS_FIELDS 28
+
+bool checkSysTblFields(TABLE *table, uint minFields, uint numFields);
+bool sysTblHasField(TABLE *table, uint idx);
+longlong sysTblInt(TABLE *table, uint idx, longlong defVal);
+bool sysTblStr(TABLE *table, uint idx, String *str);
+void sysTblStoreInt(TABLE *table, uint idx, longlong value);
+
 void loadQqueueUsrGrps(TABLE *fromThisTable);
 void loadQqueueQueues(TABLE *fromThisTable);
 int addQqueueUsrGrpRow(qqueue_usrGrp_row *thisRow, TABLE *toThisTable);
 int addQqueueQueuesRow(qqueue_queues_row *thisRow, TABLE *toThisTable);
 int updateQqueueUsrGrpRow(qqueue_usrGrp_row *thisRow, TABLE *toThisTable);
 int updateQqueueQueuesRow(qqueue_queues_row *thisRow, TABLE *toThisTable);
+const qqueue_option *getQueueOption(const char *name);
+int setQqueueQueuesOption(long long queueId, const qqueue_option *option,
+                          long long intValue, const char *strValue, TABLE *toThisTable);
+const qqueue_option *getUsrGrpOption(const char *name);
+int setQqueueUsrGrpsOption(long long usrGrpId, const qqueue_option *option,
+                           long long intValue, const char *strValue, TABLE *toThisTable);
 
 int addQqueueJobsRow(qqueue_jobs_row *thisRow, TABLE *toThisTable, ulonglong id);
 int updateQqueueJobsRow(qqueue_jobs_row *thisRow, TABLE *toThisTable);
 int setQqueueJobsRow(qqueue_jobs_row *thisRow, TABLE *toThisTable);
 int deleteQqueueJobsRow(ulonglong id, TABLE *toThisTable);
+int setQqueueJobsLastStmt(ulonglong id, int lastStmt, TABLE *toThisTable);
+int setQqueueJobsChunk(ulonglong id, int chunksDone, long long chunkPos, TABLE *toThisTable);
+int setQqueueJobsOutput(ulonglong id, const char *outputFile, long long outputSize, TABLE *toThisTable);
+int countQqueueSubJobs(ulonglong parentId, TABLE *fromThisTable);
+#define QQUEUE_MAX_RESERVED_IDS 1000000   //largest range of ids qqueue_reserveJobIds hands out
+
+int seedJobIds();
+void raiseJobIds(longlong id);
+ulonglong newJobIdRange(int count);
+ulonglong newJobId();
 
 qqueue_usrGrp_row *getUsrGrp(char *usrGrp);
+qqueue_usrGrp_row *getUsrGrpByID(long long id);
 qqueue_queues_row *getQueue(char *queue);
 qqueue_queues_row *getQueueByID(long long id);
 qqueue_jobs_row *getJobFromID(TABLE *fromThisTable, ulonglong id);
-qqueue_jobs_row **getHighestPriorityJob(TABLE *fromThisTable, int numJobs);
-int resetJobQueue(enum_queue_status status);
+qqueue_jobs_row *extractJobFromTable(TABLE *fromThisTable);
+qqueue_jobs_row **getHighestPriorityJob(TABLE *fromThisTable, int numJobs, bool reserveQuota);
+long long getEffectivePriority(long long priority, long long queueId, const MYSQL_TIME *subTime,
+                               longlong now);
+int resetJobQueue(enum_queue_status defaultStatus, bool keepPartial);
+void touchHeartbeat();
 bool checkIfResultTableExists(TABLE *inThisTable, char *database, char *tblName);
+bool reserveResultTable(const char *database, const char *tblName);
+void releaseResultTable(const char *database, const char *tblName, long long journaledJobId);
+bool reserveJobId(long long id);
+void releaseJobId(long long id, bool journaled);
 
 #endif
\ No newline at end of file
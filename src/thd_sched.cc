@@ -0,0 +1,317 @@
+/* Copyright (c) 2012, 2013, Adrian M. Partl, eScience Group at the
+   Leibniz Institut for Astrophysics, Potsdam
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; version 2 of the License.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA */
+
+/*****************************************************************
+ ********                    thd_sched                     *******
+ *****************************************************************
+ *
+ * placement of the job worker threads on CPUs and NUMA nodes
+ *
+ *****************************************************************
+ */
+
+#define MYSQL_SERVER 1
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <sys/resource.h>
+#include <sql_class.h>
+#include "sys_tbl.h"
+#include "exec_query.h"
+#include "thd_sched.h"
+
+#ifdef USE_PRAGMA_IMPLEMENTATION
+#pragma implementation
+#endif
+
+//memory policy of set_mempolicy(2), numaif.h is not needed for this one
+#define QQUEUE_MPOL_DEFAULT 0
+#define QQUEUE_MPOL_PREFERRED 1
+
+//ioprio_set(2) has no glibc wrapper
+#define QQUEUE_IOPRIO_WHO_PROCESS 1
+#define QQUEUE_IOPRIO_CLASS_SHIFT 13
+
+char numaSpread;
+
+static int numNodes = 0;
+static cpu_set_t nodeCpus[QQUEUE_MAX_NUMA_NODES];
+static int nodeJobs[QQUEUE_MAX_NUMA_NODES];
+static bool schedInitialised = false;
+mysql_mutex_t LOCK_thd_sched;
+
+//parses a list of CPUs like "0-7,16-23" as found in the cpulist files of sysfs
+static int parseCpuList(const char *list, cpu_set_t *cpus) {
+    const char *pos = list;
+
+    CPU_ZERO(cpus);
+
+    while (*pos != '\0') {
+        char *end;
+
+        while (*pos == ' ' || *pos == ',' || *pos == '\n')
+            pos++;
+        if (*pos == '\0')
+            break;
+
+        long first = strtol(pos, &end, 10);
+        if (end == pos || first < 0)
+            return 1;
+
+        long last = first;
+        pos = end;
+        if (*pos == '-') {
+            pos++;
+            last = strtol(pos, &end, 10);
+            if (end == pos || last < first)
+                return 1;
+            pos = end;
+        }
+
+        if (*pos != '\0' && *pos != ',' && *pos != '\n' && *pos != ' ')
+            return 1;
+
+        for (long cpu = first; cpu <= last && cpu < CPU_SETSIZE; cpu++) {
+            CPU_SET(cpu, cpus);
+        }
+    }
+
+    return CPU_COUNT(cpus) > 0 ? 0 : 1;
+}
+
+//reads the NUMA topology from sysfs. a machine without it is treated as a
+//single node
+int initThdSched() {
+    char path[FN_REFLEN];
+    char buff[4096];
+
+    if (schedInitialised == true)
+        return 0;
+
+    mysql_mutex_init(0, &LOCK_thd_sched, MY_MUTEX_INIT_FAST);
+
+    numNodes = 0;
+    for (int i = 0; i < QQUEUE_MAX_NUMA_NODES; i++) {
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%i/cpulist", i);
+
+        FILE *file = fopen(path, "r");
+        if (file == NULL)
+            break;
+
+        if (fgets(buff, sizeof(buff), file) != NULL && parseCpuList(buff, &nodeCpus[i]) == 0) {
+            numNodes = i + 1;
+        }
+        fclose(file);
+
+        nodeJobs[i] = 0;
+    }
+
+    schedInitialised = true;
+
+    return 0;
+}
+
+int schedNodeOfCpu(int cpu) {
+    if (cpu < 0 || cpu >= CPU_SETSIZE)
+        return -1;
+
+    for (int i = 0; i < numNodes; i++) {
+        if (CPU_ISSET(cpu, &nodeCpus[i]))
+            return i;
+    }
+
+    return -1;
+}
+
+//binds the calling thread to the CPUs of a node and prefers the memory of that node
+static int bindToNode(int node) {
+    if (node < 0 || node >= numNodes)
+        return 1;
+
+    if (pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &nodeCpus[node]) != 0)
+        return 1;
+
+    unsigned long nodeMask = 1UL << node;
+    if (syscall(SYS_set_mempolicy, QQUEUE_MPOL_PREFERRED, &nodeMask, sizeof(nodeMask) * 8) != 0) {
+        fprintf(stderr, "Query queue - thd_sched: could not set the memory policy for node %i\n", node);
+    }
+
+    return 0;
+}
+
+//called on the worker thread before the job runs. a CPU set of the queue takes
+//precedence over its NUMA node. jobs of queues without either are spread over
+//the nodes if qqueue_numaSpread is set
+void schedJobStart(jobWorkerThd *job) {
+    char cpuList[QQUEUE_CPUSET_LEN];
+    int node = -1;
+    int niceValue = 0;
+    int ioClass = QQUEUE_IOPRIO_CLASS_NONE;
+    int ioLevel = 0;
+
+    job->tid = (pid_t) syscall(SYS_gettid);
+    job->numaNode = -1;
+    job->numaSpread = false;
+    cpuList[0] = '\0';
+
+    qqueue_queues_row *queue = getQueueByID(job->job->queue);
+    if (queue != NULL) {
+        strmake(cpuList, queue->cpuSet, QQUEUE_CPUSET_LEN - 1);
+        node = queue->numaNode;
+        niceValue = queue->niceValue;
+        ioClass = queue->ioClass;
+        ioLevel = queue->ioLevel;
+    }
+
+    //the worker thread only lives for this job, so nothing needs to be reset later
+    if (niceValue != 0 || ioClass != QQUEUE_IOPRIO_CLASS_NONE) {
+        if (schedSetThreadPriority(job->tid, niceValue != 0 ? niceValue : QQUEUE_SCHED_KEEP,
+                                   ioClass != QQUEUE_IOPRIO_CLASS_NONE ? ioClass : QQUEUE_SCHED_KEEP,
+                                   ioLevel) != 0) {
+            fprintf(stderr, "Query queue - thd_sched: could not set the priority of job %lli\n",
+                    job->job->id);
+        }
+    }
+
+    if (cpuList[0] != '\0') {
+        cpu_set_t cpus;
+
+        if (parseCpuList(cpuList, &cpus) != 0 ||
+                pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpus) != 0) {
+            fprintf(stderr, "Query queue - thd_sched: could not bind job %lli to CPUs %s\n",
+                    job->job->id, cpuList);
+        }
+
+        return;
+    }
+
+    if (node < 0 && numaSpread == true && numNodes > 1) {
+        mysql_mutex_lock(&LOCK_thd_sched);
+
+        node = 0;
+        for (int i = 1; i < numNodes; i++) {
+            if (nodeJobs[i] < nodeJobs[node])
+                node = i;
+        }
+        nodeJobs[node]++;
+        job->numaSpread = true;
+
+        mysql_mutex_unlock(&LOCK_thd_sched);
+    }
+
+    if (node >= 0) {
+        if (bindToNode(node) != 0) {
+            fprintf(stderr, "Query queue - thd_sched: could not bind job %lli to NUMA node %i\n",
+                    job->job->id, node);
+        } else {
+            job->numaNode = node;
+        }
+    }
+}
+
+void schedJobEnd(jobWorkerThd *job) {
+    job->tid = 0;
+
+    if (job->numaSpread == true) {
+        mysql_mutex_lock(&LOCK_thd_sched);
+        nodeJobs[job->numaNode >= 0 ? job->numaNode : 0]--;
+        mysql_mutex_unlock(&LOCK_thd_sched);
+
+        job->numaSpread = false;
+    }
+}
+
+//sets the nice value and the I/O class and level of a thread of the server.
+//settings given as QQUEUE_SCHED_KEEP are not changed, the level is only used
+//together with a class. raising the priority needs CAP_SYS_NICE
+int schedSetThreadPriority(pid_t tid, int niceValue, int ioClass, int ioLevel) {
+    int result = 0;
+
+    if (tid == 0)
+        return 1;
+
+    if (niceValue != QQUEUE_SCHED_KEEP) {
+        if (setpriority(PRIO_PROCESS, (id_t) tid, niceValue) != 0)
+            result = 1;
+    }
+
+    if (ioClass != QQUEUE_SCHED_KEEP) {
+        if (ioLevel < 0 || ioLevel > 7)
+            ioLevel = 4;
+
+        int ioprio = ioClass == QQUEUE_IOPRIO_CLASS_NONE ? 0 :
+                     (ioClass << QQUEUE_IOPRIO_CLASS_SHIFT) | ioLevel;
+
+        if (syscall(SYS_ioprio_set, QQUEUE_IOPRIO_WHO_PROCESS, (int) tid, ioprio) != 0)
+            result = 1;
+    }
+
+    return result;
+}
+
+//returns the CPU a thread of the server last ran on, or -1. migrations is set to
+//the number of times the scheduler moved the thread, or -1 if the kernel does
+//not tell
+int schedThreadCpu(pid_t tid, longlong *migrations) {
+    char path[FN_REFLEN];
+    char buff[1024];
+    int cpu = -1;
+
+    *migrations = -1;
+
+    snprintf(path, sizeof(path), "/proc/self/task/%i/stat", (int) tid);
+    FILE *file = fopen(path, "r");
+    if (file != NULL) {
+        if (fgets(buff, sizeof(buff), file) != NULL) {
+            //the processor is field 39, counting starts after the command name
+            char *pos = strrchr(buff, ')');
+            int field = 2;
+
+            while (pos != NULL && field < 39) {
+                pos = strchr(pos + 1, ' ');
+                field++;
+            }
+
+            if (pos != NULL)
+                cpu = atoi(pos + 1);
+        }
+        fclose(file);
+    }
+
+    snprintf(path, sizeof(path), "/proc/self/task/%i/sched", (int) tid);
+    file = fopen(path, "r");
+    if (file != NULL) {
+        while (fgets(buff, sizeof(buff), file) != NULL) {
+            if (strncmp(buff, "se.nr_migrations", strlen("se.nr_migrations")) == 0) {
+                char *pos = strchr(buff, ':');
+                if (pos != NULL)
+                    *migrations = strtoll(pos + 1, NULL, 10);
+                break;
+            }
+        }
+        fclose(file);
+    }
+
+    return cpu;
+}
@@ -0,0 +1,61 @@
+/* Copyright (c) 2012, 2013, Adrian M. Partl, eScience Group at the
+   Leibniz Institut for Astrophysics, Potsdam
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; version 2 of the License.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA */
+
+/*****************************************************************
+ ********                    thd_sched                     *******
+ *****************************************************************
+ *
+ * placement of the job worker threads on CPUs and NUMA nodes
+ *
+ *****************************************************************
+ */
+
+#ifndef __MYSQL_THD_SCHED__
+#define __MYSQL_THD_SCHED__
+
+#define MYSQL_SERVER 1
+
+#include <sql_class.h>
+#include "exec_query.h"
+
+#ifdef USE_PRAGMA_IMPLEMENTATION
+#pragma implementation
+#endif
+
+#define QQUEUE_MAX_NUMA_NODES 64
+
+//I/O scheduling classes of ioprio_set(2), 0 keeps the class the kernel derives
+//from the nice value
+#define QQUEUE_IOPRIO_CLASS_NONE 0
+#define QQUEUE_IOPRIO_CLASS_RT 1
+#define QQUEUE_IOPRIO_CLASS_BE 2
+#define QQUEUE_IOPRIO_CLASS_IDLE 3
+
+//leaves a setting of schedSetThreadPriority as it is
+#define QQUEUE_SCHED_KEEP INT_MIN
+
+extern char numaSpread;
+
+int initThdSched();
+
+void schedJobStart(jobWorkerThd *job);
+void schedJobEnd(jobWorkerThd *job);
+
+int schedSetThreadPriority(pid_t tid, int niceValue, int ioClass, int ioLevel);
+int schedThreadCpu(pid_t tid, longlong *migrations);
+int schedNodeOfCpu(int cpu);
+
+#endif
@@ -0,0 +1,277 @@
+/* Copyright (c) 2012, 2013, Adrian M. Partl, eScience Group at the
+   Leibniz Institut for Astrophysics, Potsdam
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; version 2 of the License.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA */
+
+/*****************************************************************
+ ********                     throttle                     *******
+ *****************************************************************
+ *
+ * limits the rate at which running jobs read rows and bytes
+ *
+ * a thread compares the read counters of the jobs of queues with
+ * a read limit against a token bucket every tick and notes how far
+ * a job ran ahead. the worker pays this back by sleeping between
+ * its statements or chunks, where it holds no latches or locks of
+ * the server.
+ *
+ *****************************************************************
+ */
+
+#define MYSQL_SERVER 1
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <mysql_version.h>
+#include <sql_class.h>
+#include "sys_tbl.h"
+#include "exec_query.h"
+#include "throttle.h"
+
+#ifdef USE_PRAGMA_IMPLEMENTATION
+#pragma implementation
+#endif
+
+#define QQUEUE_THROTTLE_TICK_USEC 100000
+#define QQUEUE_THROTTLE_MAX_SLEEP_USEC 10000000
+
+mysql_mutex_t LOCK_throttle;
+mysql_cond_t COND_throttle;
+static pthread_t throttle_thread;
+static bool throttleInitialised = false;
+static bool throttleStop = false;
+
+//jobs with a read limit, the THD of a job stays valid while it is in the list
+static jobWorkerThd *throttleList = NULL;
+
+static ulonglong throttleNow() {
+#if defined(MARIADB_BASE_VERSION) && MYSQL_VERSION_ID >= 50500
+    return microsecond_interval_timer();
+#else
+    return my_micro_time();
+#endif
+}
+
+//bytes the thread has read from storage, 0 without task I/O accounting
+static ulonglong bytesRead(pid_t tid) {
+    char path[FN_REFLEN];
+    char buff[256];
+    ulonglong bytes = 0;
+
+    snprintf(path, sizeof(path), "/proc/self/task/%i/io", (int) tid);
+    FILE *file = fopen(path, "r");
+    if (file == NULL)
+        return 0;
+
+    while (fgets(buff, sizeof(buff), file) != NULL) {
+        if (strncmp(buff, "read_bytes:", strlen("read_bytes:")) == 0) {
+            bytes = strtoull(buff + strlen("read_bytes:"), NULL, 10);
+            break;
+        }
+    }
+    fclose(file);
+
+    return bytes;
+}
+
+//refills the buckets of a job by the time passed and takes out what it has read.
+//returns the seconds the job is ahead of its limit
+static double takeTokens(double *tokens, long long rate, double seconds, ulonglong used) {
+    if (rate <= 0)
+        return 0.0;
+
+    *tokens += rate * seconds;
+    if (*tokens > rate)
+        *tokens = rate;
+
+    *tokens -= used;
+
+    return *tokens < 0 ? -*tokens / rate : 0.0;
+}
+
+//one tick of the throttle, needs to be called with the throttle locked
+static void throttleJobs() {
+    ulonglong now = throttleNow();
+
+    for (jobWorkerThd *job = throttleList; job != NULL; job = job->throttleNext) {
+        double seconds = (now - job->throttleLast) / 1000000.0;
+        ulonglong rows = jobRowsRead(job->thd);
+        ulonglong bytes = job->maxReadBytes > 0 ? bytesRead(job->tid) : 0;
+        double ahead;
+
+        ahead = takeTokens(&job->rowTokens, job->maxReadRows, seconds, rows - job->lastRows);
+        double aheadBytes = takeTokens(&job->byteTokens, job->maxReadBytes, seconds, bytes - job->lastBytes);
+        if (aheadBytes > ahead)
+            ahead = aheadBytes;
+
+        job->throttleLast = now;
+        job->lastRows = rows;
+        job->lastBytes = bytes;
+
+        //the debt is what the bucket is short right now, not a sum over the ticks
+        job->throttleOwed = (ulonglong) (ahead * 1000000.0);
+    }
+}
+
+pthread_handler_t throttle_worker(void *p) {
+    struct timespec deltaTime;
+
+    my_thread_init();
+
+    mysql_mutex_lock(&LOCK_throttle);
+
+    while (throttleStop == false) {
+        throttleJobs();
+
+        set_timespec_nsec(deltaTime, QQUEUE_THROTTLE_TICK_USEC * 1000ULL);
+        mysql_cond_timedwait(&COND_throttle, &LOCK_throttle, &deltaTime);
+    }
+
+    mysql_mutex_unlock(&LOCK_throttle);
+
+    my_thread_end();
+    pthread_exit(0);
+
+    return NULL;
+}
+
+int startThrottle() {
+    pthread_attr_t attr;
+
+    if (throttleInitialised == true)
+        return 0;
+
+    mysql_mutex_init(0, &LOCK_throttle, MY_MUTEX_INIT_FAST);
+    mysql_cond_init(0, &COND_throttle, NULL);
+    throttleStop = false;
+
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_JOINABLE);
+    if (pthread_create(&throttle_thread, &attr, throttle_worker, NULL) != 0) {
+        fprintf(stderr, "Query queue - throttle ERROR: Could not create thread!\n");
+        pthread_attr_destroy(&attr);
+        mysql_cond_destroy(&COND_throttle);
+        mysql_mutex_destroy(&LOCK_throttle);
+        return 1;
+    }
+    pthread_attr_destroy(&attr);
+
+    throttleInitialised = true;
+
+    return 0;
+}
+
+void stopThrottle() {
+    if (throttleInitialised == false)
+        return;
+
+    mysql_mutex_lock(&LOCK_throttle);
+    throttleStop = true;
+    mysql_cond_signal(&COND_throttle);
+    mysql_mutex_unlock(&LOCK_throttle);
+
+    pthread_join(throttle_thread, NULL);
+
+    mysql_cond_destroy(&COND_throttle);
+    mysql_mutex_destroy(&LOCK_throttle);
+
+    throttleInitialised = false;
+}
+
+//called on the worker thread before the job runs. only jobs of queues with a
+//read limit are watched
+void throttleJobStart(jobWorkerThd *job) {
+    qqueue_queues_row *queue = getQueueByID(job->job->queue);
+    if (queue == NULL || (queue->maxReadRows <= 0 && queue->maxReadBytes <= 0))
+        return;
+
+    if (throttleInitialised == false || job->tid == 0)
+        return;
+
+    mysql_mutex_lock(&LOCK_throttle);
+
+    job->maxReadRows = queue->maxReadRows;
+    job->maxReadBytes = queue->maxReadBytes;
+    job->rowTokens = (double) job->maxReadRows;
+    job->byteTokens = (double) job->maxReadBytes;
+    job->throttleLast = throttleNow();
+    job->throttleOwed = 0;
+    job->lastRows = jobRowsRead(job->thd);
+    job->lastBytes = job->maxReadBytes > 0 ? bytesRead(job->tid) : 0;
+
+    job->throttlePrev = NULL;
+    job->throttleNext = throttleList;
+    if (throttleList != NULL)
+        throttleList->throttlePrev = job;
+    throttleList = job;
+    job->throttled = true;
+
+    mysql_mutex_unlock(&LOCK_throttle);
+}
+
+void throttleJobEnd(jobWorkerThd *job) {
+    if (job->throttled == false)
+        return;
+
+    mysql_mutex_lock(&LOCK_throttle);
+
+    if (job->throttlePrev != NULL)
+        job->throttlePrev->throttleNext = job->throttleNext;
+    else
+        throttleList = job->throttleNext;
+
+    if (job->throttleNext != NULL)
+        job->throttleNext->throttlePrev = job->throttlePrev;
+
+    job->throttlePrev = NULL;
+    job->throttleNext = NULL;
+    job->throttled = false;
+
+    mysql_mutex_unlock(&LOCK_throttle);
+}
+
+//called by the worker between statements and chunks, where it does not hold any
+//locks of the server. sleeps off the time the job is ahead of its read limits,
+//waking up early if the job is killed
+void throttlePoint(jobWorkerThd *job) {
+    if (job->throttled == false)
+        return;
+
+    mysql_mutex_lock(&LOCK_throttle);
+    ulonglong usec = job->throttleOwed;
+    mysql_mutex_unlock(&LOCK_throttle);
+
+    if (usec == 0)
+        return;
+
+    if (usec > QQUEUE_THROTTLE_MAX_SLEEP_USEC)
+        usec = QQUEUE_THROTTLE_MAX_SLEEP_USEC;
+
+    ulonglong slept = 0;
+    while (slept < usec && job->thd->killed == 0) {
+        ulonglong step = usec - slept;
+        if (step > QQUEUE_THROTTLE_TICK_USEC)
+            step = QQUEUE_THROTTLE_TICK_USEC;
+
+        my_sleep((ulong) step);
+        slept += step;
+    }
+
+    //the bucket has been refilled while sleeping, the next tick works out the new debt
+    mysql_mutex_lock(&LOCK_throttle);
+    job->throttleOwed = 0;
+    job->throttleUsec += slept;
+    mysql_mutex_unlock(&LOCK_throttle);
+}
@@ -31,12 +31,22 @@
 #include <mysql.h>
 #include <tztime.h>
 #include <sql_parse.h>
+#include <mysqld.h>
 #include "sys_tbl.h"
 #include "plugin_init.h"
 #include "internal_func.h"
 #include "sql_query.h"
 #include "exec_query.h"
 #include "query_queue.h"
+#include "history_cleanup.h"
+#include "quota.h"
+#include "thd_sched.h"
+#include "result_sink.h"
+#include "split_job.h"
+#include "journal.h"
+#include "event_trace.h"
+
+#define QQUEUE_HISTORY_CLEAN_BATCH 1000
 
 extern "C" {
 
@@ -53,6 +63,14 @@ extern "C" {
     void qqueue_flushUsrGrps_deinit(UDF_INIT *initid);
     long long qqueue_flushUsrGrps(UDF_INIT *initid, UDF_ARGS *args, char *is_null, char *is_error);
 
+    my_bool qqueue_setUsrGrpOption_init(UDF_INIT *initid, UDF_ARGS *args, char *message);
+    void qqueue_setUsrGrpOption_deinit(UDF_INIT *initid);
+    long long qqueue_setUsrGrpOption(UDF_INIT *initid, UDF_ARGS *args, char *is_null, char *is_error);
+
+    my_bool qqueue_setUsrQuota_init(UDF_INIT *initid, UDF_ARGS *args, char *message);
+    void qqueue_setUsrQuota_deinit(UDF_INIT *initid);
+    long long qqueue_setUsrQuota(UDF_INIT *initid, UDF_ARGS *args, char *is_null, char *is_error);
+
     // queues admin
     my_bool qqueue_addQueue_init(UDF_INIT *initid, UDF_ARGS *args, char *message);
     void qqueue_addQueue_deinit(UDF_INIT *initid);
@@ -66,15 +84,41 @@ extern "C" {
     void qqueue_flushQueues_deinit(UDF_INIT *initid);
     long long qqueue_flushQueues(UDF_INIT *initid, UDF_ARGS *args, char *is_null, char *is_error);
 
+    my_bool qqueue_setQueueOption_init(UDF_INIT *initid, UDF_ARGS *args, char *message);
+    void qqueue_setQueueOption_deinit(UDF_INIT *initid);
+    long long qqueue_setQueueOption(UDF_INIT *initid, UDF_ARGS *args, char *is_null, char *is_error);
+
     // job submission
     my_bool qqueue_addJob_init(UDF_INIT *initid, UDF_ARGS *args, char *message);
     void qqueue_addJob_deinit(UDF_INIT *initid);
     long long qqueue_addJob(UDF_INIT *initid, UDF_ARGS *args, char *is_null, char *is_error);
 
+    my_bool qqueue_reserveJobIds_init(UDF_INIT *initid, UDF_ARGS *args, char *message);
+    void qqueue_reserveJobIds_deinit(UDF_INIT *initid);
+    long long qqueue_reserveJobIds(UDF_INIT *initid, UDF_ARGS *args, char *is_null, char *is_error);
+
     my_bool qqueue_killJob_init(UDF_INIT *initid, UDF_ARGS *args, char *message);
     void qqueue_killJob_deinit(UDF_INIT *initid);
     long long qqueue_killJob(UDF_INIT *initid, UDF_ARGS *args, char *is_null, char *is_error);
 
+    my_bool qqueue_resumeJob_init(UDF_INIT *initid, UDF_ARGS *args, char *message);
+    void qqueue_resumeJob_deinit(UDF_INIT *initid);
+    long long qqueue_resumeJob(UDF_INIT *initid, UDF_ARGS *args, char *is_null, char *is_error);
+
+    my_bool qqueue_setJobPriority_init(UDF_INIT *initid, UDF_ARGS *args, char *message);
+    void qqueue_setJobPriority_deinit(UDF_INIT *initid);
+    long long qqueue_setJobPriority(UDF_INIT *initid, UDF_ARGS *args, char *is_null, char *is_error);
+
+    // history maintenance
+    my_bool qqueue_cleanHistory_init(UDF_INIT *initid, UDF_ARGS *args, char *message);
+    void qqueue_cleanHistory_deinit(UDF_INIT *initid);
+    long long qqueue_cleanHistory(UDF_INIT *initid, UDF_ARGS *args, char *is_null, char *is_error);
+
+    // event trace
+    my_bool qqueue_dumpEvents_init(UDF_INIT *initid, UDF_ARGS *args, char *message);
+    void qqueue_dumpEvents_deinit(UDF_INIT *initid);
+    long long qqueue_dumpEvents(UDF_INIT *initid, UDF_ARGS *args, char *is_null, char *is_error);
+
 #ifdef __QQUEUE_DEBUG__
     // job execution
     my_bool qqueue_execJob_init(UDF_INIT *initid, UDF_ARGS *args, char *message);
@@ -89,6 +133,12 @@ struct qqueue_table_data {
     THD *thd;
 };
 
+struct qqueue_option_data {
+    Open_tables_backup backup;
+    TABLE *tbl;
+    const qqueue_option *option;
+};
+
 struct qqueue_job_data {
     Open_tables_backup backup;
     TABLE *tbl;
@@ -96,6 +146,12 @@ struct qqueue_job_data {
     int priority;
     int id_usrGrp;
     int id_queue;
+    long long id_usr;
+    bool quotaReserved;
+    int jobFlags;                               //flags of the job, with the ones its queue adds
+    char resultDb[QQUEUE_RESULTDBNAME_LEN];     //result table reserved by qqueue_addJob
+    char resultTbl[QQUEUE_RESULTTBLNAME_LEN];
+    long long journaledId;                      //job that went to the journal, 0 if none
 };
 
 my_bool qqueue_addUsrGrp_init(UDF_INIT *initid, UDF_ARGS *args, char *message) {
@@ -271,6 +327,155 @@ long long qqueue_flushUsrGrps(UDF_INIT *initid, UDF_ARGS *args, char *is_null, c
     return 0;
 }
 
+my_bool qqueue_setUsrGrpOption_init(UDF_INIT *initid, UDF_ARGS *args, char *message) {
+    if (getPluginInstalled() == 0) {
+        strcpy(message, "Qqueue pluing is not installed on this MySQL instance.");
+        return 1;
+    }
+
+    //checking stuff to be correct
+    if (args->arg_count != 3) {
+        strcpy(message, "wrong number of arguments: qqueue_setUsrGrpOption() requires three parameters");
+        return 1;
+    }
+
+    if (args->arg_type[0] != INT_RESULT) {
+        strcpy(message, "qqueue_setUsrGrpOption() requires an integer as parameter one");
+        return 1;
+    }
+
+    if (args->arg_type[1] != STRING_RESULT || args->args[1] == NULL) {
+        strcpy(message, "qqueue_setUsrGrpOption() requires a string as parameter two");
+        return 1;
+    }
+
+    const qqueue_option *option = getUsrGrpOption((char *) args->args[1]);
+    if (option == NULL) {
+        strcpy(message, "qqueue_setUsrGrpOption() unknown user group option");
+        return 1;
+    }
+
+    if (option->type == QQUEUE_OPTION_INT && args->arg_type[2] != INT_RESULT) {
+        strcpy(message, "qqueue_setUsrGrpOption() requires an integer as parameter three for this option");
+        return 1;
+    }
+
+    if (option->type == QQUEUE_OPTION_STRING && args->arg_type[2] != STRING_RESULT) {
+        strcpy(message, "qqueue_setUsrGrpOption() requires a string as parameter three for this option");
+        return 1;
+    }
+
+    int error = 0;
+    qqueue_option_data *udfData = new qqueue_option_data;
+    udfData->option = option;
+    udfData->tbl = open_sysTbl(current_thd, "qqueue_usrGrps", strlen("qqueue_usrGrps"), &udfData->backup, true, &error);
+    if (error) {
+        strcpy(message, "qqueue_setUsrGrpOption: error in opening sys table");
+        close_sysTbl(current_thd, udfData->tbl, &udfData->backup);
+        delete udfData;
+        return 1;
+    }
+
+    //no limits on number of decimals
+    initid->decimals = 31;
+    initid->maybe_null = 0;
+    initid->max_length = 17 + 31;
+    initid->ptr = (char *) udfData;
+
+    return 0;
+}
+
+void qqueue_setUsrGrpOption_deinit(UDF_INIT *initid) {
+    qqueue_option_data *udfData = (qqueue_option_data *) initid->ptr;
+    close_sysTbl(current_thd, udfData->tbl, &udfData->backup);
+    delete (qqueue_option_data *) initid->ptr;
+}
+
+long long qqueue_setUsrGrpOption(UDF_INIT *initid, UDF_ARGS *args, char *is_null, char *is_error) {
+    qqueue_option_data *udfData = (qqueue_option_data *) initid->ptr;
+
+    long long intValue = 0;
+    const char *strValue = NULL;
+    if (udfData->option->type == QQUEUE_OPTION_INT) {
+        if (args->args[2] != NULL)
+            intValue = *(long long *) args->args[2];
+    } else {
+        strValue = (char *) args->args[2];
+    }
+
+    return setQqueueUsrGrpsOption(*(long long *) args->args[0], udfData->option, intValue, strValue, udfData->tbl);
+}
+
+my_bool qqueue_setUsrQuota_init(UDF_INIT *initid, UDF_ARGS *args, char *message) {
+    if (getPluginInstalled() == 0) {
+        strcpy(message, "Qqueue pluing is not installed on this MySQL instance.");
+        return 1;
+    }
+
+    //checking stuff to be correct
+    if (args->arg_count != 5) {
+        strcpy(message, "wrong number of arguments: qqueue_setUsrQuota() requires five parameters");
+        return 1;
+    }
+
+    if (args->arg_type[0] != INT_RESULT) {
+        strcpy(message, "qqueue_setUsrQuota() requires an integer as parameter one");
+        return 1;
+    }
+
+    //the limits are integers or NULL to inherit the value of the user group
+    for (unsigned int i = 1; i < args->arg_count; i++) {
+        args->arg_type[i] = INT_RESULT;
+    }
+
+    int error = 0;
+    qqueue_table_data *udfData = new qqueue_table_data;
+    udfData->tbl = open_sysTbl(current_thd, "qqueue_usrQuotas", strlen("qqueue_usrQuotas"), &udfData->backup, true, &error);
+    if (error) {
+        strcpy(message, "qqueue_setUsrQuota: error in opening sys table");
+        close_sysTbl(current_thd, udfData->tbl, &udfData->backup);
+        delete udfData;
+        return 1;
+    }
+
+    //no limits on number of decimals
+    initid->decimals = 31;
+    initid->maybe_null = 0;
+    initid->max_length = 17 + 31;
+    initid->ptr = (char *) udfData;
+
+    return 0;
+}
+
+void qqueue_setUsrQuota_deinit(UDF_INIT *initid) {
+    qqueue_table_data *udfData = (qqueue_table_data *) initid->ptr;
+    close_sysTbl(current_thd, udfData->tbl, &udfData->backup);
+    delete (qqueue_table_data *) initid->ptr;
+}
+
+static int getQuotaArg(UDF_ARGS *args, int i) {
+    if (args->args[i] == NULL)
+        return QQUEUE_QUOTA_INHERIT;
+
+    return (int) *(long long *) args->args[i];
+}
+
+long long qqueue_setUsrQuota(UDF_INIT *initid, UDF_ARGS *args, char *is_null, char *is_error) {
+    qqueue_table_data *udfData = (qqueue_table_data *) initid->ptr;
+    qqueue_usrQuota_row aRow;
+
+    if (args->args[0] == NULL)
+        return -1;
+
+    aRow.usrId = *(long long *) args->args[0];
+    aRow.maxRunning = getQuotaArg(args, 1);
+    aRow.maxPending = getQuotaArg(args, 2);
+    aRow.submitRate = getQuotaArg(args, 3);
+    aRow.submitBurst = getQuotaArg(args, 4);
+
+    return setQqueueUsrQuotaRow(&aRow, udfData->tbl);
+}
+
 
 ////////////////////////////////////////////////////////////////////////////////
 ///// queues function implementation ///////////////////////////////////////////
@@ -459,6 +664,85 @@ long long qqueue_flushQueues(UDF_INIT *initid, UDF_ARGS *args, char *is_null, ch
     return 0;
 }
 
+my_bool qqueue_setQueueOption_init(UDF_INIT *initid, UDF_ARGS *args, char *message) {
+    if (getPluginInstalled() == 0) {
+        strcpy(message, "Qqueue pluing is not installed on this MySQL instance.");
+        return 1;
+    }
+
+    //checking stuff to be correct
+    if (args->arg_count != 3) {
+        strcpy(message, "wrong number of arguments: qqueue_setQueueOption() requires three parameters");
+        return 1;
+    }
+
+    if (args->arg_type[0] != INT_RESULT) {
+        strcpy(message, "qqueue_setQueueOption() requires an integer as parameter one");
+        return 1;
+    }
+
+    if (args->arg_type[1] != STRING_RESULT || args->args[1] == NULL) {
+        strcpy(message, "qqueue_setQueueOption() requires a string as parameter two");
+        return 1;
+    }
+
+    const qqueue_option *option = getQueueOption((char *) args->args[1]);
+    if (option == NULL) {
+        strcpy(message, "qqueue_setQueueOption() unknown queue option");
+        return 1;
+    }
+
+    if (option->type == QQUEUE_OPTION_INT && args->arg_type[2] != INT_RESULT) {
+        strcpy(message, "qqueue_setQueueOption() requires an integer as parameter three for this option");
+        return 1;
+    }
+
+    if (option->type == QQUEUE_OPTION_STRING && args->arg_type[2] != STRING_RESULT) {
+        strcpy(message, "qqueue_setQueueOption() requires a string as parameter three for this option");
+        return 1;
+    }
+
+    int error = 0;
+    qqueue_option_data *udfData = new qqueue_option_data;
+    udfData->option = option;
+    udfData->tbl = open_sysTbl(current_thd, "qqueue_queues", strlen("qqueue_queues"), &udfData->backup, true, &error);
+    if (error) {
+        strcpy(message, "qqueue_setQueueOption: error in opening sys table");
+        close_sysTbl(current_thd, udfData->tbl, &udfData->backup);
+        delete udfData;
+        return 1;
+    }
+
+    //no limits on number of decimals
+    initid->decimals = 31;
+    initid->maybe_null = 0;
+    initid->max_length = 17 + 31;
+    initid->ptr = (char *) udfData;
+
+    return 0;
+}
+
+void qqueue_setQueueOption_deinit(UDF_INIT *initid) {
+    qqueue_option_data *udfData = (qqueue_option_data *) initid->ptr;
+    close_sysTbl(current_thd, udfData->tbl, &udfData->backup);
+    delete (qqueue_option_data *) initid->ptr;
+}
+
+long long qqueue_setQueueOption(UDF_INIT *initid, UDF_ARGS *args, char *is_null, char *is_error) {
+    qqueue_option_data *udfData = (qqueue_option_data *) initid->ptr;
+
+    long long intValue = 0;
+    const char *strValue = NULL;
+    if (udfData->option->type == QQUEUE_OPTION_INT) {
+        if (args->args[2] != NULL)
+            intValue = *(long long *) args->args[2];
+    } else {
+        strValue = (char *) args->args[2];
+    }
+
+    return setQqueueQueuesOption(*(long long *) args->args[0], udfData->option, intValue, strValue, udfData->tbl);
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 ///// jobsub function implementation ///////////////////////////////////////////
 ////////////////////////////////////////////////////////////////////////////////
@@ -470,8 +754,8 @@ my_bool qqueue_addJob_init(UDF_INIT *initid, UDF_ARGS *args, char *message) {
     }
 
     //checking stuff to be correct
-    if (!(args->arg_count == 9 || args->arg_count == 10)) {
-        strcpy(message, "wrong number of arguments: qqueue_addJob() requires nine (if actual query is given with paqu flag on, ten) parameters");
+    if (!(args->arg_count == 9 || args->arg_count == 10 || args->arg_count == 11)) {
+        strcpy(message, "wrong number of arguments: qqueue_addJob() requires nine (if actual query is given with paqu flag on, ten, if job flags are given, eleven) parameters");
         return 1;
     }
 
@@ -520,7 +804,7 @@ my_bool qqueue_addJob_init(UDF_INIT *initid, UDF_ARGS *args, char *message) {
         return 1;
     }
 
-    if (args->arg_count == 10) {
+    if (args->arg_count >= 10 && args->args[9] != NULL) {
         if (args->arg_type[9] != STRING_RESULT) {
             strcpy(message, "qqueue_addJob() requires an string as parameter ten");
             return 1;
@@ -533,6 +817,11 @@ my_bool qqueue_addJob_init(UDF_INIT *initid, UDF_ARGS *args, char *message) {
         }
     }
 
+    if (args->arg_count == 11 && args->arg_type[10] != INT_RESULT) {
+        strcpy(message, "qqueue_addJob() requires an integer as parameter eleven");
+        return 1;
+    }
+
     //retrieve and check userGrp and queue for priority calculation
     qqueue_usrGrp_row *priority_usrGrp = getUsrGrp((char *) args->args[2]);
     qqueue_queues_row *priority_queue = getQueue((char *) args->args[3]);
@@ -611,20 +900,36 @@ my_bool qqueue_addJob_init(UDF_INIT *initid, UDF_ARGS *args, char *message) {
         return 1;
     }
 
-    int i;
+    //the jobs table is only opened to look for pending jobs with the same result table
+    //and again in qqueue_addJob to insert the row. submissions in between are seen
+    //through the reservation
+    if (reserveResultTable((char *)args->args[5], (char *)args->args[6]) == false) {
+        strcpy(message, "qqueue_addJob() the result table will already be created by another query in the queue.");
+        return 1;
+    }
+
     int error = 0;
     qqueue_job_data *udfData = new qqueue_job_data;
-    udfData->tbl = open_sysTbl(current_thd, "qqueue_jobs", strlen("qqueue_jobs"), &udfData->backup, true, &error);
-    if (error) {
+    strmake(udfData->resultDb, (char *)args->args[5], QQUEUE_RESULTDBNAME_LEN - 1);
+    strmake(udfData->resultTbl, (char *)args->args[6], QQUEUE_RESULTTBLNAME_LEN - 1);
+    udfData->journaledId = 0;
+
+    udfData->tbl = open_sysTbl(current_thd, "qqueue_jobs", strlen("qqueue_jobs"), &udfData->backup, false, &error);
+    if (error || udfData->tbl == NULL) {
         strcpy(message, "qqueue_addJob: error in opening sys table");
         close_sysTbl(current_thd, udfData->tbl, &udfData->backup);
+        releaseResultTable(udfData->resultDb, udfData->resultTbl, 0);
         delete udfData;
         return 1;
     }
 
-    if (checkIfResultTableExists(udfData->tbl, (char *)args->args[5], (char *)args->args[6]) == true) {
+    bool resultExists = checkIfResultTableExists(udfData->tbl, (char *)args->args[5], (char *)args->args[6]);
+    close_sysTbl(current_thd, udfData->tbl, &udfData->backup);
+    udfData->tbl = NULL;
+
+    if (resultExists == true) {
         strcpy(message, "qqueue_addJob() the result table will already be created by another query in the queue.");
-        close_sysTbl(current_thd, udfData->tbl, &udfData->backup);
+        releaseResultTable(udfData->resultDb, udfData->resultTbl, 0);
         delete udfData;
         return 1;
     }
@@ -636,24 +941,101 @@ my_bool qqueue_addJob_init(UDF_INIT *initid, UDF_ARGS *args, char *message) {
     //here... otherwise MySQL would segfault spectacularly.
     char *outQuery = NULL;
 
+    //jobs writing their result to a file get no result table
+    int jobFlags = 0;
+    if (args->arg_count == 11 && args->args[10] != NULL)
+        jobFlags = (int) *(long long *) args->args[10];
+
+    if ((jobFlags & (QQUEUE_JOB_OUTPUT_FILE | QQUEUE_JOB_EXPORT)) != 0 && (spoolDir == NULL || spoolDir[0] == '\0')) {
+        strcpy(message, "qqueue_addJob() jobs can only write to a file if qqueue_spoolDir is set");
+        releaseResultTable(udfData->resultDb, udfData->resultTbl, 0);
+        delete udfData->job;
+        delete udfData;
+        return 1;
+    }
+
+    //split and chunked jobs rewrite the query themselves, it has to be a plain select
+    //on a single table
+    if ((jobFlags & QQUEUE_JOB_SPLIT) != 0 && (jobFlags & QQUEUE_JOB_CHUNKED) != 0) {
+        strcpy(message, "qqueue_addJob() a job cannot be split and chunked at the same time");
+        releaseResultTable(udfData->resultDb, udfData->resultTbl, 0);
+        delete udfData->job;
+        delete udfData;
+        return 1;
+    }
+
+    if ((jobFlags & (QQUEUE_JOB_SPLIT | QQUEUE_JOB_CHUNKED)) != 0) {
+        qqueue_simple_select select;
+        if (*(long long *) args->args[8] == 1 || (jobFlags & QQUEUE_JOB_OUTPUT_FILE) != 0 ||
+            parseSimpleSelect((char *) args->args[4], &select) != 0) {
+            strcpy(message, "qqueue_addJob() only simple SELECT statements on a single table can be split or chunked");
+            releaseResultTable(udfData->resultDb, udfData->resultTbl, 0);
+            delete udfData->job;
+            delete udfData;
+            return 1;
+        }
+    }
+
+    //the read limits can only slow a job down between its statements or chunks, a
+    //single long statement would run at full speed. jobs of queues with a read limit
+    //are therefore always chunked, and the ones that cannot be are not accepted
+    if ((priority_queue->maxReadRows > 0 || priority_queue->maxReadBytes > 0) &&
+        (jobFlags & (QQUEUE_JOB_SPLIT | QQUEUE_JOB_CHUNKED)) == 0) {
+        qqueue_simple_select select;
+        if (*(long long *) args->args[8] == 1 || (jobFlags & QQUEUE_JOB_OUTPUT_FILE) != 0 ||
+            parseSimpleSelect((char *) args->args[4], &select) != 0) {
+            strcpy(message, "qqueue_addJob() queues with a read limit only take simple SELECT statements on a single table, "
+                            "which are run in chunks");
+            releaseResultTable(udfData->resultDb, udfData->resultTbl, 0);
+            delete udfData->job;
+            delete udfData;
+            return 1;
+        }
+
+        jobFlags |= QQUEUE_JOB_CHUNKED;
+    }
+    udfData->jobFlags = jobFlags;
+
     //if the query was processed by PaQu, then the result table does not need to be added...
-    if (*(long long *) args->args[8] != 1) {
-        addResultTableSQLAtPlaceholder((char *) args->args[4], &outQuery, (char *) args->args[5], (char *) args->args[6]);
+    if (*(long long *) args->args[8] != 1 && (jobFlags & QQUEUE_JOB_OUTPUT_FILE) == 0) {
+        char tableOptions[QQUEUE_TABLE_OPTIONS_LEN];
+        if (buildResultTableOptions(priority_queue, tableOptions, sizeof(tableOptions)) != 0) {
+            strcpy(message, "qqueue_addJob() the result table options of the queue are invalid");
+            releaseResultTable(udfData->resultDb, udfData->resultTbl, 0);
+            delete udfData->job;
+            delete udfData;
+            return 1;
+        }
+
+        addResultTableSQLAtPlaceholder((char *) args->args[4], &outQuery, (char *) args->args[5], (char *) args->args[6],
+                                       tableOptions);
         if (outQuery == NULL)
-            addResultTableSQL((char *) args->args[4], &outQuery, (char *) args->args[5], (char *) args->args[6]);
+            addResultTableSQL((char *) args->args[4], &outQuery, (char *) args->args[5], (char *) args->args[6],
+                              tableOptions);
     }
 
     if (outQuery == NULL) {
-        udfData->job->actualQuery = my_strdup((char *) args->args[4], MYF(0));
+        udfData->job->setActualQuery((char *) args->args[4], strlen((char *) args->args[4]));
     } else {
-        udfData->job->actualQuery = my_strdup(outQuery, MYF(0));
+        udfData->job->setActualQuery(outQuery, strlen(outQuery));
         free(outQuery);
     }
 
     //check if there are no wild SELECT statements in here...
-    if (validateMultiSQL(udfData->job->actualQuery) != 0) {
+    if (validateMultiSQL(udfData->job->actualQuery, (jobFlags & QQUEUE_JOB_OUTPUT_FILE) != 0) != 0) {
         strcpy(message, "qqueue_addJob() there are multiple SELECT statments not captured by CREATE TABLE!");
-        close_sysTbl(current_thd, udfData->tbl, &udfData->backup);
+        releaseResultTable(udfData->resultDb, udfData->resultTbl, 0);
+        delete udfData->job;
+        delete udfData;
+        return 1;
+    }
+
+    //only the result table the queue creates is kept out of the binary log. other
+    //statements of the job might use it and would break the replicas
+    if (priority_queue->resultNoBinlog == true && *(long long *) args->args[8] != 1 &&
+        (jobFlags & QQUEUE_JOB_OUTPUT_FILE) == 0 && skipSQLStatements(udfData->job->actualQuery, 1) != NULL) {
+        strcpy(message, "qqueue_addJob() jobs of a queue with resultNoBinlog must consist of a single statement");
+        releaseResultTable(udfData->resultDb, udfData->resultTbl, 0);
         delete udfData->job;
         delete udfData;
         return 1;
@@ -662,6 +1044,23 @@ my_bool qqueue_addJob_init(UDF_INIT *initid, UDF_ARGS *args, char *message) {
     udfData->priority = priority_usrGrp->priority * priority_queue->priority;
     udfData->id_usrGrp = priority_usrGrp->id;
     udfData->id_queue = priority_queue->id;
+    udfData->id_usr = 0;
+    udfData->quotaReserved = false;
+
+    //check the quotas of the user and the group. if the user is not known yet,
+    //this is done for each row
+    if (args->args[1] != NULL) {
+        udfData->id_usr = *(long long *) args->args[1];
+        if (quotaReserveSubmit((int) udfData->id_usr, udfData->id_usrGrp,
+                               message, MYSQL_ERRMSG_SIZE) != 0) {
+            releaseResultTable(udfData->resultDb, udfData->resultTbl, 0);
+            delete udfData->job;
+            delete udfData;
+            return 1;
+        }
+
+        udfData->quotaReserved = true;
+    }
 
     //no limits on number of decimals
     initid->decimals = 31;
@@ -674,7 +1073,13 @@ my_bool qqueue_addJob_init(UDF_INIT *initid, UDF_ARGS *args, char *message) {
 
 void qqueue_addJob_deinit(UDF_INIT *initid) {
     qqueue_job_data *udfData = (qqueue_job_data *) initid->ptr;
-    close_sysTbl(current_thd, udfData->tbl, &udfData->backup);
+    releaseResultTable(udfData->resultDb, udfData->resultTbl, udfData->journaledId);
+
+    //the job has never been queued, give back what has been reserved in init
+    if (udfData->quotaReserved == true) {
+        quotaJobDeleted((int) udfData->id_usr, udfData->id_usrGrp);
+    }
+
     delete (qqueue_job_data *) initid->ptr;
 }
 
@@ -685,50 +1090,43 @@ long long qqueue_addJob(UDF_INIT *initid, UDF_ARGS *args, char *is_null, char *i
     ulonglong jobId;
     if(args->args[0] == NULL) {
         //calculate unique (hopefully) id for this job
-#if defined(MARIADB_BASE_VERSION) && MYSQL_VERSION_ID >= 50500
-        jobId = microsecond_interval_timer();
-#else        
-        jobId = my_micro_time();
-#endif
-        //shift by 8 bits to make some space for a random component
-        jobId = jobId << 8;
-        //add the last 8 bits of a random number to the id
-
-#if MYSQL_VERSION_ID >= 50505
-        mysql_mutex_lock(&LOCK_thread_count);
-#else
-        pthread_mutex_lock(&LOCK_thread_count);
-#endif
-
-        ulong tmp=(ulong) (my_rnd(&sql_rand) * 0xffffffff);
-
-#if MYSQL_VERSION_ID >= 50505
-        mysql_mutex_unlock(&LOCK_thread_count);
-#else
-        pthread_mutex_unlock(&LOCK_thread_count);
-#endif
-
-        jobId += (ulonglong)(tmp & 0x000000ff);
+        jobId = newJobId();
     } else {
         jobId = *(long long *) args->args[0];
     }
 
     aRow->id = jobId;
     aRow->usrId = *(long long *) args->args[1];
+
+    if (udfData->quotaReserved == false) {
+        char quotaMessage[MYSQL_ERRMSG_SIZE];
+        if (quotaReserveSubmit(aRow->usrId, udfData->id_usrGrp, quotaMessage, sizeof(quotaMessage)) != 0) {
+            my_printf_error(ER_UNKNOWN_ERROR, "%s", MYF(0), quotaMessage);
+            *is_error = 1;
+            delete udfData->job;
+            return -1;
+        }
+    }
+
+    //from here on the reservation belongs to the job
+    udfData->quotaReserved = false;
     aRow->usrGroup = udfData->id_usrGrp;
     aRow->queue = udfData->id_queue;
     aRow->priority = udfData->priority;
-    if (args->arg_count == 10) {
-        aRow->query = my_strdup((char *) args->args[9], MYF(0));
+    aRow->effPriority = udfData->priority;
+    if (args->arg_count >= 10 && args->args[9] != NULL) {
+        aRow->query = aRow->dupString((char *) args->args[9]);
     } else {
-        aRow->query = my_strdup((char *) args->args[4], MYF(0));
+        aRow->query = aRow->dupString((char *) args->args[4]);
     }
 
+    aRow->jobFlags = udfData->jobFlags;
+
     aRow->status = QUEUE_PENDING;
-    strcpy(aRow->resultDBName, (char *) args->args[5]);
-    strcpy(aRow->resultTableName, (char *) args->args[6]);
+    aRow->resultDBName = aRow->dupString((char *) args->args[5]);
+    aRow->resultTableName = aRow->dupString((char *) args->args[6]);
     if (args->args[7] != NULL) {
-        aRow->comment = my_strdup((char *) args->args[7], MYF(0));
+        aRow->comment = aRow->dupString((char *) args->args[7]);
     } else {
         aRow->comment = NULL;
     }
@@ -739,16 +1137,122 @@ long long qqueue_addJob(UDF_INIT *initid, UDF_ARGS *args, char *is_null, char *i
     aRow->timeSubmit = localTime;
     MYSQL_TIME nullTime = {0, 0, 0, 0, 0, 0, 0, 0};
     aRow->timeExecute = nullTime;
-    aRow->timeFinish = nullTime,
-          strcpy(aRow->error, "");
+    aRow->timeFinish = nullTime;
+    aRow->setError(NULL);
+
+    //everything has been prepared, the jobs table is only held for the lookup of the
+    //id and the insert. the journal does not see duplicate ids, the id is reserved
+    //until the row of the job is in the table. jobs that have records waiting to be
+    //applied are not in the table yet, but their id is taken
+    int err = 0;
+    bool journaled = false;
+    bool idReserved = false;
+    if (journalMode == true) {
+        if (journalJobBusy(jobId) == true || reserveJobId(jobId) == false) {
+            err = HA_ERR_FOUND_DUPP_KEY;
+        } else {
+            idReserved = true;
+
+            udfData->tbl = open_sysTbl(current_thd, "qqueue_jobs", strlen("qqueue_jobs"), &udfData->backup, false, &err);
+            int found = (err || udfData->tbl == NULL) ? 1 : retrRowAtPKId(udfData->tbl, jobId);
+            close_sysTbl(current_thd, udfData->tbl, &udfData->backup);
+            err = 0;
+
+            if (found == 0) {
+                err = HA_ERR_FOUND_DUPP_KEY;
+            } else if ((found == HA_ERR_KEY_NOT_FOUND || found == HA_ERR_END_OF_FILE) && journalJob(aRow) == 0) {
+                udfData->journaledId = jobId;
+                journaled = true;
+            }
+        }
 
-    int err = addQqueueJobsRow(aRow, udfData->tbl, jobId);
+        if (err == HA_ERR_FOUND_DUPP_KEY) {
+            my_printf_error(ER_UNKNOWN_ERROR, "qqueue_addJob: a job with id %lli already exists", MYF(0),
+                            (long long) jobId);
+            *is_error = 1;
+        }
+    }
+
+    if (journaled == false && err == 0) {
+        udfData->tbl = open_sysTbl(current_thd, "qqueue_jobs", strlen("qqueue_jobs"), &udfData->backup, true, &err);
+        if (err || udfData->tbl == NULL) {
+            my_printf_error(ER_UNKNOWN_ERROR, "qqueue_addJob: error in opening sys table", MYF(0));
+            err = 1;
+        } else {
+            err = addQqueueJobsRow(aRow, udfData->tbl, jobId);
+            if (err == HA_ERR_FOUND_DUPP_KEY) {
+                my_printf_error(ER_UNKNOWN_ERROR, "qqueue_addJob: a job with id %lli already exists", MYF(0),
+                                (long long) jobId);
+                *is_error = 1;
+            }
+        }
+        close_sysTbl(current_thd, udfData->tbl, &udfData->backup);
+    }
+    udfData->tbl = NULL;
+
+    if (idReserved == true)
+        releaseJobId(jobId, journaled);
+
+    if (err != 0) {
+        quotaJobDeleted(aRow->usrId, aRow->usrGroup);
+    } else {
+        //the counter must not hand out an explicit id later on
+        if (args->args[0] != NULL)
+            raiseJobIds((longlong) jobId + 1);
+
+        //a journaled job is pending once the applier has written its row
+        traceEvent(QQUEUE_EV_SUBMIT, jobId, aRow->priority);
+        if (journaled == false)
+            traceEvent(QQUEUE_EV_ENQUEUE, jobId, 0);
+    }
 
     delete udfData->job;
 
     return err;
 }
 
+my_bool qqueue_reserveJobIds_init(UDF_INIT *initid, UDF_ARGS *args, char *message) {
+    if (getPluginInstalled() == 0) {
+        strcpy(message, "Qqueue pluing is not installed on this MySQL instance.");
+        return 1;
+    }
+
+    //checking stuff to be correct
+    if (args->arg_count != 1) {
+        strcpy(message, "wrong number of arguments: qqueue_reserveJobIds() requires one parameter");
+        return 1;
+    }
+
+    if (args->arg_type[0] != INT_RESULT) {
+        strcpy(message, "qqueue_reserveJobIds() requires an integer as parameter one");
+        return 1;
+    }
+
+    initid->decimals = 31;
+    initid->maybe_null = 0;
+    initid->max_length = 17 + 31;
+    initid->ptr = NULL;
+
+    return 0;
+}
+
+void qqueue_reserveJobIds_deinit(UDF_INIT *initid) {
+}
+
+//reserves a range of consecutive job ids for a bulk submission and returns the
+//first of them. the ids can be given to qqueue_addJob
+long long qqueue_reserveJobIds(UDF_INIT *initid, UDF_ARGS *args, char *is_null, char *is_error) {
+    if (args->args[0] == NULL || *(long long *) args->args[0] < 1 ||
+        *(long long *) args->args[0] > QQUEUE_MAX_RESERVED_IDS) {
+        my_printf_error(ER_UNKNOWN_ERROR, "qqueue_reserveJobIds: the number of ids has to be between 1 and %i",
+                        MYF(0), QQUEUE_MAX_RESERVED_IDS);
+        *is_error = 1;
+        return -1;
+    }
+
+    return (long long) newJobIdRange((int) *(long long *) args->args[0]);
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 ///// delete/kill job implementation        ////////////////////////////////////
 ////////////////////////////////////////////////////////////////////////////////
@@ -771,6 +1275,9 @@ my_bool qqueue_killJob_init(UDF_INIT *initid, UDF_ARGS *args, char *message) {
     }
 
 
+    //the job is read from the table, which has to be up to date with the journal
+    journalWaitApplied(*(long long *)args->args[0]);
+
     int i;
     int error = 0;
     qqueue_job_data *udfData = new qqueue_job_data;
@@ -791,7 +1298,8 @@ my_bool qqueue_killJob_init(UDF_INIT *initid, UDF_ARGS *args, char *message) {
     close_sysTbl(current_thd, udfData->tbl, &udfData->backup);
 
     //check if we should run this query
-    if (udfData->job->status != QUEUE_PENDING && udfData->job->status != QUEUE_RUNNING) {
+    if (udfData->job->status != QUEUE_PENDING && udfData->job->status != QUEUE_RUNNING &&
+        udfData->job->status != QUEUE_WAITING) {
         strcpy(message, "qqueue_killJob: this job is not pending or running... therefore I cannot delete...");
         return 1;
     }
@@ -830,13 +1338,14 @@ long long qqueue_killJob(UDF_INIT *initid, UDF_ARGS *args, char *is_null, char *
 
     close_sysTbl(current_thd, udfData->tbl, &udfData->backup);
 
-    if (row->status == QUEUE_PENDING) {
+    if (row->status == QUEUE_PENDING || row->status == QUEUE_WAITING) {
+        enum enum_queue_status oldStatus = row->status;
         MYSQL_TIME localTime;
         current_thd->variables.time_zone->gmt_sec_to_TIME(&localTime, (my_time_t) my_time(0));
         row->timeFinish = localTime;
 
         row->status = QUEUE_DELETED;
-        row->error[0] = '\0';
+        row->setError(NULL);
 
         Open_tables_backup backup;
         TABLE *tbl = open_sysTbl(current_thd, "qqueue_jobs", strlen("qqueue_jobs"), &backup, true, &error);
@@ -846,7 +1355,10 @@ long long qqueue_killJob(UDF_INIT *initid, UDF_ARGS *args, char *is_null, char *
             return 1;
         }
 
-        deleteQqueueJobsRow(*(long long *)args->args[0], tbl);
+        //a job waiting for its sub-jobs does not count as pending
+        if (deleteQqueueJobsRow(*(long long *)args->args[0], tbl) == 0 && oldStatus == QUEUE_PENDING) {
+            quotaJobDeleted(row->usrId, row->usrGroup);
+        }
 
         close_sysTbl(current_thd, udfData->tbl, &backup);
 
@@ -861,6 +1373,11 @@ long long qqueue_killJob(UDF_INIT *initid, UDF_ARGS *args, char *is_null, char *
 
         close_sysTbl(current_thd, udfData->tbl, &backup);
 
+        if (oldStatus == QUEUE_WAITING)
+            killSubJobs(row->id);
+        else if (row->parentJob != 0)
+            subJobEnded(row);
+
     } else if (row->status == QUEUE_RUNNING) {
         registerJobKill(*(long long *)args->args[0]);
     }
@@ -868,6 +1385,329 @@ long long qqueue_killJob(UDF_INIT *initid, UDF_ARGS *args, char *is_null, char *
     return 0;
 }
 
+////////////////////////////////////////////////////////////////////////////////
+///// job resume implementation             ////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+
+my_bool qqueue_resumeJob_init(UDF_INIT *initid, UDF_ARGS *args, char *message) {
+    if (getPluginInstalled() == 0) {
+        strcpy(message, "Qqueue pluing is not installed on this MySQL instance.");
+        return 1;
+    }
+
+    //checking stuff to be correct
+    if (args->arg_count != 1) {
+        strcpy(message, "wrong number of arguments: qqueue_resumeJob() requires one parameter");
+        return 1;
+    }
+
+    if (args->arg_type[0] != INT_RESULT) {
+        strcpy(message, "qqueue_resumeJob() requires an integer as parameter one");
+        return 1;
+    }
+
+    initid->decimals = 31;
+    initid->maybe_null = 0;
+    initid->max_length = 17 + 31;
+    initid->ptr = NULL;
+
+    return 0;
+}
+
+void qqueue_resumeJob_deinit(UDF_INIT *initid) {
+}
+
+//puts a chunked job that timed out, was killed or failed back into the queue. it
+//continues after the chunks it has already written to its result table
+long long qqueue_resumeJob(UDF_INIT *initid, UDF_ARGS *args, char *is_null, char *is_error) {
+    long long id = *(long long *) args->args[0];
+
+    int error = 0;
+    Open_tables_backup backup;
+    TABLE *tbl = open_sysTbl(current_thd, "qqueue_history", strlen("qqueue_history"), &backup, false, &error);
+    if (error || tbl == NULL) {
+        fprintf(stderr, "qqueue_resumeJob: error in opening history sys table\n");
+        close_sysTbl(current_thd, tbl, &backup);
+        return -1;
+    }
+
+    qqueue_jobs_row *row = getJobFromID(tbl, id);
+
+    close_sysTbl(current_thd, tbl, &backup);
+
+    if (row == NULL) {
+        my_printf_error(ER_UNKNOWN_ERROR, "qqueue_resumeJob: cannot find the job in the history", MYF(0));
+        *is_error = 1;
+        return -1;
+    }
+
+    if ((row->jobFlags & QQUEUE_JOB_CHUNKED) == 0 || row->chunksDone == 0 ||
+        (row->status != QUEUE_TIMEOUT && row->status != QUEUE_KILLED && row->status != QUEUE_ERROR)) {
+        my_printf_error(ER_UNKNOWN_ERROR, "qqueue_resumeJob: only chunked jobs that did not finish can be resumed",
+                        MYF(0));
+        *is_error = 1;
+        delete row;
+        return -1;
+    }
+
+    char quotaMessage[MYSQL_ERRMSG_SIZE];
+    if (quotaReserveSubmit(row->usrId, row->usrGroup, quotaMessage, sizeof(quotaMessage)) != 0) {
+        my_printf_error(ER_UNKNOWN_ERROR, "%s", MYF(0), quotaMessage);
+        *is_error = 1;
+        delete row;
+        return -1;
+    }
+
+    MYSQL_TIME nullTime = {0, 0, 0, 0, 0, 0, 0, 0};
+    row->status = QUEUE_PENDING;
+    row->timeExecute = nullTime;
+    row->timeFinish = nullTime;
+    row->setError(NULL);
+
+    //the job goes into the queue before it leaves the history, so that it cannot get lost
+    tbl = open_sysTbl(current_thd, "qqueue_jobs", strlen("qqueue_jobs"), &backup, true, &error);
+    if (error || tbl == NULL) {
+        fprintf(stderr, "qqueue_resumeJob: error in opening jobs sys table\n");
+        close_sysTbl(current_thd, tbl, &backup);
+        quotaJobDeleted(row->usrId, row->usrGroup);
+        delete row;
+        return -1;
+    }
+
+    error = addQqueueJobsRow(row, tbl, row->id);
+
+    close_sysTbl(current_thd, tbl, &backup);
+
+    if (error != 0) {
+        quotaJobDeleted(row->usrId, row->usrGroup);
+        delete row;
+        return -1;
+    }
+
+    traceEvent(QQUEUE_EV_ENQUEUE, row->id, row->preemptCount);
+
+    tbl = open_sysTbl(current_thd, "qqueue_history", strlen("qqueue_history"), &backup, true, &error);
+    if (error || tbl == NULL) {
+        fprintf(stderr, "qqueue_resumeJob: error in opening history sys table\n");
+    } else {
+        deleteQqueueJobsRow(id, tbl);
+    }
+    close_sysTbl(current_thd, tbl, &backup);
+
+    delete row;
+
+    return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+///// job priority implementation           ////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+
+my_bool qqueue_setJobPriority_init(UDF_INIT *initid, UDF_ARGS *args, char *message) {
+    if (getPluginInstalled() == 0) {
+        strcpy(message, "Qqueue pluing is not installed on this MySQL instance.");
+        return 1;
+    }
+
+    //checking stuff to be correct
+    if (args->arg_count < 2 || args->arg_count > 4) {
+        strcpy(message, "wrong number of arguments: qqueue_setJobPriority() requires two to four parameters");
+        return 1;
+    }
+
+    for (uint i = 0; i < args->arg_count; i++) {
+        args->arg_type[i] = INT_RESULT;
+    }
+
+    if (args->args[0] != NULL && *(long long *) args->args[0] == 0) {
+        strcpy(message, "qqueue_setJobPriority() requires a job id as parameter one");
+        return 1;
+    }
+
+    if (args->args[1] != NULL && (*(long long *) args->args[1] < -20 || *(long long *) args->args[1] > 19)) {
+        strcpy(message, "qqueue_setJobPriority(): the nice value needs to be between -20 and 19");
+        return 1;
+    }
+
+    if (args->arg_count > 2 && args->args[2] != NULL &&
+            (*(long long *) args->args[2] < QQUEUE_IOPRIO_CLASS_NONE || *(long long *) args->args[2] > QQUEUE_IOPRIO_CLASS_IDLE)) {
+        strcpy(message, "qqueue_setJobPriority(): the I/O class needs to be between 0 and 3");
+        return 1;
+    }
+
+    if (args->arg_count > 3 && args->args[3] != NULL &&
+            (*(long long *) args->args[3] < 0 || *(long long *) args->args[3] > 7)) {
+        strcpy(message, "qqueue_setJobPriority(): the I/O level needs to be between 0 and 7");
+        return 1;
+    }
+
+    initid->decimals = 0;
+    initid->maybe_null = 0;
+    initid->max_length = 1;
+
+    return 0;
+}
+
+void qqueue_setJobPriority_deinit(UDF_INIT *initid) {
+}
+
+//changes the nice value and the I/O class and level of a running job without
+//killing it. NULL keeps a setting. returns 1 if the job is not running and 2 if
+//the operating system refused
+long long qqueue_setJobPriority(UDF_INIT *initid, UDF_ARGS *args, char *is_null, char *is_error) {
+    if (args->args[0] == NULL)
+        return 1;
+
+    long long id = *(long long *) args->args[0];
+    int niceValue = QQUEUE_SCHED_KEEP;
+    int ioClass = QQUEUE_SCHED_KEEP;
+    int ioLevel = 4;
+
+    if (args->args[1] != NULL)
+        niceValue = (int) *(long long *) args->args[1];
+
+    if (args->arg_count > 2 && args->args[2] != NULL)
+        ioClass = (int) *(long long *) args->args[2];
+
+    if (args->arg_count > 3 && args->args[3] != NULL)
+        ioLevel = (int) *(long long *) args->args[3];
+
+    return setRunningJobPriority(id, niceValue, ioClass, ioLevel);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+///// history cleanup implementation        ////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+
+my_bool qqueue_cleanHistory_init(UDF_INIT *initid, UDF_ARGS *args, char *message) {
+    if (getPluginInstalled() == 0) {
+        strcpy(message, "Qqueue pluing is not installed on this MySQL instance.");
+        return 1;
+    }
+
+    //checking stuff to be correct
+    if (args->arg_count != 1 && args->arg_count != 2) {
+        strcpy(message, "wrong number of arguments: qqueue_cleanHistory() requires one or two parameters");
+        return 1;
+    }
+
+    if (args->arg_type[0] != INT_RESULT) {
+        strcpy(message, "qqueue_cleanHistory() requires an integer as parameter one");
+        return 1;
+    }
+
+    if (args->arg_count == 2 && args->arg_type[1] != INT_RESULT) {
+        strcpy(message, "qqueue_cleanHistory() requires an integer as parameter two");
+        return 1;
+    }
+
+    //no limits on number of decimals
+    initid->decimals = 31;
+    initid->maybe_null = 0;
+    initid->max_length = 17 + 31;
+    initid->ptr = NULL;
+
+    return 0;
+}
+
+void qqueue_cleanHistory_deinit(UDF_INIT *initid) {
+}
+
+long long qqueue_cleanHistory(UDF_INIT *initid, UDF_ARGS *args, char *is_null, char *is_error) {
+    bool wipe = (args->args[0] != NULL && *(long long *) args->args[0] != 0);
+    int batchSize = QQUEUE_HISTORY_CLEAN_BATCH;
+
+    if (args->arg_count == 2 && args->args[1] != NULL)
+        batchSize = (int) *(long long *) args->args[1];
+
+    return cleanQqueueHistory(current_thd, wipe, batchSize);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+///// event trace implementation            ////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+
+my_bool qqueue_dumpEvents_init(UDF_INIT *initid, UDF_ARGS *args, char *message) {
+    if (getPluginInstalled() == 0) {
+        strcpy(message, "Qqueue pluing is not installed on this MySQL instance.");
+        return 1;
+    }
+
+    //checking stuff to be correct
+    if (args->arg_count != 1 && args->arg_count != 2) {
+        strcpy(message, "wrong number of arguments: qqueue_dumpEvents() requires one or two parameters");
+        return 1;
+    }
+
+    if (args->arg_type[0] != STRING_RESULT) {
+        strcpy(message, "qqueue_dumpEvents() requires a string as parameter one");
+        return 1;
+    }
+
+    if (args->arg_count == 2 && args->arg_type[1] != STRING_RESULT) {
+        strcpy(message, "qqueue_dumpEvents() requires a string as parameter two");
+        return 1;
+    }
+
+    //no limits on number of decimals
+    initid->decimals = 31;
+    initid->maybe_null = 0;
+    initid->max_length = 17 + 31;
+    initid->ptr = NULL;
+
+    return 0;
+}
+
+void qqueue_dumpEvents_deinit(UDF_INIT *initid) {
+}
+
+long long qqueue_dumpEvents(UDF_INIT *initid, UDF_ARGS *args, char *is_null, char *is_error) {
+    //the file is written by the server, same as SELECT ... INTO OUTFILE
+    if ((current_thd->security_ctx->master_access & FILE_ACL) == 0) {
+        my_printf_error(ER_UNKNOWN_ERROR, "qqueue_dumpEvents: the FILE privilege is required", MYF(0));
+        *is_error = 1;
+        return -1;
+    }
+
+    if (args->args[0] == NULL || args->lengths[0] == 0 || args->lengths[0] >= FN_REFLEN) {
+        my_printf_error(ER_UNKNOWN_ERROR, "qqueue_dumpEvents: invalid file name", MYF(0));
+        *is_error = 1;
+        return -1;
+    }
+
+    char path[FN_REFLEN];
+    strmake(path, args->args[0], args->lengths[0]);
+
+    //same restriction as SELECT ... INTO OUTFILE
+    if (is_secure_file_path(path) == false) {
+        my_printf_error(ER_UNKNOWN_ERROR, "qqueue_dumpEvents: the file has to be in the directory of --secure-file-priv (%s)",
+                        MYF(0), opt_secure_file_priv);
+        *is_error = 1;
+        return -1;
+    }
+
+    bool binary = false;
+    if (args->arg_count == 2 && args->args[1] != NULL) {
+        if (args->lengths[1] == 6 && strncasecmp(args->args[1], "binary", 6) == 0) {
+            binary = true;
+        } else if (args->lengths[1] != 4 || strncasecmp(args->args[1], "json", 4) != 0) {
+            my_printf_error(ER_UNKNOWN_ERROR, "qqueue_dumpEvents: the format is either 'json' or 'binary'", MYF(0));
+            *is_error = 1;
+            return -1;
+        }
+    }
+
+    char message[MYSQL_ERRMSG_SIZE];
+    long long count = dumpEvents(path, binary, message, sizeof(message));
+    if (count < 0) {
+        my_printf_error(ER_UNKNOWN_ERROR, "qqueue_dumpEvents: %s", MYF(0), message);
+        *is_error = 1;
+        return -1;
+    }
+
+    return count;
+}
+
 
 #ifdef __QQUEUE_DEBUG__
 ////////////////////////////////////////////////////////////////////////////////
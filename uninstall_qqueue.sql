@@ -1,5 +1,6 @@
 -- getting rid of all the data tables (you can skip this if you just want to reinstall)
 DROP TABLE IF EXISTS mysql.qqueue_usrGrps;
+DROP TABLE IF EXISTS mysql.qqueue_usrQuotas;
 DROP TABLE IF EXISTS mysql.qqueue_queues;
 DROP TABLE IF EXISTS mysql.qqueue_jobs;
 DROP TABLE IF EXISTS mysql.qqueue_history;
@@ -8,11 +9,19 @@ DROP TABLE IF EXISTS mysql.qqueue_history;
 DROP FUNCTION IF EXISTS qqueue_addUsrGrp;
 DROP FUNCTION IF EXISTS qqueue_updateUsrGrp;
 DROP FUNCTION IF EXISTS qqueue_flushUsrGrps;
+DROP FUNCTION IF EXISTS qqueue_setUsrGrpOption;
+DROP FUNCTION IF EXISTS qqueue_setUsrQuota;
 DROP FUNCTION IF EXISTS qqueue_addQueue;
 DROP FUNCTION IF EXISTS qqueue_updateQueue;
 DROP FUNCTION IF EXISTS qqueue_flushQueues;
+DROP FUNCTION IF EXISTS qqueue_setQueueOption;
 DROP FUNCTION IF EXISTS qqueue_addJob;
+DROP FUNCTION IF EXISTS qqueue_reserveJobIds;
 DROP FUNCTION IF EXISTS qqueue_killJob;
+DROP FUNCTION IF EXISTS qqueue_resumeJob;
+DROP FUNCTION IF EXISTS qqueue_setJobPriority;
+DROP FUNCTION IF EXISTS qqueue_cleanHistory;
+DROP FUNCTION IF EXISTS qqueue_dumpEvents;
 
 -- uninstalling all the procedures
 USE mysql;
@@ -0,0 +1,119 @@
+-- UPGRADE AN EXISTING INSTALLATION
+-- adds the tables and columns of newer versions to the system tables of an
+-- older installation and registers the new UDFs. the data of the tables is
+-- kept. the script can be run more than once, columns that are already there
+-- are left alone.
+
+USE mysql;
+
+-- NEW TABLES
+create table if not exists mysql.qqueue_usrQuotas(
+    usrId int not null,
+    maxRunning int default null,
+    maxPending int default null,
+    submitRate int default null,
+    submitBurst int default null,
+    primary key (usrId)
+) engine=MyISAM default charset=utf8 collate=utf8_bin;
+
+-- NEW COLUMNS
+-- the plugin addresses the columns by position, every column is added right
+-- after the one preceding it in install_qqueue.sql
+DROP PROCEDURE IF EXISTS qqueue_upgrade_column;
+DELIMITER //
+CREATE PROCEDURE qqueue_upgrade_column (tbl VARCHAR(64), col VARCHAR(64), def VARCHAR(255), prev VARCHAR(64))
+BEGIN
+  IF NOT EXISTS (SELECT * FROM information_schema.COLUMNS
+                   WHERE TABLE_SCHEMA = 'mysql' AND TABLE_NAME = tbl AND COLUMN_NAME = col) THEN
+    SET @qqueue_upgrade = CONCAT('ALTER TABLE mysql.', tbl, ' ADD COLUMN ', col, ' ', def, ' AFTER ', prev);
+    PREPARE stmt FROM @qqueue_upgrade;
+    EXECUTE stmt;
+    DEALLOCATE PREPARE stmt;
+  END IF;
+END //
+
+DROP PROCEDURE IF EXISTS qqueue_upgrade_jobs //
+CREATE PROCEDURE qqueue_upgrade_jobs (tbl VARCHAR(64))
+BEGIN
+  CALL qqueue_upgrade_column(tbl, 'preemptCount', 'int not null default 0', 'comment');
+  CALL qqueue_upgrade_column(tbl, 'effPriority', 'int not null default 0', 'preemptCount');
+  CALL qqueue_upgrade_column(tbl, 'jobFlags', 'int not null default 0', 'effPriority');
+  CALL qqueue_upgrade_column(tbl, 'lastStmt', 'int not null default 0', 'jobFlags');
+  CALL qqueue_upgrade_column(tbl, 'throttleTime', 'bigint not null default 0', 'lastStmt');
+  CALL qqueue_upgrade_column(tbl, 'outputFile', 'varchar(512) default null', 'throttleTime');
+  CALL qqueue_upgrade_column(tbl, 'outputSize', 'bigint not null default 0', 'outputFile');
+  CALL qqueue_upgrade_column(tbl, 'parentJob', 'bigint not null default 0', 'outputSize');
+  CALL qqueue_upgrade_column(tbl, 'subJobs', 'int not null default 0', 'parentJob');
+  CALL qqueue_upgrade_column(tbl, 'chunksDone', 'int not null default 0', 'subJobs');
+  CALL qqueue_upgrade_column(tbl, 'chunkPos', 'bigint not null default 0', 'chunksDone');
+END //
+DELIMITER ;
+
+CALL qqueue_upgrade_column('qqueue_usrGrps', 'maxRunning', 'int not null default 0', 'priority');
+CALL qqueue_upgrade_column('qqueue_usrGrps', 'maxPending', 'int not null default 0', 'maxRunning');
+CALL qqueue_upgrade_column('qqueue_usrGrps', 'submitRate', 'int not null default 0', 'maxPending');
+CALL qqueue_upgrade_column('qqueue_usrGrps', 'submitBurst', 'int not null default 0', 'submitRate');
+CALL qqueue_upgrade_column('qqueue_usrGrps', 'usrMaxRunning', 'int not null default 0', 'submitBurst');
+CALL qqueue_upgrade_column('qqueue_usrGrps', 'usrMaxPending', 'int not null default 0', 'usrMaxRunning');
+CALL qqueue_upgrade_column('qqueue_usrGrps', 'usrSubmitRate', 'int not null default 0', 'usrMaxPending');
+CALL qqueue_upgrade_column('qqueue_usrGrps', 'usrSubmitBurst', 'int not null default 0', 'usrSubmitRate');
+
+CALL qqueue_upgrade_column('qqueue_queues', 'preemptible', 'bool not null default 0', 'timeout');
+CALL qqueue_upgrade_column('qqueue_queues', 'agingRate', 'int not null default 0', 'preemptible');
+CALL qqueue_upgrade_column('qqueue_queues', 'agingCap', 'int not null default 0', 'agingRate');
+CALL qqueue_upgrade_column('qqueue_queues', 'recoveryPolicy', 'int not null default 0', 'agingCap');
+CALL qqueue_upgrade_column('qqueue_queues', 'recoveryMaxRuntime', 'int not null default 0', 'recoveryPolicy');
+CALL qqueue_upgrade_column('qqueue_queues', 'killWait', 'bool not null default 1', 'recoveryMaxRuntime');
+CALL qqueue_upgrade_column('qqueue_queues', 'cpuSet', 'varchar(255) not null default \'\'', 'killWait');
+CALL qqueue_upgrade_column('qqueue_queues', 'numaNode', 'int not null default -1', 'cpuSet');
+CALL qqueue_upgrade_column('qqueue_queues', 'niceValue', 'int not null default 0', 'numaNode');
+CALL qqueue_upgrade_column('qqueue_queues', 'ioClass', 'int not null default 0', 'niceValue');
+CALL qqueue_upgrade_column('qqueue_queues', 'ioLevel', 'int not null default 4', 'ioClass');
+CALL qqueue_upgrade_column('qqueue_queues', 'maxReadRows', 'bigint not null default 0', 'ioLevel');
+CALL qqueue_upgrade_column('qqueue_queues', 'maxReadBytes', 'bigint not null default 0', 'maxReadRows');
+CALL qqueue_upgrade_column('qqueue_queues', 'resultEngine', 'varchar(64) not null default \'\'', 'maxReadBytes');
+CALL qqueue_upgrade_column('qqueue_queues', 'resultRowFormat', 'varchar(64) not null default \'\'', 'resultEngine');
+CALL qqueue_upgrade_column('qqueue_queues', 'resultCompression', 'int not null default 0', 'resultRowFormat');
+CALL qqueue_upgrade_column('qqueue_queues', 'resultDataDir', 'varchar(511) not null default \'\'', 'resultCompression');
+CALL qqueue_upgrade_column('qqueue_queues', 'resultNoBinlog', 'bool not null default 0', 'resultDataDir');
+
+CALL qqueue_upgrade_jobs('qqueue_jobs');
+CALL qqueue_upgrade_jobs('qqueue_history');
+
+DROP PROCEDURE qqueue_upgrade_jobs;
+DROP PROCEDURE qqueue_upgrade_column;
+
+-- NEW UDFs
+DROP FUNCTION IF EXISTS qqueue_setUsrGrpOption;
+DROP FUNCTION IF EXISTS qqueue_setUsrQuota;
+DROP FUNCTION IF EXISTS qqueue_setQueueOption;
+DROP FUNCTION IF EXISTS qqueue_reserveJobIds;
+DROP FUNCTION IF EXISTS qqueue_resumeJob;
+DROP FUNCTION IF EXISTS qqueue_setJobPriority;
+DROP FUNCTION IF EXISTS qqueue_cleanHistory;
+DROP FUNCTION IF EXISTS qqueue_dumpEvents;
+CREATE FUNCTION qqueue_setUsrGrpOption RETURNS INTEGER SONAME 'daemon_jobqueue.so';
+CREATE FUNCTION qqueue_setUsrQuota RETURNS INTEGER SONAME 'daemon_jobqueue.so';
+CREATE FUNCTION qqueue_setQueueOption RETURNS INTEGER SONAME 'daemon_jobqueue.so';
+CREATE FUNCTION qqueue_reserveJobIds RETURNS INTEGER SONAME 'daemon_jobqueue.so';
+CREATE FUNCTION qqueue_resumeJob RETURNS INTEGER SONAME 'daemon_jobqueue.so';
+CREATE FUNCTION qqueue_setJobPriority RETURNS INTEGER SONAME 'daemon_jobqueue.so';
+CREATE FUNCTION qqueue_cleanHistory RETURNS INTEGER SONAME 'daemon_jobqueue.so';
+CREATE FUNCTION qqueue_dumpEvents RETURNS INTEGER SONAME 'daemon_jobqueue.so';
+
+-- THE CLEANUP PROCEDURES CALL qqueue_cleanHistory NOW
+DROP PROCEDURE IF EXISTS qqueue_clean_history;
+DELIMITER //
+CREATE PROCEDURE qqueue_clean_history ()
+BEGIN
+  DO qqueue_cleanHistory(0);
+END //
+DELIMITER ;
+
+DROP PROCEDURE IF EXISTS qqueue_wipe_history;
+DELIMITER //
+CREATE PROCEDURE qqueue_wipe_history ()
+BEGIN
+  DO qqueue_cleanHistory(1);
+END //
+DELIMITER ;